@@ -0,0 +1,130 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+/**
+ * Micro-benchmark of condition evaluation (Expr::condSatisfied) on in-memory PINs.
+ * Each condition is timed twice: with integer constants, which the condition compiler
+ * fuses into OP_PROPCMP/OP_PROPRNG, and with the same constants passed as parameters,
+ * which are evaluated by the generic OP_PROP/OP_CON/OP_EQ... sequence.
+ *
+ * usage: exprbench [store directory [number of evaluations]]
+ */
+
+#include "affinity.h"
+#include "startup.h"
+#include "session.h"
+#include "expr.h"
+#include "pinex.h"
+#include "qbuild.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace AfyDB;
+using namespace AfyKernel;
+
+#define	BENCH_NROWS		20000		/**< number of distinct PINs, property values are 0..BENCH_NROWS-1 */
+#define	BENCH_NEVAL		2000000		/**< default number of evaluations per condition */
+
+static double now()
+{
+	timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts); return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+static IExprTree *cmp(ISession *ses,ExprOp op,PropertyID pid,const Value& c)
+{
+	Value ops[2]; ops[0].setVarRef(0,pid); ops[1]=c; return ses->expr(op,2,ops);
+}
+
+static IExprTree *logic(ISession *ses,ExprOp op,IExprTree *l,IExprTree *r)
+{
+	Value ops[2]; ops[0].set(l); ops[1].set(r); return ses->expr(op,2,ops);
+}
+
+static Value con(int i)
+{
+	Value v; v.set(i); return v;
+}
+
+static Value par(unsigned n)
+{
+	Value v; v.setParam((unsigned char)n); return v;
+}
+
+/**
+ * builds one of the benchmark conditions; with fPar constants are replaced by parameters
+ */
+static IExprTree *cond(ISession *ses,unsigned n,PropertyID pid,bool fPar)
+{
+	Value rng[2]; rng[0].set(100); rng[1].set(5000);
+	switch (n) {
+	case 0:
+		if (!fPar) {Value v; v.setRange(rng); return cmp(ses,OP_IN,pid,v);}
+		return cmp(ses,OP_IN,pid,par(0));
+	case 1:
+		return logic(ses,OP_LAND,logic(ses,OP_LAND,cmp(ses,OP_GE,pid,fPar?par(0):con(100)),cmp(ses,OP_LT,pid,fPar?par(1):con(5000))),cmp(ses,OP_NE,pid,fPar?par(2):con(77)));
+	default:
+		return logic(ses,OP_LOR,cmp(ses,OP_LT,pid,fPar?par(0):con(10)),cmp(ses,OP_GT,pid,fPar?par(1):con(BENCH_NROWS-5)));
+	}
+}
+
+static const char *condNames[] = {"a IN [100,5000]","a>=100 AND a<5000 AND a<>77","a<10 OR a>19995"};
+
+static RC run(ISession *ses,unsigned nEval)
+{
+	Session *const s=Session::getSession(); if (s==NULL) return RC_NOSESSION;
+	URIMap um={"exprbench/a",STORE_INVALID_PROPID}; RC rc=ses->mapURIs(1,&um); if (rc!=RC_OK) return rc;
+	Value *props=(Value*)malloc(BENCH_NROWS*sizeof(Value)); PINEx **pins=(PINEx**)malloc(BENCH_NROWS*sizeof(PINEx*));
+	if (props==NULL || pins==NULL) return RC_NORESOURCES;
+	for (unsigned i=0; i<BENCH_NROWS; i++) {
+		props[i].set(int(i)); props[i].setPropID(um.uid);
+		if ((pins[i]=new(s) PINEx(s))==NULL) return RC_NORESOURCES; pins[i]->setProps(&props[i],1);
+	}
+	Value rng[2]; rng[0].set(100); rng[1].set(5000); Value pars[3];
+	for (unsigned n=0; n<sizeof(condNames)/sizeof(condNames[0]); n++) {
+		switch (n) {
+		case 0: pars[0].setRange(rng); break;
+		case 1: pars[0].set(100); pars[1].set(5000); pars[2].set(77); break;
+		default: pars[0].set(10); pars[1].set(BENCH_NROWS-5); break;
+		}
+		const ValueV vv(pars,3); double t[2]; unsigned nTrue[2];
+		for (unsigned k=0; k<2; k++) {
+			IExprTree *et=cond(ses,n,um.uid,k!=0); if (et==NULL) return RC_NORESOURCES;
+			Expr *exp=NULL; rc=Expr::compile((ExprTree*)et,exp,s,true); et->destroy(); if (rc!=RC_OK) return rc;
+			const Expr *const pe=exp; nTrue[k]=0; const double start=now();
+			for (unsigned i=0; i<nEval; i++) if (Expr::condSatisfied(&pe,1,&pins[i%BENCH_NROWS],1,&vv,1,s)) nTrue[k]++;
+			t[k]=(now()-start)/nEval; exp->destroy();
+		}
+		printf("%-32s generic %6.1f ns  fused %6.1f ns%s\n",condNames[n],t[1],t[0],nTrue[0]!=nTrue[1]?"  RESULTS DIFFER":"");
+		if (nTrue[0]!=nTrue[1]) rc=RC_INTERNAL;
+	}
+	for (unsigned i=0; i<BENCH_NROWS; i++) delete pins[i];
+	free(pins); free(props); return rc;
+}
+
+int main(int argc,char *argv[])
+{
+	const char *dir=argc>1?argv[1]:"."; const unsigned nEval=argc>2?(unsigned)atoi(argv[2]):BENCH_NEVAL;
+	StartupParameters sp(STARTUP_MODE_DESKTOP,dir); AfyDBCtx ctx=NULL; RC rc;
+	if ((rc=openStore(sp,ctx))!=RC_OK) {StoreCreationParameters cp; rc=createStore(cp,sp,ctx);}
+	if (rc!=RC_OK) {fprintf(stderr,"cannot open store in %s: %d\n",dir,rc); return 1;}
+	ISession *ses=ISession::startSession(ctx);
+	if (ses==NULL) rc=RC_NOSESSION; else {rc=run(ses,nEval); ses->terminate();}
+	shutdownStore(ctx); if (rc!=RC_OK) fprintf(stderr,"benchmark failed: %d\n",rc);
+	return rc==RC_OK?0:1;
+}
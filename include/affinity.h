@@ -124,6 +124,7 @@ namespace AfyDB
 	 * PIN create/commit/modify/delete, IStmt execute mode flags
 	 */
 	#define MODE_NO_EID					0x00010000	/**< in modify() - don't update "eid" field of Value structure */
+	#define	MODE_ANALYZE				0x00010000	/**< in IStmt::analyze(): execute the query and report run-time statistics of each operator */
 	#define	MODE_FOR_UPDATE				0x00020000	/**< in IStmt::execute(): lock pins for update while reading them */
 	#define	MODE_NEW_COMMIT				0x00040000	/**< used in PIN::clone() to immediately commit a cloned pin */
 	#define	MODE_PURGE					0x00040000	/**< in deletePINs(): purge pins rather than just delete */
@@ -990,6 +991,70 @@ namespace AfyDB
 		virtual	void	destroy() = 0;
 	};
 
+	/**
+	 * family index statistics collected by ISession::analyzeIndices()
+	 */
+	struct IndexStatistics
+	{
+		uint64_t	nEntries;				/**< current number of index entries */
+		uint64_t	nAnalyzed;				/**< number of index entries when the statistics were collected */
+		uint64_t	nPages;					/**< estimated number of leaf pages */
+		unsigned	nBuckets;				/**< number of equi-depth histogram buckets */
+		unsigned	nSegs;					/**< number of key segments */
+	};
+
+	/**
+	 * store-wide statement cache counters, see ISession::getPlanCacheStats()
+	 */
+	struct PlanCacheStatistics
+	{
+		uint64_t	nHits;					/**< number of statements found in the cache */
+		uint64_t	nMisses;				/**< number of statements parsed because they were not cached */
+		uint64_t	nFlushes;				/**< number of cache invalidations caused by class or index changes */
+		unsigned	nPlans;					/**< current number of cached statements */
+	};
+
+	/**
+	 * page buffer access strategy counters of large scans and bulk operations, see ISession::getBufferStrategyStats()
+	 */
+	struct BufferStrategyStatistics
+	{
+		uint64_t	nOps;					/**< number of operations which switched to a private ring of page frames */
+		uint64_t	nEvicted;				/**< number of pages evicted from private rings */
+		uint64_t	nEscaped;				/**< number of dirty or shared pages handed over to the common buffer queues */
+	};
+
+	/**
+	 * page buffer pool partition counters, see ISession::getBufferPartitionStats()
+	 * hit/miss/eviction counters are shared by all stores and not synchronized
+	 */
+	struct BufferPartitionStatistics
+	{
+		uint64_t	nHits;					/**< number of requests satisfied from memory */
+		uint64_t	nMisses;				/**< number of requests which required a page frame */
+		uint64_t	nEvicted;				/**< number of clean pages evicted to free a frame */
+		unsigned	nT1;					/**< number of pages in recency queue */
+		unsigned	nT2;					/**< number of pages in frequency queue */
+		unsigned	nB1;					/**< number of recency queue ghost entries */
+		unsigned	nB2;					/**< number of frequency queue ghost entries */
+		unsigned	nDirty;					/**< number of dirty pages of this store in the partition */
+	};
+
+	/**
+	 * background page writer counters, see ISession::getBufferWriterStats()
+	 * redo distance is measured from the oldest page at the head of buffer partition flush lists
+	 */
+	struct BufferWriterStatistics
+	{
+		uint64_t	redoDistance;			/**< log bytes between the oldest dirty page redo LSN and the end of the log */
+		uint64_t	redoTarget;				/**< redo distance maintained by the background writer */
+		uint64_t	nPasses;				/**< number of background writer passes */
+		uint64_t	nWritten;				/**< number of pages written by the background writer */
+		uint64_t	logGrowth;				/**< log bytes generated between background writer passes */
+		double		writeRate;				/**< pages written per megabyte of log */
+		unsigned	nDirty;					/**< current number of dirty pages */
+	};
+
 	class StringEnum
 	{
 	public:
@@ -1073,6 +1138,12 @@ namespace AfyDB
 		virtual	RC			enableClassNotifications(ClassID,unsigned notifications) = 0;						/**< enables notifications for a given class, see CLASS_NOTIFY_XXX above */
 		virtual	RC			rebuildIndices(const ClassID *cidx=NULL,unsigned nClasses=0) = 0;					/**< rebuild all DB indices (except free-text index) */
 		virtual	RC			rebuildIndexFT() = 0;																/**< rebuild free-text index */
+		virtual	RC			analyzeIndices(const ClassID *cidx=NULL,unsigned nClasses=0) = 0;					/**< collect statistics (NDV, histograms) for class family indices */
+		virtual	RC			getIndexStats(ClassID,IndexStatistics& stats,uint64_t *ndv=NULL,unsigned nSegs=0) = 0;	/**< get family index statistics; ndv receives the number of distinct values of each key prefix */
+		virtual	RC			getPlanCacheStats(PlanCacheStatistics& stats) = 0;									/**< get statement cache hit/miss counters */
+		virtual	RC			getBufferStrategyStats(BufferStrategyStatistics& scan,BufferStrategyStatistics& bulk) = 0;	/**< get page eviction counters of scan and bulk buffer strategies */
+		virtual	RC			getBufferPartitionStats(unsigned idx,BufferPartitionStatistics& stats,unsigned& nPartitions) = 0;	/**< get counters of buffer pool partition idx; nPartitions receives the number of partitions */
+		virtual	RC			getBufferWriterStats(BufferWriterStatistics& stats) = 0;							/**< get redo distance and write rate of the background page writer */
 		virtual	RC			createIndexNav(ClassID,IndexNav *&nav) = 0;											/**< create IndexNav object */
 		virtual	RC			listValues(ClassID cid,PropertyID pid,IndexNav *&ven) = 0;							/**< list all stored values for a given class family */
 		virtual	RC			listWords(const char *query,StringEnum *&sen) = 0;									/**< list all words in FT index matching given prefix or list of words */
@@ -41,6 +41,9 @@ Written by Mark Venguerov 2004-2012
 #define	DEFAULT_ASYNC_TIMEOUT		30000											/**< default timeout for asynchronous operations */
 #define	DEFAULT_LOGSEG_SIZE			0x1000000										/**< log segment size in bytes (16Mb) */
 #define	DEFAULT_LOGBUF_SIZE			0x40000											/**< log buffer size in bytes (256Kb) */
+#define	DEFAULT_COMMIT_DELAY		0												/**< group commit: log flush delay in milliseconds */
+#define	DEFAULT_COMMIT_BATCH		32												/**< group commit: number of waiting commits to flush without delay */
+#define	DEFAULT_INDEX_FILL			0.9f											/**< fill factor of index pages built by bulk loading */
 
 /**
  * startup flags
@@ -57,6 +60,7 @@ Written by Mark Venguerov 2004-2012
 #define	STARTUP_REDUCED_DURABILITY	0x0100											/**< no log flush on transaction commit for improved performance */
 #define	STARTUP_LOG_PREALLOC		0x0200											/**< pre-allocate log files */
 #define	STARTUP_TOUCH_FILE			0x0400											/**< change file access date if even only read access */
+#define	STARTUP_IO_URING			0x0800											/**< use io_uring for store file i/o if supported by the kernel (Linux only) */
 
 #define	STARTUP_MODE_DESKTOP		0x0000											/**< database is running as a part of a desktop application */
 #define	STARTUP_MODE_SERVER			0x8000											/**< database is opened on a server */
@@ -167,11 +171,16 @@ struct StartupParameters
 	IStoreIO				*io;								/**< I/O interface, if not standard (e.g. S3) */
 	ILockNotification		*lockNotification;
 	size_t					logBufSize;							/**< size of log buffer in memory */
+	unsigned				nBufPartitions;						/**< number of independently latched buffer pool partitions; 0 - by number of processors */
+	unsigned				commitDelay;						/**< time in milliseconds the log flusher waits for more committing transactions */
+	unsigned				commitBatch;						/**< number of waiting commits which triggers log flush before commitDelay expires */
+	float					indexFill;							/**< fill factor of index pages built by bulk loading (class creation, rebuildIndices()), from 0.5 to 1.0 */
 	StartupParameters(unsigned md=STARTUP_MODE_DESKTOP,const char *dir=NULL,unsigned xFiles=DEFAULT_MAX_FILES,unsigned nBuf=DEFAULT_BLOCK_NUM,
 						unsigned asyncTimeout=DEFAULT_ASYNC_TIMEOUT,IStoreNet *net=NULL,IStoreNotification *notItf=NULL,
-						const char *pwd=NULL,const char *logDir=NULL,IStoreIO *pio=NULL,ILockNotification *lno=NULL,size_t lbs=DEFAULT_LOGBUF_SIZE) 
+						const char *pwd=NULL,const char *logDir=NULL,IStoreIO *pio=NULL,ILockNotification *lno=NULL,size_t lbs=DEFAULT_LOGBUF_SIZE,unsigned nParts=0,
+						unsigned cDelay=DEFAULT_COMMIT_DELAY,unsigned cBatch=DEFAULT_COMMIT_BATCH,float iFill=DEFAULT_INDEX_FILL) 
 		: mode(md),directory(dir),maxFiles(xFiles),nBuffers(nBuf),shutdownAsyncTimeout(asyncTimeout),
-		network(net),notification(notItf),password(pwd),logDirectory(logDir),io(pio),lockNotification(lno),logBufSize(lbs) {}
+		network(net),notification(notItf),password(pwd),logDirectory(logDir),io(pio),lockNotification(lno),logBufSize(lbs),nBufPartitions(nParts),commitDelay(cDelay),commitBatch(cBatch),indexFill(iFill) {}
 };
 
 /**
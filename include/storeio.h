@@ -172,6 +172,16 @@ public:
 	*/
 	virtual RC		listIO(int mode,int nent,iodesc* const* pcbs)=0;
 
+	/*! Register a memory region containing page buffers used in subsequent listIO calls.
+	Implementations can use it to pin the region in memory once instead of mapping it on every i/o operation.
+	Buffers outside of registered regions must still be accepted by listIO.
+
+	\param buf start of the region, aligned to page size
+	\param lbuf length of the region in bytes
+	\returns RC_FALSE if the implementation doesn't use registered buffers
+	*/
+	virtual RC		registerBuffers(void *buf,size_t lbuf) {return RC_FALSE;}
+
 	/*! Test whether the implementation supports asynchronous I/O
 	*/
 
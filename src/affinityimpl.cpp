@@ -1160,12 +1160,67 @@ RC SessionX::rebuildIndices(const ClassID *cidx,unsigned nClasses)
 	try {
 		assert(ses==Session::getSession());
 		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN; if (ctx->isServerLocked()) return RC_READONLY;
-		if (!checkAdmin()) return RC_NOACCESS;
-		//...
-		return RC_OK;
+		return checkAdmin()?ctx->classMgr->rebuildIndices(ses,cidx,nClasses):RC_NOACCESS;
 	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::rebuildFamilyIndices()\n"); return RC_INTERNAL;}
 }
 
+RC SessionX::analyzeIndices(const ClassID *cidx,unsigned nClasses)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN; if (ctx->isServerLocked()) return RC_READONLY;
+		return checkAdmin()?ctx->classMgr->analyze(ses,cidx,nClasses):RC_NOACCESS;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::analyzeIndices()\n"); return RC_INTERNAL;}
+}
+
+RC SessionX::getIndexStats(ClassID cid,IndexStatistics& stats,uint64_t *ndv,unsigned nSegs)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+		Class *cls=ctx->classMgr->getClass(cid); if (cls==NULL) return RC_NOTFOUND;
+		ClassIndex *cidx=cls->getIndex(); RC rc=cidx!=NULL?cidx->getStatistics(stats,ndv,nSegs):RC_NOTFOUND;
+		cls->release(); return rc;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getIndexStats()\n"); return RC_INTERNAL;}
+}
+
+RC SessionX::getPlanCacheStats(PlanCacheStatistics& stats)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+		ctx->queryMgr->getPlanCache().getStats(stats); return RC_OK;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getPlanCacheStats()\n"); return RC_INTERNAL;}
+}
+
+RC SessionX::getBufferStrategyStats(BufferStrategyStatistics& scan,BufferStrategyStatistics& bulk)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+		ctx->bufMgr->getStrategyStats(BAS_SCAN,scan); ctx->bufMgr->getStrategyStats(BAS_BULK,bulk); return RC_OK;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getBufferStrategyStats()\n"); return RC_INTERNAL;}
+}
+
+RC SessionX::getBufferPartitionStats(unsigned idx,BufferPartitionStatistics& stats,unsigned& nPartitions)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+		if (idx>=(nPartitions=ctx->bufMgr->getNPartitions())) return RC_NOTFOUND;
+		ctx->bufMgr->getPartitionStats(idx,stats); return RC_OK;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getBufferPartitionStats()\n"); return RC_INTERNAL;}
+}
+
+RC SessionX::getBufferWriterStats(BufferWriterStatistics& stats)
+{
+	try {
+		assert(ses==Session::getSession());
+		StoreCtx *ctx=ses->getStore(); if (ctx->inShutdown()) return RC_SHUTDOWN;
+		ctx->bufMgr->getWriterStats(stats); return RC_OK;
+	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in ISession::getBufferWriterStats()\n"); return RC_INTERNAL;}
+}
+
 RC SessionX::rebuildIndexFT()
 {
 	try {
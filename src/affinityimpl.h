@@ -325,6 +325,12 @@ public:
 	RC			getClassID(const char *className,ClassID& cid);
 	RC			enableClassNotifications(ClassID,unsigned notifications);
 	RC			rebuildIndices(const ClassID *cidx=NULL,unsigned nClasses=0);
+	RC			analyzeIndices(const ClassID *cidx=NULL,unsigned nClasses=0);
+	RC			getIndexStats(ClassID,IndexStatistics& stats,uint64_t *ndv=NULL,unsigned nSegs=0);
+	RC			getPlanCacheStats(PlanCacheStatistics& stats);
+	RC			getBufferStrategyStats(BufferStrategyStatistics& scan,BufferStrategyStatistics& bulk);
+	RC			getBufferPartitionStats(unsigned idx,BufferPartitionStatistics& stats,unsigned& nPartitions);
+	RC			getBufferWriterStats(BufferWriterStatistics& stats);
 	RC			rebuildIndexFT();
 	RC			createIndexNav(ClassID,IndexNav *&nav);
 	RC			listValues(ClassID cid,PropertyID pid,IndexNav *&ven);
@@ -23,35 +23,47 @@ Written by Mark Venguerov 2004-2012
 #include "logmgr.h"
 #include "logchkp.h"
 #include "session.h"
+#include "startup.h"
 
 using namespace AfyKernel;
 
 bool BufMgr::fInit = false;
 Mutex BufMgr::initLock;
-SLIST_HEADER BufMgr::freeBuffers;
+SLIST_HEADER BufMgr::freeBuffers[BUF_MAX_PARTS];
 ulong BufMgr::nBuffers = 0;
 ulong BufMgr::xBuffers = 0;
 volatile long BufMgr::nStores = 0;
+BufMgr::BufChunk BufMgr::bufChunks[MAX_BUF_CHUNKS];
+ulong BufMgr::nBufChunks = 0;
 
 namespace AfyKernel
 {
-BufQMgr::QueueCtrl<SERVER_HEAP> bufCtrl(0);
+BufQMgr::QueueCtrl<SERVER_HEAP> bufCtrl[BUF_MAX_PARTS];
 FreeQ<> asyncWriteReqs;
 };
 
-BufMgr::BufMgr(StoreCtx *ct,int initNumberOfBlocks,size_t lpage) 
-: BufQMgr(bufCtrl,PAGE_HASH_SIZE),ctx(ct),lPage(nextP2((unsigned)lpage)),nStoreBuffers(initNumberOfBlocks),
-	pageList(NULL),flushList(NULL),dirtyCount(0),maxDepDepth(initNumberOfBlocks/4)
+BufMgr::BufMgr(StoreCtx *ct,int initNumberOfBlocks,size_t lpage,unsigned nParts) 
+: BufQMgr(initCtrl(nParts,initNumberOfBlocks),PAGE_HASH_SIZE),ctx(ct),lPage(nextP2((unsigned)lpage)),nStoreBuffers(initNumberOfBlocks),
+	maxDepDepth(initNumberOfBlocks/4),writerLSN(0),nWriterPasses(0),nWriterPages(0),writerLog(0),writerRQ(this)
 {	
 	InterlockedIncrement(&nStores); assert((lPage&getPageSize()-1)==0);
 }
 
 BufMgr::~BufMgr() 
 {
-	cleanup(); assert(!pageList.isInList());
+	cleanup();
+#ifdef _DEBUG
+	for (unsigned i=0; i<nParts; i++) assert(!parts[i].pageList.isInList());
+#endif
 #ifdef _DEBUG
 	reportHighwatermark("BufMgr");
 #endif
+	if ((ctx->mode&STARTUP_PRINT_STATS)!=0) for (int i=0; i<BAS_ALL; i++) if (strategyCnt[i].nOps!=0)
+		report(MSG_INFO,"\tBufMgr %s strategy: %ld operations, %ld pages evicted, %ld escaped\n",
+		i==BAS_SCAN?"scan":"bulk",(long)strategyCnt[i].nOps,(long)strategyCnt[i].nEvicted,(long)strategyCnt[i].nEscaped);
+	if ((ctx->mode&STARTUP_PRINT_STATS)!=0 && nWriterPasses!=0)
+		report(MSG_INFO,"\tBufMgr writer: %ld pages in %ld passes (%.2f pages per MB of log)\n",(long)nWriterPages,(long)nWriterPasses,
+																	writerLog!=0?double(nWriterPages)*1048576./double(writerLog):0.);
 	InterlockedDecrement(&nStores);
 }
 
@@ -60,11 +72,25 @@ void *BufMgr::operator new(size_t s,StoreCtx *ctx)
 	void *p=ctx->malloc(s); if (p==NULL) throw RC_NORESOURCES; return p;
 }
 
+BufQMgr::QueueCtrl<SERVER_HEAP>& BufMgr::initCtrl(unsigned nParts,ulong nBuf)
+{
+	MutexP lck(&initLock);
+	if (!fInit) {
+		// partition count is fixed when the first store is opened
+		if (nParts==0) nParts=getNProcessors();
+		if (nParts>BUF_MAX_PARTS) nParts=BUF_MAX_PARTS; else if (nParts==0) nParts=1;
+		if ((nParts&nParts-1)!=0) nParts=nextP2(nParts)>>1;
+		while (nParts>1 && nBuf/nParts<BUF_PART_MIN) nParts>>=1;
+		for (unsigned i=0; i<BUF_MAX_PARTS; i++) InitializeSListHead(&freeBuffers[i]);
+		bufCtrl[0].nParts=nParts; fInit=true;
+	}
+	return bufCtrl[0];
+}
+
 RC BufMgr::init()
 {
 	if (ctx->getEncKey()!=NULL) setLockType(RW_X_LOCK);
 	MutexP lck(&initLock);
-	if (!fInit) {InitializeSListHead(&freeBuffers); fInit=true;}
 	if (nStoreBuffers>xBuffers) xBuffers=nStoreBuffers;
 	ulong nBufNew=xBuffers;		//...*log10(nStores)
 	if (nBufNew>nBuffers) {
@@ -76,28 +102,33 @@ RC BufMgr::init()
 		
 			PBlock *pb=(PBlock*)::malloc(n*sizeof(PBlock));
 			if (pb==NULL) {freeAligned(pg); break;}
+			if (nBufChunks<MAX_BUF_CHUNKS) {bufChunks[nBufChunks].frames=pg; bufChunks[nBufChunks++].lChunk=n*lPage;}
 
 			for (ulong i=0; i<n; ++pb,++i,pg+=lPage) 
-				InterlockedPushEntrySList(&freeBuffers,(SLIST_ENTRY*)new(pb) PBlock(this,pg));
+				InterlockedPushEntrySList(&freeBuffers[(nBuffers+i)&(nParts-1)],(SLIST_ENTRY*)new(pb) PBlock(this,pg));
 			nBuffers+=n;
 		}
 		if (nBuffers!=0) {
 			setNElts(nBuffers);
-			if (nBuffers>nBufOld) report(MSG_INFO,"Number of allocated buffers: %u\n",nBuffers-nBufOld);
+			if (nBuffers>nBufOld) report(MSG_INFO,"Number of allocated buffers: %u in %u partition(s)\n",nBuffers-nBufOld,nParts);
 		}
 	}
+	if (ctx->fileMgr!=NULL) for (ulong i=0; i<nBufChunks; i++)
+		ctx->fileMgr->registerBuffers(bufChunks[i].frames,bufChunks[i].lChunk);
 	return nBuffers==0?RC_NORESOURCES:RC_OK;
 }
 
 #ifdef _DEBUG
 void BufMgr::checkState()
 {
-	MutexP lck(&pageLock);
-	for (HChain<PBlock>::it it(&pageList); ++it;) {
-		PBlock *pb=it.get();
-		if ((pb->pageID&0xFF000000)==0 && pb->QE!=NULL && (pb->QE->isFixed() || pb->QE->isLocked()))
-			report(MSG_DEBUG,"BufMgr::checkState: block is locked for %s\n",
-				pb->QE->isXLocked()?"write":pb->QE->isULocked()?"update":"read");
+	for (unsigned i=0; i<nParts; i++) {
+		MutexP lck(&parts[i].pageLock);
+		for (HChain<PBlock>::it it(&parts[i].pageList); ++it;) {
+			PBlock *pb=it.get();
+			if ((pb->pageID&0xFF000000)==0 && pb->QE!=NULL && (pb->QE->isFixed() || pb->QE->isLocked()))
+				report(MSG_DEBUG,"BufMgr::checkState: block is locked for %s\n",
+					pb->QE->isXLocked()?"write":pb->QE->isULocked()?"update":"read");
+		}
 	}
 }
 #endif
@@ -118,6 +149,7 @@ PBlock* BufMgr::getPage(PageID pid,PageMgr *pageMgr,ulong flags,PBlock *old,Sess
 		return old;
 	}
 	PBlock *ret=NULL; LatchedPage *lp; if (ses==NULL) ses=Session::getSession();
+	if (ses!=NULL) ses->nPageGets++;
 	if (ses!=NULL && (lp=(LatchedPage*)BIN<LatchedPage,PageID,LatchedPage::Cmp>::find(pid,ses->latched,ses->nLatched))!=NULL) {
 		if (old!=NULL) {
 			const bool fAfter=pid>old->getPageID(); old->release(flags,ses); 
@@ -133,7 +165,7 @@ PBlock* BufMgr::getPage(PageID pid,PageMgr *pageMgr,ulong flags,PBlock *old,Sess
 	if ((flags&PGCTL_RLATCH)!=0 && ses!=NULL) ses->releaseLatches(pid,pageMgr,(flags&(PGCTL_ULOCK|PGCTL_XLOCK))!=0);
 	ulong flg=((flags&PGCTL_XLOCK)!=0?RW_X_LOCK:(flags&PGCTL_ULOCK)!=0?RW_U_LOCK:RW_S_LOCK)|(flags&(QMGR_TRY|QMGR_UFORCE|QMGR_INMEM));
 	if (pid==INVALID_PAGEID || ctx->theCB->nMaster==0 && PageNumFromPageID(pid)==0 && FileIDFromPageID(pid)==0) flags|=PGCTL_COUPLE;
-	else if (get(ret,pid,pageMgr,flg,(flags&PGCTL_COUPLE)==0?old:NULL)!=RC_OK) {assert(ret==0);}
+	else if (get(ret,pid,pageMgr,flg,(flags&PGCTL_COUPLE)==0?old:NULL,ses!=NULL?getRing(ses->bufStrategy):(QRing<PageID>*)0)!=RC_OK) {assert(ret==0);}
 	else {
 		assert(ret->QE->getKey()==ret->pageID && ret->QE->isFixed());
 		if (pageMgr!=ret->pageMgr) {
@@ -150,6 +182,14 @@ PBlock* BufMgr::getPage(PageID pid,PageMgr *pageMgr,ulong flags,PBlock *old,Sess
 	return ret;
 }
 
+PBlock *BufMgr::fixPage(PageID pid,PageMgr *pageMgr,Session *ses)
+{
+	PBlock *ret=NULL; if (pid==INVALID_PAGEID) return NULL; if (ses==NULL) ses=Session::getSession();
+	if (get(ret,pid,pageMgr,RW_NO_LOCK|QMGR_INMEM,NULL,ses!=NULL?getRing(ses->bufStrategy):(QRing<PageID>*)0)!=RC_OK) {assert(ret==0); return NULL;}
+	if (ret->pageMgr!=pageMgr) {unfix(ret); ret=NULL;}
+	return ret;
+}
+
 PBlock *BufMgr::newPage(PageID pid,PageMgr *pageMgr,PBlock *old,ulong flags,Session *ses)
 {
 	if (pid==INVALID_PAGEID || ctx->theCB->nMaster==0 && PageNumFromPageID(pid)==0 && FileIDFromPageID(pid)==0)
@@ -160,7 +200,8 @@ PBlock *BufMgr::newPage(PageID pid,PageMgr *pageMgr,PBlock *old,ulong flags,Sess
 			{if (old!=NULL) old->release(flags,ses); return NULL;}
 		if (old!=NULL && !ses->unlatch(old,flags)) old=NULL;
 	}
-	switch (get(pb,pid,pageMgr,QMGR_NEW|RW_X_LOCK|(flags&QMGR_UFORCE),old)) {
+	BufStrategy *bs=ses!=NULL?ses->bufStrategy:(BufStrategy*)0;
+	switch (get(pb,pid,pageMgr,QMGR_NEW|RW_X_LOCK|(flags&QMGR_UFORCE),old,bs!=NULL&&bs->type==BAS_BULK?getRing(bs):(QRing<PageID>*)0)) {
 	case RC_ALREADYEXISTS: 
 		report(MSG_ERROR,"BufMgr::newPage: page %X already exists\n",pid);
 	default: assert(pb==NULL); break;
@@ -173,27 +214,76 @@ PBlock *BufMgr::newPage(PageID pid,PageMgr *pageMgr,PBlock *old,ulong flags,Sess
 	return pb;
 }
 
+QRing<PageID> *BufMgr::getRing(BufStrategy *bs)
+{
+	if (bs==NULL) return NULL;
+	if (bs->mgr==NULL) {
+		if (++bs->nAccess<nBuffers/BUF_RING_THR) return NULL;
+		bs->mgr=this; ++strategyCnt[bs->type].nOps;
+		if (bs->ring.xKeys>nBuffers/8) bs->ring.xKeys=max(nBuffers/8,1ul);
+	}
+	return bs->mgr==this?&bs->ring:(QRing<PageID>*)0;
+}
+
+void BufMgr::getStrategyStats(BufStrategyType ty,BufferStrategyStatistics& stats) const
+{
+	if (ty>=BAS_ALL) stats.nOps=stats.nEvicted=stats.nEscaped=0;
+	else {stats.nOps=strategyCnt[ty].nOps; stats.nEvicted=strategyCnt[ty].nEvicted; stats.nEscaped=strategyCnt[ty].nEscaped;}
+}
+
+void BufMgr::getWriterStats(BufferWriterStatistics& stats) const
+{
+	LSN end(ctx->logMgr->getMaxLSN()),redo(end);
+	for (unsigned i=0; i<nParts; i++) {
+		const BufPart& bp=parts[i]; MutexP lck(&bp.flushLock);
+		PBlock *pb=bp.flushList.getFirst(); if (pb!=NULL && pb->redoLSN<redo) redo=pb->redoLSN;
+	}
+	stats.redoDistance=uint64_t(end-redo); stats.redoTarget=uint64_t(end-ctx->logMgr->getOldLSN());
+	stats.nPasses=nWriterPasses; stats.nWritten=nWriterPages; stats.logGrowth=writerLog;
+	stats.writeRate=writerLog!=0?double(nWriterPages)*1048576./double(writerLog):0.; stats.nDirty=getDirtyCount();
+}
+
+void BufMgr::getPartitionStats(unsigned idx,BufferPartitionStatistics& stats) const
+{
+	if (idx>=nParts) memset(&stats,0,sizeof(BufferPartitionStatistics));
+	else {
+		const BufQMgr::QueueCtrl<SERVER_HEAP>& qc=(&ctrl)[idx];
+		stats.nHits=qc.nHits; stats.nMisses=qc.nMisses; stats.nEvicted=qc.nEvicted;
+		stats.nT1=qc.T1.l; stats.nT2=qc.T2.l; stats.nB1=qc.B1.l; stats.nB2=qc.B2.l; stats.nDirty=parts[idx].dirtyCount;
+	}
+}
+
+void BufStrategy::release()
+{
+	if (mgr!=NULL) {
+		mgr->releaseRing(ring); mgr->strategyCnt[type].nEvicted+=ring.nEvicted; mgr->strategyCnt[type].nEscaped+=ring.nEscaped;
+		ring.nEvicted=ring.nEscaped=0; mgr=NULL; nAccess=0;
+	}
+}
+
 RC BufMgr::flushAll(uint64_t timeout)
 {
 	if (ctx->theCB->state==SST_NO_SHUTDOWN) return RC_OK;
 	myaio **pcbs; RC rc=RC_OK; int cnt,ncbs; TIMESTAMP start,current; getTimestamp(start);
-	if (dirtyCount!=0) {
-		if ((pcbs=(myaio**)ctx->malloc((ncbs=dirtyCount)*sizeof(myaio*)))==NULL) return RC_NORESOURCES;
+	if ((ncbs=getDirtyCount())!=0) {
+		if ((pcbs=(myaio**)ctx->malloc(ncbs*sizeof(myaio*)))==NULL) return RC_NORESOURCES;
 		do {
-			LSN flushLSN(0); cnt=0; pageLock.lock(); PBlock *pb;
-			for (HChain<PBlock>::it it(&pageList); cnt<ncbs && rc==RC_OK && ++it;)
-				if ((pb=lockForSave(it.get()->getPageID(),true))!=NULL) {
-					if ((pb->state&(BLOCK_DIRTY|BLOCK_IO_WRITE))!=BLOCK_DIRTY || pb->isDependent()) endSave(pb);
-					else {
-						if (pb->aio==NULL && !pb->setaio()) rc=RC_NORESOURCES;
-						else if (pb->pageMgr!=NULL) {
-							LSN lsn(pb->pageMgr->getLSN(pb->frame,lPage)); if (lsn>flushLSN) flushLSN=lsn;
-							if (!pb->pageMgr->beforeFlush(pb->frame,lPage,pb->pageID)) rc=RC_CORRUPTED;
+			LSN flushLSN(0); cnt=0; PBlock *pb;
+			for (unsigned i=0; i<nParts && cnt<ncbs && rc==RC_OK; i++) {
+				MutexP lck(&parts[i].pageLock);
+				for (HChain<PBlock>::it it(&parts[i].pageList); cnt<ncbs && rc==RC_OK && ++it;)
+					if ((pb=lockForSave(it.get()->getPageID(),true))!=NULL) {
+						if ((pb->state&(BLOCK_DIRTY|BLOCK_IO_WRITE))!=BLOCK_DIRTY || pb->isDependent()) endSave(pb);
+						else {
+							if (pb->aio==NULL && !pb->setaio()) rc=RC_NORESOURCES;
+							else if (pb->pageMgr!=NULL) {
+								LSN lsn(pb->pageMgr->getLSN(pb->frame,lPage)); if (lsn>flushLSN) flushLSN=lsn;
+								if (!pb->pageMgr->beforeFlush(pb->frame,lPage,pb->pageID)) rc=RC_CORRUPTED;
+							}
+							if (rc!=RC_OK) endSave(pb); else {pb->fillaio(LIO_WRITE,NULL); pcbs[cnt++]=pb->aio;}
 						}
-						if (rc!=RC_OK) endSave(pb); else {pb->fillaio(LIO_WRITE,NULL); pcbs[cnt++]=pb->aio;}
 					}
-				}
-			pageLock.unlock(); 
+			}
 			if (cnt!=0) {
 				if (flushLSN.isNull() || (rc=ctx->logMgr->flushTo(flushLSN))==RC_OK) rc=ctx->fileMgr->listIO(LIO_WAIT,cnt,pcbs);
 				for (int i=0; i<cnt; i++) pcbs[i]->aio_pb->writeResult(rc);
@@ -202,7 +292,7 @@ RC BufMgr::flushAll(uint64_t timeout)
 				if (current-start>timeout) return RC_TIMEOUT;
 				if (asyncWriteCount!=0) threadYield();
 			}
-		} while (rc==RC_OK && dirtyCount!=0);
+		} while (rc==RC_OK && getDirtyCount()!=0);
 		ctx->free(pcbs);
 	}
 	while (asyncWriteCount+asyncReadCount!=0) {
@@ -215,18 +305,20 @@ RC BufMgr::flushAll(uint64_t timeout)
 
 RC BufMgr::close(FileID fid,bool fAll)
 {
-	pageLock.lock();
-	for (HChain<PBlock>::it_r it(&pageList); ++it;) {
-		PBlock *pb=it.get();
-		if (fAll || FileIDFromPageID(pb->pageID)==fid) {
-			bool fDel=drop(pb,false,false); pb->pageList.remove(); 
-			if (pb->flushList.isInList()) {MutexP lck(&flushLock); pb->flushList.remove(); dirtyCount--;}
-			if (pb->dependent!=NULL) {assert(pb->dependent->dependCnt>0); --pb->dependent->dependCnt;}
-			if (fDel) {pb->pageID=INVALID_PAGEID; pb->mgr=NULL; InterlockedPushEntrySList(&freeBuffers,(SLIST_ENTRY*)pb);}
+	for (unsigned i=0; i<nParts; i++) {
+		BufPart& bp=parts[i]; MutexP lck(&bp.pageLock);
+		for (HChain<PBlock>::it_r it(&bp.pageList); ++it;) {
+			PBlock *pb=it.get();
+			if (fAll || FileIDFromPageID(pb->pageID)==fid) {
+				bool fDel=drop(pb,false,false); pb->pageList.remove(); 
+				if (pb->flushList.isInList()) {MutexP flck(&bp.flushLock); pb->flushList.remove(); bp.dirtyCount--;}
+				if (pb->dependent!=NULL) {assert(pb->dependent->dependCnt>0); --pb->dependent->dependCnt;}
+				if (fDel) {pb->pageID=INVALID_PAGEID; pb->mgr=NULL; InterlockedPushEntrySList(&freeBuffers[i],(SLIST_ENTRY*)pb);}
+			}
 		}
+		assert(!fAll || !bp.pageList.isInList());
 	}
-	assert(!fAll || !pageList.isInList());
-	pageLock.unlock(); return fAll?RC_OK:ctx->fileMgr->close(fid);
+	return fAll?RC_OK:ctx->fileMgr->close(fid);
 }
 
 void BufMgr::prefetch(const PageID *pages,int nPages,PageMgr *pageMgr,PageMgr *const *mgrs)
@@ -260,39 +352,83 @@ void BufMgr::asyncWriteNotify(void *p,RC rc)
 	PBlock *pb=(PBlock*)p; BufMgr *mgr=pb->mgr; assert(mgr->asyncWriteCount>0); pb->writeResult(rc); --mgr->asyncWriteCount;
 }
 
-LogDirtyPages *BufMgr::getDirtyPageInfo(LSN old,LSN& redo,PageID *asyncPages,ulong& nAsyncPages,ulong maxAsyncPages)
+LogDirtyPages *BufMgr::getDirtyPageInfo(LSN& redo)
 {
+	for (unsigned i=0; i<nParts; i++) parts[i].flushLock.lock();
+	ulong dirtyCount=getDirtyCount();
 	LogDirtyPages *ldp=(LogDirtyPages*)ctx->malloc(sizeof(LogDirtyPages)+int(dirtyCount-1)*sizeof(LogDirtyPages::LogDirtyPage));
 	if (ldp!=NULL) {
-		ulong cnt=0; nAsyncPages=0; LSN *flushLSN=asyncPages!=NULL?(LSN*)alloca(maxAsyncPages*sizeof(LSN)):(LSN*)0;
-		{MutexP flck(&flushLock);
-		for (HChain<PBlock>::it it(&flushList); ++it;) {
+		ulong cnt=0;
+		for (unsigned i=0; i<nParts; i++) for (HChain<PBlock>::it it(&parts[i].flushList); ++it;) {
 			PBlock *pb=it.get(); if ((pb->state&BLOCK_DIRTY)==0) continue;
 			assert(cnt<dirtyCount);
 			if ((ldp->pages[cnt].redo=pb->redoLSN)<redo) redo=pb->redoLSN;
 			ldp->pages[cnt].pageID=pb->pageID; cnt++;
-			if (flushLSN!=NULL && !pb->isDependent() && pb->redoLSN<=old && (nAsyncPages<maxAsyncPages||pb->redoLSN<flushLSN[nAsyncPages-1])) {
-				ulong n=nAsyncPages,base=0,k=0;
-				while (n!=0) {
-					LSN lsn=flushLSN[(k=n>>1)+base];
-					if (lsn>pb->redoLSN || lsn==pb->redoLSN && asyncPages[k+base]<pb->pageID) n=k; 
-					else {base+=k+1; n-=k+1; k=0;}
-				}
-				if ((k+=base)<nAsyncPages && (n=nAsyncPages<maxAsyncPages?nAsyncPages-k:nAsyncPages-k-1)>0) {
-					memmove(&asyncPages[k+1],&asyncPages[k],n*sizeof(PageID));
-					memmove(&flushLSN[k+1],&flushLSN[k],n*sizeof(LSN));
-				}
-				if (k<nAsyncPages || nAsyncPages<maxAsyncPages) {
-					asyncPages[k]=pb->pageID; flushLSN[k]=pb->redoLSN;
-					if (nAsyncPages<maxAsyncPages) nAsyncPages++;
-				}
-			}
 		}
-		ldp->nPages=cnt; assert(cnt<=dirtyCount);}
+		ldp->nPages=cnt; assert(cnt<=dirtyCount);
 	}
+	for (unsigned i=nParts; i--!=0; ) parts[i].flushLock.unlock();
 	return ldp;
 }
 
+void BufMgr::trickle()
+{
+	if (!writerLock.trylock()) return;
+	const LSN end(ctx->logMgr->getMaxLSN()),old(ctx->logMgr->getOldLSN());
+	const uint64_t target=uint64_t(end-old),growth=writerLSN.isNull()||end<writerLSN?0:uint64_t(end-writerLSN);
+	writerLSN=end; nWriterPasses++; writerLog+=growth;
+	ulong nDirty=getDirtyCount();
+	if (nDirty!=0 && asyncWriteCount<BUF_WRITER_MAX) {
+		// the share of the dirty set proportional to log growth is written, so every page is written while the log grows by the target distance
+		ulong quota=target!=0?ulong((uint64_t(nDirty)*growth+target-1)/target):nDirty; if (quota>BUF_WRITER_MAX) quota=BUF_WRITER_MAX;
+		DirtyPageInfo *pages=(DirtyPageInfo*)alloca(BUF_WRITER_MAX*sizeof(DirtyPageInfo)); ulong nPages=0;
+		for (unsigned i=0; i<nParts; i++) {
+			// flush lists are kept in the order pages become dirty, i.e. in ascending redo LSN order
+			BufPart& bp=parts[i]; MutexP lck(&bp.flushLock); ulong cnt=0;
+			for (HChain<PBlock>::it it(&bp.flushList); cnt<BUF_WRITER_MAX && ++it;) {
+				PBlock *pb=it.get(); if ((pb->state&(BLOCK_DIRTY|BLOCK_IO_WRITE))!=BLOCK_DIRTY || pb->isDependent()) continue;
+				if (nPages==BUF_WRITER_MAX && pb->redoLSN>=pages[nPages-1].redoLSN) break;
+				ulong lo=0,hi=nPages;
+				while (lo<hi) {ulong k=(lo+hi)>>1; if (pages[k].redoLSN<=pb->redoLSN) lo=k+1; else hi=k;}
+				if (nPages<BUF_WRITER_MAX) nPages++;
+				if (lo+1<nPages) memmove((byte*)&pages[lo+1],&pages[lo],(nPages-lo-1)*sizeof(DirtyPageInfo));
+				pages[lo].pageID=pb->pageID; pages[lo].redoLSN=pb->redoLSN; cnt++;
+			}
+		}
+		// pages beyond the redo distance target are written regardless of the quota
+		ulong n=min(quota,nPages); while (n<nPages && pages[n].redoLSN<=old) n++;
+		if (n!=0) {
+			PageID *pids=(PageID*)alloca(n*sizeof(PageID));
+			for (ulong i=0; i<n; i++) pids[i]=pages[i].pageID;
+			writeAsyncPages(pids,n); nWriterPages+=n;
+		}
+	}
+	writerLock.unlock();
+}
+
+void BufMgr::writeDirty()
+{
+	ulong nDirty=getDirtyCount(),nPages=0; if (nDirty==0) return;
+	PageID *pids=(PageID*)ctx->malloc(nDirty*sizeof(PageID)); if (pids==NULL) return;
+	for (unsigned i=0; i<nParts && nPages<nDirty; i++) {
+		BufPart& bp=parts[i]; MutexP lck(&bp.flushLock);
+		for (HChain<PBlock>::it it(&bp.flushList); nPages<nDirty && ++it;) {
+			PBlock *pb=it.get(); if ((pb->state&(BLOCK_DIRTY|BLOCK_IO_WRITE))==BLOCK_DIRTY && !pb->isDependent()) pids[nPages++]=pb->pageID;
+		}
+	}
+	for (ulong i=0; i<nPages; i+=BUF_WRITER_MAX) writeAsyncPages(pids+i,nPages-i<BUF_WRITER_MAX?nPages-i:BUF_WRITER_MAX);
+	ctx->free(pids);
+}
+
+void BufMgr::WriterRQ::process()
+{
+	mgr->trickle();
+}
+
+void BufMgr::WriterRQ::destroy()
+{
+}
+
 void BufMgr::writeAsyncPages(const PageID *asyncPages,ulong nAsyncPages)
 {
 	ulong cnt=0; LSN flushLSN(0); RC rc; assert(asyncPages!=NULL && nAsyncPages>0);
@@ -331,11 +467,11 @@ PBlock::~PBlock()
 void PBlock::setRedo(LSN lsn) {
 	assert(isXLocked()); 
 	if ((state&(BLOCK_REDO_SET|BLOCK_DISCARDED))==0) {
-		MutexP flck(&mgr->flushLock); 
+		BufMgr::BufPart& bp=mgr->getPart(pageID); MutexP flck(&bp.flushLock); 
 		if ((state&(BLOCK_REDO_SET|BLOCK_DISCARDED|BLOCK_DIRTY))==0) {
 			assert(!flushList.isInList());
 			redoLSN=lsn; setStateBits(BLOCK_DIRTY|BLOCK_REDO_SET);
-			mgr->flushList.insertLast(&flushList); mgr->dirtyCount++;
+			bp.flushList.insertLast(&flushList); bp.dirtyCount++;
 		}
 	}
 #ifdef _DEBUG
@@ -364,6 +500,7 @@ RW_LockType PBlock::lockType(RW_LockType lt)
 
 RC PBlock::load(PageMgr *pm,ulong flags)
 {
+	Session *ses=Session::getSession(); if (ses!=NULL) ses->nPageReads++;
 	pageMgr=pm; setStateBits(BLOCK_IO_READ); return readResult(mgr->ctx->fileMgr->io(FIO_READ,pageID,frame,mgr->lPage));
 }
 
@@ -440,7 +577,7 @@ RC PBlock::flushBlock()
 	if (rc!=RC_OK) resetStateBits(BLOCK_IO_WRITE);
 	else {
 		resetStateBits(BLOCK_IO_WRITE|BLOCK_DIRTY|BLOCK_REDO_SET|BLOCK_NEW_PAGE);
-		if (flushList.isInList()) {MutexP flck(&mgr->flushLock); flushList.remove(); mgr->dirtyCount--;}
+		if (flushList.isInList()) {BufMgr::BufPart& bp=mgr->getPart(pageID); MutexP flck(&bp.flushLock); flushList.remove(); bp.dirtyCount--;}
 		if (dependent!=NULL) {assert(dependent->dependCnt>0); --dependent->dependCnt; dependent=NULL;}
 	}
 	return rc;
@@ -449,10 +586,11 @@ RC PBlock::flushBlock()
 void PBlock::destroy()
 {
 	if (vb!=NULL) {vb->release(); vb=NULL;}
-	if (flushList.isInList()) {MutexP lck(&mgr->flushLock); flushList.remove(); mgr->dirtyCount--;}
+	unsigned idx=mgr!=NULL?mgr->part(pageID):0;
+	if (flushList.isInList()) {BufMgr::BufPart& bp=mgr->parts[idx]; MutexP lck(&bp.flushLock); flushList.remove(); bp.dirtyCount--;}
 	if (dependent!=NULL) {assert(dependent->dependCnt>0); --dependent->dependCnt;}
-	if (pageList.isInList()) {MutexP lck(&mgr->pageLock); pageList.remove();}
-	pageID=INVALID_PAGEID; mgr=NULL; InterlockedPushEntrySList(&BufMgr::freeBuffers,(SLIST_ENTRY*)this);
+	if (pageList.isInList()) {MutexP lck(&mgr->parts[idx].pageLock); pageList.remove();}
+	pageID=INVALID_PAGEID; mgr=NULL; InterlockedPushEntrySList(&BufMgr::freeBuffers[idx],(SLIST_ENTRY*)this);
 }
 
 RC PBlock::readResult(RC rc)
@@ -482,7 +620,7 @@ void PBlock::writeResult(RC rc)
 		} else {
 			bool fChain=(state&BLOCK_FLUSH_CHAIN)!=0;
 			resetStateBits(BLOCK_IO_WRITE|BLOCK_DIRTY|BLOCK_REDO_SET|BLOCK_ASYNC_IO|BLOCK_NEW_PAGE|BLOCK_FLUSH_CHAIN);
-			if (flushList.isInList()) {MutexP flck(&mgr->flushLock); flushList.remove(); mgr->dirtyCount--;}
+			if (flushList.isInList()) {BufMgr::BufPart& bp=mgr->getPart(pageID); MutexP flck(&bp.flushLock); flushList.remove(); bp.dirtyCount--;}
 			if (pageMgr!=NULL && !pageMgr->getLSN(frame,mgr->lPage).isNull()) mgr->ctx->logMgr->insert(NULL,LR_FLUSH,pageMgr->getPGID(),pageID);
 			if (dependent!=NULL) {if (fChain) chain=mgr->trylock(dependent,RW_U_LOCK); assert(dependent->dependCnt>0); --dependent->dependCnt; dependent=NULL;}
 		}
@@ -494,7 +632,8 @@ void PBlock::writeResult(RC rc)
 
 PBlock *PBlock::createNew(PageID pid,void *mg)
 {
-	PBlock *ret=(PBlock*)InterlockedPopEntrySList(&BufMgr::freeBuffers);
+	BufMgr *mgr=(BufMgr*)(BufQMgr*)mg; const unsigned idx=mgr->part(pid),msk=mgr->nParts-1; PBlock *ret=NULL;
+	for (unsigned i=0; i<=msk && (ret=(PBlock*)InterlockedPopEntrySList(&BufMgr::freeBuffers[idx+i&msk]))==NULL; i++);
 	if (ret!=NULL) {new(ret) PBlock((BufMgr*)(BufQMgr*)mg,ret->frame,ret->aio); ret->pageID=pid;}
 	return ret;
 }
@@ -511,15 +650,15 @@ void PBlock::signal(void*)
 
 void PBlock::initNew()
 {
-	MutexP lck(&mgr->pageLock); mgr->pageList.insertFirst(&pageList);
+	BufMgr::BufPart& bp=mgr->getPart(pageID); MutexP lck(&bp.pageLock); bp.pageList.insertFirst(&pageList);
 }
 
 void PBlock::setKey(PageID pid,void *mg)
 {
 	if (vb!=NULL) {vb->release(); vb=NULL;}
-	if (mgr!=NULL && pageList.isInList()) {MutexP lck(&mgr->pageLock); pageList.remove();}
+	if (mgr!=NULL && pageList.isInList()) {MutexP lck(&mgr->getPart(pageID).pageLock); pageList.remove();}
 	pageID=pid; mgr=(BufMgr*)(BufQMgr*)mg;
-	MutexP lck(&mgr->pageLock); mgr->pageList.insertFirst(&pageList);
+	BufMgr::BufPart& bp=mgr->getPart(pageID); MutexP lck(&bp.pageLock); bp.pageList.insertFirst(&pageList);
 }
 
 PBlock*	PBlockP::getPage(PageID pid,PageMgr *mgr,ulong f,Session *ses)
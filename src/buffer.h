@@ -27,6 +27,9 @@ Written by Mark Venguerov 2004-2012
 #include "utils.h"
 #include "pagemgr.h"
 #include "qmgr.h"
+#include "affinity.h"
+
+using namespace AfyDB;
 
 #define	PAGE_HASH_SIZE		0x0400				/**< size of the page hash table */
 
@@ -51,11 +54,20 @@ Written by Mark Venguerov 2004-2012
 #define MAX_ASYNC_PAGES		32					/**< maximum number of pages being asynchronously saved to disk */
 #define	FLUSH_CHAIN_THR		12					/**< when dependency chain reaches this length, page flushing starts automatically */
 #define	MIN_BUFFERS			8					/**< minimum number of page buffers in memory */
+#define	MAX_BUF_CHUNKS		64					/**< maximum number of page frame regions registered for i/o */
+#define	BUF_RING_SCAN		32					/**< number of frames in the private ring of a scan strategy */
+#define	BUF_RING_BULK		128					/**< number of frames in the private ring of a bulk operation strategy */
+#define	BUF_RING_THR		4					/**< ring is used after an operation touched 1/BUF_RING_THR of the buffer pool */
+#define	BUF_MAX_PARTS		64					/**< maximum number of buffer pool partitions */
+#define	BUF_PART_MIN		32					/**< minimum number of page buffers in one partition */
+#define	BUF_WRITER_STEPS	16					/**< background writer passes while the log grows by the redo distance target */
+#define	BUF_WRITER_MAX		128					/**< maximum number of pages written by one background writer pass */
 
 namespace AfyKernel
 {
 
 class Session;
+class BufMgr;
 struct LogDirtyPages;
 struct DirtyPageInfo
 {
@@ -65,6 +77,8 @@ struct DirtyPageInfo
 
 /**
  * buffer page descriptor
+ * a page fixed with BufMgr::fixPage() can be read without latching: startRead() gets the latch version,
+ * validate() checks that the page was not exclusively latched since then; data read in between must not be trusted otherwise
  */
 class PBlock
 {
@@ -112,6 +126,8 @@ public:
 	void			upgradeLock() {if (QE!=NULL) QE->upgradeLock(RW_X_LOCK);}
 	bool			tryupgrade() {return QE==NULL||QE->tryupgrade();}
 	void			downgradeLock(RW_LockType lt) {if (QE!=NULL) QE->downgradeLock(lt);}
+	bool			startRead(long& ver) const {if (QE==NULL) {ver=0; return false;} ver=QE->getVersion(); MemoryBarrier(); const bool f=!QE->isXLocked(); MemoryBarrier(); return f;}	/**< fences order version, latch and page reads */
+	bool			validate(long ver) const {MemoryBarrier(); if (QE->isXLocked()) return false; MemoryBarrier(); return QE->getVersion()==ver;}	/**< latch is checked before version: a released latch implies a visible version bump */
 	void			flushPage() {assert(isXLocked() && !isDependent()); flushBlock();}
 	VBlock			*getVBlock() const {return vb;}
 	void			setVBlock(VBlock *v) {vb=v;}
@@ -161,6 +177,36 @@ public:
 
 typedef QMgr<PBlock,PageID,PageID,PageMgr*,SERVER_HEAP> BufQMgr;
 
+/**
+ * buffer access strategy types
+ */
+enum BufStrategyType
+{
+	BAS_SCAN, BAS_BULK, BAS_ALL
+};
+
+/**
+ * per-operation buffer access strategy
+ * large scans and bulk operations read pages through a small private ring of frames
+ * which is recycled without entering ARC queues; pages already in memory are used in place
+ * installed for a session with BufStrategyP
+ */
+class BufStrategy
+{
+	friend	class			BufMgr;
+	const	BufStrategyType	type;
+	BufMgr					*mgr;
+	ulong					nAccess;
+	QRing<PageID>			ring;
+	PageID					pages[BUF_RING_BULK];
+public:
+	BufStrategy(BufStrategyType ty) : type(ty),mgr(NULL),nAccess(0),ring(pages,ty==BAS_BULK?BUF_RING_BULK:BUF_RING_SCAN) {}
+	~BufStrategy() {release();}
+	void					release();
+	BufStrategyType			getType() const {return type;}
+	ulong					getEvicted() const {return ring.nEvicted;}
+};
+
 /**
  * Buffer manager
  * @see also QMgr
@@ -170,23 +216,43 @@ class BufMgr : public BufQMgr
 	class	StoreCtx *const	ctx;
 	const	size_t			lPage;
 	const	ulong			nStoreBuffers;
-	mutable	Mutex			pageLock;
-	HChain<PBlock>			pageList;
-	mutable	Mutex			flushLock;
-	HChain<PBlock>			flushList;
-	ulong					dirtyCount;
+	struct	BufPart {
+		mutable	Mutex		pageLock;
+		HChain<PBlock>		pageList;
+		mutable	Mutex		flushLock;
+		HChain<PBlock>		flushList;
+		ulong				dirtyCount;
+		BufPart() : pageList(NULL),flushList(NULL),dirtyCount(0) {}
+	}						parts[BUF_MAX_PARTS];
 	SharedCounter			asyncWriteCount;
 	SharedCounter			asyncReadCount;
 	ulong					maxDepDepth;
+	struct	StrategyCnt {SharedCounter nOps,nEvicted,nEscaped;} strategyCnt[BAS_ALL];
+	Mutex					writerLock;
+	LSN						writerLSN;
+	uint64_t				nWriterPasses;
+	uint64_t				nWriterPages;
+	uint64_t				writerLog;
+	class WriterRQ	: public Request
+	{
+		BufMgr			*const	mgr;
+	public:
+		WriterRQ(BufMgr *mg) : mgr(mg) {}
+		void process();
+		void destroy();
+	}						writerRQ;
+	friend	class			WriterRQ;
 
 	static ulong			nBuffers;
 	static ulong			xBuffers;
 	static volatile	long	nStores;
-	static SLIST_HEADER		freeBuffers;
+	static SLIST_HEADER		freeBuffers[BUF_MAX_PARTS];
+	static struct BufChunk {byte *frames; size_t lChunk;} bufChunks[MAX_BUF_CHUNKS];
+	static ulong			nBufChunks;
 	static Mutex			initLock;
 	static bool				fInit;
 public:
-	BufMgr(class StoreCtx *ct,int initNumberOfBlocks,size_t lpage);
+	BufMgr(class StoreCtx *ct,int initNumberOfBlocks,size_t lpage,unsigned nParts=0);
 	~BufMgr();
 	void *operator new(size_t s,StoreCtx *ctx);
 	RC					init();
@@ -194,19 +260,33 @@ public:
 	size_t				getPageSize() const {return lPage;}
 	PBlock*				newPage(PageID pid,PageMgr*,PBlock *old=NULL,ulong flags=0,Session *ses=NULL);
 	PBlock*				getPage(PageID pid,PageMgr*,ulong flags=0,PBlock *old=NULL,Session *ses=NULL);
+	PBlock*				fixPage(PageID pid,PageMgr*,Session *ses=NULL);
+	void				unfixPage(PBlock *pb) {unfix(pb);}
+	void				getStrategyStats(BufStrategyType ty,BufferStrategyStatistics& stats) const;
+	unsigned			getNPartitions() const {return nParts;}
+	void				getPartitionStats(unsigned idx,BufferPartitionStatistics& stats) const;
+	void				getWriterStats(BufferWriterStatistics& stats) const;
 	void				prefetch(const PageID *pages,int nPages,PageMgr *mgr,PageMgr *const *mgrs=NULL);
 	void				asyncWrite();
+	void				startWriter() {RequestQueue::postRequest(&writerRQ,ctx,RQ_NORMAL);}
+	void				writeDirty();
 	RC					close(FileID fid,bool fAll=false);
 	void				writeAsyncPages(const PageID *asyncPages,ulong nAsyncPages);
-	LogDirtyPages		*getDirtyPageInfo(LSN old,LSN& redo,PageID *asyncPages,ulong& nAsyncPages,ulong maxAsyncPages);
+	LogDirtyPages		*getDirtyPageInfo(LSN& redo);
 #ifdef _DEBUG
 	void				checkState();
 #endif
 private:
+	BufPart&			getPart(PageID pid) {return parts[part(pid)];}
+	ulong				getDirtyCount() const {ulong cnt=0; for (unsigned i=0; i<nParts; i++) cnt+=parts[i].dirtyCount; return cnt;}
+	QRing<PageID>		*getRing(BufStrategy *bs);
+	void				trickle();
+	static	BufQMgr::QueueCtrl<SERVER_HEAP>& initCtrl(unsigned nParts,ulong nBuf);
 	static	void		asyncReadNotify(void*,RC);
 	static	void		asyncWriteNotify(void*,RC);
 	friend	class		PBlock;
 	friend	class		Session;
+	friend	class		BufStrategy;
 };
 
 };
@@ -30,10 +30,12 @@ using namespace AfyKernel;
 
 static const IndexFormat classIndexFmt(KT_UINT,sizeof(uint64_t),KT_VARMDPINREFS);
 static const IndexFormat classPINsFmt(KT_UINT,sizeof(uint64_t),KT_VARDATA);
+static const IndexFormat classStatsFmt(KT_UINT,sizeof(uint64_t),KT_VARDATA);
 
 Classifier::Classifier(StoreCtx *ct,ulong timeout,ulong hashSize,ulong cacheSize) 
 	: ClassHash(*new(ct) ClassHash::QueueCtrl<STORE_HEAP>(cacheSize),hashSize),ctx(ct),fInit(false),classIndex(ct),
 	classMap(MA_CLASSINDEX,classIndexFmt,ct,TF_WITHDEL),classPINs(MA_CLASSPINS,classPINsFmt,ct,TF_WITHDEL),
+	classStats(MA_CLASSSTATS,classStatsFmt,ct,TF_WITHDEL),
 	nCached(0),xCached(cacheSize),xPropID(ct->theCB->xPropID)
 {
 	if (&ctrl==NULL) throw RC_NORESOURCES;
@@ -242,6 +244,7 @@ IndexFormat ClassIndex::ifmt(KT_ALL,0,0);
 
 ClassIndex::~ClassIndex()
 {
+	if (stats!=NULL) cls.mgr.ctx->free(stats);
 }
 
 TreeFactory *ClassIndex::getFactory() const
@@ -307,6 +310,246 @@ void ClassIndex::destroy()
 	cls.release();
 }
 
+bool ClassIndex::isCovering() const
+{
+	// keys reproduce property values only for typed segments without prefix truncation or case folding
+	for (ulong i=0; i<nSegs; i++) {
+		const IndexSeg& is=indexSegs[i];
+		if (is.lPrefix!=0 || (is.flags&ORD_NCASE)!=0) return false;
+		switch (is.type) {
+		case VT_ANY: case VT_STREAM: case VT_REF: case VT_REFPROP: case VT_REFELT: return false;
+		default: break;
+		}
+	}
+	return true;
+}
+
+IndexStats *ClassIndex::getStats()
+{
+	if (!fStatsLoaded && cls.txs==NULL) {IndexStats *st=NULL; if (cls.mgr.loadStats(cls.cid,st)==RC_OK) setStats(st);}
+	return stats;
+}
+
+void ClassIndex::setStats(IndexStats *st)
+{
+	if (stats!=NULL) cls.mgr.ctx->free(stats); stats=st; fStatsLoaded=true;
+	nSave=st!=NULL?(long)max(st->nAnalyzed/CLASS_STATS_SAVE,(uint64_t)CLASS_STATS_SAVE):0;
+}
+
+static inline uint64_t addRows(uint64_t nRows,long delta)
+{
+	return delta>=0||nRows>uint64_t(-delta)?nRows+delta:0;
+}
+
+bool ClassIndex::estimate(const SearchKey *keys,ulong nRanges,bool fExact,double& nRows)
+{
+	MutexP lck(&statsLock); const IndexStats *st=getStats(); if (st==NULL) return false;
+	const double nAll=double(addRows(st->nRows,nDelta));
+	if (nRanges==0) {nRows=nAll; return true;}
+	nRows=0.;
+	for (ulong i=0; i<nRanges; i++,keys+=2) {
+		const double n=st->estimate(&keys[0],&keys[1],fExact); if (n<0.) return false; nRows+=n;
+	}
+	if (nRows>nAll) nRows=nAll;
+	return true;
+}
+
+RC ClassIndex::getStatistics(IndexStatistics& ist,uint64_t *ndv,unsigned nS)
+{
+	MutexP lck(&statsLock); const IndexStats *st=getStats(); if (st==NULL) return RC_NOTFOUND;
+	ist.nEntries=addRows(st->nRows,nDelta); ist.nAnalyzed=st->nAnalyzed; ist.nPages=st->nPages; ist.nBuckets=st->nBounds; ist.nSegs=st->nSegs;
+	if (ndv!=NULL) for (unsigned i=0; i<nS; i++) ndv[i]=i<st->nSegs?st->getNDV()[i]:0ULL;
+	return RC_OK;
+}
+
+namespace AfyKernel
+{
+	/**
+	 * asynchronous statistics refresh, see ClassIndex::countKeys()
+	 * the class is looked up by id, the request is a no-op if the class was dropped in the meantime
+	 */
+	class StatsRQ : public Request
+	{
+		StoreCtx		*const	ctx;
+		const	ClassID	cid;
+	public:
+		StatsRQ(StoreCtx *ct,ClassID id) : ctx(ct),cid(id) {}
+		void	*operator new(size_t s,StoreCtx *ctx) throw() {return ctx->malloc(s);}
+		void	process() {
+			Class *cls=ctx->classMgr->getClass(cid); if (cls==NULL) return;
+			ClassIndex *cidx=cls->getIndex();
+			if (cidx!=NULL) {
+				RC rc=cidx->refreshStats(Session::getSession());
+				if (rc!=RC_OK && rc!=RC_SHUTDOWN) report(MSG_ERROR,"Failed to refresh statistics of class %08X (%d)\n",cid,rc);
+			}
+			cls->release();
+		}
+		void	destroy() {StoreCtx *ct=ctx; this->~StatsRQ(); ct->free(this);}
+	};
+};
+
+void ClassIndex::countKeys(Session *ses,long delta)
+{
+	// rows count is kept current between analyze() runs; rolled back index updates are not subtracted
+	// the insert path only accumulates deltas, they are applied and saved by StatsRQ in the background
+	if (!fStatsLoaded) {MutexP lck(&statsLock); getStats();}
+	if (nSave==0) return;
+	for (long d=nDelta; !cas(&nDelta,d,d+delta); d=nDelta);
+	if (InterlockedIncrement(&nUpdates)>=nSave && cas(&fRefresh,0L,1L)) {
+		StoreCtx *ctx=cls.mgr.ctx; StatsRQ *rq=new(ctx) StatsRQ(ctx,cls.cid);
+		if (rq==NULL || !RequestQueue::postRequest(rq,ctx)) {if (rq!=NULL) rq->destroy(); fRefresh=0;}
+	}
+}
+
+RC ClassIndex::refreshStats(Session *ses)
+{
+	if (ses==NULL) return RC_NOSESSION; IndexStats *copy=NULL; bool fDrift=false; RC rc=RC_OK;
+	{
+		MutexP lck(&statsLock); IndexStats *st=getStats(); nUpdates=0;
+		long d=nDelta; while (!cas(&nDelta,d,0L)) d=nDelta;
+		if (st!=NULL) {
+			st->nRows=addRows(st->nRows,d); st->nRefresh++;
+			const uint64_t dr=st->nRows>st->nAnalyzed?st->nRows-st->nAnalyzed:st->nAnalyzed-st->nRows;
+			fDrift=st->nRefresh>=CLASS_STATS_DRIFT || dr>st->nAnalyzed/CLASS_STATS_DRIFT;
+			// the record is saved from a copy, the mini-transaction doesn't run under statsLock
+			if (!fDrift) {if ((copy=(IndexStats*)ses->malloc(st->length()))!=NULL) memcpy(copy,st,st->length()); else rc=RC_NORESOURCES;}
+		}
+	}
+	if (fDrift) rc=analyze(ses);
+	else if (copy!=NULL) {rc=cls.mgr.saveStats(ses,cls.cid,copy); ses->free(copy);}
+	fRefresh=0; return rc;
+}
+
+namespace AfyKernel
+{
+	/**
+	 * key distribution collector for ClassIndex::analyze()
+	 * index values are read as one stream, the scan reports the start of each key through newKey()
+	 */
+	class IndexStatsCtx : public IKeyCallback
+	{
+		Session		*const	ses;
+		const	ulong		nSegs;
+		unsigned			cur;
+		byte				*keys[2];
+		ushort				lKeys[2];
+		ushort				xKeys[2];
+	public:
+		TreeScan			*scan;
+		uint64_t			*const ndv;
+		uint64_t			nRows;
+		uint64_t			nValues;
+		uint64_t			depth;
+		uint64_t			lData;
+		unsigned			nBounds;
+		size_t				lBounds;
+		byte				*bnd[CLASS_STATS_BUCKETS*2];
+		ushort				lbnd[CLASS_STATS_BUCKETS*2];
+		RC					rc;
+		IndexStatsCtx(Session *s,ulong nS,uint64_t *nd) : ses(s),nSegs(nS),cur(0),scan(NULL),ndv(nd),nRows(0),nValues(0),depth(1),lData(0),nBounds(0),lBounds(0),rc(RC_OK)
+			{keys[0]=keys[1]=NULL; lKeys[0]=lKeys[1]=xKeys[0]=xKeys[1]=0; memset(ndv,0,nSegs*sizeof(uint64_t));}
+		~IndexStatsCtx() {
+			for (unsigned i=0; i<2; i++) if (keys[i]!=NULL) ses->free(keys[i]);
+			for (unsigned i=0; i<nBounds; i++) ses->free(bnd[i]);
+		}
+		void newKey() {
+			if (rc!=RC_OK || scan==NULL) return; flush(); cur^=1;
+			// the key is copied: getKey() is not valid any more after the last value of the key is read
+			const SearchKey& key=scan->getKey(); const ushort lk=key.extLength(); unsigned nEq=0;
+			if (lk>xKeys[cur]) {byte *p=(byte*)ses->realloc(keys[cur],lk); if (p==NULL) {rc=RC_NORESOURCES; return;} keys[cur]=p; xKeys[cur]=lk;}
+			key.serialize(keys[cur]); lKeys[cur]=lk; lData+=lk;
+			if (nSegs>1 && key.type==KT_VAR) {
+				// NDV of each key prefix is the number of positions where it changes between adjacent keys
+				SearchKey prev; if (lKeys[cur^1]!=0 && prev.deserialize(keys[cur^1],lKeys[cur^1])==RC_OK && prev.type==KT_VAR)
+					cmpMSegPrefix(prev.getPtr2(),prev.v.ptr.l,key.getPtr2(),key.v.ptr.l,&nEq);
+				for (unsigned i=nEq; i<nSegs; i++) ndv[i]++;
+			} else ndv[nSegs-1]++;
+		}
+		void flush() {
+			// equi-depth histogram: bound i is the key of entry (i+1)*depth, depth doubles when all slots are used
+			for (nRows+=nValues,nValues=0; lKeys[cur]!=0 && nRows>=depth*(nBounds+1); ) {
+				if (nBounds>=CLASS_STATS_BUCKETS*2) {halve(); continue;}
+				if ((bnd[nBounds]=(byte*)ses->malloc(lKeys[cur]))==NULL) {rc=RC_NORESOURCES; break;}
+				memcpy(bnd[nBounds],keys[cur],lbnd[nBounds]=lKeys[cur]); lBounds+=lKeys[cur]; nBounds++;
+			}
+		}
+		void halve() {
+			unsigned i=0; lBounds=0;
+			for (; i<nBounds/2; i++) {ses->free(bnd[i*2]); bnd[i]=bnd[i*2+1]; lBounds+=lbnd[i]=lbnd[i*2+1];}
+			if ((nBounds&1)!=0) ses->free(bnd[nBounds-1]);
+			nBounds=i; depth*=2;
+		}
+	};
+};
+
+RC ClassIndex::analyze(Session *ses)
+{
+	if (ses==NULL) return RC_NOSESSION; if (cls.txs!=NULL) return RC_OK;
+	StoreCtx *ctx=cls.mgr.ctx; const size_t lPage=ctx->bufMgr->getPageSize(); const void *p; size_t l;
+	IndexStatsCtx sc(ses,nSegs,(uint64_t*)alloca(nSegs*sizeof(uint64_t))); RC rc=RC_OK;
+	if ((sc.scan=Tree::scan(ses,NULL,NULL,0,indexSegs,nSegs,&sc))==NULL) return RC_NORESOURCES;
+	while (sc.rc==RC_OK && (p=sc.scan->nextValue(l))!=NULL) {
+		sc.nValues++; sc.lData+=l;
+		if (ctx->inShutdown()) {rc=RC_SHUTDOWN; break;}
+	}
+	sc.scan->destroy(); sc.scan=NULL; sc.flush(); if (rc==RC_OK) rc=sc.rc;
+	if (rc==RC_OK) {
+		while (sc.nBounds>1 && sizeof(IndexStats)+nSegs*sizeof(uint64_t)+sc.lBounds>lPage/4) sc.halve();
+		const size_t lStats=sizeof(IndexStats)+nSegs*sizeof(uint64_t)+sc.lBounds; IndexStats *st=(IndexStats*)ctx->malloc(lStats);
+		if (st==NULL) rc=RC_NORESOURCES;
+		else {
+			st->nRows=st->nAnalyzed=sc.nRows; st->nPages=(sc.lData+lPage-1)/lPage; st->depth=sc.depth;
+			st->nSegs=(uint32_t)nSegs; st->nBounds=sc.nBounds; st->lBounds=(uint32_t)sc.lBounds; st->nRefresh=0;
+			memcpy(st->getNDV(),sc.ndv,nSegs*sizeof(uint64_t)); byte *pb=(byte*)st->getBounds();
+			for (unsigned i=0; i<sc.nBounds; pb+=sc.lbnd[i++]) memcpy(pb,sc.bnd[i],sc.lbnd[i]);
+			if ((rc=cls.mgr.saveStats(ses,cls.cid,st))!=RC_OK) ctx->free(st);
+			else {MutexP lck(&statsLock); setStats(st); nDelta=0; nUpdates=0;}
+		}
+	}
+	return rc;
+}
+
+static double numKey(const SearchKey& key)
+{
+	switch (key.type) {
+	case KT_UINT: return double(key.v.u);
+	case KT_INT: return double(key.v.i);
+	case KT_FLOAT: return key.v.f;
+	default: return key.v.d;
+	}
+}
+
+static bool cmpStatsKey(const SearchKey& key,const SearchKey& bound,int& cmp)
+{
+	// search keys may have a different numeric type than the index; integers are compared as the tree compares them
+	if (key.type==bound.type) cmp=key.type!=KT_VAR?key.cmp(bound):cmpMSegPrefix(key.getPtr2(),key.v.ptr.l,bound.getPtr2(),bound.v.ptr.l);
+	else if (key.isPrefNumKey() && bound.isPrefNumKey()) cmp=key.type==KT_INT?cmp3(key.v.i,bound.v.i):cmp3(key.v.u,bound.v.u);
+	else if (key.isNumKey() && bound.isNumKey()) cmp=cmp3(numKey(key),numKey(bound));
+	else return false;
+	return true;
+}
+
+double IndexStats::estimate(const SearchKey *start,const SearchKey *finish,bool fExact) const
+{
+	if (nAnalyzed==0) return 0.;
+	const bool fStart=start->isSet(),fFinish=finish->isSet(); unsigned nLess=0,nLE=nBounds,nKeySegs=nSegs; int cmp;
+	const byte *p=getBounds(),*const end=p+lBounds;
+	for (unsigned i=0; i<nBounds; i++) {
+		SearchKey bound; size_t lb=0; if (bound.deserialize(p,end-p,&lb)!=RC_OK) return -1.; p+=lb;
+		if (fStart) {if (!cmpStatsKey(*start,bound,cmp)) return -1.; if (cmp>0) nLess=i+1;}
+		if (fFinish && nLE==nBounds) {if (!cmpStatsKey(*finish,bound,cmp)) return -1.; if (cmp<0) nLE=i;}
+	}
+	// positions of range ends are taken in the middle of their buckets
+	const double N=double(nAnalyzed),d=double(depth),tail=N-d*nBounds;
+	const double lo=fStart?d*nLess+(nLess<nBounds?d:tail)/2.:0.,hi=fFinish?d*nLE+(nLE<nBounds?d:tail)/2.:N;
+	double n=hi-lo;
+	if (fExact && fStart) {
+		if (start->type==KT_VAR) {cmpMSegPrefix(start->getPtr2(),start->v.ptr.l,start->getPtr2(),start->v.ptr.l,&nKeySegs); if (nKeySegs==0||nKeySegs>nSegs) nKeySegs=nSegs;}
+		const uint64_t nd=getNDV()[nKeySegs-1]; const double nEq=nd!=0?N/double(nd):1.; if (n<nEq) n=nEq;
+	} else if (n<d/2.) n=d/2.;
+	return n*double(nRows)/N;
+}
+
 Tree *Classifier::connect(uint32_t hndl)
 {
 	Class *cls=ctx->classMgr->getClass(hndl); if (cls==NULL) return NULL;
@@ -446,15 +689,7 @@ RC Classifier::indexFormat(ulong vt,IndexFormat& fmt) const
 RC Classifier::rebuildAll(Session *ses)
 {
 	if (ses==NULL) return RC_NOSESSION; assert(fInit && ses->inWriteTx());
-	RC rc=classMap.dropTree(); if (rc!=RC_OK) return rc;
-	PINEx qr(ses),*pqr=&qr; ses->resetAbortQ(); MutexP lck(&lock); ClassResult clr(ses,ses->getStore());
-	QCtx qc(ses); qc.ref(); FullScan fs(&qc,HOH_HIDDEN); fs.connect(&pqr);
-	while (rc==RC_OK && (rc=fs.next())==RC_OK) {
-		if ((rc=classify(&qr,clr))==RC_OK && clr.classes!=NULL && clr.nClasses>0) 
-			rc=index(ses,&qr,clr,(qr.hpin->hdr.descr&HOH_DELETED)!=0?CI_INSERTD:CI_INSERT); // data for other indices!!!
-		clr.nClasses=clr.nIndices=0;
-	}
-	return rc==RC_EOF?RC_OK:rc;
+	RC rc=classMap.dropTree(); return rc==RC_OK?rebuildIndices(ses):rc;
 }
 
 namespace AfyKernel
@@ -476,12 +711,13 @@ namespace AfyKernel
 			}
 		}
 		void			*operator new(size_t s,ulong nSegs,Session *ses) {return ses->malloc(s+int(nSegs-1)*sizeof(IndexSeg));}
-		ulong			getMode() const {return TF_SPLITINTX|TF_NOPOST;}
+		ulong			getMode() const {return TF_SPLITINTX|TF_NOPOST|TF_BULKLOAD;}
 		TreeFactory		*getFactory() const {return NULL;}
 		IndexFormat		indexFormat() const {return fmt;}
 		bool			lock(RW_LockType,bool fTry=false) const {return true;}
 		void			unlock() const {}
 		void			destroy() {}
+		RC				load(IMultiKey& mk) {return root==INVALID_PAGEID?ctx->trpgMgr->bulkLoad(*this,mk,root,height):insert(mk);}
 		friend	class	Classifier;
 	};
 	struct IndexValue
@@ -500,6 +736,7 @@ namespace AfyKernel
 	{
 		ClassDscr		*cd;
 		bool			fSkip;
+		bool			fSwap;
 		union {
 			struct {
 				size_t	lx,ldx;
@@ -551,7 +788,7 @@ RC Classifier::freeSpace(ClassCtx& cctx,size_t l,unsigned skip)
 		if (idx==~0u) return RC_NORESOURCES;
 		ClassIndexData& ci=cctx.cid[idx]; assert(ci.cd!=NULL);
 		if (ci.cd->cidx!=NULL) {
-			IndexMultiKey imk(cctx,ci); if ((rc=ci.cd->cidx->insert(imk))!=RC_OK) return rc;
+			IndexMultiKey imk(cctx,ci); if ((rc=ci.cd->cidx->load(imk))!=RC_OK) return rc;
 			ci.sa->release(); ci.liv=0; if ((ci.il=new(ci.sa) IndexList(*ci.sa,ci.ity))==NULL) return RC_NORESOURCES;
 		} else {
 			if (ci.buf!=NULL) {
@@ -669,15 +906,24 @@ RC Classifier::classifyAll(PIN *const *pins,unsigned nPINs,Session *ses,bool fDr
 		}
 	}
 
+	ClassCtx cctx={ses,cid,first,last,0,0,CLASS_BUF_LIMIT/StoreCtx::getNStores()};
+	if (rc==RC_OK) rc=buildIndices(cctx,nIndex,indexed,nIndexed,xSegs,fDrop);
+	if (indexed!=NULL) ses->free(indexed);
+
+	if (cds!=NULL) {if (rc==RC_OK) {*pcd=ses->tx.txClass; ses->tx.txClass=cds;} else classTx(ses,cds,false);}
+	return rc;
+}
+
+RC Classifier::buildIndices(ClassCtx& cctx,unsigned nIndex,Value *indexed,unsigned nIndexed,unsigned xSegs,bool fScan)
+{
+	Session *const ses=cctx.ses; ClassIndexData *const cid=cctx.cid; const unsigned first=cctx.first,last=cctx.last; RC rc=RC_OK;
 #ifdef REPORT_INDEX_CREATION_TIMES
 	TIMESTAMP st,mid,end; getTimestamp(st);
 #endif
 
-	ClassCtx cctx={ses,cid,first,last,0,0,CLASS_BUF_LIMIT/StoreCtx::getNStores()};
-
-	if (rc==RC_OK && nIndex>0) {
+	if (nIndex>0) {
 		MutexP lck(&lock); bool fTest=false; PINEx qr(ses),*pqr=&qr; QueryOp *qop=NULL; ses->resetAbortQ(); QCtx qc(ses);
-		if (nIndex==1 && cid[first].cd->query!=NULL && !fDrop) {
+		if (nIndex==1 && cid[first].cd->query!=NULL && !fScan) {
 			QBuildCtx qctx(ses,ValueV(NULL,0),cid[first].cd->query,0,(cid[first].cd->flags&CLASS_SDELETE)!=0?MODE_CLASS:MODE_CLASS|MODE_NODEL);
 			rc=qctx.process(qop);
 		} else {
@@ -773,7 +1019,6 @@ RC Classifier::classifyAll(PIN *const *pins,unsigned nPINs,Session *ses,bool fDr
 		while (freeAV!=NULL) {ArrayVal *av=freeAV; freeAV=av->prev; ses->free(av);}
 		qr.cleanup(); if (qop!=NULL) delete qop; if (rc==RC_EOF) rc=RC_OK;
 	}
-	if (indexed!=NULL) ses->free(indexed);
 #ifdef REPORT_INDEX_CREATION_TIMES
 	getTimestamp(mid);
 #endif
@@ -797,7 +1042,7 @@ RC Classifier::classifyAll(PIN *const *pins,unsigned nPINs,Session *ses,bool fDr
 			}
 		} else {
 			if (ci.il!=NULL) {
-				if (rc==RC_OK) {IndexMultiKey imk(cctx,ci); rc=ci.cd->cidx->insert(imk);}
+				if (rc==RC_OK) {IndexMultiKey imk(cctx,ci); rc=ci.cd->cidx->load(imk);}
 				else {
 					///
 				}
@@ -806,11 +1051,11 @@ RC Classifier::classifyAll(PIN *const *pins,unsigned nPINs,Session *ses,bool fDr
 		}
 	}
 
+	if (rc==RC_OK && nIndex>0 && (ctx->mode&STARTUP_NO_RECOVERY)!=0) ctx->bufMgr->writeDirty();		// nothing was logged, write new index pages now
+
 #ifdef REPORT_INDEX_CREATION_TIMES
 	getTimestamp(end); report(MSG_DEBUG,"Index creation time: "_LD_FM", "_LD_FM"\n",mid-st,end-mid);
 #endif
-
-	if (cds!=NULL) {if (rc==RC_OK) {*pcd=ses->tx.txClass; ses->tx.txClass=cds;} else classTx(ses,cds,false);}
 	return rc;
 }
 
@@ -836,7 +1081,7 @@ Class *Classifier::getClass(ClassID cid,RW_LockType lt)
 
 RC Classifier::classTx(Session *ses,ClassDscr *&cds,bool fCommit)
 {
-	RC rc=RC_OK;
+	RC rc=RC_OK; const bool fFlush=fCommit && cds!=NULL;
 	for (ClassDscr *cd=cds,*cd2; cd!=NULL; cd=cd2) {
 		if (fCommit && rc==RC_OK) {
 			Class *cls=NULL;
@@ -845,7 +1090,9 @@ RC Classifier::classTx(Session *ses,ClassDscr *&cds,bool fCommit)
 				else {
 					SearchKey key((uint64_t)cd->cid);
 					if ((cls->getFlags()&CLASS_VIEW)==0) {
-						if (cls->index!=NULL) rc=cls->index->drop();
+						if (cls->index!=NULL) {
+							if ((rc=cls->index->drop())==RC_OK && (rc=classStats.remove(key))==RC_NOTFOUND) rc=RC_OK;
+						}
 						else {
 							SearchKey dkey((uint64_t)(cd->cid|SDEL_FLAG));
 							if ((rc=classMap.remove(key,NULL,0))==RC_NOTFOUND) rc=RC_OK;
@@ -879,6 +1126,7 @@ RC Classifier::classTx(Session *ses,ClassDscr *&cds,bool fCommit)
 		if (cd->query!=NULL) ((Stmt*)cd->query)->destroy();
 		cd2=cd->next; ses->free(cd);
 	}
+	if (fFlush) ctx->queryMgr->getPlanCache().invalidate();		// cached statements may refer to changed classes or indices
 	cds=NULL; return rc;
 }
 
@@ -893,14 +1141,46 @@ void Classifier::merge(struct ClassDscr *from,struct ClassDscr *&to)
 	if (to==NULL) to=from; else for (ClassDscr *cd=to;;cd=cd->next) if (cd->next==NULL) {cd->next=from; break;}
 }
 
+RC TxIndex::add(ClassID cid,const SearchKey& key,const byte *ext,byte lext)
+{
+	TxIndexElt te,*pe; te.cid=cid; te.key.copy(key); memcpy(te.ext,ext,te.lext=lext);
+	if (key.type>=KT_BIN && key.type<KT_ALL) {te.key.v.ptr.p=key.getPtr2(); te.key.loc=SearchKey::PLC_SPTR;}
+	if (keys.add(te,&pe)!=SLO_INSERT) return RC_NORESOURCES;
+	return key.type<KT_BIN || key.type>=KT_ALL || (pe->key.v.ptr.p=keys.store(key.getPtr2(),key.v.ptr.l))!=NULL?RC_OK:RC_NORESOURCES;
+}
+
+namespace AfyKernel
+{
+	class TxIndexKeys : public IMultiKey {
+		TxIndexList&		keys;
+		const TxIndexElt	*te;
+		const ClassID		cid;
+	public:
+		TxIndexKeys(TxIndexList& ks,const TxIndexElt *t) : keys(ks),te(t),cid(t->cid) {}
+		RC	nextKey(const SearchKey *&nk,const void *&value,ushort& lValue,bool& fMulti) {
+			if (te==NULL || te->cid!=cid) return RC_EOF;
+			nk=&te->key; value=te->ext; lValue=te->lext; fMulti=false; te=keys.next(); return RC_OK;
+		}
+		void	skip() {while (te!=NULL && te->cid==cid) te=keys.next();}
+		const TxIndexElt *getNext() const {return te;}
+	};
+};
+
 RC TxIndex::flush()
 {
-	const TxIndexElt *te; start();
-	while ((te=next())!=NULL) {
-		// if ClassIndex -> process all keys
-		// else -> process all classes to the end
+	Classifier *cmgr=ses->getStore()->classMgr; RC rc=RC_OK; keys.start();
+	for (const TxIndexElt *te=keys.next(); rc==RC_OK && te!=NULL; ) {
+		TxIndexKeys tik(keys,te);
+		if (te->cid==STORE_INVALID_CLASSID) rc=cmgr->classMap.insert(tik);
+		else {
+			Class *cls=cmgr->getClass(te->cid); ClassIndex *cidx;
+			if (cls==NULL || (cidx=cls->getIndex())==NULL) {report(MSG_ERROR,"Family %d not found\n",te->cid); tik.skip();}
+			else if ((rc=cidx->insert(tik))!=RC_OK) report(MSG_ERROR,"Error %d updating index %d\n",rc,te->cid);
+			if (cls!=NULL) cls->release();
+		}
+		te=tik.getNext();
 	}
-	return RC_OK;
+	return rc;
 }
 
 #define	PHASE_INSERT	1
@@ -916,6 +1196,7 @@ RC Classifier::index(Session *ses,PINEx *pin,const ClassResult& clr,ClassIdxOp o
 	RC rc=RC_OK; const bool fMigrated=op==CI_UPDATE && pin->addr!=*oldAddr;
 	Class *cls=NULL; ClassIndex *cidx; byte ext[XPINREFSIZE],ext2[XPINREFSIZE];
 	PINRef pr(ctx->storeID,pin->id,pin->addr); byte lext=pr.enc(ext),lext2=0; const Value *psegs[10],**pps=psegs; ulong xSegs=10;
+	TxIndex *const txi=op==CI_INSERT||op==CI_INSERTD?ses->tx.txIndex:NULL;
 	struct SegInfo {PropertyID pid; const PropInfo *pi; SubSetV ssv; ModInfo *mi; Value v; const Value *cv; uint32_t flags,idx,prev; bool fLoaded;} keysegs[10],*pks=keysegs;
 	for (ulong i=0; rc==RC_OK && i<clr.nClasses; PINRef::changeFColl(ext,lext,false),i++) {
 		const ClassRef *cr=clr.classes[i];
@@ -924,8 +1205,8 @@ RC Classifier::index(Session *ses,PINEx *pin,const ClassResult& clr,ClassIdxOp o
 			switch (op) {
 			default: rc=RC_INVPARAM; break;
 			case CI_UDELETE: if ((cr->flags&CLASS_SDELETE)!=0 && (rc=classMap.remove(dkey,ext,lext))!=RC_OK) break;
-			case CI_INSERT: rc=classMap.insert(key,ext,lext); break;
-			case CI_INSERTD: if ((cr->flags&CLASS_SDELETE)!=0) rc=classMap.insert(dkey,ext,lext); break;
+			case CI_INSERT: rc=txi!=NULL?txi->add(STORE_INVALID_CLASSID,key,ext,lext):classMap.insert(key,ext,lext); break;
+			case CI_INSERTD: if ((cr->flags&CLASS_SDELETE)!=0) rc=txi!=NULL?txi->add(STORE_INVALID_CLASSID,dkey,ext,lext):classMap.insert(dkey,ext,lext); break;
 			case CI_UPDATE: if (fMigrated) {if (lext2==0) {pr.addr=*oldAddr; lext2=pr.enc(ext2);} rc=classMap.update(key,ext2,lext2,ext,lext);} break;	// check same?
 			case CI_SDELETE: if ((cr->flags&CLASS_SDELETE)!=0 && (rc=classMap.insert(dkey,ext,lext))!=RC_OK) break;
 			case CI_DELETE: rc=classMap.remove(key,ext,lext); break;
@@ -1020,12 +1301,13 @@ RC Classifier::index(Session *ses,PINEx *pin,const ClassResult& clr,ClassIdxOp o
 					} else {
 						switch (kop) {
 						default: assert(0);
-						case CI_INSERT: case CI_UDELETE: rc=cidx->insert(key,ext,lext); break;
+						case CI_INSERT: case CI_UDELETE: rc=txi!=NULL?txi->add(cr->cid,key,ext,lext):cidx->insert(key,ext,lext); break;
 						case CI_DELETE: case CI_SDELETE: rc=cidx->remove(key,ext,lext); break;
 						case CI_UPDATE: rc=cidx->update(key,ext2,lext2,ext,lext); break;
 						}
 						if (rc!=RC_OK) 
 							report(MSG_ERROR,"Error %d updating(%d) index %d\n",rc,op,cr->cid);		// break???
+						else if (kop!=CI_UPDATE) cidx->countKeys(ses,kop==CI_DELETE||kop==CI_SDELETE?-1:1);
 						key.free(ses);
 					}
 					fNext=false;
@@ -1099,6 +1381,149 @@ RC Classifier::createTree(const byte *params,byte lparams,Tree *&tree)
 	tree=cls->index; return RC_OK;
 }
 
+RC Classifier::analyze(Session *ses,const ClassID *cids,unsigned nClasses)
+{
+	if (ses==NULL) return RC_NOSESSION; RC rc=RC_OK; ClassID *all=NULL;
+	if (cids==NULL || nClasses==0) {if ((rc=getClassIDs(ses,all,nClasses))!=RC_OK) return rc; cids=all;}
+	for (unsigned i=0; rc==RC_OK && i<nClasses; i++) {
+		Class *cls=getClass(cids[i]);
+		if (cls==NULL) {if (all==NULL) rc=RC_NOTFOUND;}
+		else {if (cls->index!=NULL) rc=cls->index->analyze(ses); cls->release();}
+	}
+	if (all!=NULL) ses->free(all);
+	return rc;
+}
+
+RC Classifier::getClassIDs(Session *ses,ClassID *&cids,unsigned& nClasses)
+{
+	TreeScan *scan=classPINs.scan(ses,NULL); if (scan==NULL) return RC_NORESOURCES; unsigned xAll=0; RC rc; cids=NULL;
+	for (nClasses=0; (rc=scan->nextKey())==RC_OK; ) {
+		const SearchKey& key=scan->getKey(); if (key.type!=KT_UINT) continue;
+		if (nClasses>=xAll && (cids=(ClassID*)ses->realloc(cids,(xAll+=xAll==0?32:xAll)*sizeof(ClassID)))==NULL) {rc=RC_NORESOURCES; break;}
+		cids[nClasses++]=(ClassID)key.v.u;
+	}
+	scan->destroy(); if (rc==RC_EOF) return RC_OK;
+	if (cids!=NULL) {ses->free(cids); cids=NULL;}
+	return rc;
+}
+
+RC Classifier::rebuildIndices(Session *ses,const ClassID *cids,unsigned nClasses)
+{
+	if (ses==NULL) return RC_NOSESSION; assert(fInit);
+	PageID *olds=NULL; unsigned nOlds=0; RC rc=replaceIndices(ses,cids,nClasses,olds,nOlds);
+	if (rc==RC_OK && nOlds!=0) {
+		// replaced trees are dropped only after the new roots are committed
+		TxSP tx(ses);
+		if ((rc=tx.start())==RC_OK) {
+			for (unsigned i=0; i<nOlds; i++) {RC rc2=Tree::drop(olds[i],ctx); if (rc2!=RC_OK) report(MSG_ERROR,"Failed to drop replaced index tree %08X (%d)\n",olds[i],rc2);}
+			tx.ok();
+		}
+	}
+	if (olds!=NULL) ses->free(olds);
+	return rc;
+}
+
+RC Classifier::replaceIndices(Session *ses,const ClassID *cids,unsigned nClasses,PageID *&olds,unsigned& nOlds)
+{
+	RC rc=RC_OK; ClassID *all=NULL; const bool fAll=cids==NULL||nClasses==0;
+	if (fAll) {if ((rc=getClassIDs(ses,all,nClasses))!=RC_OK) return rc; cids=all;}
+	TxSP tx(ses); ClassIndexData *cid=NULL; ClassDscr *cds=NULL,**pcd=&cds; Value *indexed=NULL;
+	unsigned nIndexed=0,xIndexed=0,xSegs=0,first=~0u,last=0,nIndex=0;
+	if (nClasses!=0 && (rc=tx.start())==RC_OK) {
+		// class X lock keeps commitPINs() of other sessions out of the old trees until the new roots are committed
+		if (ses->classLocked!=RW_NO_LOCK && ses->classLocked!=RW_X_LOCK) rc=RC_DEADLOCK;
+		else {
+			ses->lockClass(RW_X_LOCK);
+			if ((cid=new(ses) ClassIndexData[nClasses])!=NULL) memset(cid,0,nClasses*sizeof(ClassIndexData)); else rc=RC_NORESOURCES;
+		}
+	}
+	for (unsigned i=0; rc==RC_OK && i<nClasses; i++) {
+		ClassIndexData &ci=cid[i]; ci.fSkip=true; Class *cls=getClass(cids[i]);
+		if (cls==NULL) {if (!fAll) rc=RC_NOTFOUND; continue;}
+		const Stmt *qry=cls->getQuery(); const ClassIndex *cidx=cls->getIndex(); const unsigned flags=cls->getFlags();
+		if ((flags&CLASS_VIEW)==0 && (cidx!=NULL || (flags&CLASS_INDEXED)!=0) && qry!=NULL && qry->top!=NULL && qry->top->type==QRY_SIMPLE) {
+			if ((ci.cd=new(ses) ClassDscr(cls->getID(),0,flags))==NULL || (ci.cd->query=qry->clone(STMT_QUERY,ses,true))==NULL) rc=RC_NORESOURCES;
+			else if (cidx==NULL) {
+				// class membership is rebuilt from scratch
+				SearchKey key((uint64_t)ci.cd->cid); SearchKey dkey((uint64_t)(ci.cd->cid|SDEL_FLAG));
+				if ((rc=classMap.remove(key,NULL,0))==RC_NOTFOUND) rc=RC_OK;
+				if (rc==RC_OK && (flags&CLASS_SDELETE)!=0 && (rc=classMap.remove(dkey,NULL,0))==RC_NOTFOUND) rc=RC_OK;
+			} else if ((ci.cd->cidx=new(cidx->nSegs,ses) IndexInit(ses,((SimpleVar*)qry->top)->condIdx,cidx->nSegs))==NULL) rc=RC_NORESOURCES;
+			else {
+				// family index is built in a new tree which replaces the old one
+				ci.cd->nIndexProps=(ushort)cidx->nSegs; ci.cd->cidx->fmt=cidx->fmt; ci.ity=cidx->fmt.keyType(); ci.sa=NULL; ci.il=NULL; ci.liv=0;
+				if (cidx->nSegs>xSegs) xSegs=cidx->nSegs;
+				for (unsigned k=0; rc==RC_OK && k<cidx->nSegs; k++) {
+					Value v; v.setPropID(cidx->indexSegs[k].propID);
+					rc=BIN<Value,PropertyID,ValCmp>::insert(indexed,nIndexed,v.property,v,ses,&xIndexed);
+				}
+			}
+			if (ci.cd!=NULL) {*pcd=ci.cd; pcd=&ci.cd->next;}
+			if (rc==RC_OK) {ci.fSkip=false; nIndex++; last=i; if (first==~0u) first=i;}
+		}
+		cls->release();
+	}
+
+	ClassCtx cctx={ses,cid,first,last,0,0,CLASS_BUF_LIMIT/StoreCtx::getNStores()};
+	if (rc==RC_OK) {BufStrategy bulk(BAS_BULK); BufStrategyP bsp(ses,&bulk); rc=buildIndices(cctx,nIndex,indexed,nIndexed,xSegs,true);}
+	if (indexed!=NULL) ses->free(indexed);
+	if (rc==RC_OK && nIndex!=0 && (olds=(PageID*)ses->malloc(nIndex*sizeof(PageID)))==NULL) rc=RC_NORESOURCES;
+
+	for (unsigned i=first; rc==RC_OK && nIndex!=0 && i<=last; i++) {
+		ClassIndexData &ci=cid[i]; if (ci.fSkip || ci.cd->cidx==NULL) continue;
+		Class *cls=getClass(ci.cd->cid,RW_X_LOCK); ClassIndex *cidx;
+		if (cls==NULL || (cidx=cls->index)==NULL) rc=RC_NOTFOUND;
+		else {
+			RWLockP rw(&cidx->rootLock,RW_X_LOCK); PageID old=cidx->root; ulong height=cidx->height; PageID anchor=cidx->anchor;
+			cidx->root=ci.cd->cidx->root; cidx->height=ci.cd->cidx->height; cidx->anchor=ci.cd->cidx->anchor;
+			for (int k=0; k<TREE_NODETYPE_ALL; k++) cidx->advanceStamp((TREE_NODETYPE)k);
+			if ((rc=cls->update())!=RC_OK) {cidx->root=old; cidx->height=height; cidx->anchor=anchor;}
+			else {
+				// the old tree stays intact until commit, the new one is dropped by rollback
+				ci.cd->cidx->root=old; ci.cd->cidx->height=height; ci.cd->cidx->anchor=anchor; ci.fSwap=true;
+				if (old!=INVALID_PAGEID) olds[nOlds++]=old;
+			}
+		}
+		if (cls!=NULL) cls->release();
+	}
+	if (rc!=RC_OK) for (unsigned i=first; nIndex!=0 && i<=last; i++) {
+		ClassIndexData &ci=cid[i]; if (ci.fSkip || !ci.fSwap) continue;
+		Class *cls=getClass(ci.cd->cid,RW_X_LOCK); ClassIndex *cidx;
+		if (cls!=NULL) {
+			if ((cidx=cls->index)!=NULL) {
+				RWLockP rw(&cidx->rootLock,RW_X_LOCK);
+				cidx->root=ci.cd->cidx->root; cidx->height=ci.cd->cidx->height; cidx->anchor=ci.cd->cidx->anchor;
+				for (int k=0; k<TREE_NODETYPE_ALL; k++) cidx->advanceStamp((TREE_NODETYPE)k);
+			}
+			cls->release();
+		}
+	}
+	if (rc!=RC_OK) nOlds=0;
+	if (cds!=NULL) classTx(ses,cds,false);
+	if (cid!=NULL) ses->free(cid);
+	if (all!=NULL) ses->free(all);
+	if (rc==RC_OK) tx.ok();
+	return rc;
+}
+
+RC Classifier::loadStats(ClassID cid,IndexStats *&st)
+{
+	SearchKey key((uint64_t)cid); size_t l=0; st=NULL;
+	if (!classStats.find(key,NULL,l)) return RC_OK;
+	if (l<sizeof(IndexStats)) return RC_CORRUPTED;
+	if ((st=(IndexStats*)ctx->malloc(l))==NULL) return RC_NORESOURCES;
+	if (!classStats.find(key,st,l) || st->length()!=l) {ctx->free(st); st=NULL; return RC_CORRUPTED;}
+	return RC_OK;
+}
+
+RC Classifier::saveStats(Session *ses,ClassID cid,const IndexStats *st)
+{
+	if (ses==NULL) return RC_NOSESSION;
+	SearchKey key((uint64_t)cid); MiniTx tx(ses,0); const ushort l=(ushort)st->length();
+	RC rc=classStats.update(key,NULL,0,st,l); if (rc==RC_NOTFOUND) rc=classStats.insert(key,st,l);
+	if (rc==RC_OK) tx.ok(); return rc;
+}
+
 RC Classifier::getClassInfo(ClassID cid,Class *&cls,uint64_t& nPINs,uint64_t& nDeletedPINs)
 {
 	nPINs=~0u; nDeletedPINs=0; RC rc=RC_OK;
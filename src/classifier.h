@@ -48,6 +48,10 @@ namespace AfyKernel
 #define	DEFAULT_CLASS_HASH_SIZE		0x100
 #define	DEFAULT_CLASS_CACHE_SIZE	0x400
 
+#define	CLASS_STATS_BUCKETS	32						/**< number of histogram buckets collected by Classifier::analyze() */
+#define	CLASS_STATS_SAVE	16						/**< statistics are re-saved after nRows/CLASS_STATS_SAVE index updates */
+#define	CLASS_STATS_DRIFT	4						/**< histogram is rebuilt after CLASS_STATS_DRIFT*nRows/CLASS_STATS_SAVE index updates or when nRows drifts by nAnalyzed/CLASS_STATS_DRIFT */
+
 enum ClassIdxOp {CI_INSERT, CI_UPDATE, CI_DELETE, CI_SDELETE, CI_UDELETE, CI_PURGE, CI_INSERTD};
 
 /**
@@ -97,6 +101,26 @@ public:
 	static	void		signal(void *mg) {}
 };
 
+/**
+ * family index statistics (persistent, see ClassIndex::analyze())
+ * followed by NDV counters for each key prefix and by serialized equi-depth histogram bounds
+ */
+struct IndexStats
+{
+	uint64_t		nRows;					/**< current number of index entries, adjusted on index updates */
+	uint64_t		nAnalyzed;				/**< number of index entries when the histogram was built */
+	uint64_t		nPages;					/**< estimated number of leaf pages */
+	uint64_t		depth;					/**< number of index entries per histogram bucket */
+	uint32_t		nSegs;					/**< number of key segments (NDV counters) */
+	uint32_t		nBounds;				/**< number of histogram bounds */
+	uint32_t		lBounds;				/**< total length of serialized bounds */
+	uint32_t		nRefresh;				/**< number of incremental updates saved since the histogram was built */
+	uint64_t		*getNDV() const {return (uint64_t*)(this+1);}
+	const	byte	*getBounds() const {return (const byte*)(getNDV()+nSegs);}
+	size_t			length() const {return sizeof(IndexStats)+nSegs*sizeof(uint64_t)+lBounds;}
+	double			estimate(const SearchKey *start,const SearchKey *finish,bool fExact) const;
+};
+
 /**
  * index descriptor (associated with class family)
  */
@@ -108,11 +132,20 @@ class ClassIndex : public TreeStdRoot
 	mutable RWLock	rwlock;
 	mutable	RWLock	rootLock;
 	ulong			state;
+	Mutex			statsLock;
+	IndexStats		*stats;
+	volatile bool	fStatsLoaded;
+	volatile long	nDelta;					/**< change of the number of entries not yet applied to stats */
+	volatile long	nUpdates;				/**< index updates since the statistics were last saved */
+	volatile long	nSave;					/**< number of updates which triggers saving, 0 if there are no statistics */
+	volatile long	fRefresh;				/**< refresh request is posted */
 	const ulong		nSegs;
 	IndexSeg		indexSegs[1];
+	IndexStats		*getStats();
+	void			setStats(IndexStats *st);
 public:
 	ClassIndex(Class& cl,ulong nS,PageID rt,PageID anc,IndexFormat fm,uint32_t h,StoreCtx *ct)
-				: TreeStdRoot(rt,ct),cls(cl),fmt(fm),anchor(anc),state(0),nSegs(nS) {height=h;}
+				: TreeStdRoot(rt,ct),cls(cl),fmt(fm),anchor(anc),state(0),stats(NULL),fStatsLoaded(false),nDelta(0),nUpdates(0),nSave(0),fRefresh(0),nSegs(nS) {height=h;}
 	virtual			~ClassIndex();
 	void			*operator new(size_t s,ulong nSegs,MemAlloc *ma) {return ma->malloc(s+int(nSegs-1)*sizeof(IndexSeg));}
 	operator		Class&() const {return cls;}
@@ -120,7 +153,14 @@ public:
 
 	ulong			getNSegs() const {return nSegs;}
 	const IndexSeg *getIndexSegs() const {return indexSegs;}
+	ulong			getNLevels() const {return root!=INVALID_PAGEID?height+1:0;}
 	void			release() {cls.release();}
+	RC				analyze(Session *ses);
+	bool			estimate(const SearchKey *keys,ulong nRanges,bool fExact,double& nRows);
+	RC				getStatistics(IndexStatistics& ist,uint64_t *ndv,unsigned nSegs);
+	void			countKeys(Session *ses,long delta);
+	RC				refreshStats(Session *ses);
+	bool			isCovering() const;
 
 	TreeFactory		*getFactory() const;
 	IndexFormat		indexFormat() const;
@@ -272,35 +312,41 @@ private:
 	};
 };
 
+/**
+ * PIN reference inserted into an index
+ */
 struct TxIndexElt
 {
-	uint32_t	id;
+	ClassID		cid;			/**< family ID, STORE_INVALID_CLASSID for class membership keys */
 	SearchKey	key;
-	byte		*ins;
-	size_t		lIns;
-	byte		*del;
-	size_t		lDel;
-	byte		*upd;
-	size_t		lUpd;
-
-	static	SListOp	compare(const TxIndexElt &e1,const TxIndexElt &e2) {
-		int cmp=cmp3(e1.id,e2.id);
-		if (cmp==0) {
-			//...
-		}
-		return cmp<0?SLO_LT:SLO_GT;
+	byte		lext;
+	byte		ext[XPINREFSIZE];
+
+	static	SListOp	compare(const TxIndexElt &e1,const TxIndexElt &e2,ulong) {
+		int cmp=cmp3(e1.cid,e2.cid);
+		if (cmp==0 && (cmp=cmp3(e1.key.type,e2.key.type))==0 && (cmp=e1.key.v.cmp(e2.key.v,e1.key.type))==0)
+			cmp=PINRef::cmpPIDs(e1.ext,e1.lext,e2.ext,e2.lext);
+		return cmp<0?SLO_LT:SLO_GT;		// duplicates (e.g. repeated collection elements) are kept
 	}
 };
 
+typedef	SList<TxIndexElt,TxIndexElt> TxIndexList;
+
 /**
- * transaction cache of index operations
+ * cache of index insertions made by one commitPINs() call
+ * flush() passes the sorted keys of each tree through Tree::insert(IMultiKey&),
+ * so consecutive keys falling on the same leaf don't descend the tree again
  */
-class TxIndex : public SList<TxIndexElt,TxIndexElt>
+class TxIndex : public SubAlloc
 {
-	Session	*const	ses;
+	Session		*const	ses;
+	TxIndexList			keys;
 public:
-	TxIndex(Session *s) : SList<TxIndexElt,TxIndexElt>(*(MemAlloc*)s),ses(s) {}
-	RC	flush();
+	TxIndex(Session *s) : SubAlloc(s),ses(s),keys(*this) {}
+	virtual	~TxIndex() {}
+	void	operator delete(void *p) {if (p!=NULL) ((TxIndex*)p)->parent->free(p);}
+	RC		add(ClassID cid,const SearchKey& key,const byte *ext,byte lext);
+	RC		flush();
 };
 
 /**
@@ -348,6 +394,7 @@ class Classifier : public ClassHash, public TreeFactory, public TreeConnect
 	friend	class		ClassPropIndex;
 	friend	class		IndexInit;
 	friend	class		ClassDelTx;
+	friend	class		TxIndex;
 	StoreCtx			*const ctx;
 	RWLock				rwlock;
 	Mutex				lock;
@@ -355,6 +402,7 @@ class Classifier : public ClassHash, public TreeFactory, public TreeConnect
 	ClassPropIndex		classIndex;
 	TreeGlobalRoot		classMap;
 	TreeGlobalRoot		classPINs;
+	TreeGlobalRoot		classStats;
 	SharedCounter		nCached;
 	int					xCached;
 	volatile long		xPropID;
@@ -372,8 +420,10 @@ public:
 	RC					index(Session *ses,PINEx *pin,const ClassResult& clr,ClassIdxOp op,const struct PropInfo **ppi=NULL,unsigned npi=0,const PageAddr *old=NULL);
 	RC					initClasses(Session *ses);
 	RC					rebuildAll(Session *ses);
+	RC					rebuildIndices(Session *ses,const ClassID *cids=NULL,unsigned nClasses=0);
 	RC					classifyAll(PIN *const *pins,unsigned nPins,Session *ses,bool fDrop=false);
 	RC					dropClass(Class *cls,Session *ses);
+	RC					analyze(Session *ses,const ClassID *cids=NULL,unsigned nClasses=0);
 	void				findBase(class SimpleVar *qv);
 	TreeGlobalRoot&		getClassMap() {return classMap;}
 	TreeGlobalRoot&		getClassPINs() {return classPINs;}
@@ -396,6 +446,11 @@ private:
 	RC					indexFormat(ulong vt,IndexFormat& fmt) const;
 	RC					insertRef(struct ClassCtx& cctx,ushort **ppb,size_t *ps,const byte *extb,ushort lext,struct IndexValue *iv=NULL);
 	RC					freeSpace(ClassCtx& cctx,size_t l,unsigned skip=~0u);
+	RC					buildIndices(ClassCtx& cctx,unsigned nIndex,Value *indexed,unsigned nIndexed,unsigned xSegs,bool fScan);
+	RC					replaceIndices(Session *ses,const ClassID *cids,unsigned nClasses,PageID *&olds,unsigned& nOlds);
+	RC					getClassIDs(Session *ses,ClassID *&cids,unsigned& nClasses);
+	RC					loadStats(ClassID cid,IndexStats *&st);
+	RC					saveStats(Session *ses,ClassID cid,const IndexStats *st);
 	Tree				*connect(uint32_t handle);
 };
 
@@ -399,7 +399,8 @@ RC QueryPrc::commitPINs(Session *ses,PIN *const *pins,unsigned nPins,unsigned mo
 finish:
 	if (!pb.isNull()) {if (rc==RC_OK) {if (fForced) ses->forcedPage=pb->getPageID(); else ctx->heapMgr->reuse(pb,ses,reserve);} pb.release(ses);}
 
-	ClassResult clr(ses,ses->getStore());
+	ClassResult clr(ses,ses->getStore()); TxIndex *txi=NULL;
+	if (rc==RC_OK && nPins>1 && ses->tx.txIndex==NULL && ctx->queryMgr->notification==NULL && (txi=new(ses) TxIndex(ses))!=NULL) ses->tx.txIndex=txi;	// index insertions are batched
 	for (i=0; i<nPins; i++) if ((pin=pins[i])!=NULL) {
 		bool fProc = rc==RC_OK && (pin->mode&COMMIT_ALLOCATED)!=0; mem.mark(mrk);
 		if ((pin->mode&COMMIT_PREFIX)!=0) for (j=0; j<pin->nProperties; j++) {
@@ -497,6 +498,7 @@ finish:
 		pin->mode&=~COMMIT_MASK; pin->stamp=0; clr.nClasses=clr.nIndices=clr.notif=0;
 		mem.truncate(mrk); if (rc!=RC_OK) pin->addr=PageAddr::invAddr;
 	}
+	if (txi!=NULL) {ses->tx.txIndex=NULL; if (rc==RC_OK) rc=txi->flush(); delete txi;}
 	if (rc==RC_OK && classPINs!=NULL && nClassPINs>0) rc=ctx->classMgr->classifyAll(classPINs,nClassPINs,ses);
 	if (rc==RC_OK) {tx.ok(); ses->nTotalIns+=nInserted; ses->tx.nInserted+=nInserted;}
 	return rc;
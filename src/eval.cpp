@@ -20,6 +20,7 @@ Written by Mark Venguerov 2004-2012
 
 #include "expr.h"
 #include "queryprc.h"
+#include "queryop.h"
 #include "stmt.h"
 #include "ftindex.h"
 #include "parser.h"
@@ -34,6 +35,33 @@ const byte Expr::compareCodeTab[] = {2,5,1,3,4,6};
 
 static const byte cndAct[8][2] = {{0,1},{1,0},{0,2},{2,0},{2,1},{1,2},{2,3},{3,2}};
 
+/**
+ * threaded dispatch of frequent p-code operations (GCC computed goto)
+ * other operations are dispatched through the switch in Expr::eval()
+ */
+#if defined(__GNUC__) && !defined(NO_THREADED_CODE)
+#define	EXPR_THREADED
+#define	DISP(i)		((i)==OP_CON?&&l_con:(i)==OP_PARAM?&&l_param:(i)==OP_PROP||(i)==OP_ELT||(i)==OP_SETPROP?&&l_prop:	\
+					(i)==OP_PROPCMP||(i)==OP_PROPRNG?&&l_super:(i)==OP_JUMP?&&l_jump:(i)==OP_CATCH?&&l_catch:(i)==OP_IN1?&&l_in1:	\
+					(i)>=OP_EQ&&(i)<=OP_GE||(i)==OP_CONTAINS||(i)==OP_BEGINS||(i)==OP_ENDS||(i)==OP_REGEX||(i)==OP_IN?&&l_cmp:&&l_switch)
+#define	DISP4(i)	DISP(i),DISP(i+1),DISP(i+2),DISP(i+3)
+#define	DISP16(i)	DISP4(i),DISP4(i+4),DISP4(i+8),DISP4(i+12)
+#define	NEXT_OP		if (codePtr<codeEnd) {op=*codePtr++; ff=(op&0x80)!=0; goto *dispatch[op&=0x7F];} break
+#else
+#define	NEXT_OP		break
+#endif
+
+static inline int cmpIntCon(const Value& v,const byte *pc)
+{
+	int64_t c; memcpy(&c,pc,sizeof(int64_t));
+	switch (v.type) {
+	case VT_INT: return cmp3(v.i,int32_t(c));
+	case VT_UINT: return cmp3(v.ui,uint32_t(c));
+	case VT_INT64: case VT_INTERVAL: return cmp3(v.i64,c);
+	default: return cmp3(v.ui64,uint64_t(c));
+	}
+}
+
 RC Expr::execute(Value& res,const Value *params,unsigned nParams) const
 {
 	try {
@@ -64,6 +92,72 @@ bool Expr::condSatisfied(const Expr *const *exprs,ulong nExp,PINEx **vars,unsign
 	return false;
 }
 
+bool Expr::getBatchCmp(BatchCmp& bc) const
+{
+	// the whole expression must be one superinstruction on a property of variable 0 with no jumps and no boolean value
+	if ((hdr.flags&EXPR_PRELOAD)!=0) return false;
+	const byte *cp=(const byte*)(&hdr+1)+hdr.lProps,*const end=(const byte*)&hdr+hdr.lExpr; const byte op=*cp++&0x7F;
+	if (op!=OP_PROPCMP && op!=OP_PROPRNG) return false;
+	const byte *pc=cp+(op==OP_PROPCMP?PROPCMP_HDR:PROPRNG_HDR),*pe=pc+cp[1]; if (pc[0]!=OP_PROP || (pc[1]>>6)!=0 || pe+2>end) return false;
+	uint32_t u=pe[1]; pe+=2; if ((u&CND_EXT)!=0) u|=*pe++<<8;
+	if ((u&CND_MASK)>1 || (u&CND_VBOOL)!=0 || pe!=end) return false;
+	const VarHdr *vh=(VarHdr*)(&hdr+1),*vend=(VarHdr*)((byte*)vh+hdr.lProps);
+	while (vh<vend && vh->var!=0) vh=(VarHdr*)((byte*)(vh+1)+vh->nProps*sizeof(uint32_t));
+	if (vh>=vend || (pc[1]&0x3F)>=vh->nProps) return false;
+	bc.pid=((PropertyID*)(vh+1))[pc[1]&0x3F]&STORE_MAX_URIID; bc.type=cp[0]; bc.con=cp+2;
+	bc.fRange=op==OP_PROPRNG; bc.fInv=(u&CND_MASK)==1; bc.flags=op==OP_PROPRNG?u:compareCodeTab[(pc[cp[1]]&0x7F)-OP_EQ];
+	return true;
+}
+
+__forceinline bool Expr::BatchCmp::test(const Value& v) const
+{
+	// same result as OP_PROPCMP/OP_PROPRNG followed by bool_op in eval()
+	int c; bool f;
+	if (!fRange) f=(flags&1<<(cmpIntCon(v,con)+1))!=0;
+	else f=!((c=cmpIntCon(v,con))<0 || c==0 && (flags&CND_IN_LBND)!=0 || (c=cmpIntCon(v,con+sizeof(int64_t)))>0 || c==0 && (flags&CND_IN_RBND)!=0);
+	return f!=fInv;
+}
+
+unsigned Expr::condBatch(const Expr *const *exprs,ulong nExp,const QBatch& qb,unsigned *sel,const ValueV *pars,unsigned nPars,MemAlloc *ma)
+{
+	// simple integer comparisons are evaluated column by column over the selection, other conditions and rows where
+	// the projected value doesn't have the type of the constant are evaluated row by row
+	Session *const ses=Session::getSession(); PINEx var(ses),full(ses),*pv; unsigned nSel=0,nCand=0,cand[QB_ROWS];
+	const Expr **rest=(const Expr**)alloca(nExp*sizeof(Expr*)); ulong nRest=0; bool fGen[QB_ROWS]; BatchCmp bc;
+	for (unsigned i=0; i<qb.nRows; i++) {cand[i]=i; fGen[i]=false;} nCand=qb.nRows;
+	for (ulong k=0; k<nExp; k++) {
+		if (!exprs[k]->getBatchCmp(bc)) {rest[nRest++]=exprs[k]; continue;}
+		unsigned col=0; while (col<qb.nProps && qb.props[col]<bc.pid) col++;
+		if (col>=qb.nProps || qb.props[col]!=bc.pid) {rest[nRest++]=exprs[k]; continue;}
+		unsigned n=0;
+		for (unsigned j=0; j<nCand; j++) {
+			const unsigned i=cand[j]; const Value *row=qb.getRow(i),*v=NULL;
+			if (fGen[i]) {cand[n++]=i; continue;}
+			if (qb.nVals[i]==qb.nProps) v=&row[col]; else for (unsigned m=0; m<qb.nVals[i]; m++) if (row[m].property==bc.pid) {v=&row[m]; break;}
+			if (v==NULL || v->type!=bc.type) {fGen[i]=true; cand[n++]=i;} else if (bc.test(*v)) cand[n++]=i;
+		}
+		nCand=n;
+	}
+	for (unsigned j=0; j<nCand; j++) {
+		const unsigned i=cand[j]; const Expr *const *ex=exprs; ulong ne=nExp;
+		if (!fGen[i]) {if (nRest==0) {sel[nSel++]=i; continue;} ex=rest; ne=nRest;}
+		const Value *row=qb.getRow(i); qb.get(i,var); pv=&var;
+		for (unsigned m=0; m<qb.nVals[i]; m++) if (row[m].type==VT_EXPR) {									// may refer to properties which are not projected
+			full.cleanup(); memcpy(&full.epr,&qb.refs[i],qb.refs[i].trunc<8>()); full.epr.flags&=~PINEX_ADDRSET;
+			pv=full.load(LOAD_SSV)==RC_OK?&full:(PINEx*)0; break;
+		}
+		if (pv!=NULL) try {
+			Value res;
+			switch (eval(ex,ne,res,&pv,1,pars,nPars,ma)) {
+			case RC_TRUE: sel[nSel++]=i; break;
+			case RC_OK: if (res.type==VT_BOOL && res.b) sel[nSel++]=i; freeV(res); break;
+			default: break;
+			}
+		} catch (...) {}
+	}
+	return nSel;
+}
+
 RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulong nVars,const ValueV *params,ulong nParams,MemAlloc *ma,bool fIgnore)
 {
 	if (nExp==1 && (exprs[0]->hdr.flags&EXPR_EXTN)!=0) {
@@ -74,6 +168,9 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 	}
 	ulong idx=0; const Expr *exp; assert(exprs!=NULL && nExp>0 && exprs[0]!=NULL); Session *ses=NULL;
 	const byte *codePtr=NULL,*codeEnd=NULL; ulong cntCatch=0,lStack=0; Value *stack=NULL,*top=NULL; VarD vds[4],*evds=NULL;
+#ifdef EXPR_THREADED
+	static const void *const dispatch[0x80] = {DISP16(0),DISP16(0x10),DISP16(0x20),DISP16(0x30),DISP16(0x40),DISP16(0x50),DISP16(0x60),DISP16(0x70)};
+#endif
 	for (;;) {
 		if (codePtr>=codeEnd) {
 			if (codePtr>codeEnd || top!=stack && top!=stack+1) return RC_INTERNAL;
@@ -96,14 +193,20 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 			}
 		}
 		assert(top>=stack && top<=stack+exp->hdr.lStack);
-		TIMESTAMP ts; const Value *v; RC rc=RC_OK; VarD *vd; ElementID eid;
-		byte op=*codePtr++; const bool ff=(op&0x80)!=0; int nops; unsigned fop; uint32_t u,vdx;
+		TIMESTAMP ts; const Value *v; RC rc=RC_OK; VarD *vd; ElementID eid; const byte *pc;
+		byte op=*codePtr++; bool ff=(op&0x80)!=0; int nops,c; unsigned fop; uint32_t u,vdx;
+#ifdef EXPR_THREADED
+	l_switch:
+#endif
 		switch (op&=0x7F) {
 		case OP_CON:
+#ifdef EXPR_THREADED
+		l_con:
+#endif
 			assert(top<stack+exp->hdr.lStack); top->flags=0;
 			if ((rc=AfyKernel::deserialize(*top,codePtr,codeEnd,ma,true))!=RC_OK) break;
 			assert(top->type!=VT_VARREF && top->type!=VT_CURRENT);
-			top++; break;
+			top++; NEXT_OP;
 		case OP_CONID:
 			if ((u=*codePtr++)==0xFF) {u=codePtr[0]|codePtr[1]<<8; codePtr+=2;}
 			if (!ff && vds[0].fInit) u=vds[0].props[u];
@@ -115,6 +218,9 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 			if (ff) top->setIdentity(u); else top->setURIID(u&STORE_MAX_URIID);
 			top++; break;
 		case OP_PARAM:
+#ifdef EXPR_THREADED
+		l_param:
+#endif
 			if ((u=*codePtr++)!=0xFF) vdx=u>>6,u&=0x3F; else {vdx=codePtr[0]; u=codePtr[1]; codePtr+=2;}
 			if (vdx>=nParams || u>=params[vdx].nValues) rc=RC_NOTFOUND;
 			else {
@@ -125,12 +231,15 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 			}
 			if (ff) top->set(unsigned(rc!=RC_OK?(rc=RC_OK,0u):v->type==VT_ARRAY?v->length:v->type==VT_COLLECTION?v->nav->count():1u)); 
 			else if (rc==RC_OK) {*top=*v; top->flags=NO_HEAP;} else {top->setError(); if (cntCatch!=0) rc=RC_OK;}
-			top++; break;
+			top++; if (rc!=RC_OK) break; NEXT_OP;
 		case OP_VAR:
 			if ((u=*codePtr++)<nVars && vars[u]->load()==RC_OK) {if (ff) top->set(1u); else top->set((PIN*)vars[u]);}
 			else if (ff) top->set(0u); else {top->setError(); if (cntCatch==0) rc=RC_NOTFOUND;}
 			top++; break;
 		case OP_PROP: case OP_ELT: case OP_SETPROP:
+#ifdef EXPR_THREADED
+		l_prop:
+#endif
 			if ((u=*codePtr++)!=0xff) vd=&vds[vdx=u>>6],u&=0x3f;
 			else {
 				if ((vdx=codePtr[0])>=nVars) {/*...*/}
@@ -173,7 +282,29 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 				if ((rc=Expr::eval(&expr,1,*top,vars,nVars,params,nParams,ma))==RC_OK) {if (fFree) ma->free(expr);}
 				else if (cntCatch!=0) {top->setError(); rc=RC_OK;}
 			}
-			top++; break;
+			top++; if (rc!=RC_OK) break; NEXT_OP;
+		case OP_PROPCMP: case OP_PROPRNG:
+#ifdef EXPR_THREADED
+		l_super:
+#endif
+			// property of the same integer type as the constant is compared inline, otherwise the generic code is executed
+			pc=codePtr+(op==OP_PROPCMP?PROPCMP_HDR:PROPRNG_HDR); u=pc[1]; vd=&vds[vdx=u>>6]; u&=0x3F;
+			if (vdx>=nVars || (exp->hdr.flags&EXPR_PRELOAD)!=0) {codePtr=pc; NEXT_OP;}
+			if (!vd->fInit) {
+				const VarHdr *vh=(VarHdr*)(&exp->hdr+1),*vend=(VarHdr*)((byte*)vh+exp->hdr.lProps);
+				while (vh<vend && vh->var!=vdx) vh=(VarHdr*)((byte*)(vh+1)+vh->nProps*sizeof(uint32_t));
+				vd->props=(PropertyID*)(vh+1); vd->fInit=true; vd->fLoaded=false;
+			}
+			if ((rc=vars[vdx]->getValue(vd->props[u],*top,LOAD_SSV,NULL,STORE_COLLECTION_ID))!=RC_OK) {
+				if (cntCatch==0 || rc!=RC_NOTFOUND) break; top->setError(); rc=RC_OK;
+			} else if (top->type==codePtr[0]) {
+				const byte *pk=codePtr+2; codePtr=pc+codePtr[1]; const byte cop=*codePtr++&0x7F;
+				if (((u=*codePtr++)&CND_EXT)!=0) u|=*codePtr++<<8;
+				if (op==OP_PROPCMP) rc=(compareCodeTab[cop-OP_EQ]&1<<(cmpIntCon(*top,pk)+1))!=0?RC_TRUE:RC_FALSE;
+				else rc=(c=cmpIntCon(*top,pk))<0 || c==0 && (u&CND_IN_LBND)!=0 || (c=cmpIntCon(*top,pk+sizeof(int64_t)))>0 || c==0 && (u&CND_IN_RBND)!=0?RC_FALSE:RC_TRUE;
+				goto bool_op;
+			} else if (top->type==VT_EXPR) {freeV(*top); codePtr=pc; NEXT_OP;}
+			codePtr=pc+2; top++; NEXT_OP;
 		case OP_PATH:
 			if ((rc=exp->path(top,codePtr,params[0],ma))!=RC_OK && rc!=RC_CORRUPTED && rc!=RC_NORESOURCES && cntCatch!=0)
 				{(top++)->setError(); rc=RC_OK;}
@@ -187,13 +318,22 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 			}
 			top++; break;
 		case OP_CATCH:
-			if (ff) cntCatch++; else {assert(cntCatch>0); cntCatch--;} break;
+#ifdef EXPR_THREADED
+		l_catch:
+#endif
+			if (ff) cntCatch++; else {assert(cntCatch>0); cntCatch--;} NEXT_OP;
 		case OP_JUMP:
-			u=codePtr[0]|codePtr[1]<<8; codePtr+=ff?-(int)u:(int)u; break;
+#ifdef EXPR_THREADED
+		l_jump:
+#endif
+			u=codePtr[0]|codePtr[1]<<8; codePtr+=ff?-(int)u:(int)u; NEXT_OP;
 		case OP_COALESCE:
 			if (top[-1].type==VT_ERROR) {freeV(*--top); codePtr+=2;} else codePtr+=codePtr[0]|codePtr[1]<<8;
 			break;
 		case OP_IN1:
+#ifdef EXPR_THREADED
+		l_in1:
+#endif
 			if (((u=*codePtr++)&CND_EXT)!=0) u|=*codePtr++<<8;
 			rc=top[-2].type!=VT_ERROR&&top[-1].type!=VT_ERROR?calc(OP_EQ,top[-2],&top[-1],2,u,ma):(u&CND_NOT)!=0?RC_TRUE:RC_FALSE;
 			if (unsigned(rc-RC_TRUE)<=unsigned(RC_FALSE-RC_TRUE)) {freeV(*--top); if (cndAct[u&CND_MASK][rc-RC_TRUE]!=2) freeV(*--top); goto bool_op;}
@@ -214,6 +354,9 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 			freeV(*--top); if (((u=*codePtr++)&CND_EXT)!=0) u|=*codePtr++<<8; goto bool_op;
 		case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
 		case OP_CONTAINS: case OP_BEGINS: case OP_ENDS: case OP_REGEX: case OP_IN:
+#ifdef EXPR_THREADED
+		l_cmp:
+#endif
 			if (((u=*codePtr++)&CND_EXT)!=0) u|=*codePtr++<<8;
 			rc=top[-2].type!=VT_ERROR&&top[-1].type!=VT_ERROR?calc((ExprOp)op,top[-2],&top[-1],2,u,ma):op==OP_NE||(u&CND_NOT)!=0?RC_TRUE:RC_FALSE;
 			freeV(*--top); freeV(*--top);
@@ -233,6 +376,7 @@ RC Expr::eval(const Expr *const *exprs,ulong nExp,Value& result,PINEx **vars,ulo
 				case 2: if ((u&CND_MASK)>=6) codePtr+=2; rc=RC_OK; break;
 				case 3: codePtr+=codePtr[0]|codePtr[1]<<8; rc=RC_OK; break;
 				}
+				NEXT_OP;
 			}
 			break;
 		default:
@@ -924,7 +1068,7 @@ RC Expr::calc(ExprOp op,Value& arg,const Value *moreArgs,int nargs,unsigned flag
 			moreArgs->nav->navigate(GO_FINDBYID,STORE_COLLECTION_ID); return rc;
 		}
 		break;
-	case OP_CONTAINS:	// optimization (Boyer-Moore etc.)
+	case OP_CONTAINS:
 	case OP_BEGINS:
 	case OP_ENDS:
 		rc=RC_FALSE;
@@ -993,28 +1137,22 @@ RC Expr::calc(ExprOp op,Value& arg,const Value *moreArgs,int nargs,unsigned flag
 		case VT_URL:
 			if (op!=OP_CONTAINS && op!=OP_POSITION) {
 				const char *p=op==OP_BEGINS?arg.str:arg.str+arg.length-arg2->length;
-				if (((flags&CND_NCASE)!=0?strncasecmp(p,arg2->str,arg2->length):strncmp(p,arg2->str,arg2->length))==0) rc=RC_TRUE;
+				if (((flags&CND_NCASE)!=0?memNCaseCmp(p,arg2->str,arg2->length):memcmp(p,arg2->str,arg2->length))==0) rc=RC_TRUE;
 			} else {
-				const char *p=arg.str,*q=NULL; char ch=0; if ((flags&CND_NCASE)!=0) ch=toupper(*arg2->bstr);
-				for (len=arg.length-arg2->length+1; ;len-=ulong(q-p)+1,p=q+1,q=NULL) {
-					if (len!=0) {
-						q=(char*)memchr(p,*arg2->str,len);
-						if ((flags&CND_NCASE)!=0) {const char *q2=(char*)memchr(p,ch,len); if (q==NULL || q2!=NULL && q2<q) q=q2;}
-					}
-					if (q==NULL) {if (op==OP_POSITION) {freeV(arg); arg.set(-1);} break;}
-					if (((flags&CND_NCASE)!=0?strncasecmp(q,arg2->str,arg2->length):strncmp(q,arg2->str,arg2->length))==0) 
-						{if (op==OP_POSITION) {freeV(arg); arg.set((unsigned)(q-arg.str));} else rc=RC_TRUE; break;}
-				}
+				const char *q=memFind(arg.str,arg.length,arg2->str,arg2->length,(flags&CND_NCASE)!=0);
+				if (op!=OP_POSITION) {if (q!=NULL) rc=RC_TRUE;}
+				else if (q==NULL) {freeV(arg); arg.set(-1);}
+				else {len=uint32_t(q-arg.str); freeV(arg); arg.set((unsigned)len);}
 			}
 			break;
 		case VT_BSTR:
 			if (op!=OP_CONTAINS && op!=OP_POSITION) {
 				if (memcmp(op==OP_BEGINS?arg.bstr:arg.bstr+arg.length-arg2->length,arg2->bstr,arg2->length)==0) rc=RC_TRUE;
 			} else {
-				const uint8_t *p=arg.bstr,*q;
-				for (len=arg.length-arg2->length+1; ;len-=ulong(q-p)+1,p=q+1)
-					if (len==0 || (q=(uint8_t*)memchr(p,*arg2->bstr,len))==NULL) {if (op==OP_POSITION) {freeV(arg); arg.set(-1);} break;}
-					else if (!memcmp(q,arg2->bstr,arg2->length)) {if (op==OP_POSITION) {freeV(arg); arg.set((unsigned)(q-arg.bstr));} else rc=RC_TRUE; break;}
+				const char *q=memFind(arg.str,arg.length,arg2->str,arg2->length,false);
+				if (op!=OP_POSITION) {if (q!=NULL) rc=RC_TRUE;}
+				else if (q==NULL) {freeV(arg); arg.set(-1);}
+				else {len=uint32_t(q-arg.str); freeV(arg); arg.set((unsigned)len);}
 			}
 			break;
 		} else if (op==OP_POSITION) {freeV(arg); arg.set(-1);}
@@ -1026,12 +1164,12 @@ RC Expr::calc(ExprOp op,Value& arg,const Value *moreArgs,int nargs,unsigned flag
 		default: assert(0);
 		case VT_STRING:
 		case VT_URL:
-			break;
 		case VT_BSTR:
+			{const Regex *rx; if ((rc=Regex::get(arg2->str,arg2->length,(flags&CND_NCASE)!=0,rx,(flags&CND_CONST_R)!=0))==RC_OK) rc=rx->match(arg.str,arg.length,Session::getSession());}
 			break;
 		}
 		if (arg2==&val) freeV(val);
-		break;
+		return rc;
 	case OP_COUNT:
 		if (moreArgs->type!=VT_URIID) return RC_TYPE;
 		switch (arg.type) {
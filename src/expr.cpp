@@ -238,6 +238,8 @@ RC ExprCompileCtx::compileNode(const ExprTree *node,ulong flg)
 		break;
 	case OP_STRUCT: case OP_PIN: 
 		flg|=CV_PROP; break;
+	case OP_CALL:
+		pHdr->hdr.flags|=EXPR_NOBATCH; break;
 	case OP_PATH:
 		return RC_INTERNAL;
 		pHdr->hdr.flags|=EXPR_PATH;
@@ -365,12 +367,12 @@ RC ExprCompileCtx::compileValue(const Value& v,ulong flg) {
 				if ((p=alloc(4))!=NULL) {p[0]=OP_PARAM|fc; p[1]=0xFF; p[2]=byte(pdx); p[3]=v.refV.refN;} else return RC_NORESOURCES;
 			}
 		} else if (v.length==0) {
-			if ((p=alloc(2))==NULL) return RC_NORESOURCES; p[0]=OP_VAR|fc; p[1]=v.refV.refN;
+			if ((p=alloc(2))==NULL) return RC_NORESOURCES; p[0]=OP_VAR|fc; p[1]=v.refV.refN; pHdr->hdr.flags|=EXPR_NOBATCH;
 		} else {
 			byte op=OP_PROP; unsigned eid=0;
 			if ((rc=addExtRef(v.refV.id,v.refV.refN,((flg&CV_CARD)?PROP_ORD:0)|((flg&CV_OPT)!=0?PROP_OPTIONAL:0),pdx))!=RC_OK) return rc;
 			const bool fExt=v.refV.refN>3||pdx>0x3F; l=fExt?5:2;
-			if (v.eid!=STORE_COLLECTION_ID) {op=OP_ELT; eid=afy_enc32zz(v.eid); l+=afy_len32(eid);}
+			if (v.eid!=STORE_COLLECTION_ID) {op=OP_ELT; eid=afy_enc32zz(v.eid); l+=afy_len32(eid); pHdr->hdr.flags|=EXPR_NOBATCH;}
 			if ((p=alloc(l))==NULL) return RC_NORESOURCES; p[0]=op|fc;
 			if (!fExt) {p[1]=byte(v.refV.refN<<6|pdx); p+=2;}
 			else {p[1]=0xFF; p[2]=v.refV.refN; p[3]=byte(pdx); p[4]=byte(pdx>>8); p+=5;}
@@ -430,6 +432,41 @@ RC ExprCompileCtx::putCondCode(ExprOp op,ulong fa,uint32_t lbl,bool flbl,int nop
 	return RC_OK;
 }
 
+static bool isIntCon(const Value& v)
+{
+	switch (v.type) {
+	case VT_INT: case VT_UINT: case VT_INT64: case VT_UINT64: case VT_DATETIME: case VT_INTERVAL: return true;
+	default: return false;
+	}
+}
+
+static uint64_t intCon(const Value& v)
+{
+	return v.type==VT_INT?uint64_t(int64_t(v.i)):v.type==VT_UINT?uint64_t(v.ui):v.ui64;
+}
+
+uint32_t ExprCompileCtx::putSuperOp(const ExprTree *node,ExprOp op,uint32_t& sht) {
+	if (fCollectRefs || node->nops!=2) return 0;
+	const Value &pv=node->operands[0],&cv=node->operands[1]; const Value *ct; uint64_t c[2]; uint32_t l; byte *p;
+	if (pv.type!=VT_VARREF || (pv.refV.flags&VAR_TYPE_MASK)!=0 || pv.length==0 || pv.refV.refN>3 || pv.eid!=STORE_COLLECTION_ID) return 0;
+	if (op==OP_IN) {
+		if (cv.type!=VT_RANGE || cv.range[0].type!=cv.range[1].type || !isIntCon(*(ct=&cv.range[0]))) return 0;
+		c[0]=intCon(cv.range[0]); c[1]=intCon(cv.range[1]); l=PROPRNG_HDR+1;
+	} else if (op>=OP_EQ && op<=OP_GE && isIntCon(*(ct=&cv))) {c[0]=intCon(cv); l=PROPCMP_HDR+1;}
+	else return 0;
+	if ((p=alloc(l))==NULL) return 0; sht=lCode-l;
+	p[0]=op==OP_IN?OP_PROPRNG:OP_PROPCMP; p[1]=ct->type; p[2]=0; memcpy(p+3,c,l-3);
+	return l;
+}
+
+void ExprCompileCtx::endSuperOp(uint32_t sht,uint32_t lh) {
+	if (!fCollectRefs) {
+		byte *p=pCode+sht; const uint32_t l=lCode-sht-lh;
+		if (p[lh]==OP_PROP && p[lh+1]!=0xFF && l<=0xFF) p[2]=byte(l);				// generic code must start with short OP_PROP
+		else {memmove(p,p+lh,l); lCode-=lh;}
+	}
+}
+
 void ExprCompileCtx::adjustRef(uint32_t lbl) {
 	bool fDel=true;
 	for (ExprLbl *lb,**plb=&labels; (lb=*plb)!=NULL; ) {
@@ -443,7 +480,7 @@ void ExprCompileCtx::adjustRef(uint32_t lbl) {
 }
 
 RC ExprCompileCtx::compileCondition(const ExprTree *node,ulong mode,uint32_t lbl,ulong flg) {
-	RC rc=RC_OK; uint32_t lbl1; ulong i; ExprOp op=node->op; const Value *pv,*cv; bool fJump;
+	RC rc=RC_OK; uint32_t lbl1,sht,lh; ulong i; ExprOp op=node->op; const Value *pv,*cv; bool fJump;
 	switch (op) {
 	default: assert(0); rc=RC_INTERNAL; break;
 	case OP_LOR: pHdr->hdr.flags|=EXPR_DISJUNCTIVE; flg|=CV_OPT;
@@ -508,7 +545,15 @@ RC ExprCompileCtx::compileCondition(const ExprTree *node,ulong mode,uint32_t lbl
 	case OP_EQ: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
 	bool_op: 
 		assert(node->nops<=2);
+		if (op==OP_REGEX && node->nops==2 && node->operands[1].type==VT_STRING) {
+			// compile constant pattern now: report syntax errors and keep it in the table of constant patterns found by eval without locking
+			const Regex *rx; const Value& pat=node->operands[1];
+			if ((rc=Regex::get(pat.str,pat.length,(node->flags&CASE_INSENSITIVE_OP)!=0,rx,true))!=RC_OK && rc!=RC_NOSESSION) return rc;
+			mode|=CND_CONST_R;
+		}
+		lh=putSuperOp(node,op,sht);
 		if ((rc=compileValue(node->operands[0],flg))==RC_OK && (node->nops==1 || (rc=compileValue(node->operands[1],flg))==RC_OK)) {
+			if (lh!=0) endSuperOp(sht,lh);
 			if ((node->flags&CASE_INSENSITIVE_OP)!=0) mode|=CND_NCASE;
 			if ((node->flags&FOR_ALL_LEFT_OP)!=0) mode|=CND_FORALL_L;
 			if ((node->flags&EXISTS_LEFT_OP)!=0) mode|=CND_EXISTS_L;
@@ -602,6 +647,10 @@ RC Expr::decompile(ExprTree*&res,Session *ses) const
 		case OP_JUMP:
 			//???
 			codePtr+=2; break;
+		case OP_PROPCMP:
+			codePtr+=PROPCMP_HDR; break;
+		case OP_PROPRNG:
+			codePtr+=PROPRNG_HDR; break;
 		case OP_CATCH:
 			//???
 			break;
@@ -51,6 +51,7 @@ namespace AfyKernel
 #define	EXPR_NO_CODE		0x0800
 #define	EXPR_PRELOAD		0x0400
 #define	EXPR_PARAMS			0x0200
+#define	EXPR_NOBATCH		0x0100		/**< refers to whole variables or collection elements, can't be evaluated over projected values */
 
 #define	PROP_OPTIONAL	0x80000000
 #define	PROP_NO_LOAD	0x40000000
@@ -67,11 +68,17 @@ namespace AfyKernel
 #define OP_CURRENT		0x77
 #define	OP_CONID		0x76
 #define	OP_SETPROP		0x75
+#define	OP_PROPCMP		0x74		/**< superinstruction: property compared with integer constant, followed by generic code */
+#define	OP_PROPRNG		0x73		/**< superinstruction: property in integer range, followed by generic code */
+
+#define	PROPCMP_HDR		10			/**< type, length of generic operand code, constant */
+#define	PROPRNG_HDR		18			/**< type, length of generic operand code, lower and upper bounds */
 
 #define	CND_SORT		0x80000000
 #define	CND_EQ			0x40000000
 #define	CND_NE			0x20000000
 
+#define	CND_CONST_R		0x4000
 #define	CND_EXISTS_R	0x2000
 #define	CND_FORALL_R	0x1000
 #define	CND_EXISTS_L	0x0800
@@ -160,6 +167,8 @@ public:
 	static	Expr	*clone(const Expr *exp,MemAlloc *ma);
 	static	RC		getI(const Value& v,long& num);
 	static	bool	condSatisfied(const class Expr *const *exprs,ulong nExp,PINEx **vars,unsigned nVars,const ValueV *pars,unsigned nPars,MemAlloc *ma,bool fIgnore=false);
+	static	unsigned	condBatch(const Expr *const *exprs,ulong nExp,const struct QBatch& qb,unsigned *sel,const ValueV *pars,unsigned nPars,MemAlloc *ma);
+	bool			isBatch() const {return (hdr.flags&(EXPR_EXTN|EXPR_PATH|EXPR_NOBATCH))==0 && hdr.xVar==0;}
 	static	RC		condRC(int c,ExprOp op) {assert(op>=OP_EQ && op<=OP_GE); return c<-2?RC_TYPE:c==-2||(compareCodeTab[op-OP_EQ]&1<<(c+1))==0?RC_FALSE:RC_TRUE;}
 	static	RC		registerExtn(void *itf,uint16_t& langID);
 	static	void	**extnTab;
@@ -172,6 +181,19 @@ private:
 	static	const	Value *numOpConv(Value&,const Value*,Value&,unsigned flg);
 	static	bool	numOpConv(Value&,unsigned flg);
 	static	const	byte	compareCodeTab[];
+	/**
+	 * single OP_PROPCMP/OP_PROPRNG condition evaluated column-wise by condBatch()
+	 */
+	struct	BatchCmp	{
+		PropertyID			pid;
+		byte				type;
+		bool				fRange;
+		bool				fInv;
+		uint32_t			flags;
+		const	byte		*con;
+		bool				test(const Value& v) const;
+	};
+	bool			getBatchCmp(BatchCmp& bc) const;
 	struct	VarD	{
 		bool				fInit;
 		bool				fLoaded;
@@ -268,6 +290,8 @@ class ExprCompileCtx {
 	RC		compileCondition(const ExprTree *node,ulong mode,uint32_t lbl,ulong flg=0);
 	RC		addExtRef(uint32_t id,uint16_t var,uint32_t flags,uint16_t& idx);
 	RC		putCondCode(ExprOp op,ulong fa,uint32_t lbl,bool flbl=true,int nops=0);
+	uint32_t	putSuperOp(const ExprTree *node,ExprOp op,uint32_t& sht);
+	void	endSuperOp(uint32_t sht,uint32_t lh);
 	void	adjustRef(uint32_t lbl);
 	bool	expandHdr(uint32_t l,VarHdr *&vh);
 	bool	expand(uint32_t l);
@@ -0,0 +1,497 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+/**
+ * external sort file
+ * temporary file pages organized in runs; used by Sort for sorted runs and by HashJoin for spilled partitions
+ */
+#ifndef _EXTSORT_H_
+#define _EXTSORT_H_
+
+#include "session.h"
+#include "fio.h"
+
+namespace AfyKernel
+{
+
+__forceinline const Value *getValues(const EncPINRef *ep)
+{
+	return (const Value*)((byte*)ep+ep->trunc<8>());		// 8???
+}
+
+typedef	uint32_t		RunID;
+#define INVALID_RUN		RunID(~0u)
+#define EXTENT_ALLOC	0x40
+#define TESTES			0
+#define	EXTSORT_IO_WAIT		100			/**< interval (ms) of checks for completion of a read-ahead */
+#define	EXTSORT_IO_TIMEOUT	30000		/**< time (ms) after which a read-ahead is abandoned and the page is read synchronously */
+
+/**
+ * tournament tree of losers for k-way merge
+ * node[0] is the source with the smallest current element, node[1..k-1] keep losers of internal matches,
+ * so advancing the winner costs log2(k) comparisons; ties are resolved in favour of the source with smaller index
+ * Src provides top(i) - current element of source i or NULL if the source is exhausted - and cmp()
+ */
+template<class Src> class LoserTree
+{
+	const	Src			src;
+	unsigned	*const	node;
+	const	unsigned	k;
+	bool	beats(unsigned a,unsigned b) const {
+		if (a>=k) return true; if (b>=k) return false;		// k is the initial "minus infinity" filler
+		const EncPINRef *pa=src.top(a),*pb=src.top(b); if (pa==NULL) return false; if (pb==NULL) return true;
+		const int c=src.cmp(pa,pb); return c<0 || c==0 && a<b;
+	}
+public:
+	LoserTree(const Src& s,unsigned *nd,unsigned nk) : src(s),node(nd),k(nk) {}
+	void		build() {unsigned i; for (i=0; i<k; i++) node[i]=k; while (i--!=0) adjust(i);}
+	void		adjust(unsigned i) {
+		unsigned w=i;
+		for (unsigned t=(i+k)/2; t!=0; t/=2) if (beats(node[t],w)) {unsigned l=node[t]; node[t]=w; w=l;}
+		node[0]=w;
+	}
+	unsigned	winner() const {return node[0];}
+};
+
+struct ExtSortPageHdr 
+{
+	uint32_t	nItems;		//Number of pins
+	uint32_t	bufEnd;		//End of buffer for backward scanning
+	RunID run;				//Sanity check
+};
+
+class ExtSortFile 
+{
+	friend class OutRun;
+	friend class InRun;
+	struct ExtSortPage {
+		PageID	next;	// next in run or empty list
+		PageID	prev;	// previous in run or empty
+	};
+	struct RunInfo {
+		PageID	head;
+		PageID	pos;	  // current
+		PageID	tail;  
+		RunInfo() : head(INVALID_PAGEID),pos(INVALID_PAGEID),tail(INVALID_PAGEID) {}
+	};
+	Session		*const	ses;
+	FileID		fid;
+	ExtSortPage	*pages;
+	ulong		nPages; // Currently allocated in file
+	RunInfo		*runs;
+	ulong		nRuns;
+	ulong		xRuns;
+	PageID		freeList;
+	uint64_t&	lSpill;
+
+public:
+	ExtSortFile(Session *s,uint64_t& spill) : ses(s),fid(INVALID_FILEID),pages(NULL),nPages(0),
+						runs(NULL),nRuns(0),xRuns(0),freeList(INVALID_PAGEID),lSpill(spill) {}
+	~ExtSortFile() {
+		if (pages!=NULL) ses->free(pages);
+		if (runs!=NULL) ses->free(runs);	
+		if (fid!=INVALID_FILEID) ses->getStore()->fileMgr->close(fid);
+	}
+
+	RunID beginRun() {
+		if (nRuns>=xRuns && (runs=(RunInfo*)ses->realloc(runs,sizeof(RunInfo)*(xRuns+=xRuns==0?16:xRuns/2)))==NULL) return INVALID_RUN;
+		runs[nRuns].head=runs[nRuns].tail=runs[nRuns].pos=INVALID_PAGEID; return nRuns++;
+	}
+
+	RC writePage(RunID runid,byte *pageBuf) {
+		if (runid>=nRuns) return RC_INVPARAM;
+		if (fid==INVALID_FILEID) {
+			RC rc=ses->getStore()->fileMgr->open(fid,NULL,FIO_TEMP);
+			if (rc!=RC_OK) {report(MSG_ERROR,"Failure to create external sort file (%d)\n",rc); return rc;}
+		}
+		PageID pos=getFreePage(); if (pos==INVALID_PAGEID) return RC_NORESOURCES;
+		assert(pages[pos].next==INVALID_PAGEID);
+
+		// encrypt page!!!
+		RC rc=ses->getStore()->fileMgr->io(FIO_WRITE,PageIDFromPageNum(fid,pos),pageBuf,pageLen());  
+		if (rc!=RC_OK) {
+			report(MSG_ERROR,"Failure to write page %x to external sort file (%d)\n",pos,rc); releasePage(pos);
+		} else {
+			lSpill+=pageLen();
+			PageID oldTail=runs[runid].tail;
+			if(oldTail==INVALID_PAGEID) {
+				assert(runs[runid].head==INVALID_PAGEID);
+				runs[runid].head=runs[runid].pos=runs[runid].tail=pos;
+			} else {
+				assert(pages[oldTail].next==INVALID_PAGEID);
+				assert(runs[runid].head!=INVALID_PAGEID);
+				pages[oldTail].next=pos; runs[runid].tail=pos;
+			}
+		}
+		check();
+		return rc;
+	}
+	RC readPage(RunID runid, byte* buf, bool bRelease=false) {
+		if(buf==NULL) return RC_INVPARAM;
+		if(runid>=nRuns || runs[runid].pos==INVALID_PAGEID) return RC_NOTFOUND;
+		RC rc; PageID nextInRun=runs[runid].pos;
+		if ((rc=ses->getStore()->fileMgr->io(FIO_READ,PageIDFromPageNum(fid,nextInRun),buf,pageLen()))==RC_OK) {
+			runs[runid].pos=pages[nextInRun].next;
+			if (bRelease) {runs[runid].head=runs[runid].pos; releasePage(nextInRun);} // when no rewind needed
+			// decrypt page!!!
+		}
+		check();
+		return rc;
+	}
+	// Asynchronous read of the next page of a run; the page is returned to empty list by releaseRead() when consumed
+	PageID nextPage(RunID runid) {
+		if (runid>=nRuns) return INVALID_PAGEID;
+		PageID pg=runs[runid].pos; if (pg!=INVALID_PAGEID) runs[runid].pos=pages[pg].next; return pg;
+	}
+	RC readAsync(PageID pg,byte *buf,myaio& aio) {
+		aio.aio_fildes=fid; aio.aio_offset=PageIDToOffset(pg,pageLen()); aio.aio_buf=buf; aio.aio_nbytes=pageLen(); aio.aio_lio_opcode=LIO_READ;
+		myaio *pa=&aio; return ses->getStore()->fileMgr->listIO(LIO_NOWAIT,1,&pa);
+	}
+	RC readSync(PageID pg,byte *buf) {
+		return ses->getStore()->fileMgr->io(FIO_READ,PageIDFromPageNum(fid,pg),buf,pageLen());
+	}
+	void releaseRead(RunID runid,PageID pg) {
+		assert(runs[runid].head==pg); runs[runid].head=pages[pg].next; releasePage(pg);
+	}
+	// Return run pages to empty list
+	RC releaseRun(RunID runid) {	
+		for (PageID pos=runs[runid].head,next; pos!=INVALID_PAGEID; pos=next) {next=pages[pos].next; releasePage(pos);}
+		return RC_OK;
+	}
+	RC rewind(RunID runid) {
+		if(runid>=nRuns) return RC_INVPARAM;
+		runs[runid].pos=runs[runid].head;
+		return RC_OK;
+	}
+
+	size_t pageLen() const {return ses->getStore()->fileMgr->getPageSize();}
+	ulong runCount() const {return nRuns;}
+
+	void check(bool bPrintStats=false) {
+#ifdef _DEBUG
+		if (fid==INVALID_FILEID) {
+			assert(freeList==INVALID_PAGEID);
+		} else {
+			assert(nPages==(ulong)ses->getStore()->fileMgr->getFileSize(fid)/pageLen());
+			assert(pages!=NULL);
+			ulong cntFree=0; 
+			for (PageID iter=freeList; iter!=INVALID_PAGEID; iter=pages[iter].next) cntFree++;
+            assert(xRuns>=nRuns);
+			ulong cnt=cntFree; ulong cntEmpty=0;
+			for (ulong i=0; i<nRuns; i++) {
+				PageID iter=runs[i].head;
+				if (iter==INVALID_PAGEID) cntEmpty++;
+				else for (;iter!=INVALID_PAGEID; iter=pages[iter].next) cnt++;
+			}
+			if(bPrintStats) report(MSG_DEBUG,"External sort: Alloc Pages 0x%x, Free Pages 0x%x Runs 0x%x Empty Runs 0x%x\n",nPages,cntFree,nRuns,cntEmpty);
+			assert(nPages==cnt);
+		}
+#endif
+	}
+	void	operator	delete(void *p) {if (p!=NULL) ((ExtSortFile*)p)->ses->free(p);}
+
+private:
+	PageID getFreePage() {
+		if (freeList==INVALID_PAGEID) growFile();
+		if (freeList==INVALID_PAGEID) return INVALID_PAGEID;
+		PageID free=freeList;
+		freeList=pages[freeList].next;
+		pages[free].next=INVALID_PAGEID;
+		return free;
+	}
+
+	void releasePage(PageID c) {
+		assert(c<nPages); assert(c!=INVALID_PAGEID);
+		pages[c].next=freeList; freeList=c;
+	}
+
+	void growFile() {
+		assert(freeList==INVALID_PAGEID); // Only grow if all full
+		off64_t addr; RC rc;
+		if ((rc=ses->getStore()->fileMgr->allocateExtent(fid,EXTENT_ALLOC,addr))!=RC_OK)
+			{report(MSG_ERROR,"Cannot grow file for external sort (%d)\n",rc); return; }
+		ulong curPageCnt=nPages; nPages+=EXTENT_ALLOC;
+		pages=(ExtSortPage*)ses->realloc(pages,nPages*sizeof(ExtSortPage));
+		for (ulong i=curPageCnt; i<nPages-1; i++) pages[i].next=i+1;
+		pages[nPages-1].next=INVALID_PAGEID; freeList=curPageCnt;
+	}
+};
+
+class OutRun
+{
+	// Assist in writing a sorted series of pins into ExtSortFile
+	ExtSortFile		*esFile;
+	byte			*page;     
+	size_t			pagePos;
+	ExtSortPageHdr	*hdr;
+	unsigned		nValues;
+	ulong			nRunPins;
+public:
+	OutRun(ExtSortFile *es,unsigned nVals) : esFile(es),page(NULL),hdr(NULL),nValues(nVals),nRunPins(0) {
+		page=(byte*)es->ses->malloc(esFile->pageLen()); hdr=(ExtSortPageHdr*)page;
+	}
+	~OutRun() {
+		if (page!=NULL) esFile->ses->free(page);
+	}
+
+	RC beginRun() {
+		if (page==NULL) return RC_NORESOURCES;
+		hdr->run=esFile->beginRun(); hdr->nItems=0;
+		pagePos=sizeof(ExtSortPageHdr);
+		nRunPins=0;
+		return RC_OK;
+	}
+
+	RC add(const EncPINRef *ep) {
+		// Get buffer to fill in
+		const size_t lHdr=sizeof(uint16_t)+1+
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+			((((ptrdiff_t)ep)&1)!=0?byte((ptrdiff_t)ep)>>1:ep->lref);
+#else
+			ep->lref;
+#endif
+		size_t pinlen=lHdr,pageLen=esFile->pageLen();
+		if (nValues!=0) {
+			const Value *pv=getValues(ep);
+			for (ulong i=0; i<nValues; i++,pv++) pinlen+=AfyKernel::serSize(*pv);
+		}
+		size_t oldLen=afy_len32(pinlen); pinlen+=oldLen;
+		size_t newLen=afy_len32(pinlen); pinlen+=newLen-oldLen;
+
+		if (pinlen+pagePos>pageLen) {
+			if (hdr->nItems==0) {report(MSG_ERROR,"Single sort key too large (%u) for external sort\n",pinlen); return RC_NORESOURCES;}
+#if TESTES
+			report(MSG_DEBUG,"Write page, run %x, %x pins\n",hdr->run,hdr->nItems);
+#endif
+			RC rc = esFile->writePage(hdr->run,page); if (rc!=RC_OK) return rc;
+			// Start next page
+			pagePos = sizeof(ExtSortPageHdr); hdr->nItems=0;
+#ifdef _DEBUG
+			memset(page+pagePos,0xCD,pageLen-pagePos);
+#endif
+		}
+
+		// serialize pin
+		byte *ps=page+pagePos; afy_enc32(ps,pinlen);
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+		if ((((ptrdiff_t)ep)&1)!=0) {
+			*(uint16_t*)ps=0; ps[sizeof(uint16_t)]=byte((ptrdiff_t)ep)>>1; memcpy(ps+sizeof(uint16_t)+1,(byte*)&ep+1,ps[sizeof(uint16_t)]);
+		} else
+#endif
+		memcpy(ps,ep,lHdr); ps+=lHdr;
+
+		// Values 
+		if (nValues!=0) {
+			const Value *pv=getValues(ep);
+			for (ulong i=0; i<nValues; i++,pv++) ps=AfyKernel::serialize(*pv,ps);
+		}
+
+		hdr->nItems++; nRunPins++; pagePos=ulong(ps-page);
+		return RC_OK;
+	}
+
+	RC term()
+	{
+		if (hdr->nItems>0) { 
+			esFile->writePage(hdr->run,page); 
+#if TESTES
+			report(MSG_DEBUG,"Write last run page, run %x, %x pins, total %x\n",hdr->run,hdr->nItems,nRunPins);	
+#endif
+		}
+		return RC_OK;
+	}
+	void	operator	delete(void *p) {if (p!=NULL) ((OutRun*)p)->esFile->ses->free(p);}
+};
+
+/**
+ * control block and both page buffers of InRun read-ahead
+ * allocated in store memory and reference counted, so a read which doesn't complete in time
+ * can be abandoned: the completion callback then releases the block
+ */
+class ReadAhead
+{
+	friend	class	InRun;
+	myaio				aio;
+	Mutex				lock;
+	Event				done;
+	volatile	long	refCnt;
+	volatile	bool	fReady;
+	StoreCtx	*const	ctx;
+	ReadAhead(StoreCtx *ct) : refCnt(1),fReady(true),ctx(ct) {memset(&aio,0,sizeof(aio));}
+	byte	*buffer(unsigned i,size_t lPage) {return (byte*)this+ceil(sizeof(ReadAhead),sizeof(uint64_t))+i*lPage;}
+	void	release() {if (InterlockedDecrement(&refCnt)==0) {StoreCtx *ct=ctx; this->~ReadAhead(); ct->free(this);}}
+	static	void	notify(void *param,RC) {
+		ReadAhead *ra=(ReadAhead*)param; {MutexP lck(&ra->lock); ra->fReady=true; ra->done.signalAll();} ra->release();
+	}
+	static	ReadAhead	*create(StoreCtx *ctx,size_t lPage) {
+		void *p=ctx->malloc(ceil(sizeof(ReadAhead),sizeof(uint64_t))+lPage*2); return p!=NULL?new(p) ReadAhead(ctx):(ReadAhead*)0;
+	}
+};
+
+class InRun
+{
+	// Assist in reading a run from disk
+	ExtSortFile			*esFile;
+	RunID				runid;
+	unsigned			nValues;
+	ulong				remItems; 
+	const	byte		*page;     // Current page of run
+	const	byte		*pos;		
+	bool				bTemp;
+	EncPINRef			*ep;
+	byte				*buf;
+	ReadAhead			*ra;		// read-ahead control block, NULL if pages are read synchronously
+	byte				*ahead;		// read-ahead page
+	PageID				pgAhead;	// page being read into ahead
+
+	void startRead() {
+		if ((pgAhead=esFile->nextPage(runid))!=INVALID_PAGEID) {
+			ra->fReady=false; ra->aio.aio_param=ra; ra->aio.aio_notify=ReadAhead::notify; InterlockedIncrement(&ra->refCnt);
+			// listIO notifies failed requests too, so the reference is released either way; the page is then re-read in readAhead()
+			RC rc=esFile->readAsync(pgAhead,ahead,ra->aio); if (rc!=RC_OK && ra->aio.aio_rc==RC_OK) ra->aio.aio_rc=rc;
+		}
+	}
+	RC wait() {
+		if (pgAhead!=INVALID_PAGEID) {
+			MutexP lck(&ra->lock);
+			for (unsigned t=0; !ra->fReady; t+=EXTSORT_IO_WAIT) {
+				if (t>=EXTSORT_IO_TIMEOUT) {
+					// the page buffers are left to the completion callback, the run is continued synchronously
+					report(MSG_ERROR,"External sort: read-ahead of page %u didn't complete in %u ms\n",pgAhead,EXTSORT_IO_TIMEOUT);
+					lck.set(NULL); ra->release(); ra=NULL; ahead=NULL;
+					page=(byte*)esFile->ses->malloc(esFile->pageLen()); return page!=NULL?RC_TIMEOUT:RC_NORESOURCES;
+				}
+				ra->done.wait(ra->lock,EXTSORT_IO_WAIT);
+			}
+		}
+		return RC_OK;
+	}
+	RC readAhead() {
+		// the next page is read while the current one is merged
+		if (pgAhead==INVALID_PAGEID && (startRead(),pgAhead==INVALID_PAGEID)) return RC_NOTFOUND;
+		RC rc=wait(); const PageID pg=pgAhead; pgAhead=INVALID_PAGEID;
+		if (rc==RC_TIMEOUT) rc=esFile->readSync(pg,(byte*)page);
+		else if (rc==RC_OK && ra->aio.aio_rc!=RC_OK) rc=esFile->readSync(pg,ahead);		// asynchronous read failed or wasn't submitted
+		if (rc!=RC_OK) return rc; if (bTemp) esFile->releaseRead(runid,pg);
+		if (ra!=NULL) {const byte *p=page; page=ahead; ahead=(byte*)p; startRead();}
+		return RC_OK;
+	}
+
+public:
+	// if new,delete created
+	InRun() : esFile(NULL),runid(INVALID_RUN),nValues(0),remItems(0),page(NULL),pos(NULL),bTemp(false),ep(NULL),buf(NULL),ra(NULL),ahead(NULL),pgAhead(INVALID_PAGEID) {}
+
+	~InRun() {term(); if (buf!=NULL) esFile->ses->free(buf);}
+
+	RC init(ExtSortFile *es,unsigned nVals,bool fAhead=false) {
+		esFile=es; nValues=nVals;
+		buf=(byte*)es->ses->memalign(sizeof(EncPINRef*),sizeof(EncPINRef)+nVals*sizeof(Value));
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+		assert((((ptrdiff_t)buf)&1)==0);
+#endif
+		if (buf==NULL) return RC_NORESOURCES;
+		if (fAhead) {
+			if ((ra=ReadAhead::create(es->ses->getStore(),es->pageLen()))==NULL) return RC_NORESOURCES;
+			page=ra->buffer(0,es->pageLen()); ahead=ra->buffer(1,es->pageLen()); return RC_OK;
+		}
+		return (page=(byte*)es->ses->malloc(es->pageLen()))!=NULL?RC_OK:RC_NORESOURCES;
+	}
+	void setRun(RunID r, bool bTempRun) {
+		// Can change run
+		wait(); pgAhead=INVALID_PAGEID;
+		runid=r; remItems=0; pos=NULL;
+		bTemp=bTempRun; 
+		ep=NULL;
+		next();
+	}
+	RC rewind() {
+		assert(!bTemp);
+		wait(); pgAhead=INVALID_PAGEID;
+		ep=NULL; remItems=0; pos=NULL;
+		esFile->rewind(runid);
+		return RC_OK;
+	}
+	void term() {
+		wait(); pgAhead=INVALID_PAGEID;
+		if (ep!=NULL) {
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+			if ((((ptrdiff_t)ep)&1)==0)
+#endif
+			{
+				Value *pv=(Value*)getValues(ep);
+				for (unsigned i=0; i<nValues; i++) freeV(pv[i]);
+			}
+			ep=NULL;
+		}
+		if (ra!=NULL) {ra->release(); ra=NULL; ahead=NULL; page=NULL;}		// page buffers are part of the read-ahead block
+		else if (page!=NULL) {esFile->ses->free((byte*)page); page=NULL;}
+	}
+
+	bool next() {
+		RC rc=RC_OK;
+		if (remItems==0) {
+			if ((ra!=NULL?readAhead():esFile->readPage(runid,(byte*)page,bTemp))==RC_OK) {
+				pos=page;
+				ExtSortPageHdr *pageHdr=(ExtSortPageHdr*)page;
+				assert(pageHdr->run==runid);
+				remItems=pageHdr->nItems;
+				pos+=sizeof(ExtSortPageHdr);
+#if TESTES
+				report(MSG_DEBUG,"Read page, run %x, %x pins\n",runid,pageHdr->nItems);
+#endif
+			} else {
+				if (ep!=NULL) {
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+					if ((((ptrdiff_t)ep)&1)==0)
+#endif
+					{
+						Value *pv=(Value*)getValues(ep);
+						for (unsigned i=0; i<nValues; i++) freeV(pv[i]);
+					}
+					ep=NULL;
+				}
+				pos=NULL; return false;
+			}
+		}
+		assert(page!=NULL);
+		assert((ulong)(pos-page)<esFile->pageLen());
+
+		const byte *end=pos; size_t len; afy_dec32(pos,len); end+=len; assert((ulong)(end-page)<=esFile->pageLen());
+		const EncPINRef *hdr=(const EncPINRef *)pos; pos+=sizeof(uint16_t)+1+hdr->lref; assert((ulong)(pos-page)<=esFile->pageLen());
+
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+		if (nValues==0 && hdr->lref<sizeof(EncPINRef*) && hdr->flags==0)		// flags alignment???
+			{byte *p=(byte*)&ep; p[0]=hdr->lref<<1|1; memcpy(p+1,hdr->buf,hdr->lref);} else
+#endif
+		{
+			ep=(EncPINRef*)buf; memcpy(ep,hdr,sizeof(uint16_t)+1+hdr->lref);
+			Value *pv=(Value*)getValues(ep);
+			for (unsigned i=0; i<nValues; i++,pv++)
+				if ((rc=AfyKernel::deserialize(*pv,pos,end,esFile->ses,false))!=RC_OK) break;
+		}
+		pos=end; remItems--;
+		return rc==RC_OK;
+	}
+	const EncPINRef *top() const {return ep;} // current item in run
+	void *operator new[](size_t s,Session *ses) throw() {return ses->malloc(s);}
+	void operator delete[](void *p) {free(p,SES_HEAP);}
+};
+
+};
+
+#endif
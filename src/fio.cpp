@@ -30,6 +30,9 @@ FileMgr::FileMgr(StoreCtx *ct,int /*maxOpenFiles*/,IStoreIO *i_o)
 : dir(NULL),ctx(ct),pio(i_o),bDefaultIO(false)
 {
 	if (pio==NULL) {
+#if defined(_LINUX) && !defined(Darwin)
+		if ((ctx->mode&STARTUP_IO_URING)!=0 && (pio=getStoreIOURing())!=NULL) report(MSG_INFO,"Using io_uring for store i/o\n"); else
+#endif
 		if ((pio=getStoreIO())==NULL) throw RC_NORESOURCES; 
 		bDefaultIO=true;
 	}
@@ -159,11 +162,20 @@ RC FileMgr::moveStore(const char *from,const char *to,IStoreIO *pio)
 
 RC	FileMgr::listIO(int mode,int nent,myaio* const* pcbs,bool fSync)
 {
-	int i; 
-	IStoreIO::iodesc **adescs=(IStoreIO::iodesc **)ctx->malloc(sizeof(IStoreIO::iodesc *)*nent); if (adescs==NULL) return RC_NORESOURCES;
+	int i=0; 
+	IStoreIO::iodesc **adescs=(IStoreIO::iodesc **)ctx->malloc(sizeof(IStoreIO::iodesc *)*nent);
+	if (adescs!=NULL) while (i<nent && (adescs[i]=(IStoreIO::iodesc *)ctx->malloc(sizeof(IStoreIO::iodesc)))!=NULL) i++;
+	if (adescs==NULL || i<nent) {
+		// nothing is submitted; asynchronous requests are notified anyway, as IStoreIO::listIO() does for failed entries
+		if (adescs!=NULL) {while (--i>=0) ctx->free(adescs[i]); ctx->free(adescs);}
+		for (i=0; i<nent; i++) {
+			pcbs[i]->aio_rc=RC_NORESOURCES;
+			if (mode!=LIO_WAIT && pcbs[i]->aio_notify!=NULL) pcbs[i]->aio_notify(pcbs[i]->aio_param,RC_NORESOURCES);
+		}
+		return RC_NORESOURCES;
+	}
 	for (i=0; i<nent; i++) 
 	{
-		adescs[i]=(IStoreIO::iodesc *)ctx->malloc(sizeof(IStoreIO::iodesc)); if (adescs[i]==NULL) return RC_NORESOURCES;
 		adescs[i]->aio_buf=pcbs[i]->aio_buf;
 		adescs[i]->aio_fildes=pcbs[i]->aio_fildes;
 		adescs[i]->aio_lio_opcode=pcbs[i]->aio_lio_opcode;
@@ -191,9 +203,9 @@ void FileMgr::asyncIOCompletionCallback(IStoreIO::iodesc *aiodesc)
 	assert(aiodesc->aio_ptrpos==1);
 	myaio *aio;
 	if (aiodesc->aio_ptrpos==1 && (aio=(myaio *)aiodesc->aio_ptr[--aiodesc->aio_ptrpos])!= NULL ) {			
-		if (aio->aio_ctx!=NULL) aio->aio_ctx->set(); else assert(0);
-		aio->aio_rc=aiodesc->aio_rc;
+		StoreCtx *ctx=aio->aio_ctx; if (ctx!=NULL) ctx->set(); else assert(0);
+		aio->aio_rc=aiodesc->aio_rc;		// aio can be released by the waiter as soon as it's notified
 		if (aio->aio_notify!=NULL) aio->aio_notify(aio->aio_param,aio->aio_rc); else assert(0);
-		aio->aio_ctx->free(aiodesc);
+		ctx->free(aiodesc);
 	}
 } 
@@ -81,6 +81,7 @@ public:
 	void	closeAll(FileID start);
 	RC		io(FIOType type,PageID pid,void *buf,size_t len,bool fSync=false);
 	RC		listIO(int mode,int nent,myaio* const* pcbs,bool fSync=false);
+	RC		registerBuffers(void *buf,size_t lbuf) {return pio->registerBuffers(buf,lbuf);}
 	off64_t	getFileSize(FileID fid);
 	RC		truncate(FileID fid,off64_t size);
 	RC		allocateExtent(FileID fid,ulong nPages,off64_t& addr);
@@ -90,6 +91,10 @@ public:
 	static RC	deleteStore(const char *path,IStoreIO *pio=NULL);
 };
 
+#if defined(_LINUX) && !defined(Darwin)
+extern	IStoreIO	*getStoreIOURing();		/**< io_uring based i/o, NULL if not supported by the kernel */
+#endif
+
 inline FileID FileIDFromPageID(PageID pid) {return (FileID)(pid>>24&0xFF);}
 inline ulong  PageNumFromPageID(PageID pid) {return pid&0x00FFFFFF;}
 inline PageID PageIDFromPageNum(FileID fid,ulong pageN) {assert((pageN&0xFF000000)==0); return (PageID)(fid<<24|pageN);}
@@ -76,7 +76,7 @@ void FileIOLinux::init(void (*cb)(iodesc*))
 #endif
 }
 
-inline off64_t getFileSz(int fd)
+off64_t FileIOLinux::getFileSz(int fd)
 {
 #ifndef __arm__	
 	struct stat64 fileStats;
@@ -71,6 +71,7 @@ namespace AfyKernel
 	 */
 	class FileIOLinux : public IStoreIO
 	{
+	protected:
 		mutable RWLock		lock;
 		FileDescLinux		*slotTab;
 		int					xSlotTab;
@@ -97,6 +98,7 @@ namespace AfyKernel
 		RC		deleteFile(const char *fname);
 		void	deleteLogFiles(ulong maxFile,const char *lDir,bool fArchived);
 		void	destroy() { this->~FileIOLinux(); }
+		static	off64_t	getFileSz(int fd);
 #ifdef STORE_AIO_THREAD
 		static	void _asyncIOCompletion(sigval_t val);
 #else
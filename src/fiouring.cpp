@@ -0,0 +1,340 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+#ifdef _LINUX
+#ifndef Darwin
+
+#include "fiouring.h"
+#include "fio.h"
+#include "session.h"
+#include <sys/mman.h>
+
+using namespace AfyKernel;
+
+#ifdef STORE_IO_URING
+
+namespace AfyKernel
+{
+/**
+ * waiting context for LIO_WAIT requests
+ */
+struct URingSync
+{
+	long			cnt;
+	Mutex			lock;
+	Event			wait;
+	URingSync() : cnt(0) {}
+};
+
+/**
+ * one i/o operation in the ring
+ * for asynchronous requests doubles as completion request posted to RQ_IO threads
+ */
+struct URingReq : public Request
+{
+	FileIOURing				*const	fio;
+	IStoreIO::iodesc		*const	pcb;
+	URingSync				*const	sync;
+	const	int						fd;
+	const	bool					fFixedFile;
+	const	int						bufIdx;
+	size_t							done;
+	URingReq(FileIOURing *f,IStoreIO::iodesc *pc,URingSync *sy,int fdesc,bool fFixed,int idx) : fio(f),pcb(pc),sync(sy),fd(fdesc),fFixedFile(fFixed),bufIdx(idx),done(0) {}
+	void process() {if (fio->asyncIOCallback!=NULL) fio->asyncIOCallback(pcb);}
+	void destroy() {this->~URingReq(); FileIOURing::freeReqs.dealloc(this);}
+};
+};
+
+FreeQ<> FileIOURing::freeReqs;
+
+static inline int uring_enter(int fd,unsigned toSubmit,unsigned minComplete,unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter,fd,toSubmit,minComplete,flags,NULL,0);
+}
+
+static inline int uring_register(int fd,unsigned opcode,void *arg,unsigned nArgs)
+{
+	return (int)syscall(__NR_io_uring_register,fd,opcode,arg,nArgs);
+}
+
+FileIOURing::FileIOURing()
+: ringFd(-1),sqDepth(0),sqRing(MAP_FAILED),lsqRing(0),cqRing(MAP_FAILED),lcqRing(0),sqes((io_uring_sqe*)MAP_FAILED),lsqes(0),
+	sqTail(NULL),sqMask(0),sqArray(NULL),cqHead(NULL),cqTail(NULL),cqMask(0),cqes(NULL),nInFlight(0),fRegFiles(false),nRegBufs(0),fReaper(false),fStop(false)
+{
+	for (int i=0; i<FIO_MAX_OPENFILES; i++) regFd[i]=INVALID_FD;
+}
+
+FileIOURing::~FileIOURing()
+{
+	if (fReaper) {
+		// NOP with zero user_data tells the reaper thread to exit
+		fStop=true; sqLock.lock(); unsigned tail=*sqTail,idx=tail&sqMask;
+		memset(&sqes[idx],0,sizeof(io_uring_sqe)); sqes[idx].opcode=IORING_OP_NOP; sqArray[idx]=idx;
+		__atomic_store_n(sqTail,tail+1,__ATOMIC_RELEASE);
+		while (uring_enter(ringFd,1,0,0)<0 && (errno==EINTR||errno==EAGAIN||errno==EBUSY)) threadYield();
+		sqLock.unlock(); threadsWaitFor(1,&reaper); fReaper=false;
+	}
+	FileIOLinux::closeAll(0);
+	if (sqes!=MAP_FAILED) munmap(sqes,lsqes);
+	if (cqRing!=MAP_FAILED && cqRing!=sqRing) munmap(cqRing,lcqRing);
+	if (sqRing!=MAP_FAILED) munmap(sqRing,lsqRing);
+	if (ringFd>=0) ::close(ringFd);
+}
+
+RC FileIOURing::setup()
+{
+	io_uring_params params; memset(&params,0,sizeof(params));
+	params.flags=IORING_SETUP_CQSIZE; params.cq_entries=URING_DEPTH*2;
+	if ((ringFd=(int)syscall(__NR_io_uring_setup,URING_DEPTH,&params))<0) return convCode(errno);
+
+	lsqRing=params.sq_off.array+params.sq_entries*sizeof(unsigned);
+	lcqRing=params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe);
+	if ((params.features&IORING_FEAT_SINGLE_MMAP)!=0) {if (lcqRing>lsqRing) lsqRing=lcqRing; lcqRing=lsqRing;}
+	if ((sqRing=mmap(0,lsqRing,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringFd,IORING_OFF_SQ_RING))==MAP_FAILED) return convCode(errno);
+	if ((params.features&IORING_FEAT_SINGLE_MMAP)!=0) cqRing=sqRing;
+	else if ((cqRing=mmap(0,lcqRing,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringFd,IORING_OFF_CQ_RING))==MAP_FAILED) return convCode(errno);
+	lsqes=params.sq_entries*sizeof(io_uring_sqe);
+	if ((sqes=(io_uring_sqe*)mmap(0,lsqes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringFd,IORING_OFF_SQES))==MAP_FAILED) return convCode(errno);
+
+	sqDepth=params.sq_entries;
+	sqTail=(unsigned*)((byte*)sqRing+params.sq_off.tail);
+	sqMask=*(unsigned*)((byte*)sqRing+params.sq_off.ring_mask);
+	sqArray=(unsigned*)((byte*)sqRing+params.sq_off.array);
+	cqHead=(unsigned*)((byte*)cqRing+params.cq_off.head);
+	cqTail=(unsigned*)((byte*)cqRing+params.cq_off.tail);
+	cqMask=*(unsigned*)((byte*)cqRing+params.cq_off.ring_mask);
+	cqes=(io_uring_cqe*)((byte*)cqRing+params.cq_off.cqes);
+	if (params.cq_entries<sqDepth) return RC_INVOP;		// in-flight limit relies on CQ never overflowing
+
+	// opcode probing appeared together with IORING_OP_READ/IORING_OP_WRITE (5.6)
+	const size_t lprobe=sizeof(io_uring_probe)+256*sizeof(io_uring_probe_op);
+	io_uring_probe *probe=(io_uring_probe*)alloca(lprobe); memset(probe,0,lprobe);
+	if (uring_register(ringFd,IORING_REGISTER_PROBE,probe,256)<0) return RC_INVOP;
+	static const byte ops[]={IORING_OP_READ,IORING_OP_WRITE,IORING_OP_READ_FIXED,IORING_OP_WRITE_FIXED,IORING_OP_NOP};
+	for (unsigned i=0; i<sizeof(ops); i++)
+		if (ops[i]>probe->last_op || (probe->ops[ops[i]].flags&IO_URING_OP_SUPPORTED)==0) return RC_INVOP;
+
+	// sparse table of registered descriptors indexed by FileID, filled in open()
+	int fds[FIO_MAX_OPENFILES]; for (int i=0; i<FIO_MAX_OPENFILES; i++) fds[i]=INVALID_FD;
+	fRegFiles=uring_register(ringFd,IORING_REGISTER_FILES,fds,FIO_MAX_OPENFILES)==0;
+
+	RC rc=createThread(_reaper,this,reaper); if (rc==RC_OK) fReaper=true;
+	return rc;
+}
+
+RC FileIOURing::open(FileID& fid,const char *fname,const char *dir,ulong flags)
+{
+	RC rc=FileIOLinux::open(fid,fname,dir,flags);
+	if (rc==RC_OK && fRegFiles) {
+		RWLockP rw(&lock,RW_X_LOCK);
+		if (fid<xSlotTab && fid<FIO_MAX_OPENFILES && slotTab[fid].isOpen()) updateFile(fid,slotTab[fid].osFile);
+	}
+	return rc;
+}
+
+RC FileIOURing::close(FileID fid)
+{
+	if (fRegFiles) {
+		RWLockP rw(&lock,RW_X_LOCK);
+		if (fid<FIO_MAX_OPENFILES && regFd[fid]!=INVALID_FD) updateFile(fid,INVALID_FD);
+	}
+	return FileIOLinux::close(fid);
+}
+
+void FileIOURing::closeAll(FileID start)
+{
+	if (fRegFiles) {
+		RWLockP rw(&lock,RW_X_LOCK);
+		for (FileID fid=start; fid<FIO_MAX_OPENFILES; fid++) if (regFd[fid]!=INVALID_FD) updateFile(fid,INVALID_FD);
+	}
+	FileIOLinux::closeAll(start);
+}
+
+void FileIOURing::updateFile(FileID fid,int fd)
+{
+	io_uring_files_update upd; memset(&upd,0,sizeof(upd));
+	upd.offset=fid; upd.fds=(uint64_t)(uintptr_t)&fd;
+	regFd[fid]=uring_register(ringFd,IORING_REGISTER_FILES_UPDATE,&upd,1)==1?fd:INVALID_FD;
+}
+
+RC FileIOURing::registerBuffers(void *buf,size_t lbuf)
+{
+	if (ringFd<0 || buf==NULL || lbuf==0) return RC_FALSE;
+	RWLockP rw(&lock,RW_X_LOCK); const unsigned nOld=nRegBufs;
+	for (byte *p=(byte*)buf,*end=p+lbuf; p<end; ) {
+		if (nRegBufs>=URING_MAX_REGBUFS) break;
+		const size_t l=min(size_t(end-p),size_t(URING_MAX_IOVEC)); unsigned i=nRegBufs;
+		for (; i>0 && regBufs[i-1].iov_base>(void*)p; i--) regBufs[i]=regBufs[i-1];
+		regBufs[i].iov_base=p; regBufs[i].iov_len=l; nRegBufs++; p+=l;
+	}
+	if (nRegBufs==nOld) return RC_FALSE;
+	if (nOld!=0) uring_register(ringFd,IORING_UNREGISTER_BUFFERS,NULL,0);
+	if (uring_register(ringFd,IORING_REGISTER_BUFFERS,regBufs,nRegBufs)<0) {
+		// most likely RLIMIT_MEMLOCK; i/o still works with unregistered buffers
+		RC rc=convCode(errno); nRegBufs=0;
+		report(MSG_WARNING,"io_uring: cannot register page buffers (%d)\n",errno);
+		return rc;
+	}
+	return RC_OK;
+}
+
+int FileIOURing::findBuffer(const void *buf,size_t lbuf) const
+{
+	unsigned n=nRegBufs,base=0;
+	while (n>0) {
+		unsigned k=n>>1; const iovec& iov=regBufs[base+k];
+		if ((byte*)buf<(byte*)iov.iov_base) n=k;
+		else if ((byte*)buf>=(byte*)iov.iov_base+iov.iov_len) {base+=k+1; n-=k+1;}
+		else return (byte*)buf+lbuf<=(byte*)iov.iov_base+iov.iov_len?int(base+k):-1;
+	}
+	return -1;
+}
+
+RC FileIOURing::listIO(int mode,int nent,iodesc* const* pcbs)
+{
+	URingReq **reqs=(URingReq**)alloca(sizeof(URingReq*)*nent); unsigned nReqs=0; RC rc=RC_OK; URingSync sync; int i;
+	lock.lock(RW_S_LOCK);
+	for (i=0; i<nent; i++) if (pcbs[i]!=NULL && pcbs[i]->aio_lio_opcode!=LIO_NOP) {
+		iodesc *pcb=pcbs[i]; FileID fid=pcb->aio_fildes; void *p;
+		assert(pcb->aio_nbytes>0 && pcb->aio_buf!=NULL);
+		pcb->aio_rc=RC_OK;
+		if (fid>=xSlotTab || !slotTab[fid].isOpen()) rc=pcb->aio_rc=RC_INVPARAM;
+		else if (pcb->aio_lio_opcode==LIO_READ && (off64_t)(pcb->aio_nbytes+pcb->aio_offset)>slotTab[fid].fileSize
+			&& (off64_t)(pcb->aio_nbytes+pcb->aio_offset)>(slotTab[fid].fileSize=getFileSz(slotTab[fid].osFile))) rc=pcb->aio_rc=RC_EOF;
+		else if ((p=freeReqs.alloc(sizeof(URingReq)))==NULL) rc=pcb->aio_rc=RC_NORESOURCES;
+		else {
+			if ((off64_t)(pcb->aio_nbytes+pcb->aio_offset)>slotTab[fid].fileSize) slotTab[fid].fSize=false;
+			const bool fFixed=fid<FIO_MAX_OPENFILES && regFd[fid]==slotTab[fid].osFile;
+			reqs[nReqs++]=new(p) URingReq(this,pcb,mode==LIO_WAIT?&sync:NULL,fFixed?(int)fid:slotTab[fid].osFile,fFixed,findBuffer(pcb->aio_buf,pcb->aio_nbytes));
+		}
+	}
+	lock.unlock();
+	if (mode!=LIO_WAIT && rc!=RC_OK) for (i=0; i<nent; i++)
+		if (pcbs[i]!=NULL && pcbs[i]->aio_lio_opcode!=LIO_NOP && pcbs[i]->aio_rc!=RC_OK) asyncIOCallback(pcbs[i]);
+	if (nReqs!=0) {
+		if (mode==LIO_WAIT) sync.cnt=nReqs;
+		submit(reqs,nReqs);
+		if (mode==LIO_WAIT) {
+			sync.lock.lock(); while (sync.cnt>0) sync.wait.wait(sync.lock,0); sync.lock.unlock();
+			for (i=0; i<nent; i++) if (pcbs[i]!=NULL && pcbs[i]->aio_lio_opcode!=LIO_NOP && pcbs[i]->aio_rc!=RC_OK) rc=pcbs[i]->aio_rc;
+		}
+	}
+	return rc;
+}
+
+void FileIOURing::submit(URingReq *const *reqs,unsigned nReqs,bool fReserved)
+{
+	for (unsigned i=0,n; i<nReqs; i+=n) {
+		n=nReqs-i;
+		if (!fReserved) {
+			// number of requests in flight never exceeds SQ size, so CQ (twice as large) can't overflow
+			slotLock.lock(); while (nInFlight>=sqDepth) slotWait.wait(slotLock,0);
+			if (n>sqDepth-nInFlight) n=sqDepth-nInFlight; nInFlight+=n; slotLock.unlock();
+		} else if (n>sqDepth) n=sqDepth;
+		sqLock.lock(); unsigned tail=*sqTail;
+		for (unsigned j=0; j<n; j++,tail++) {unsigned idx=tail&sqMask; prepare(reqs[i+j],&sqes[idx]); sqArray[idx]=idx;}
+		__atomic_store_n(sqTail,tail,__ATOMIC_RELEASE);
+		for (unsigned left=n; left!=0; ) {
+			int res=uring_enter(ringFd,left,0,0);
+			if (res>0) left-=res;
+			else if (res<0 && errno!=EINTR && errno!=EAGAIN && errno!=EBUSY) {report(MSG_CRIT,"io_uring_enter failed (%d)\n",errno); break;}
+			else threadYield();
+		}
+		sqLock.unlock();
+	}
+}
+
+void FileIOURing::prepare(const URingReq *req,io_uring_sqe *sqe) const
+{
+	const iodesc *pcb=req->pcb; const bool fWrite=pcb->aio_lio_opcode==LIO_WRITE;
+	memset(sqe,0,sizeof(io_uring_sqe));
+	if (req->bufIdx<0) sqe->opcode=fWrite?IORING_OP_WRITE:IORING_OP_READ;
+	else {sqe->opcode=fWrite?IORING_OP_WRITE_FIXED:IORING_OP_READ_FIXED; sqe->buf_index=(uint16_t)req->bufIdx;}
+	if (req->fFixedFile) sqe->flags=IOSQE_FIXED_FILE;
+	sqe->fd=req->fd;
+	sqe->addr=(uint64_t)(uintptr_t)((byte*)pcb->aio_buf+req->done);
+	sqe->len=(uint32_t)(pcb->aio_nbytes-req->done);
+	sqe->off=(uint64_t)(pcb->aio_offset+req->done);
+	sqe->user_data=(uint64_t)(uintptr_t)req;
+}
+
+void FileIOURing::complete(URingReq *req,int res)
+{
+	iodesc *pcb=req->pcb;
+	if (res==-EINTR || res==-EAGAIN) {submit(&req,1,true); return;}
+	if (res<0) pcb->aio_rc=convCode(-res);
+	else if ((req->done+=res)<pcb->aio_nbytes) {
+		if (res!=0) {submit(&req,1,true); return;}		// short transfer: continue from where it stopped
+		pcb->aio_rc=RC_EOF;
+	}
+	slotLock.lock(); if (nInFlight--==sqDepth) slotWait.signal(); slotLock.unlock();
+	if (req->sync!=NULL) {
+		URingSync *sync=req->sync; req->destroy();
+		sync->lock.lock(); if (--sync->cnt==0) sync->wait.signal(); sync->lock.unlock();
+	} else if (!RequestQueue::postRequest(req,NULL,RQ_IO)) {
+		if (asyncIOCallback!=NULL) asyncIOCallback(pcb); req->destroy();
+	}
+}
+
+void FileIOURing::reap()
+{
+	for (;;) {
+		unsigned head=*cqHead,tail=__atomic_load_n(cqTail,__ATOMIC_ACQUIRE);
+		if (head==tail) {
+			if (uring_enter(ringFd,0,1,IORING_ENTER_GETEVENTS)<0 && errno!=EINTR && errno!=EAGAIN)
+				{report(MSG_CRIT,"io_uring_enter failed in completion thread (%d)\n",errno); threadSleep(10);}
+			continue;
+		}
+		for (; head!=tail; ++head) {
+			const io_uring_cqe *cqe=&cqes[head&cqMask]; URingReq *req=(URingReq*)(uintptr_t)cqe->user_data; int res=cqe->res;
+			__atomic_store_n(cqHead,head+1,__ATOMIC_RELEASE);
+			if (req!=NULL) complete(req,res); else if (fStop) return;
+		}
+	}
+}
+
+void *FileIOURing::_reaper(void *param)
+{
+	sigset_t sigs; sigemptyset(&sigs); sigaddset(&sigs,SIGAFYAIO); sigaddset(&sigs,SIGAFYSIO);
+	pthread_sigmask(SIG_BLOCK,&sigs,0);
+	((FileIOURing*)param)->reap();
+	return NULL;
+}
+
+IStoreIO *AfyKernel::getStoreIOURing()
+{
+	FileIOURing *fio=NULL;
+	try {
+		if ((fio=new(STORE_HEAP) FileIOURing)!=NULL) {
+			RC rc=fio->setup();
+			if (rc!=RC_OK) {report(MSG_INFO,"io_uring is not available (%d), using POSIX aio\n",rc); fio->~FileIOURing(); free(fio,STORE_HEAP); fio=NULL;}
+		}
+	} catch (...) {report(MSG_ERROR,"Exception in getStoreIOURing\n"); fio=NULL;}
+	return fio;
+}
+
+#else
+
+IStoreIO *AfyKernel::getStoreIOURing()
+{
+	return NULL;
+}
+
+#endif
+
+#endif
+#endif
@@ -0,0 +1,109 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+/**
+ * io_uring based file i/o for Linux platforms
+ */
+#ifndef _FIOURING_H_
+#define _FIOURING_H_
+
+#ifdef _LINUX
+#ifndef Darwin
+
+#include "fiolinux.h"
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define	STORE_IO_URING
+#endif
+
+#ifdef STORE_IO_URING
+
+#define	URING_DEPTH				256					/**< number of submission queue entries */
+#define	URING_MAX_REGBUFS		256					/**< maximum number of registered buffer regions */
+#define	URING_MAX_IOVEC			0x40000000			/**< maximum length of one registered region (kernel limit) */
+
+namespace AfyKernel
+{
+	struct URingReq;
+	struct URingSync;
+
+	/**
+	 * io_uring file i/o manager
+	 * file open/close/grow operations are inherited from FileIOLinux
+	 * data file descriptors and page buffer regions are registered with the ring,
+	 * completions are reaped by a dedicated thread instead of aio signals
+	 */
+	class FileIOURing : public FileIOLinux
+	{
+		int					ringFd;
+		unsigned			sqDepth;
+		void				*sqRing;
+		size_t				lsqRing;
+		void				*cqRing;
+		size_t				lcqRing;
+		io_uring_sqe		*sqes;
+		size_t				lsqes;
+		unsigned			*sqTail;
+		unsigned			sqMask;
+		unsigned			*sqArray;
+		unsigned			*cqHead;
+		unsigned			*cqTail;
+		unsigned			cqMask;
+		io_uring_cqe		*cqes;
+		Mutex				sqLock;
+		Mutex				slotLock;
+		Event				slotWait;
+		unsigned			nInFlight;
+		bool				fRegFiles;
+		int					regFd[FIO_MAX_OPENFILES];
+		iovec				regBufs[URING_MAX_REGBUFS];
+		unsigned			nRegBufs;
+		HTHREAD				reaper;
+		bool				fReaper;
+		volatile bool		fStop;
+		static	FreeQ<>		freeReqs;
+	public:
+		FileIOURing();
+		~FileIOURing();
+		RC		setup();
+		const char *getType() const {return "fiouring";}
+		RC		open(FileID& fid,const char *fname,const char *dir,ulong flags);
+		RC		close(FileID fid);
+		void	closeAll(FileID start);
+		RC		listIO(int mode,int nent,iodesc* const* pcbs);
+		RC		registerBuffers(void *buf,size_t lbuf);
+		void	destroy() {this->~FileIOURing();}
+	private:
+		void	submit(URingReq *const *reqs,unsigned nReqs,bool fReserved=false);
+		void	prepare(const URingReq *req,io_uring_sqe *sqe) const;
+		void	complete(URingReq *req,int res);
+		void	updateFile(FileID fid,int fd);
+		int		findBuffer(const void *buf,size_t lbuf) const;
+		void	reap();
+		static	void	*_reaper(void *param);
+		friend	struct	URingReq;
+	};
+};
+
+#endif
+#endif
+#endif
+#endif
@@ -238,6 +238,7 @@ RC FTIndexMgr::rebuildIndex(Session *ses)
 	RC rc=RC_OK; MiniTx tx(ses,MTX_FLUSH|MTX_GLOB);
 	if ((rc=indexFT.dropTree())==RC_OK) {
 		PINEx qr(ses),*pqr=&qr; ses->resetAbortQ(); QCtx qc(ses); qc.ref();
+		BufStrategy bulk(BAS_BULK); BufStrategyP bsp(ses,&bulk);
 		FullScan fs(&qc,HOH_DELETED|HOH_HIDDEN); fs.connect(&pqr); RWLockP lck(&lock,RW_X_LOCK);
 		while ((rc=fs.next())==RC_OK) {
 #if 0
@@ -62,6 +62,8 @@ class TreeScanImpl : public TreeScan, public TreeCtx, public LatchHolder
 	ulong					stamp;
 	SearchKey				*savedKey;
 	size_t					lKeyBuf;
+	SearchKey				*skipKey;
+	size_t					lSkipBuf;
 
 	PBlock					*subpg;
 	PageID					sPage;
@@ -88,6 +90,15 @@ private:
 		else if (lKeyBuf<sizeof(SearchKey)+lk) savedKey=(SearchKey*)ses->realloc(savedKey,lKeyBuf=sizeof(SearchKey)+lk);
 		if (savedKey!=NULL) if (tp!=NULL) tp->getKey(ushort(index),*savedKey); else new(savedKey) SearchKey;
 	}
+	const SearchKey *hyperSkip(ushort lPrefix,const byte *sfx,ushort lsfx) {
+		if (lPrefix==0) return NULL; size_t l=sizeof(SearchKey)+lPrefix+(sfx!=NULL?lsfx:1);
+		if (skipKey==NULL) skipKey=(SearchKey*)ses->malloc(lSkipBuf=l);
+		else if (lSkipBuf<l) skipKey=(SearchKey*)ses->realloc(skipKey,lSkipBuf=l);
+		if (skipKey==NULL) {lSkipBuf=0; return NULL;}
+		byte *p=(byte*)(skipKey+1); ushort lk=setSkipKey(p,savedKey->getPtr2(),lPrefix,sfx,lsfx);
+		if (cmpMSeg(p,lk,savedKey->getPtr2(),savedKey->v.ptr.l)<=0) return NULL;
+		skipKey->type=KT_VAR; skipKey->loc=SearchKey::PLC_SPTR; skipKey->v.ptr.p=p; skipKey->v.ptr.l=lk; return skipKey;
+	}
 	void findSubPage(const byte *k,size_t lk,bool fF=true) {
 		if (subpg!=NULL) {subpg->release(0,ses); subpg=NULL;}
 		if ((state&SC_KEYSET)==0 || pb.isNull() && !restore()) return;
@@ -140,7 +151,7 @@ private:
 public:
 	TreeScanImpl(Session *se,Tree& tr,const SearchKey *st,const SearchKey *fi,ulong flgs,const IndexSeg *sg,unsigned nS,IKeyCallback *kcb)
 		: TreeCtx(tr),LatchHolder(se),ses(se),ctx(ses->getStore()),state(flgs|SC_INIT),start(st),finish(fi),segs(sg),nSegs(nS),keycb(kcb),fHyper(false),
-		kPage(INVALID_PAGEID),lsn(0),stamp(0),savedKey(NULL),lKeyBuf(0),subpg(NULL),sPage(INVALID_PAGEID),stamp2(0),ps(NULL),pe(NULL),ptr(NULL),
+		kPage(INVALID_PAGEID),lsn(0),stamp(0),savedKey(NULL),lKeyBuf(0),skipKey(NULL),lSkipBuf(0),subpg(NULL),sPage(INVALID_PAGEID),stamp2(0),ps(NULL),pe(NULL),ptr(NULL),
 		lElt(0),buf(NULL),lbuf(0),ldata(0),lpref(0),bufsht(0)
 	{
 			IndexFormat ifmt=tr.indexFormat(); if (ifmt.isUnique()) state|=SC_UNIQUE;
@@ -152,7 +163,7 @@ public:
 	}
 	virtual ~TreeScanImpl() {
 		pb.release(ses); parent.release(ses); if (subpg!=NULL) subpg->release(0,ses);
-		if (savedKey!=NULL) ses->free(savedKey); if (buf!=NULL) ses->free(buf);
+		if (savedKey!=NULL) ses->free(savedKey); if (skipKey!=NULL) ses->free(skipKey); if (buf!=NULL) ses->free(buf);
 	}
 	void operator delete(void *p) {if (p!=NULL) ((TreeScanImpl*)p)->ses->free(p);}
 	RC nextKey(GO_DIR op=GO_NEXT,const SearchKey *skip=NULL) {
@@ -292,11 +303,21 @@ public:
 retkey:
 			state|=SC_KEYSET;
 			if (fHyper) {
-				skip=NULL; saveKey(); if (savedKey==NULL) return RC_NORESOURCES;
-				if (start!=NULL && !checkHyperRect(start->getPtr2(),start->v.ptr.l,savedKey->getPtr2(),savedKey->v.ptr.l,segs,nSegs,true) ||
-					finish!=NULL && !checkHyperRect(savedKey->getPtr2(),savedKey->v.ptr.l,finish->getPtr2(),finish->v.ptr.l,segs,nSegs,false))
-						{op=fF?GO_NEXT:GO_PREVIOUS; continue;}
-				// exclude boundaries, skip to next
+				skip=NULL; saveKey(); if (savedKey==NULL) return RC_NORESOURCES; ushort lk=0,lb=0;
+				if (start!=NULL && !checkHyperRect(start->getPtr2(),start->v.ptr.l,savedKey->getPtr2(),savedKey->v.ptr.l,segs,nSegs,true,&lb,&lk))
+					{if (fF) skip=hyperSkip(lk,start->getPtr2()+lb,ushort(start->v.ptr.l-lb));}
+				else if (finish!=NULL && !checkHyperRect(savedKey->getPtr2(),savedKey->v.ptr.l,finish->getPtr2(),finish->v.ptr.l,segs,nSegs,false,&lk,&lb))
+					{if (fF) skip=hyperSkip(lk,NULL,0);}
+				else {if (keycb!=NULL) keycb->newKey(); return RC_OK;}
+				op=fF?GO_NEXT:GO_PREVIOUS; if (skip==NULL) continue;
+				// skip-scan: jump over keys with the same leading segments, first within the current leaf page, then by a new descent
+				const TreePageMgr::TreePage* tp=(const TreePageMgr::TreePage*)pb->getPageBuf(); ++ctx->treeMgr->skipScan;
+				if (tp->findKey(*skip,index) && index<(ulong)tp->info.nSearchKeys) goto retkey;
+				if (index<(ulong)tp->info.nSearchKeys) {
+					if (checkBounds(tp,true)) goto retkey;
+					pb.release(ses); state=state&~SC_KEYSET|SC_EOF; return RC_EOF;
+				}
+				pb.release(ses); parent.release(ses); depth=0; state|=SC_INIT; continue;
 			}
 			if (keycb!=NULL) keycb->newKey(); return RC_OK;
 		}
@@ -107,7 +107,7 @@ public:
 
 };
 
-TreeMgr::TreeMgr(StoreCtx *ct,ulong timeout) : ctx(ct)
+TreeMgr::TreeMgr(StoreCtx *ct,ulong timeout,float fill) : ctx(ct),bulkFill(fill>=0.5f&&fill<=1.f?fill:DEFAULT_INDEX_FILL)
 {
 	if ((ptrt=new(ct) TreeRQTable(DEFAULT_TREERQ_SIZE))==NULL) throw RC_NORESOURCES;
 	memset(factoryTable,0,sizeof(factoryTable));
@@ -116,7 +116,7 @@ TreeMgr::TreeMgr(StoreCtx *ct,ulong timeout) : ctx(ct)
 TreeMgr::~TreeMgr()
 {
 	if (traverse!=0 && (ctx->mode&STARTUP_PRINT_STATS)!=0)
-		report(MSG_INFO,"\tIndex access stats: %d/%d/%g/%d\n",(long)sideLink,(long)pageRead,double(pageRead)/double(traverse),(long)sibRead);
+		report(MSG_INFO,"\tIndex access stats: %d/%d/%g/%d, unlatched: %d/%d, skip-scan: %d\n",(long)sideLink,(long)pageRead,double(pageRead)/double(traverse),(long)sibRead,(long)optRead,(long)optFail,(long)skipScan);
 	//delete ptrt;
 }
 
@@ -240,12 +240,50 @@ RC TreeCtx::getPreviousPage(bool fRead)
 	return RC_NOTFOUND;
 }
 
+PBlock *TreeCtx::descend(PageID& pid,const SearchKey *key,int& level,int stop,long& ver)
+{
+	// interior pages above 'stop' level are read without latching; a page read is valid if the latch version of the page and
+	// of its parent didn't change, i.e. no split, merge or drop happened in between (drops are preceded by parent updates);
+	// the descent stops at a page which needs a latch (leaf, sibling link, empty page), the caller latches it and validates
+	// the returned (fixed, unlatched) parent against 'ver'; if any validation fails the descent restarts from the root;
+	// startRead() and validate() fence the page reads, child index and page ID are bounds-checked before the page is validated
+	StoreCtx *ctx=tree->getStoreCtx(); Session *ses=Session::getSession(); const size_t lPage=ctx->bufMgr->getPageSize(); ulong kpos=~0ul; long cver=0;
+	const PageID start=pid; const ulong dp=depth; const int lstart=level; PBlock *par=NULL,*cur=ctx->bufMgr->fixPage(pid,ctx->trpgMgr,ses);
+	if (cur!=NULL && !cur->startRead(cver)) {ctx->bufMgr->unfixPage(cur); cur=NULL;}
+	while (cur!=NULL) {
+		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)cur->getPageBuf(); const int lvl=tp->info.level;
+		if (lvl<=stop || lvl>TREE_MAX_DEPTH || depth>=TREE_MAX_DEPTH || tp->info.nSearchKeys==0 || !tp->info.fmt.isFixedLenData()) break;
+		const ulong stamp=tp->info.stamp; const PageID child=key!=NULL?tp->getChildUnlatched(*key,kpos,lPage):tp->info.leftMost;
+		if (child==INVALID_PAGEID || child==pid || key!=NULL && tp->checkSibling(*key) || !cur->validate(cver)) break;
+		if (par!=NULL) ctx->bufMgr->unfixPage(par);
+		par=cur; ver=cver; cur=NULL; stack[depth++]=pid; if (lvl==1) stamps[PITREE_1STLEV]=stamp;
+		pid=child; level=lvl-1; ++ctx->treeMgr->pageRead; ++ctx->treeMgr->optRead;
+		if (level<=stop || (cur=ctx->bufMgr->fixPage(pid,ctx->trpgMgr,ses))==NULL) break;
+		if (!cur->startRead(cver)) {ctx->bufMgr->unfixPage(cur); cur=NULL; break;}
+		if (!par->validate(ver)) {
+			ctx->bufMgr->unfixPage(cur); ctx->bufMgr->unfixPage(par); cur=par=NULL;
+			++ctx->treeMgr->optFail; pid=start; depth=dp; level=lstart; break;
+		}
+	}
+	if (cur!=NULL) ctx->bufMgr->unfixPage(cur);
+	return par;
+}
+
+bool TreeCtx::revalidate(PBlock *&par,long ver,PageID& pid,PageID root,ulong d0,int& level,int l0)
+{
+	StoreCtx *ctx=tree->getStoreCtx(); const bool fValid=par->validate(ver); ctx->bufMgr->unfixPage(par); par=NULL;
+	if (!fValid) {pb.release(); ++ctx->treeMgr->optFail; pid=root; depth=d0; level=l0;}
+	return fValid;
+}
+
 RC TreeCtx::findPage(const SearchKey *key)
 {
 	StoreCtx *ctx=tree->getStoreCtx(); getStamps(stamps);
 	int level=-1; PageID pid=startPage(key,level); parent.moveTo(pb);
 	ulong xlock=(mode&TF_WITHDEL)!=0?PGCTL_COUPLE:0,kpos=~0ul; ++ctx->treeMgr->traverse;
+	const PageID root=pid; const ulong d0=depth; const int l0=level; long ver=0; PBlock *opt=pid!=INVALID_PAGEID?descend(pid,key,level,0,ver):(PBlock*)0;
 	if (pid!=INVALID_PAGEID) while (pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL) {
+		if (opt!=NULL && !revalidate(opt,ver,pid,root,d0,level,l0)) continue;
 		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)pb->getPageBuf();
 		++ctx->treeMgr->pageRead; if (tp->info.level>TREE_MAX_DEPTH) break;
 		if (tp->info.nSearchKeys==0 && depth>0 && key!=NULL)
@@ -261,14 +299,18 @@ RC TreeCtx::findPage(const SearchKey *key)
 			if ((pid=key!=NULL?tp->getChild(*key,kpos,false):tp->info.leftMost)==INVALID_PAGEID) break;
 		}
 	}
+	if (opt!=NULL) ctx->bufMgr->unfixPage(opt);
 	pb.release(); return RC_NOTFOUND;
 }
 
 RC TreeCtx::findPageForUpdate(const SearchKey *key,bool fIns)
 {
 	StoreCtx *ctx=tree->getStoreCtx(); ++ctx->treeMgr->traverse; getStamps(stamps); assert(key!=NULL);
-	int level=-1; PageID pid=startPage(key,level,false); unsigned xlock=level==0||level==1?PGCTL_ULOCK:0; ulong kpos=~0u;
+	int level=-1; PageID pid=startPage(key,level,false); const PageID root=pid; const ulong d0=depth; const int l0=level;
+	long ver=0; PBlock *opt=pid!=INVALID_PAGEID?descend(pid,key,level,2,ver):(PBlock*)0;
+	unsigned xlock=level==0||level==1?PGCTL_ULOCK:0; ulong kpos=~0u;
 	while (pid!=INVALID_PAGEID && pb.getPage(pid,ctx->trpgMgr,xlock)!=NULL) {
+		if (opt!=NULL && !revalidate(opt,ver,pid,root,d0,level,l0)) {xlock=level==0||level==1?PGCTL_ULOCK:0; continue;}
 		++ctx->treeMgr->pageRead; xlock&=~PGCTL_COUPLE;
 		const TreePageMgr::TreePage *tp=(const TreePageMgr::TreePage*)pb->getPageBuf();
 		if (tp->info.level>TREE_MAX_DEPTH) break;
@@ -291,6 +333,7 @@ RC TreeCtx::findPageForUpdate(const SearchKey *key,bool fIns)
 			if (!parent.isSet(QMGR_UFORCE)) parent.release(); stamps[PITREE_LEAF]=tree->getStamp(PITREE_LEAF); return RC_OK;
 		}
 	}
+	if (opt!=NULL) ctx->bufMgr->unfixPage(opt);
 	parent.release(); pb.release(); return RC_NOTFOUND;
 }
 
@@ -904,6 +947,19 @@ int AfyKernel::cmpMSeg(const byte *s1,ushort l1,const byte *s2,ushort l2)
 	return -2;
 }
 
+int AfyKernel::cmpMSegPrefix(const byte *s1,ushort l1,const byte *s2,ushort l2,unsigned *pnEq)
+{
+	unsigned nEq=0; int cmp=-2;
+	try {
+		do {if ((cmp=cmpSeg(s1,l1,s2,l2))!=0) break; nEq++;} while (l1*l2!=0);
+		if (cmp==0 && l1!=0) cmp=1;
+	} catch (int) {
+		cmp=-2;
+	}
+	if (pnEq!=NULL) *pnEq=nEq;
+	return cmp;
+}
+
 bool AfyKernel::isHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2)
 {
 	try {
@@ -930,13 +986,17 @@ bool AfyKernel::cmpBound(const byte *s1,ushort l1,const byte *s2,ushort l2,const
 	return false;
 }
 
-bool AfyKernel::checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart)
+bool AfyKernel::checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart,ushort *pOff1,ushort *pOff2)
 {
 	try {
-		unsigned i=0;
+		unsigned i=0; const byte *const b1=s1,*const b2=s2;
 		do {
+			const byte *const p1=s1,*const p2=s2;
 			int cmp=cmpSeg(s1,l1,s2,l2,sg==0||(sg[i].flags&SCAN_PREFIX)==0?0:fStart?1:2);
-			if (cmp>0 || cmp==0 && sg!=NULL && (sg[i].flags&(fStart?SCAN_EXCLUDE_START:SCAN_EXCLUDE_END))!=0) return false;
+			if (cmp>0 || cmp==0 && sg!=NULL && (sg[i].flags&(fStart?SCAN_EXCLUDE_START:SCAN_EXCLUDE_END))!=0) {
+				if (pOff1!=NULL) *pOff1=ushort(p1-b1); if (pOff2!=NULL) *pOff2=ushort(p2-b2);
+				return false;
+			}
 		} while (l1*l2!=0 && (sg==NULL||++i<nSegs));
 		return true;
 	} catch (int) {
@@ -945,6 +1005,19 @@ bool AfyKernel::checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2
 	return false;
 }
 
+ushort AfyKernel::firstSegLength(const byte *s,ushort l)
+{
+	const byte *s2=s,*const s0=s; ushort l2=l;
+	try {if (l!=0) cmpSeg(s,l,s2,l2);} catch (int) {return 0;}
+	return ushort(s-s0);
+}
+
+ushort AfyKernel::setSkipKey(byte *buf,const byte *key,ushort lPrefix,const byte *sfx,ushort lsfx)
+{
+	memcpy(buf,key,lPrefix); if (sfx!=NULL) {memcpy(buf+lPrefix,sfx,lsfx); return lPrefix+lsfx;}
+	buf[lPrefix]=0x90|KVT_NULL; return lPrefix+1;
+}
+
 ushort AfyKernel::calcMSegPrefix(const byte *s1,ushort l1,const byte *s2,ushort l2)
 {
 	for (ushort lPrefix=0;;) {
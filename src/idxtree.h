@@ -53,9 +53,12 @@ enum TREE_KT
  * KT_VAR helper functions
  */
 extern	int		cmpMSeg(const byte *s1,ushort l1,const byte *s2,ushort l2);
+extern	int		cmpMSegPrefix(const byte *s1,ushort l1,const byte *s2,ushort l2,unsigned *pnEq=NULL);
 extern	bool	isHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2);
 extern	bool	cmpBound(const byte *p1,ushort l1,const byte *p2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart);
-extern	bool	checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart);
+extern	bool	checkHyperRect(const byte *s1,ushort l1,const byte *s2,ushort l2,const IndexSeg *sg,unsigned nSegs,bool fStart,ushort *pOff1=NULL,ushort *pOff2=NULL);
+extern	ushort	firstSegLength(const byte *s,ushort l);
+extern	ushort	setSkipKey(byte *buf,const byte *key,ushort lPrefix,const byte *sfx,ushort lsfx);
 extern	ushort	calcMSegPrefix(const byte *s1,ushort l1,const byte *s2,ushort l2);
 
 /**
@@ -219,6 +222,7 @@ struct CheckTreeReport
 #define	TF_WITHDEL		0x0001			/**< index allows deletions */
 #define	TF_SPLITINTX	0x0002			/**< split operations don't require separate transactions */
 #define	TF_NOPOST		0x0004			/**< no tree repair operations to be posted */
+#define	TF_BULKLOAD		0x0008			/**< keys mostly arrive in ascending order: rightmost pages are filled up to TreeMgr::bulkFill and split at the end */
 
 /**
  * multi-key insert interface
@@ -376,8 +380,12 @@ public:
 	SharedCounter		traverse;
 	SharedCounter		pageRead;
 	SharedCounter		sibRead;
+	SharedCounter		optRead;
+	SharedCounter		optFail;
+	SharedCounter		skipScan;
+	const	float		bulkFill;
 public:
-	TreeMgr(StoreCtx *ct,ulong timeout);
+	TreeMgr(StoreCtx *ct,ulong timeout,float fill);
 	virtual ~TreeMgr();
 	void	*operator new(size_t s,StoreCtx *ctx);
 	RC		registerFactory(TreeFactory& factory);
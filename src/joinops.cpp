@@ -23,6 +23,7 @@ Written by Mark Venguerov 2004-2012
 #include "parser.h"
 #include "stmt.h"
 #include "expr.h"
+#include "extsort.h"
 
 using namespace AfyKernel;
 
@@ -48,7 +49,7 @@ void MergeIDs::connect(PINEx **results,unsigned nRes)
 	} else for (ulong i=0; i<nOps; i++) ops[i].qop->connect(results,nRes);	///???
 }
 
-RC MergeIDs::next(const PINEx *skip)
+RC MergeIDs::advance(const PINEx *skip)
 {
 	RC rc=RC_OK; int cmp=0; if ((state&QST_EOF)!=0) return RC_EOF;
 	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
@@ -102,6 +103,14 @@ RC MergeIDs::rewind()
 	cur=~0u; state=state&~QST_EOF|QST_BOF; return RC_OK;
 }
 
+RC MergeIDs::reset()
+{
+	RC rc;
+	for (ulong i=0; i<nOps; i++) {if ((rc=ops[i].qop->reset())!=RC_OK) return rc; ops[i].state=QOS_ADV; ops[i].epr.lref=0;}
+	if (pqr!=NULL) {pqr->cleanup(); *pqr=PIN::defPID;}
+	cur=~0u; state=QST_INIT; return RC_OK;
+}
+
 RC MergeIDs::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	RC rc=RC_NOTFOUND;
@@ -116,7 +125,7 @@ RC MergeIDs::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,M
 
 void MergeIDs::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append(j_ops[op],strlen(j_ops[op])); buf.append("\n",1);
+	buf.fill('\t',level); buf.append(j_ops[op],strlen(j_ops[op])); printStats(buf); buf.append("\n",1);
 	for (ulong i=0; i<nOps; i++) ops[i].qop->print(buf,level+1);
 }
 
@@ -178,7 +187,7 @@ void MergeOp::connect(PINEx **results,unsigned nRes)
 	}
 }
 
-RC MergeOp::next(const PINEx *skip)
+RC MergeOp::advance(const PINEx *skip)
 {
 	RC rc; PID id; if ((state&QST_EOF)!=0) return RC_EOF;
 	if ((state&QST_INIT)!=0) {
@@ -294,6 +303,16 @@ RC MergeOp::rewind()
 	return rc;
 }
 
+RC MergeOp::reset()
+{
+	if (pids!=NULL) {delete pids; pids=NULL;}
+	cleanup(pV1); cleanup(pV2); cleanup(pVS); pR->cleanup();
+	RC rc=queryOp!=NULL?queryOp->reset():RC_OK;
+	if (rc==RC_OK && queryOp2!=NULL) rc=queryOp2->reset();
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
 RC MergeOp::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	if (didx!=~0u) {
@@ -318,7 +337,7 @@ void MergeOp::print(SOutCtx& buf,int level) const
 			if (ce->next!=NULL) buf.append(" and ",5);
 		}
 	}
-	buf.append("\n",1);
+	printStats(buf); buf.append("\n",1);
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 	if (queryOp2!=NULL) queryOp2->print(buf,level+1);
 }
@@ -330,7 +349,16 @@ HashOp::~HashOp()
 	delete queryOp2; delete pids;
 }
 
-RC HashOp::next(const PINEx *skip)
+RC HashOp::reset()
+{
+	if (pids!=NULL) {delete pids; pids=NULL;}
+	RC rc=queryOp->reset();
+	if (rc==RC_OK && queryOp2!=NULL) rc=queryOp2->reset();
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
+RC HashOp::advance(const PINEx *skip)
 {
 	RC rc=RC_OK;
 	if ((state&QST_INIT)!=0) {
@@ -353,7 +381,374 @@ RC HashOp::next(const PINEx *skip)
 
 void HashOp::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("lookup\n",7);
+	buf.fill('\t',level); buf.append("lookup",6); printStats(buf); buf.append("\n",1);
+	if (queryOp!=NULL) queryOp->print(buf,level+1);
+	if (queryOp2!=NULL) queryOp2->print(buf,level+1);
+}
+
+//------------------------------------------------------------------------------------------------
+
+#define	HJ_PART_BITS	4						/**< number of high hash bits selecting a spill partition */
+#define	HJ_NPARTS		(1<<HJ_PART_BITS)		/**< number of spill partitions */
+#define	HJ_MIN_BUCKETS	256						/**< initial size of the hash table, must be a power of 2 */
+
+namespace AfyKernel
+{
+	/**
+	 * hash table entry
+	 * followed by the PIN reference of the build result and its join values
+	 */
+	struct HJEntry
+	{
+		HJEntry		*next;
+		uint32_t	hash;
+		EncPINRef	*ref() const {return (EncPINRef*)(this+1);}
+		Value		*vals() const {return (Value*)getValues(ref());}
+	};
+};
+
+/**
+ * hash of a join value, consistent with cmp(): numbers (including strings representing numbers) are hashed by their double value
+ * values which can be equal to values of different types in a less predictable way hash to 0
+ */
+static uint32_t hashValue(const Value& v,ulong flags)
+{
+	Value w; const Value *pv=&v; uint64_t u; double d;
+	if (isString((ValueType)v.type) && v.str!=NULL && testStrNum(v.str,v.length,w)) pv=&w;
+	switch (pv->type) {
+	default: return 0;
+	case VT_INT: d=pv->i; break;
+	case VT_UINT: d=pv->ui; break;
+	case VT_INT64: d=(double)pv->i64; break;
+	case VT_UINT64: d=(double)pv->ui64; break;
+	case VT_FLOAT: if (pv->qval.units!=Un_NDIM) return 0; d=pv->f; break;
+	case VT_DOUBLE: if (pv->qval.units!=Un_NDIM) return 0; d=pv->d; break;
+	case VT_BOOL: u=pv->b?1:2; goto mix;
+	case VT_URIID: u=pv->uid; goto mix;
+	case VT_IDENTITY: u=pv->iid; goto mix;
+	case VT_DATETIME: case VT_INTERVAL: u=pv->ui64; goto mix;
+	case VT_REFID: u=pv->id.pid^uint64_t(pv->id.ident)<<48; goto mix;
+	case VT_REF: {const PID& id=pv->pin->getPID(); u=id.pid^uint64_t(id.ident)<<48;} goto mix;
+	case VT_STRING: case VT_BSTR: case VT_URL:
+		{uint32_t h=2166136261u; const byte *p=pv->bstr; const bool fNCase=(flags&CND_NCASE)!=0;
+		if (p!=NULL) for (uint32_t i=0; i<pv->length; i++) h=(h^(fNCase?byte(tolower(p[i])):p[i]))*16777619u;
+		return h;}
+	}
+	if (d==0.) d=0.; memcpy(&u,&d,sizeof(u));
+mix:
+	u^=u>>33; u*=0xFF51AFD7ED558CCDULL; u^=u>>33; u*=0xC4CEB9FE1A85EC53ULL; u^=u>>33;
+	return uint32_t(u);
+}
+
+/**
+ * collection join values are matched element by element: first and next combination of elements
+ */
+static bool firstKey(const Value *src,unsigned n,const Value **keys,unsigned *pos)
+{
+	for (unsigned i=0; i<n; i++) {
+		const Value& v=src[i]; pos[i]=0;
+		switch (v.type) {
+		case VT_ERROR: return false;
+		case VT_ARRAY: if (v.length==0) return false; keys[i]=&v.varray[0]; break;
+		case VT_COLLECTION: if ((keys[i]=v.nav->navigate(GO_FIRST))==NULL) return false; break;
+		default: keys[i]=&v; break;
+		}
+	}
+	return true;
+}
+
+static bool nextKey(const Value *src,unsigned n,const Value **keys,unsigned *pos)
+{
+	for (unsigned i=0; i<n; i++) {
+		const Value& v=src[i];
+		if (v.type==VT_ARRAY) {if (++pos[i]<v.length) {keys[i]=&v.varray[pos[i]]; return true;} keys[i]=&v.varray[pos[i]=0];}
+		else if (v.type==VT_COLLECTION) {if ((keys[i]=v.nav->navigate(GO_NEXT))!=NULL) return true; keys[i]=v.nav->navigate(GO_FIRST);}
+	}
+	return false;
+}
+
+__forceinline void openRun(ExtSortFile *es,InRun *ir,RunID run)
+{
+	es->rewind(run); ir->setRun(run,false);
+}
+
+HashJoin::HashJoin(QueryOp *qop1,QueryOp *qop2,const CondEJ *ce,unsigned ne,QUERY_SETOP qo,const Expr *const *cn,unsigned ncn,ulong qf,bool fS)
+	: QueryOp(qop1,qf|QO_JOIN|QO_UNIQUE),queryOp2(qop2),op(qo),ej(ce),nej(ne),fSwap(fS),conds(cn),nConds(ncn),pexR(qx->ses),pP(NULL),pB(&pexR),mem(qx->ses),
+	table(NULL),nBuckets(0),nEntries(0),memUsed(0),cur(NULL),hash(0),fKey(false),fMatched(false),esFile(NULL),parts(NULL),inRun(NULL),curPart(0),fNext(false),
+	fMulti(false),nMulti(0),iMulti(0),mflags(NULL),pK(vls),pVP(vls),pVB(vls+ne),keys((const Value**)(vls+ne*2)),pos((unsigned*)(keys+ne))
+{
+	assert(qo==QRY_JOIN||qo==QRY_SEMIJOIN||qo==QRY_LEFT_OUTER_JOIN||qo==QRY_RIGHT_OUTER_JOIN);
+	// both inputs are kept and spilled as single PIN references, see QBuildCtx::merge2()
+	assert(qop1->getNOuts()==1 && qop2->getNOuts()==1);
+	nOuts+=qop2->getNOuts();
+	if ((qf&QO_VCOPIED)!=0 && cn!=NULL && ncn!=0) {
+		Expr **pex; if ((conds=pex=new(qx->ses) Expr*[ncn])==NULL) throw RC_NORESOURCES;
+		memset(pex,0,ncn*sizeof(Expr*));
+		for (unsigned i=0; i<ncn; i++) if ((pex[i]=Expr::clone(cn[i],qx->ses))==NULL) throw RC_NORESOURCES;
+	}
+	for (unsigned i=0; i<ne; i++) {pVP[i].setError(); pVB[i].setError();}
+}
+
+HashJoin::~HashJoin()
+{
+	release();
+	if ((qflags&QO_VCOPIED)!=0) {
+		qx->ses->free((void*)ej);
+		if (nConds!=0) {
+			for (unsigned i=0; i<nConds; i++) if (conds[i]!=NULL) ((Expr*)conds[i])->destroy();
+			qx->ses->free((void*)conds);
+		}
+	}
+	delete queryOp2;
+}
+
+void HashJoin::connect(PINEx **results,unsigned nRes)
+{
+	if (results!=NULL && nRes!=0) {
+		res=results[0];
+		if (!fSwap) {
+			const unsigned nOuts1=queryOp->getNOuts(); pP=results[0];
+			queryOp->connect(results,nRes>nOuts1?nOuts1:nRes); if (nRes>nOuts1) pB=results[nOuts1];
+		} else {
+			pB=results[0];
+			if (nRes>1) {pP=results[1]; queryOp->connect(results+1,nRes-1);} else {pP=&pexR; queryOp->connect(&pP,1);}
+		}
+	}
+}
+
+RC HashJoin::loadKeys(QueryOp *qop,PINEx& qr,Value *pv,bool fBuild)
+{
+	RC rc=RC_OK; const CondEJ *ce=ej; PID id;
+	for (unsigned i=0; i<nej; i++,ce=ce->next) {
+		const PropertyID pid=fBuild==fSwap?ce->propID1:ce->propID2;
+		if (pid==PROP_SPEC_PINID) {if ((rc=qr.getID(id))==RC_OK) pv[i].set(id); else break;}
+		else if ((pv[i].property=pid,rc=qop->getData(qr,&pv[i],1))!=RC_OK) break;
+	}
+	return rc;
+}
+
+uint32_t HashJoin::hashKey() const
+{
+	uint32_t h=0; const CondEJ *ce=ej;
+	for (unsigned i=0; i<nej; i++,ce=ce->next) h=h*31+hashValue(*keys[i],ce->flags);
+	return h;
+}
+
+bool HashJoin::match(const HJEntry *he) const
+{
+	if (he->hash!=hash) return false;
+	const Value *pv=he->vals(); const CondEJ *ce=ej;
+	for (unsigned i=0; i<nej; i++,ce=ce->next) if (cmp(pv[i],*keys[i],ce->flags|CND_SORT)!=0) return false;
+	return true;
+}
+
+RC HashJoin::insert(const EncPINRef& epr,bool fPart)
+{
+	SubAlloc::SubMark mrk; mem.mark(mrk); RC rc=RC_OK;
+	HJEntry *he=(HJEntry*)mem.memalign(sizeof(HJEntry*),sizeof(HJEntry)+epr.trunc<8>()+nej*sizeof(Value)); if (he==NULL) return RC_NORESOURCES;
+	EncPINRef *ep=he->ref(); ep->flags=epr.flags; memcpy(ep->buf,epr.buf,ep->lref=epr.lref); he->hash=hash;
+	Value *pv=he->vals(); for (unsigned i=0; i<nej; i++) if ((rc=copyV(*keys[i],pv[i],&mem))!=RC_OK) {mem.truncate(mrk); return rc;}
+	if (fPart) {rc=parts[hash>>(32-HJ_PART_BITS)]->add(ep); mem.truncate(mrk); return rc;}
+	if (nEntries>=nBuckets) {
+		const ulong n=nBuckets==0?HJ_MIN_BUCKETS:nBuckets*2; HJEntry **tab=(HJEntry**)qx->ses->malloc(n*sizeof(HJEntry*));
+		if (tab==NULL) return RC_NORESOURCES; memset(tab,0,n*sizeof(HJEntry*));
+		for (ulong i=0; i<nBuckets; i++) for (HJEntry *e=table[i],*e2; e!=NULL; e=e2) {e2=e->next; HJEntry **pe=&tab[e->hash&(n-1)]; e->next=*pe; *pe=e;}
+		if (table!=NULL) qx->ses->free(table); memUsed+=(n-nBuckets)*sizeof(HJEntry*); table=tab; nBuckets=n;
+	}
+	HJEntry **pe=&table[hash&(nBuckets-1)]; he->next=*pe; *pe=he; nEntries++; memUsed+=mem.length(mrk);
+	return RC_OK;
+}
+
+RC HashJoin::build()
+{
+	PINEx qr(qx->ses),*pqr=&qr; RC rc; queryOp2->connect(&pqr);
+	while ((rc=queryOp2->next())==RC_OK) {
+		if ((rc=qx->ses->testAbortQ())!=RC_OK) break;
+		if (qr.epr.lref==0 && qr.getPID().pid!=STORE_INVALID_PID && (rc=qr.pack())!=RC_OK) break;
+		if ((rc=loadKeys(queryOp2,qr,pVB,true))==RC_OK) {
+			for (fKey=firstKey(pVB,nej,keys,pos); fKey; fKey=nextKey(pVB,nej,keys,pos))
+				{hash=hashKey(); if ((rc=insert(qr.epr,esFile!=NULL))!=RC_OK) break;}
+			if (rc==RC_OK && esFile==NULL && memUsed>DEFAULT_QUERY_MEM) rc=spill();
+		}
+		cleanup(pVB); qr.cleanup();
+		if (rc!=RC_OK && rc!=RC_NOACCESS && rc!=RC_DELETED && rc!=RC_NOTFOUND) break;
+	}
+	if (rc!=RC_EOF) return rc;
+	if (parts!=NULL) for (unsigned i=0; i<HJ_NPARTS; i++) {parts[i]->term(); delete parts[i]; parts[i]=NULL;}
+	return RC_OK;
+}
+
+RC HashJoin::spill()
+{
+	// build partition i is run i of the external file
+	RC rc; assert(esFile==NULL && parts==NULL);
+	if ((esFile=new(qx->ses) ExtSortFile(qx->ses,stats.lSpill))==NULL) return RC_NORESOURCES;
+	if ((parts=(OutRun**)qx->ses->malloc((HJ_NPARTS+1)*sizeof(OutRun*)))==NULL) return RC_NORESOURCES;
+	memset(parts,0,(HJ_NPARTS+1)*sizeof(OutRun*));
+	for (unsigned i=0; i<HJ_NPARTS; i++)
+		if ((parts[i]=new(qx->ses) OutRun(esFile,nej))==NULL) return RC_NORESOURCES;
+		else if ((rc=parts[i]->beginRun())!=RC_OK) return rc;
+	for (ulong i=0; i<nBuckets; i++) for (HJEntry *he=table[i]; he!=NULL; he=he->next)
+		if ((rc=parts[he->hash>>(32-HJ_PART_BITS)]->add(he->ref()))!=RC_OK) return rc;
+	memset(table,0,nBuckets*sizeof(HJEntry*)); nEntries=0; memUsed=nBuckets*sizeof(HJEntry*); mem.release();
+	return RC_OK;
+}
+
+RC HashJoin::partition()
+{
+	// probe partition i is run HJ_NPARTS+i, probe results with join values in more than one partition go to run HJ_NPARTS*2
+	RC rc; const bool fAll=op!=QRY_JOIN && op!=QRY_SEMIJOIN;
+	for (unsigned i=0; i<=HJ_NPARTS; i++)
+		if ((parts[i]=new(qx->ses) OutRun(esFile,nej))==NULL) return RC_NORESOURCES;
+		else if ((rc=parts[i]->beginRun())!=RC_OK) return rc;
+	while ((rc=queryOp->next())==RC_OK) {
+		if ((rc=qx->ses->testAbortQ())!=RC_OK) break;
+		if (pP->epr.lref==0 && pP->getPID().pid!=STORE_INVALID_PID && (rc=pP->pack())!=RC_OK) break;
+		if ((rc=loadKeys(queryOp,*pP,pVP,false))==RC_OK) {
+			unsigned part=~0u;
+			for (fKey=firstKey(pVP,nej,keys,pos); fKey; fKey=nextKey(pVP,nej,keys,pos)) {
+				const unsigned p=hashKey()>>(32-HJ_PART_BITS);
+				if (part==~0u) part=p; else if (p!=part) {part=HJ_NPARTS; break;}
+			}
+			if (part==~0u && fAll) part=0;
+			if (part!=~0u) {
+				SubAlloc::SubMark mrk; mem.mark(mrk);
+				EncPINRef *ep=(EncPINRef*)mem.memalign(sizeof(EncPINRef*),pP->epr.trunc<8>()+nej*sizeof(Value));
+				if (ep==NULL) rc=RC_NORESOURCES;
+				else {
+					ep->flags=pP->epr.flags; memcpy(ep->buf,pP->epr.buf,ep->lref=pP->epr.lref);
+					memcpy((Value*)getValues(ep),pVP,nej*sizeof(Value));
+					if ((rc=parts[part]->add(ep))==RC_OK && part==HJ_NPARTS) nMulti++;
+				}
+				mem.truncate(mrk);
+			}
+		}
+		cleanup(pVP); pP->cleanup();
+		if (rc!=RC_OK && rc!=RC_NOACCESS && rc!=RC_DELETED && rc!=RC_NOTFOUND) break;
+	}
+	if (rc!=RC_EOF) return rc;
+	for (unsigned i=0; i<=HJ_NPARTS; i++) {parts[i]->term(); delete parts[i]; parts[i]=NULL;}
+	if (nMulti!=0) {if ((mflags=(byte*)qx->ses->malloc(nMulti))!=NULL) memset(mflags,0,nMulti); else return RC_NORESOURCES;}
+	if ((inRun=new(qx->ses) InRun[1])==NULL) return RC_NORESOURCES;
+	return (rc=inRun->init(esFile,nej))!=RC_OK?rc:loadPart(0);
+}
+
+RC HashJoin::loadPart(unsigned part)
+{
+	RC rc; if (table!=NULL) memset(table,0,nBuckets*sizeof(HJEntry*));
+	nEntries=0; memUsed=nBuckets*sizeof(HJEntry*); mem.release(); cur=NULL; curPart=part; fNext=false;
+	if (part>=HJ_NPARTS) {fMulti=true; iMulti=0; openRun(esFile,inRun,HJ_NPARTS*2); return RC_OK;}
+	fMulti=false; openRun(esFile,inRun,part);
+	for (const EncPINRef *ep; (ep=inRun->top())!=NULL; inRun->next()) {
+		const Value *pv=getValues(ep); for (unsigned i=0; i<nej; i++) keys[i]=&pv[i];
+		hash=hashKey(); if ((rc=insert(*ep,false))!=RC_OK) return rc;
+	}
+	openRun(esFile,inRun,HJ_NPARTS+part); return RC_OK;
+}
+
+RC HashJoin::nextProbe()
+{
+	RC rc;
+	if (esFile==NULL) {
+		cleanup(pVP);
+		while ((rc=queryOp->next())==RC_OK) {
+			if ((rc=loadKeys(queryOp,*pP,pVP,false))==RC_OK) {pK=pVP; break;}
+			cleanup(pVP); if (rc!=RC_NOACCESS && rc!=RC_DELETED && rc!=RC_NOTFOUND) break;
+		}
+		return rc;
+	}
+	for (;;) {
+		if (fNext) {inRun->next(); if (fMulti) iMulti++;}
+		const EncPINRef *ep=inRun->top(); fNext=true;
+		if (ep!=NULL) {
+			if (fMulti && mflags[iMulti]!=0 && (op==QRY_SEMIJOIN||curPart>=HJ_NPARTS)) continue;
+			pP->cleanup(); *pP=PIN::defPID; memcpy(&pP->epr,ep,ep->trunc<8>()); pK=getValues(ep);
+			return qx->ses->testAbortQ();
+		}
+		// after each probe partition results spanning several partitions are matched with the same build partition
+		if (!fMulti && nMulti!=0) {fMulti=true; iMulti=0; fNext=false; openRun(esFile,inRun,HJ_NPARTS*2); continue;}
+		// the last pass over them returns results which were not matched in any partition
+		if (curPart+1>HJ_NPARTS || curPart+1==HJ_NPARTS && (nMulti==0 || op==QRY_JOIN || op==QRY_SEMIJOIN)) return RC_EOF;
+		if ((rc=loadPart(curPart+1))!=RC_OK) return rc;
+	}
+}
+
+RC HashJoin::advance(const PINEx *)
+{
+	RC rc; if ((state&QST_EOF)!=0) return RC_EOF;
+	if ((state&QST_INIT)!=0) {
+		state=state&~QST_INIT|QOS_ADV1;
+		if ((rc=build())!=RC_OK || esFile!=NULL && (rc=partition())!=RC_OK) {state|=QST_EOF; return rc;}
+		if (esFile==NULL && nEntries==0 && (op==QRY_JOIN || op==QRY_SEMIJOIN)) {state|=QST_EOF; return RC_EOF;}
+		if (nSkip>0 && (rc=initSkip())!=RC_OK) {state|=QST_EOF; return rc;}
+	}
+	for (;;) {
+		if ((state&QOS_ADV1)!=0) {
+			if ((rc=nextProbe())!=RC_OK) {state|=QST_EOF; return rc;}
+			state&=~QOS_ADV1; fMatched=false; cur=NULL; if ((fKey=firstKey(pK,nej,keys,pos))) hash=hashKey();
+		}
+		while (fKey) {
+			if (fMulti && curPart<HJ_NPARTS && hash>>(32-HJ_PART_BITS)!=curPart) cur=NULL;
+			else for (cur=cur!=NULL?cur->next:nBuckets!=0?table[hash&(nBuckets-1)]:(HJEntry*)0; cur!=NULL && !match(cur); cur=cur->next);
+			if (cur!=NULL) break; if ((fKey=nextKey(pK,nej,keys,pos))) hash=hashKey();
+		}
+		if (cur==NULL) {
+			state|=QOS_ADV1;
+			if (fMatched || op!=QRY_LEFT_OUTER_JOIN && op!=QRY_RIGHT_OUTER_JOIN || fMulti && curPart<HJ_NPARTS) continue;
+			pB->cleanup(); *pB=PIN::defPID; return RC_OK;
+		}
+		pB->cleanup(); *pB=PIN::defPID; memcpy(&pB->epr,cur->ref(),cur->ref()->trunc<8>());
+		if (conds!=NULL) {
+			if ((pB->getState()&(PEX_PAGE|PEX_PROPS))==0 && (rc=getBody(*pB))!=RC_OK || (pP->getState()&(PEX_PAGE|PEX_PROPS))==0 && (rc=getBody(*pP))!=RC_OK)
+				{if (rc==RC_NOACCESS || rc==RC_DELETED || rc==RC_NOTFOUND) continue; state|=QST_EOF; return rc;}
+			PINEx *pp[2]={fSwap?pB:pP,fSwap?pP:pB};
+			if (!Expr::condSatisfied(conds,nConds,pp,2,qx->vals,QV_ALL,qx->ses,(qflags&QO_CLASS)!=0)) continue;
+		}
+		fMatched=true; if (fMulti) mflags[iMulti]=1;
+		if (op==QRY_SEMIJOIN) state|=QOS_ADV1;
+		pP->epr.flags|=PINEX_RLOAD; pB->epr.flags|=PINEX_RLOAD; return RC_OK;
+	}
+}
+
+void HashJoin::release()
+{
+	cleanup(pVP); cleanup(pVB);
+	if (parts!=NULL) {for (unsigned i=0; i<=HJ_NPARTS; i++) delete parts[i]; qx->ses->free(parts); parts=NULL;}
+	if (inRun!=NULL) {delete[] inRun; inRun=NULL;}
+	delete esFile; esFile=NULL;
+	if (table!=NULL) {qx->ses->free(table); table=NULL;}
+	if (mflags!=NULL) {qx->ses->free(mflags); mflags=NULL;}
+	mem.release(); nBuckets=nEntries=0; memUsed=0; cur=NULL; pK=vls;
+	fKey=fMatched=fNext=fMulti=false; curPart=0; nMulti=iMulti=0;
+}
+
+RC HashJoin::reset()
+{
+	release(); RC rc=queryOp->reset();
+	if (rc==RC_OK) rc=queryOp2->reset();
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
+RC HashJoin::rewind()
+{
+	RC rc=RC_OK; if ((state&QST_INIT)!=0) return RC_OK;
+	cleanup(pVP); fKey=false; cur=NULL;
+	if (esFile==NULL) rc=queryOp->rewind();
+	else {if (mflags!=NULL) memset(mflags,0,nMulti); rc=loadPart(0);}
+	state=rc==RC_OK?QOS_ADV1:QST_EOF; return rc;
+}
+
+void HashJoin::print(SOutCtx& buf,int level) const
+{
+	buf.fill('\t',level); buf.append("hash ",5);
+	buf.append(j_ops[op],strlen(j_ops[op]));
+	buf.append(" on ",4);
+	for (const CondEJ *ce=ej; ce!=NULL; ce=ce->next) {
+		buf.renderName(ce->propID1); buf.append("=",1); buf.renderName(ce->propID2);
+		if (ce->next!=NULL) buf.append(" and ",5);
+	}
+	printStats(buf); buf.append("\n",1);
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 	if (queryOp2!=NULL) queryOp2->print(buf,level+1);
 }
@@ -375,18 +770,19 @@ NestedLoop::~NestedLoop()
 void NestedLoop::connect(PINEx **results,unsigned nRes)
 {
 	if (results!=NULL && nRes!=0) {
-		res=results[0]; unsigned nOuts1=queryOp->getNOuts();
-		queryOp->connect(results,nRes>nOuts1?nOuts1:nRes);
-		if (nRes==1) queryOp2->connect(&pR);
-		else if (nOuts1+queryOp2->getNOuts()<=nRes) {
-			queryOp2->connect(results+nOuts1,nRes-nOuts1); pR=results[nOuts1];	//???
+		QueryOp *const first=fSwap?queryOp2:queryOp,*const second=fSwap?queryOp:queryOp2;
+		res=results[0]; unsigned nOuts1=first->getNOuts();
+		first->connect(results,nRes>nOuts1?nOuts1:nRes);
+		if (nRes==1) second->connect(&pR);
+		else if (nOuts1+second->getNOuts()<=nRes) {
+			second->connect(results+nOuts1,nRes-nOuts1); pR=results[nOuts1];	//???
 		} else {
 			//???
 		}
 	}
 }
 
-RC NestedLoop::next(const PINEx *skip)
+RC NestedLoop::advance(const PINEx *skip)
 {
 	RC rc; if ((state&QST_EOF)!=0) return RC_EOF;
 	if ((state&QST_INIT)!=0) {
@@ -395,7 +791,7 @@ RC NestedLoop::next(const PINEx *skip)
 			// ???
 		}
 	}
-	if (res!=NULL) res->cleanup();
+	PINEx *const outer=fSwap?pR:res; if (outer!=NULL) outer->cleanup();
 	for (;;state|=QOS_ADV1) {
 		if ((state&QOS_ADV1)!=0) {
 			state&=~QOS_ADV1;
@@ -427,9 +823,17 @@ RC NestedLoop::rewind()
 	return RC_OK;
 }
 
+RC NestedLoop::reset()
+{
+	RC rc; pR->cleanup();
+	if (queryOp!=NULL && (rc=queryOp->reset())!=RC_OK) return rc;
+	if (queryOp2!=NULL && (rc=queryOp2->reset())!=RC_OK) return rc;
+	state=QST_INIT; return RC_OK;
+}
+
 void NestedLoop::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("nested loop\n",12);
+	buf.fill('\t',level); buf.append("nested loop",11); if (fSwap) buf.append(" (swapped)",10); printStats(buf); buf.append("\n",1);
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 	if (queryOp2!=NULL) queryOp2->print(buf,level+1);
 }
@@ -29,19 +29,24 @@ using namespace AfyKernel;
 
 static int nLogOpen = 0;
 
-LogMgr::LogMgr(StoreCtx *c,size_t logBufS,bool fAL,const char *lDir) : ctx(c),sectorSize(getSectorSize()),lPage(c->fileMgr->getPageSize()),
+LogMgr::LogMgr(StoreCtx *c,size_t logBufS,bool fAL,const char *lDir,ulong cDelay,ulong cBatch) : ctx(c),sectorSize(getSectorSize()),lPage(c->fileMgr->getPageSize()),
 	logSegSize(max(ceil(c->theCB->logSegSize,sectorSize),(size_t)MINSEGSIZE)),bufLen(max(ceil(logBufS,sectorSize),sectorSize*4)),
-	logBufBeg(NULL),logBufEnd(NULL),ptrWrite(NULL),ptrInsert(NULL),ptrRead(NULL),maxLSN(c->theCB->logEnd),minLSN(c->theCB->logEnd),prevLSN(0),
-	writtenLSN(c->theCB->logEnd),wrapLSN(0),fFull(false),fRecovery(false),fAnalizing(false),recFileSize(0),maxAllocated(0),prevTruncate(~0),
-	nRecordsSinceCheckpoint(0),newPage(NULL),currentLogFile(~0ul),logFile(INVALID_FILEID),nReadLogSegs(0),pcb(new(c) myaio),fArchive(fAL),
-	fReadFromCurrent(false),logDirectory(c->fileMgr->getDirString(lDir,true)),fInit(false),checkpointRQ(this),segAllocRQ(this)
+	writerStep(logSegSize/BUF_WRITER_STEPS),logBufBeg(NULL),logBufEnd(NULL),tailBuf(NULL),baseLSN(c->theCB->logEnd),maxLSN(c->theCB->logEnd),doneLSN(c->theCB->logEnd),minLSN(c->theCB->logEnd),
+	prevLSN(0),writtenLSN(c->theCB->logEnd),fRecovery(false),fAnalizing(false),recFileSize(0),maxAllocated(0),prevTruncate(~0),nRecordsSinceCheckpoint(0),
+	newPage(NULL),currentLogFile(~0ul),logFile(INVALID_FILEID),nReadLogSegs(0),pcb(new(c) myaio),pcbTail(new(c) myaio),fArchive(fAL),
+	fReadFromCurrent(false),logDirectory(c->fileMgr->getDirString(lDir,true)),fInit(false),commitLSN(0),flushedLSN(0),nCommitWaiters(0),
+	fFlusher(false),commitDelay(cDelay),commitBatch(cBatch!=0?cBatch:1),nGroupCommits(0),nGroupFlushes(0),checkpointRQ(this),segAllocRQ(this)
 {
-	if (pcb==NULL) throw RC_NORESOURCES;
+	if (pcb==NULL || pcbTail==NULL) throw RC_NORESOURCES;
 }
 
 LogMgr::~LogMgr()
 {
-	if ((ctx->mode&STARTUP_PRINT_STATS)!=0) report(MSG_INFO,"\tLogMgr stats: %ld/%ld\n",(long)nOverflow,(long)nWrites);
+	if ((ctx->mode&STARTUP_PRINT_STATS)!=0) {
+		report(MSG_INFO,"\tLogMgr stats: %ld/%ld\n",(long)nOverflow,(long)nWrites);
+		if (nGroupFlushes!=0) report(MSG_INFO,"\tLogMgr group commit: %ld commits in %ld flushes (%.2f per flush)\n",
+										(long)nGroupCommits,(long)nGroupFlushes,double(nGroupCommits)/double(nGroupFlushes));
+	}
 	for (int i=0; i<nReadLogSegs; i++) ctx->fileMgr->close(readLogSegs[i].fid);
 	if (logBufBeg!=NULL) freeAligned(logBufBeg); 
 //	free(logDirectory,STORE_HEAP); if (pcb!=NULL) free(pcb,STORE_HEAP);
@@ -59,8 +64,7 @@ RC LogMgr::init()
 			if ((rc=createLogFile(ctx->theCB->checkpoint,fSize))==RC_OK) {
 				fNew=save==SST_INIT || fSize==0 || fSize<(off64_t)ceil(LSNToFileOffset(ctx->theCB->logEnd),sectorSize);
 				LSN lsn(fNew?ctx->theCB->checkpoint:ctx->theCB->logEnd);
-				offset=LSNToFileOffset(lsn); prevLSN=maxLSN=writtenLSN=lsn; minLSN=maxLSN-offset%lPage;
-				ptrInsert=logBufBeg+offset%lPage; ptrWrite=floor(ptrInsert,sectorSize);
+				offset=LSNToFileOffset(lsn); prevLSN=maxLSN=doneLSN=writtenLSN=minLSN=lsn; baseLSN=lsn-offset%lPage;
 			}
 			lock.unlock();
 			if (rc==RC_OK) {
@@ -68,7 +72,7 @@ RC LogMgr::init()
 					ctx->theCB->checkpoint=ctx->logMgr->insert(NULL,LR_SHUTDOWN);
 					rc=ctx->logMgr->flushTo(ctx->theCB->checkpoint,&ctx->theCB->logEnd);
 				} else {
-					pcb->aio_fildes=logFile; pcb->aio_buf=ptrWrite; pcb->aio_lio_opcode=LIO_READ;
+					pcb->aio_fildes=logFile; pcb->aio_buf=bufPtr(sectorStart(writtenLSN)); pcb->aio_lio_opcode=LIO_READ;
 					pcb->aio_offset=floor(offset,sectorSize); pcb->aio_nbytes=sectorSize;
 					rc=ctx->fileMgr->listIO(LIO_WAIT,1,&pcb);
 				}
@@ -191,140 +195,144 @@ LSN LogMgr::insert(Session *ses,LRType type,ulong extra,PageID pid,const LSN *un
 	logRec.pageID	= pid;
 
 	if (type!=LR_CHECKPOINT) {
-		if (type!=LR_FLUSH) bufferLock.lock(); else if (!bufferLock.trylock()) return LSN(0);
+		if (type!=LR_FLUSH) bufferLock.lock(RW_S_LOCK); else if (!bufferLock.trylock(RW_S_LOCK)) return LSN(0);
 	}
 
-	HMAC hmac(ctx->getHMACKey(),HMAC_KEY_SIZE); bool fDel=false;
-	if (pData==NULL || lData==0)
-		hmac.add((const byte*)&logRec,sizeof(LogRec)-HMAC_SIZE);
-	else {
-		const byte *encKey=ctx->getEncKey();
-		if (encKey!=NULL) {
-			AES aes(encKey,ENC_KEY_SIZE); uint32_t IV[4];
-			maxLSNLock.lock(RW_S_LOCK);
-			IV[0]=uint32_t(maxLSN.lsn>>48); IV[1]=uint32_t(maxLSN.lsn>>32);
-			IV[2]=uint32_t(maxLSN.lsn>>16); IV[3]=uint32_t(maxLSN.lsn);
-			maxLSNLock.unlock();
-			ulong lpad=(ceil((ulong)lData,AES_BLOCK_SIZE)-(ulong)lData-1&AES_BLOCK_SIZE-1)+1;
-			ulong lbuf=(ulong)lData+lpad;
-			byte *buf=lbuf<=MAX_LOCAL_BUF_SIZE?(byte*)alloca(lbuf):(byte*)0;
-			if (buf==NULL) {
-				buf=(byte*)malloc(lbuf,ses!=NULL?SES_HEAP:STORE_HEAP);
-				if (buf==NULL) return LSN(0);	// ???
-				fDel=true;
-			}
-			memcpy(buf,pData,lData); memset(buf+lData,lpad,lpad);
-			aes.encrypt(buf,lbuf,IV); pData=buf; logRec.setLength((uint32_t)(lData=lbuf),flags);
+	const byte *encKey=pData!=NULL&&lData!=0?ctx->getEncKey():(const byte*)0; byte *buf=NULL; bool fDel=false; ulong lpad=0;
+	if (encKey!=NULL) {
+		lpad=(ceil((ulong)lData,AES_BLOCK_SIZE)-(ulong)lData-1&AES_BLOCK_SIZE-1)+1;
+		ulong lbuf=(ulong)lData+lpad;
+		buf=lbuf<=MAX_LOCAL_BUF_SIZE?(byte*)alloca(lbuf):(byte*)0;
+		if (buf==NULL) {
+			buf=(byte*)malloc(lbuf,ses!=NULL?SES_HEAP:STORE_HEAP);
+			if (buf==NULL) {if (type!=LR_CHECKPOINT) bufferLock.unlock(); return LSN(0);}	// ???
+			fDel=true;
 		}
-		hmac.add((const byte*)&logRec,sizeof(LogRec)-HMAC_SIZE);
-		hmac.add((const byte*)pData,lData);
+		memcpy(buf,pData,lData); memset(buf+lData,(int)lpad,lpad);
+		pData=buf; logRec.setLength((uint32_t)(lData=lbuf),flags);
 	}
-	memcpy(logRec.hmac,hmac.result(),HMAC_SIZE);
 
-	lock.lock(RW_X_LOCK);
+	// the record's place in the log is reserved first; everything below runs concurrently with other inserts
+	const size_t lTotal=sizeof(LogRec)+lData; const LSN lsn(reserve(lTotal)); LSN end(lsn+lTotal); end.align();
+
+	HMAC hmac(ctx->getHMACKey(),HMAC_KEY_SIZE);
+	if (encKey!=NULL) {
+		AES aes(encKey,ENC_KEY_SIZE); uint32_t IV[4];
+		IV[0]=uint32_t(lsn.lsn>>48); IV[1]=uint32_t(lsn.lsn>>32);
+		IV[2]=uint32_t(lsn.lsn>>16); IV[3]=uint32_t(lsn.lsn);
+		aes.encrypt(buf,(ulong)lData,IV);
+	}
+	hmac.add((const byte*)&logRec,sizeof(LogRec)-HMAC_SIZE);
+	if (pData!=NULL && lData!=0) hmac.add((const byte*)pData,lData);
+	memcpy(logRec.hmac,hmac.result(),HMAC_SIZE);
 
-	LSN saveMaxLSN(maxLSN); prevLSN=maxLSN; 
-	if (!fSpec&&ses!=NULL) {ses->tx.lastLSN=maxLSN; ses->nLogRecs++;}
+	for (uint64_t prev=prevLSN.lsn; prev<lsn.lsn && !cas(&prevLSN.lsn,prev,lsn.lsn); prev=*(volatile uint64_t*)&prevLSN.lsn);
+	if (!fSpec&&ses!=NULL) {ses->tx.lastLSN=lsn; ses->nLogRecs++;}
 	if (pb!=NULL) {
 		PageMgr *pm=pb->getPageMgr();
-		if (pm!=NULL) pm->setLSN(maxLSN,pb->getPageBuf(),lPage);
-		pb->setRedo(maxLSN);
+		if (pm!=NULL) pm->setLSN(lsn,pb->getPageBuf(),lPage);
+		pb->setRedo(lsn);
 		if (pb2!=NULL) {
-			if ((pm=pb2->getPageMgr())!=NULL) pm->setLSN(maxLSN,pb2->getPageBuf(),lPage);
-			pb2->setRedo(maxLSN);
+			if ((pm=pb2->getPageMgr())!=NULL) pm->setLSN(lsn,pb2->getPageBuf(),lPage);
+			pb2->setRedo(lsn);
 		}
 	}
 
-
-	const void *pChunk=&logRec; size_t lChunk=sizeof(LogRec),lTotal=sizeof(LogRec)+lData; RC rc; bool fWrap=false;
-	for (;;) {
-		size_t available=ptrInsert<ptrWrite?ptrWrite-ptrInsert:ptrInsert>ptrWrite||!fFull?logBufEnd-ptrInsert:0;
-		if (available>0) {
-			size_t l=available<lChunk?available:lChunk; assert(ptrRead>=ptrInsert);
-			if (fWrap && ptrInsert==logBufBeg) wrapLSN=saveMaxLSN;
-			memcpy(ptrInsert,pChunk,l); ptrInsert+=l;
-			maxLSNLock.lock(RW_X_LOCK); maxLSN+=l;
-			if ((lTotal-=l)==0) {ptrInsert=ceil(ptrInsert,sizeof(LSN)); maxLSN.align();}
-			maxLSNLock.unlock();
-			assert(LSNToFileN(maxLSN)<=currentLogFile+1);
-			if (ptrInsert==logBufEnd) {
-				ptrInsert=ptrRead=logBufBeg; minLSN=maxLSN-bufLen; fWrap=lTotal!=0;
-			} else if (ptrInsert>ptrRead) {
-				minLSN+=ulong(ptrInsert-ptrRead); ptrRead=ptrInsert;
-			}
-			if (ptrInsert==ptrWrite) fFull=true;
-			if (lTotal==0) break;
-			if ((lChunk-=l)==0) {pChunk=pData; lChunk=lData;} else pChunk=(byte*)pChunk+l;
-			if (!fFull) continue;
+	if (lTotal<=bufLen-sectorSize) {
+		if (!waitSpace(end)) ctx->theCB->state=SST_NO_SHUTDOWN;
+		else {copy(lsn,&logRec,sizeof(LogRec)); if (lData!=0) copy(lsn+sizeof(LogRec),pData,lData);}
+		// records become visible to write() strictly in LSN order
+		for (long spinCount=SpinC::SC.spinCount; !cas(&doneLSN.lsn,lsn.lsn,end.lsn); ) if (--spinCount<0) threadYield();
+	} else {
+		// the record doesn't fit in the buffer: wait for all preceding records, then copy and publish it in pieces
+		for (long spinCount=SpinC::SC.spinCount; getDoneLSN()!=lsn; ) if (--spinCount<0) threadYield();
+		const byte *pChunk=(const byte*)&logRec; size_t lChunk=sizeof(LogRec); LSN cur(lsn); bool fData=false;
+		while (lChunk!=0) {
+			size_t l=min(lChunk,bufLen/2);
+			if (!waitSpace(cur+l)) {ctx->theCB->state=SST_NO_SHUTDOWN; break;}
+			copy(cur,pChunk,l); cas(&doneLSN.lsn,cur.lsn,cur.lsn+l); cur+=l;
+			if ((lChunk-=l)!=0) pChunk+=l; else if (!fData) {pChunk=(const byte*)pData; lChunk=lData; fData=true;}
 		}
-		if ((rc=write())!=RC_OK) {ctx->theCB->state=SST_NO_SHUTDOWN; break;}
-		if (ses!=NULL && writtenLSN>=saveMaxLSN) ses->flushLSN=saveMaxLSN;
-		++nOverflow;
+		cas(&doneLSN.lsn,cur.lsn,end.lsn);
 	}
-	ulong nRecs=type==LR_CHECKPOINT?nRecordsSinceCheckpoint=0:++nRecordsSinceCheckpoint;
-	if ((ctx->mode&STARTUP_LOG_PREALLOC)!=0 && LSNToFileOffset(maxLSN)>=logSegSize*LOGFILETHRESHOLD && maxAllocated==currentLogFile)
+
+	long nRecs=type==LR_CHECKPOINT?nRecordsSinceCheckpoint=0:InterlockedIncrement(&nRecordsSinceCheckpoint);
+	if ((ctx->mode&STARTUP_LOG_PREALLOC)!=0 && LSNToFileOffset(end)>=logSegSize*LOGFILETHRESHOLD && maxAllocated==currentLogFile)
 		RequestQueue::postRequest(&segAllocRQ,ctx,RQ_HIGHPRTY);
 	if (!fRecovery && nRecs>=CHECKPOINTTHRESHOLD && type!=LR_CHECKPOINT) RequestQueue::postRequest(&checkpointRQ,ctx,RQ_HIGHPRTY);
-	lock.unlock(); if (type!=LR_CHECKPOINT) bufferLock.unlock();
-	if (fDel) free((byte*)pData,ses!=NULL?SES_HEAP:STORE_HEAP);
-	return saveMaxLSN;
+	if (!fRecovery && lsn.lsn/writerStep!=end.lsn/writerStep) ctx->bufMgr->startWriter();
+	if (type!=LR_CHECKPOINT) bufferLock.unlock();
+	if (fDel) free(buf,ses!=NULL?SES_HEAP:STORE_HEAP);
+	return lsn;
+}
+
+LSN LogMgr::reserve(size_t lTotal)
+{
+	for (;;) {
+		LSN lsn(getMaxLSN()),end(lsn+lTotal); end.align();
+		if (cas(&maxLSN.lsn,lsn.lsn,end.lsn)) return lsn;
+	}
+}
+
+bool LogMgr::waitSpace(LSN end)
+{
+	for (long spinCount=SpinC::SC.spinCount; end>sectorStart(getWrittenLSN())+bufLen; ) {
+		if (getDoneLSN()>getWrittenLSN()) {
+			RWLockP lck(&lock,RW_X_LOCK);
+			if (doneLSN>writtenLSN && end>sectorStart(writtenLSN)+bufLen) {++nOverflow; if (write()!=RC_OK) return false;}
+		} else if (--spinCount<0) threadYield();
+	}
+	return true;
+}
+
+void LogMgr::copy(LSN lsn,const void *p,size_t l)
+{
+	byte *ptr=bufPtr(lsn); size_t l1=size_t(logBufEnd-ptr);
+	if (l<=l1) memcpy(ptr,p,l); else {memcpy(ptr,p,l1); memcpy(logBufBeg,(const byte*)p+l1,l-l1);}
 }
 
 RC LogMgr::write()
 {
-	RC rc=RC_OK; bool oldFull=fFull; assert(lock.isXLocked());
-	assert(ptrInsert!=logBufEnd && (ptrWrite-logBufBeg&sectorSize-1)==0 && ptrWrite<logBufEnd);
-
-	size_t offset=floor(LSNToFileOffset(writtenLSN),sectorSize),lTransfer;
-	byte *newPtrWrite=logBufBeg,*ptrWrt=ptrWrite; LSN newWritten(maxLSN);
-	if (ptrWrt>=ptrInsert) {
-		lTransfer=size_t(logBufEnd-ptrWrt);
-		newWritten=LSNFromOffset(LSNToFileN(writtenLSN),offset+lTransfer);
-	} else {
-		lTransfer=ceil(ptrInsert-ptrWrt,sectorSize);
-		newPtrWrite=floor(ptrInsert,sectorSize);
+	RC rc=RC_OK; assert(lock.isXLocked());
+	LSN done(getDoneLSN()),start(sectorStart(writtenLSN)); if (done<=writtenLSN) return RC_OK;
+	if (LSNToFileN(start)>currentLogFile) {
+		assert(LSNToFileOffset(start)==0 && LSNToFileN(start)==currentLogFile+1); off64_t lf;
+		if ((rc=createLogFile(start,lf))!=RC_OK) return rc;
 	}
-	if (ptrWrt==logBufBeg) wrapLSN=0;
-
-	assert(ptrRead>=ptrInsert);
-	byte *newRead=ceil(ptrRead,sectorSize); ulong delta=ulong(newRead-ptrRead);
-	if (delta>0) {minLSN+=delta; memset(ptrRead,0,delta); ptrRead=newRead;}
-	
-	if (offset+lTransfer>logSegSize) {
-		lock.downgradelock(RW_U_LOCK);
-		size_t lTran=logSegSize-offset; assert(lTran<lTransfer);
+
+	size_t offset=LSNToFileOffset(start); byte *ptr=bufPtr(start);
+	size_t lTransfer=min(size_t(done-start),min(size_t(logBufEnd-ptr),logSegSize-offset));
+	size_t lTail=lTransfer&sectorSize-1; lTransfer-=lTail;
+	myaio *pcbs[2]; int nPcbs=0;
+
+	if (lTransfer!=0) {
 		pcb->aio_fildes		= logFile;
 		pcb->aio_offset		= offset;
-		pcb->aio_buf			= ptrWrt;
-		pcb->aio_nbytes		= lTran;
+		pcb->aio_buf		= ptr;
+		pcb->aio_nbytes		= lTransfer;
 		pcb->aio_lio_opcode	= LIO_WRITE;
-		rc=ctx->fileMgr->listIO(LIO_WAIT,1,&pcb,true);
-		lock.upgradelock(RW_X_LOCK); 
-		if (rc!=RC_OK) {report(MSG_ERROR,"Error %d writting log file %d\n",rc,currentLogFile); return rc;}
-		ptrWrt+=lTran; assert(ptrWrt!=logBufEnd);
-		writtenLSN=LSNFromOffset(currentLogFile+1,0); 
-		lTransfer-=lTran; offset=0; ++nWrites;
+		pcbs[nPcbs++]=pcb;
 	}
-	if (LSNToFileN(writtenLSN)>currentLogFile) {
-		assert(offset==0 && LSNToFileN(writtenLSN)==currentLogFile+1); off64_t lf;
-		if ((rc=createLogFile(writtenLSN,lf))!=RC_OK) return rc;
+	if (lTail!=0) {
+		// the last sector is only partially filled and inserts may be copying into the rest of it
+		memcpy(tailBuf,ptr+lTransfer,lTail); memset(tailBuf+lTail,0,sectorSize-lTail);
+		pcbTail->aio_fildes		= logFile;
+		pcbTail->aio_offset		= offset+lTransfer;
+		pcbTail->aio_buf		= tailBuf;
+		pcbTail->aio_nbytes		= sectorSize;
+		pcbTail->aio_lio_opcode	= LIO_WRITE;
+		pcbs[nPcbs++]=pcbTail;
 	}
 
 	lock.downgradelock(RW_U_LOCK);
-	
-	pcb->aio_fildes		= logFile;
-	pcb->aio_offset		= offset;
-	pcb->aio_buf		= ptrWrt;
-	pcb->aio_nbytes		= lTransfer;
-	pcb->aio_lio_opcode	= LIO_WRITE;
 
-	rc = ctx->fileMgr->listIO(LIO_WAIT,1,&pcb,true);
+	rc = ctx->fileMgr->listIO(LIO_WAIT,nPcbs,pcbs,true);
 
 	lock.upgradelock(RW_X_LOCK);
 
 	if (rc==RC_OK) {
-		writtenLSN=newWritten; ptrWrite=newPtrWrite; if (oldFull) fFull=false;
-		assert(writtenLSN<=maxLSN && (LSNToFileN(writtenLSN)==currentLogFile
+		writtenLSN=start+lTransfer+lTail;
+		assert(writtenLSN<=done && (LSNToFileN(writtenLSN)==currentLogFile
 				|| writtenLSN==LSNFromOffset(currentLogFile,logSegSize)));
 		++nWrites;
 	} else {
@@ -339,15 +347,51 @@ RC LogMgr::flushTo(LSN lsn,LSN *ret)
 	if ((ctx->mode&STARTUP_NO_RECOVERY)!=0) return RC_OK;
 	Session *ses=Session::getSession(); if (ses!=NULL && ses->flushLSN>lsn && ret==NULL) return RC_OK;
 
-	lock.lock(RW_X_LOCK); RC rc;
-	while (lsn>=writtenLSN || !wrapLSN.isNull() && lsn>=wrapLSN)
-		{assert(lsn<maxLSN); if ((rc=write())!=RC_OK) {lock.unlock(); return rc;}}
+	for (long spinCount=SpinC::SC.spinCount; lsn>=getDoneLSN() && lsn<getMaxLSN(); ) if (--spinCount<0) threadYield();
+	LSN done(getDoneLSN()); lock.lock(RW_X_LOCK); RC rc;
+	while (writtenLSN<done) if ((rc=write())!=RC_OK) {lock.unlock(); return rc;}
 	if (ses!=NULL) ses->flushLSN=writtenLSN;
 	if (ret!=NULL) *ret=writtenLSN;
 	lock.unlock();
 	return RC_OK;
 }
 
+RC LogMgr::commitFlush(LSN lsn)
+{
+	if ((ctx->mode&STARTUP_NO_RECOVERY)!=0) return RC_OK;
+	Session *ses=Session::getSession(); if (ses!=NULL && ses->flushLSN>lsn) return RC_OK;
+	if ((ctx->mode&STARTUP_SINGLE_SESSION)==0) {
+		MutexP lck(&commitLock);
+		if (lsn>flushedLSN) {
+			if (lsn>commitLSN) commitLSN=lsn; ++nCommitWaiters;
+			if (fFlusher) {if (nCommitWaiters>=commitBatch) commitReady.signal();}
+			else {
+				void *p=ctx->malloc(sizeof(FlushRQ)); FlushRQ *rq=p!=NULL?new(p) FlushRQ(this):(FlushRQ*)0;
+				if (rq!=NULL && (fFlusher=RequestQueue::postRequest(rq,ctx,RQ_IO))==false) ctx->free(rq);
+			}
+			while (fFlusher && lsn>flushedLSN) commitDone.wait(commitLock,0);
+		}
+		if (lsn<=flushedLSN) {if (ses!=NULL && ses->flushLSN<=flushedLSN) ses->flushLSN=flushedLSN+1; return RC_OK;}
+	}
+	return flushTo(lsn);	// flusher failed or couldn't be started
+}
+
+void LogMgr::groupFlush()
+{
+	MutexP lck(&commitLock);
+	while (nCommitWaiters!=0) {
+		if (commitDelay!=0 && nCommitWaiters<commitBatch) commitReady.wait(commitLock,commitDelay);
+		LSN lsn(commitLSN); ulong nBatch=nCommitWaiters; nCommitWaiters=0;
+		if (lsn>flushedLSN) {
+			LSN written(0); commitLock.unlock(); RC rc=flushTo(lsn,&written); commitLock.lock();
+			if (rc!=RC_OK) break;
+			flushedLSN=lsn; nGroupFlushes++;
+		}
+		nGroupCommits+=nBatch; commitDone.signalAll();
+	}
+	fFlusher=false; commitDone.signalAll();
+}
+
 LogReadCtx::LogReadCtx(LogMgr *mgr,Session *s) 
 	: logMgr(mgr),ses(s),currentLogSeg(~0ul),fid(INVALID_FILEID),ptr(NULL),len(0),fCheck(true),fLocked(false),xlrec(0),rbuf(NULL),lrec(0)
 {
@@ -356,7 +400,7 @@ LogReadCtx::LogReadCtx(LogMgr *mgr,Session *s)
 LogReadCtx::~LogReadCtx()
 {
 	ses->free(rbuf);
-	if (fLocked) logMgr->bufferLock.unlock();
+	if (fLocked) logMgr->lock.unlock();
 	pb.release(ses);
 	closeFile();
 }
@@ -388,15 +432,15 @@ void LogReadCtx::closeFile()
 
 RC LogReadCtx::readChunk(LSN lsn,void *buf,size_t l)
 {
-	assert(logMgr->fInit && buf!=NULL && l!=0);
+	assert(logMgr->fInit && buf!=NULL && l!=0); bool fMem=false;
 	for (;;) {
 		if (fCheck) {
 			if (!fLocked) {logMgr->lock.lock(RW_S_LOCK); fLocked=true;} fCheck=false;
 			assert(lsn+l<=logMgr->maxLSN || logMgr->fRecovery);
-			if (lsn>=logMgr->minLSN && lsn<logMgr->maxLSN) {
-				pb.release(ses); closeFile(); fid=INVALID_FILEID; 
-				if ((ptr=logMgr->ptrRead+ulong(lsn-logMgr->minLSN))>=logMgr->logBufEnd) ptr-=logMgr->bufLen;
-				len=ptr>=logMgr->ptrInsert?ulong(logMgr->logBufEnd-ptr):ulong(logMgr->ptrInsert-ptr);
+			LSN done(logMgr->getDoneLSN());
+			if (lsn>=logMgr->minLSN && lsn<done && lsn+logMgr->bufLen>=logMgr->getMaxLSN()) {
+				pb.release(ses); closeFile(); fid=INVALID_FILEID; fMem=true;
+				ptr=logMgr->bufPtr(lsn); len=min(size_t(done-lsn),size_t(logMgr->logBufEnd-ptr));
 			} else if (logMgr->fAnalizing) {
 				size_t offset=logMgr->LSNToFileOffset(logMgr->minLSN);
 				if ((offset+=logMgr->bufLen)<logMgr->recFileSize) logMgr->minLSN+=logMgr->bufLen;
@@ -406,13 +450,13 @@ RC LogReadCtx::readChunk(LSN lsn,void *buf,size_t l)
 				} else {
 					logMgr->lock.unlock(); fLocked=false; fCheck=true; return RC_EOF;
 				}
-				logMgr->maxLSN=logMgr->minLSN; logMgr->ptrInsert=logMgr->logBufBeg; logMgr->fFull=false;
+				logMgr->maxLSN=logMgr->doneLSN=logMgr->baseLSN=logMgr->minLSN;
 				size_t lread=min(logMgr->recFileSize-offset,logMgr->bufLen);
 				if (lread==0) {logMgr->lock.unlock(); fLocked=false; fCheck=true; return RC_EOF;}
 				logMgr->pcb->aio_fildes=logMgr->logFile; logMgr->pcb->aio_buf=logMgr->logBufBeg; logMgr->pcb->aio_lio_opcode=LIO_READ; 
 				logMgr->pcb->aio_offset=offset; logMgr->pcb->aio_nbytes=ceil(lread,logMgr->sectorSize);
 				RC rc=logMgr->ctx->fileMgr->listIO(LIO_WAIT,1,&logMgr->pcb); if (rc!=RC_OK) {logMgr->lock.unlock(); fLocked=false; fCheck=true; return rc;}
-				logMgr->maxLSN+=lread; logMgr->ptrInsert=logMgr->logBufBeg+lread; fCheck=true; continue;
+				logMgr->doneLSN=logMgr->maxLSN+=lread; fCheck=true; continue;
 			} else {
 				LSN writtenLSN(logMgr->writtenLSN); logMgr->lock.unlock(); fLocked=false;
 				ulong logSeg=logMgr->LSNToFileN(lsn); size_t offset=logMgr->LSNToFileOffset(lsn);
@@ -458,6 +502,12 @@ RC LogReadCtx::readChunk(LSN lsn,void *buf,size_t l)
 			}
 		}
 		assert(ptr!=NULL); size_t ll=min(len,l); memcpy(buf,ptr,ll);
+		if (fMem) {
+			// the buffer may have been reused by concurrent inserts while copying
+			fMem=false; fCheck=true; if (lsn+logMgr->bufLen<logMgr->getMaxLSN()) continue;
+			if ((l-=ll)==0) return RC_OK;
+			buf=(byte*)buf+ll; lsn+=ll; continue;
+		}
 		if ((l-=ll)==0) {if ((len-=ll)==0) fCheck=true; else ptr+=ll; return RC_OK;}
 		buf=(byte*)buf+ll; lsn+=ll; fCheck=true;
 	}
@@ -526,6 +576,17 @@ void LogMgr::CheckpointRQ::destroy()
 {
 }
 
+void LogMgr::FlushRQ::process()
+{
+	fDone=true; mgr->groupFlush();
+}
+
+void LogMgr::FlushRQ::destroy()
+{
+	if (!fDone) {MutexP lck(&mgr->commitLock); mgr->fFlusher=false; mgr->commitDone.signalAll();}
+	mgr->ctx->free(this);
+}
+
 void LogMgr::SegAllocRQ::process()
 {
 	if (mgr->currentLogFile==mgr->maxAllocated) {
@@ -105,31 +105,29 @@ class LogMgr
 {
 	class	StoreCtx	*const ctx;
 	mutable	RWLock 		lock;
-	mutable	Mutex		bufferLock;
-	mutable	RWLock		maxLSNLock;
+	mutable	RWLock		bufferLock;
 
 	const	size_t		sectorSize;
 	const	size_t		lPage;
 	const	size_t		logSegSize;
 	const	size_t		bufLen;
+	const	size_t		writerStep;
 	byte				*logBufBeg;
 	byte				*logBufEnd;
-	byte				*ptrWrite;
-	byte				*ptrInsert;
-	byte				*ptrRead;
+	byte				*tailBuf;
+	LSN					baseLSN;
 	LSN					maxLSN;
+	LSN					doneLSN;
 	LSN					minLSN;
 	LSN					prevLSN;
 	LSN					writtenLSN;
-	LSN					wrapLSN;
-	bool				fFull;
 	bool				fWriting;
 	bool				fRecovery;
 	bool				fAnalizing;
 	size_t				recFileSize;
 	ulong				maxAllocated;
 	ulong				prevTruncate;
-	ulong				nRecordsSinceCheckpoint;
+	volatile	long	nRecordsSinceCheckpoint;
 	SharedCounter		nOverflow;
 	SharedCounter		nWrites;
 	
@@ -144,12 +142,25 @@ class LogMgr
 	int					nReadLogSegs;
 	Event				waitLogSeg;
 	struct myaio*		pcb;
+	struct myaio*		pcbTail;
 	const	bool		fArchive;
 	bool				fReadFromCurrent;
 	char				*logDirectory;
 	Mutex				initLock;
 	volatile	bool	fInit;
 
+	mutable	Mutex		commitLock;
+	Event				commitReady;
+	Event				commitDone;
+	LSN					commitLSN;
+	LSN					flushedLSN;
+	ulong				nCommitWaiters;
+	bool				fFlusher;
+	const	ulong		commitDelay;
+	const	ulong		commitBatch;
+	uint64_t			nGroupCommits;
+	uint64_t			nGroupFlushes;
+
 	class CheckpointRQ	: public Request
 	{
 		LogMgr			*const	mgr;
@@ -168,36 +179,57 @@ class LogMgr
 		void destroy();
 	}					segAllocRQ;
 	friend class		SegAllocRQ;
+	class FlushRQ		: public Request
+	{
+		LogMgr			*const	mgr;
+		bool					fDone;
+	public:
+		FlushRQ(LogMgr *mg) : mgr(mg),fDone(false) {}
+		void process();
+		void destroy();
+	};
+	friend class		FlushRQ;
 
 public:
-						LogMgr(class StoreCtx*,size_t logBufS,bool fArchiveLogs=false,const char *logDir=NULL);
+						LogMgr(class StoreCtx*,size_t logBufS,bool fArchiveLogs=false,const char *logDir=NULL,ulong cDelay=0,ulong cBatch=0);
 						~LogMgr();
 	void *operator		new(size_t s,StoreCtx *ctx) {void *p=ctx->malloc(s); if (p==NULL) throw RC_NORESOURCES; return p;}
 	void				deleteLogs();
 	RC					init();
 	RC					allocLogFile(ulong fileN,char* buf=NULL);
 	RC					flushTo(LSN lsn,LSN* =NULL);
+	RC					commitFlush(LSN lsn);
 	LSN					insert(Session *,LRType type,ulong extra=0,PageID pid=INVALID_PAGEID,const LSN *undoNext=NULL,const void *pData=NULL,
 																				size_t lData=0,uint32_t flags=0,PBlock *pb=NULL,PBlock *pb2=NULL);
 	LSN					getRecvLSN() const {return recv;}
 	RC					rollback(Session *,bool fSavepoint);
-	LSN					getOldLSN() const {RWLockP lck(&maxLSNLock,RW_S_LOCK); return maxLSN<logSegSize?LSN(0):maxLSN-logSegSize;}
+	LSN					getOldLSN() const {LSN lsn(getMaxLSN()); return lsn<logSegSize?LSN(0):lsn-logSegSize;}
+	LSN					getMaxLSN() const {return LSN(*(volatile uint64_t*)&maxLSN.lsn);}
 	PBlock				*setNewPage(PBlock *newp) {return newPage=newp;}
 	bool				isRecovery() const {return fRecovery;}
 	bool				isInit() const {return fInit;}
 	RC					recover(Session *ses,bool fRollforward);
 	RC					close();
 private:
-	RC					initLogBuf() {return logBufBeg!=NULL?RC_OK:(ptrInsert=ptrWrite=logBufBeg=(byte*)allocAligned(bufLen,lPage))==NULL?RC_NORESOURCES:(ptrRead=logBufEnd=logBufBeg+bufLen,RC_OK);}
+	RC					initLogBuf() {return logBufBeg!=NULL?RC_OK:(logBufBeg=(byte*)allocAligned(bufLen+sectorSize,lPage))==NULL?RC_NORESOURCES:(tailBuf=logBufEnd=logBufBeg+bufLen,RC_OK);}
+	LSN					getDoneLSN() const {return LSN(*(volatile uint64_t*)&doneLSN.lsn);}
+	LSN					getWrittenLSN() const {return LSN(*(volatile uint64_t*)&writtenLSN.lsn);}
+	byte				*bufPtr(LSN lsn) const {return logBufBeg+size_t((lsn-baseLSN)%bufLen);}
+	LSN					sectorStart(LSN lsn) const {return LSN(lsn.lsn&~uint64_t(sectorSize-1));}
+	LSN					reserve(size_t lTotal);
+	bool				waitSpace(LSN end);
+	void				copy(LSN lsn,const void *p,size_t l);
 	RC					createLogFile(LSN fileStart,off64_t& fSize);
 	RC					openLogFile(LSN fileStart);
 	RC					write();
+	void				groupFlush();
 	RC					checkpoint();
 	char				*getLogFileName(ulong logFileN,char *buf) const;
 	LSN					LSNFromOffset(ulong fileN,size_t offset) {return off64_t(fileN)*logSegSize+offset;}
 	ulong				LSNToFileN(LSN lsn) {return ulong(lsn.lsn/logSegSize);}
 	size_t				LSNToFileOffset(LSN lsn) {return lsn.lsn%logSegSize;}
 	friend	class		LogReadCtx;
+	friend	class		RedoWorker;
 };
 
 /**
@@ -1776,7 +1776,9 @@ void SInCtx::parse(Value& res,const QVarRef *vars,unsigned nVars,unsigned pflags
 			else if (nVars<=1) {mapURI(); assert(v.type==VT_URIID); URIID uid=v.uid; v.setVarRef(0,uid);}
 			else throw SY_MISNAME;
 		case LX_CON:
-			if (est!=0) goto error_no_op; oprs.push(v); v.setError(); est=1; continue;
+			if (est!=0) goto error_no_op;
+			if (plift!=NULL && ops.top().lx>=OP_EQ && ops.top().lx<=OP_GE) plift->subst(errpos,v);
+			oprs.push(v); v.setError(); est=1; continue;
 		case LX_SELF: 
 			if (est!=0) goto error_no_op; v.setVarRef(0); oprs.push(v); v.setError(); est=1; continue;
 		case LX_PREFIX: throw SY_MISQN2;
@@ -2895,13 +2897,54 @@ Stmt *SInCtx::parseStmt(bool fNested)
 	return stmt;
 }
 
+void SInCtx::liftLiterals(PlanLift& pl)
+{
+	TLx lx=lex(),prev=lx; unsigned n;
+	if (lx!=LX_KEYW || v.op!=KW_SELECT) return;
+	while ((lx=lex())!=LX_EOE) {
+		switch (lx) {
+		default: break;
+		case LX_COLON: case LX_QUERY: pl.reset(); return;
+		case LX_SEMI: if (lex()!=LX_EOE) {pl.reset(); return;} break;
+		case LX_KEYW: if (v.op==KW_SELECT || v.op==KW_BASE || v.op==KW_PREFIX || v.op>=KW_INSERT) {pl.reset(); return;} break;
+		case LX_CON:
+			if (prev>=OP_EQ && prev<=OP_GE && pl.nLits<PLAN_MAX_LITERALS && PlanLift::isLiftable(v))
+				{n=pl.nLits++; pl.pos[n]=errpos; pl.pend[n]=ptr; pl.lits[n]=v; pl.fUsed[n]=false; v.setError();}
+			break;
+		}
+		prev=lx;
+	}
+	if (pl.setKey(ses,str,end-str,ids,nids,sqt)!=RC_OK) pl.reset();
+}
+
 RC SInCtx::exec(const Value *params,unsigned nParams,char **result,uint64_t *nProcessed,unsigned nProcess,unsigned nSkip)
 {
 	SOutCtx out(ses); assert(ses!=NULL); unsigned fBrkIns=false; uint64_t cnt=0;
+	PlanCache& pc=ses->getStore()->queryMgr->getPlanCache(); PlanLift pl(ses); uint32_t gen=0;
+	if (nParams==0) {
+		SInCtx lc(ses,str,end-str,ids,nids,sqt);
+		try {lc.liftLiterals(pl);} catch (SynErr) {pl.reset();} catch (RC) {pl.reset();}
+		if (pl.key!=NULL) {
+			CachedPlan *plan=pc.find(pl,gen);
+			if (plan==NULL) plift=&pl;
+			else {
+				// single SELECT statement: execute cached plan with lifted literals as parameters
+				ICursor *ir=NULL; RC rc=plan->getStmt()->execute(result!=NULL?&ir:NULL,pl.lits,pl.nLits,nProcess,nSkip,0);
+				if (rc==RC_OK && ir!=NULL) {if ((rc=out.renderJSON((Cursor*)ir,cnt))==RC_EOF) rc=RC_OK; ir->destroy();}
+				plan->release(); ptr=end; if (nProcessed!=NULL) *nProcessed=cnt; if (rc!=RC_OK) throw rc;
+				if (cnt!=0 && !out.append("\n",1)) throw RC_NORESOURCES;
+				return result==NULL||(*result=(char*)out)!=NULL?RC_OK:RC_NORESOURCES;
+			}
+		}
+	}
 	for (TLx lx=lex();;lx=lex()) {
 		if (lx==LX_EOE) break; if (lx!=LX_LPR && lx!=LX_KEYW) throw SY_SYNTAX;
 		nextLex=lx; uint64_t c; SynErr sy=SY_ALL; RC rc=RC_OK; Stmt *stmt; ICursor *ir=NULL;
 		if ((stmt=parseStmt())!=NULL) {
+			if (plift!=NULL) {
+				plift=NULL; params=pl.lits; nParams=pl.nLits;
+				if (pl.isComplete() && stmt->getOp()==STMT_QUERY) pc.insert(pl,stmt,gen);
+			}
 			if (cnt!=0 && stmt->getOp()<STMT_START_TX) {
 				if (!fBrkIns) {fBrkIns=true; if (!out.insert("[",1,0)) throw RC_NORESOURCES;}
 				if (!out.append(",\n",2)) throw RC_NORESOURCES;
@@ -2959,8 +3002,16 @@ void SInCtx::parseManage(IMapDir *id,AfyDBCtx& ctx,const StartupParameters *sp)
 					Value vv=v; if (lex()!=OP_EQ) throw SY_MISEQ; if (lex()!=LX_CON) throw SY_MISCON;
 					if (vv.length==sizeof("NBUFFERS")-1 && cmpncase(vv.str,"NBUFFERS",vv.length)) {
 						if (v.type==VT_INT || v.type==VT_UINT) params.nBuffers=v.ui>=20?v.ui:20; else throw SY_MISNUM;
+					} else if (vv.length==sizeof("NBUFPARTITIONS")-1 && cmpncase(vv.str,"NBUFPARTITIONS",vv.length)) {
+						if (v.type==VT_INT || v.type==VT_UINT) params.nBufPartitions=v.ui; else throw SY_MISNUM;
 					} else if (vv.length==sizeof("LOGBUFSIZE")-1 && cmpncase(vv.str,"LOGBUFSIZE",vv.length)) {
 						if (v.type==VT_INT || v.type==VT_UINT) params.logBufSize=v.ui; else throw SY_MISNUM;
+					} else if (vv.length==sizeof("COMMITDELAY")-1 && cmpncase(vv.str,"COMMITDELAY",vv.length)) {
+						if (v.type==VT_INT || v.type==VT_UINT) params.commitDelay=v.ui; else throw SY_MISNUM;
+					} else if (vv.length==sizeof("COMMITBATCH")-1 && cmpncase(vv.str,"COMMITBATCH",vv.length)) {
+						if (v.type==VT_INT || v.type==VT_UINT) params.commitBatch=v.ui; else throw SY_MISNUM;
+					} else if (vv.length==sizeof("INDEXFILL")-1 && cmpncase(vv.str,"INDEXFILL",vv.length)) {
+						if (v.type==VT_FLOAT) params.indexFill=v.f; else if (v.type==VT_DOUBLE) params.indexFill=(float)v.d; else throw SY_SYNTAX;
 					} else if (vv.length==sizeof("MAXFILES")-1 && cmpncase(vv.str,"MAXFILES",vv.length)) {
 						if (v.type==VT_INT || v.type==VT_UINT) params.maxFiles=v.ui>=20?v.ui:20; else throw SY_MISNUM;
 					} else if (vv.length==sizeof("SHUTDOWNASYNCTIMEOUT")-1 && cmpncase(vv.str,"SHUTDOWNASYNCTIMEOUT",vv.length)) {
@@ -3036,8 +3087,12 @@ IStmt *SessionX::createStmt(const char *qs,const URIID *ids,unsigned nids,Compil
 		assert(ses==Session::getSession());
 		if (ce!=NULL) {memset(ce,0,sizeof(CompilationError)); ce->msg="";}
 		if (qs==NULL || ses->getStore()->inShutdown()) return NULL;
-		SInCtx in(ses,qs,strlen(qs),ids,nids,(ses->itf&ITF_SPARQL)!=0?SQ_SPARQL:SQ_PATHSQL);
-		try {Stmt *st=in.parseStmt(); in.checkEnd(true); return st;}
+		size_t lqs=strlen(qs); SQType sqt=(ses->itf&ITF_SPARQL)!=0?SQ_SPARQL:SQ_PATHSQL;
+		PlanCache& pc=ses->getStore()->queryMgr->getPlanCache(); PlanLift pl(ses); CachedPlan *plan; uint32_t gen=0;
+		if (pl.setKey(ses,qs,lqs,ids,nids,sqt)==RC_OK && (plan=pc.find(pl,gen))!=NULL)
+			{Stmt *st=plan->getStmt()->clone(STMT_OP_ALL,ses); plan->release(); if (st!=NULL) return st;}
+		SInCtx in(ses,qs,lqs,ids,nids,sqt);
+		try {Stmt *st=in.parseStmt(); in.checkEnd(true); if (st!=NULL && pl.key!=NULL && st->getOp()==STMT_QUERY) pc.insert(pl,st,gen); return st;}
 		catch (SynErr sy) {in.getErrorInfo(RC_SYNTAX,sy,ce);}
 		catch (RC rc) {in.getErrorInfo(rc,SY_ALL,ce);}
 	} catch (RC) {} catch (...) {report(MSG_ERROR,"Exception in ISession::createStmt(const char *,...)\n");}
@@ -258,11 +258,12 @@ class SInCtx {
 	DynArray<Len_Str,6>			dnames;			/**< delayed mapping names for SELECT parsing */
 	TLx							nextLex;		/**< look-ahead lexem */
 	Value						v;				/**< value associated with current lexem (string, number, etc.) */
+	struct	PlanLift			*plift;			/**< literals to be replaced with parameters for plan cache */
 public:
 	SInCtx(Session *se,const char *s,size_t ls,const URIID *i=NULL,unsigned ni=0,SQType sq=SQ_PATHSQL,MemAlloc *m=NULL)
 		: ses(se),ma(m!=NULL?m:se),mtype(ma!=NULL?ma->getAType():SERVER_HEAP),str(s),end(s+ls),ids(i),nids(ni),sqt(sq),ptr(s),lbeg(s),lmb(0),line(1),errpos(NULL),
 		mode(se==NULL?SIM_NO_BASE:(se->fStdOvr?SIM_STD_OVR:0)|(se->lURIBase==0?SIM_NO_BASE:0)),base(NULL),lBase(0),lBaseBuf(0),qNames(NULL),nQNames(0),lastQN(~0u),
-		dnames(ma),nextLex(LX_ERR) {v.setError();}
+		dnames(ma),nextLex(LX_ERR),plift(NULL) {v.setError();}
 	~SInCtx();
 	Stmt	*parseStmt(bool fNested=false);															/**< parse PathSQL statement; can be called recursively for nested statements */
 	RC		exec(const Value *params,unsigned nParams,char **result=NULL,uint64_t *nProcessed=NULL,unsigned nProcess=~0u,unsigned nSkip=0);	/**< parse PathSQL, execute and return result as JSON */
@@ -282,6 +283,7 @@ public:
 	static	const	TLx		charLex[256];															/**< octet to lexem map */
 private:
 	TLx		lex();																					/**< lexer */
+	void	liftLiterals(struct PlanLift& pl);														/**< lex SELECT statement, collect literals compared with properties, build plan cache key */
 	bool	parseEID(TLx lx,ElementID& eid);														/**< parse ':XXX' eid constant */
 	void	saveLexState(LexState& s) const {s.ptr=ptr; s.lbeg=lbeg; s.lmb=lmb; s.line=line;}		/**< save lexer state for deep lookahead */
 	void	restoreLexState(const LexState& s) {ptr=s.ptr; lbeg=s.lbeg; lmb=s.lmb; line=s.line;}	/**< restore lexer state */
@@ -129,6 +129,7 @@ protected:
 	friend	class	PathOp;
 	friend	class	FTIndexMgr;
 	friend	class	FullScan;
+	friend	class	Exchange;
 	friend	class	Session;
 	friend	class	TransOp;
 	struct HeapObjHeader {
@@ -372,6 +373,7 @@ public:
 	friend	class QueryPrc;
 	friend	class Classifier;
 	friend	class FullScan;
+	friend	class Exchange;
 };
 
 };
@@ -813,6 +813,14 @@ RC TreePageMgr::update(PBlock *pb,size_t len,ulong info,const byte *rec,size_t l
 	case TRO_MULTINIT:
 		assert((flags&TXMGR_UNDO)==0); if (lrec<=sizeof(TreePageMulti)) return RC_CORRUPTED;
 		tpmi=(TreePageMulti*)rec; rec+=sizeof(TreePageMulti); fVarSub=tpmi->fmt.isVarKeyOnly();
+		if (tpmi->fLastR!=0) {
+			// page image written by bulkLoad(): TreePageInfo, entry area, data area up to the page footer
+			if (lrec<sizeof(TreePageMulti)+sizeof(TreePageInfo)+tpmi->lData) return RC_CORRUPTED;
+			const TreePageInfo *tpinfo=(const TreePageInfo*)rec; ll=ushort(lrec-sizeof(TreePageMulti)-sizeof(TreePageInfo)-tpmi->lData);
+			if (tpinfo->freeSpace+ll!=len-FOOTERSIZE || sizeof(TreePage)+tpmi->lData+tpinfo->freeSpaceLength!=tpinfo->freeSpace) return RC_CORRUPTED;
+			memcpy(&tp->info,tpinfo,sizeof(TreePageInfo)); memcpy(tp+1,rec+sizeof(TreePageInfo),tpmi->lData);
+			memcpy((byte*)tp+tp->info.freeSpace,rec+sizeof(TreePageInfo)+tpmi->lData,ll); break;
+		}
 		tp->info.fmt=tpmi->fmt; tp->info.sibling=tpmi->sibling;
 		if ((tp->info.lPrefix=tpmi->lPrefix)!=0) {
 			if (lrec<=tpmi->lPrefix) return RC_CORRUPTED;
@@ -2003,15 +2011,19 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key,const void *value,usho
 	}
 
 	ulong spaceLeft=tp->info.freeSpaceLength+tp->info.scatteredFreeSpace;
-	if (lInsert+lExtra>spaceLeft || tp->info.nEntries!=0 && idx==tp->info.nEntries && lInsert+lExtra+lKey>=spaceLeft) {
+	bool fFull=lInsert+lExtra>spaceLeft || tp->info.nEntries!=0 && idx==tp->info.nEntries && lInsert+lExtra+lKey>=spaceLeft;
+	// bulk load: appending to the rightmost page at any level, split at the end when the page reaches the fill factor
+	bool fFill=!fFull && (tctx.mode&TF_BULKLOAD)!=0 && op==TRO_INSERT && tp->info.nEntries!=0 && idx==tp->info.nEntries && !tp->hasSibling()
+					&& lInsert+lExtra+ulong(xSize*(1.f-ctx->treeMgr->bulkFill))>spaceLeft;
+	if (fFull || fFill) {
 		bool fSplit=true;
-		if (tp->info.nSearchKeys==1 && !tp->info.fmt.isUnique()) {
+		if (!fFill && tp->info.nSearchKeys==1 && !tp->info.fmt.isUnique()) {
 			const PagePtr *pp=(const PagePtr*)((byte*)(tp+1)+tp->info.keyLength());
 			if (!TreePage::isSubTree(*pp) && pp->len>=256)
 				{RC rc2=spawn(tctx,lInsert,0); if (rc2==RC_OK) fSplit=false; else if (rc2!=RC_TOOBIG) return rc2;}
 		}
 		if (fSplit) {
-			bool fInsR; ushort splitIdx=tp->calcSplitIdx(fInsR,key,idx,lInsert,prefixSize,op==TRO_INSERT);
+			bool fInsR=true; ushort splitIdx=fFill?ushort(idx):tp->calcSplitIdx(fInsR,key,idx,lInsert,prefixSize,op==TRO_INSERT);
 			if ((rc=split(tctx,&key,idx,splitIdx,fInsR))!=RC_OK) return rc;		// idx -> tctx.index ??
 		}
 		tp=(const TreePage*)tctx.pb->getPageBuf(); prefixSize=tp->info.lPrefix;
@@ -2035,6 +2047,112 @@ RC TreePageMgr::insert(TreeCtx& tctx,const SearchKey& key,const void *value,usho
 	return ctx->txMgr->update(tctx.pb,this,idx<<TRO_SHIFT|op,(byte*)tpm,lrec+lValue+lFact,tf!=NULL?LRC_LUNDO:0);
 }
 
+RC TreePageMgr::bulkLoad(Tree& tr,IMultiKey& mk,PageID& root,ulong& height)
+{
+	BulkEdge be; be.nLevels=0; BulkDeferred *def=NULL,**pdef=&def; RC rc;
+	const SearchKey *pkey; const void *value; ushort lValue; bool fMulti;
+	while ((rc=mk.nextKey(pkey,value,lValue,fMulti))==RC_OK) {
+		if (be.nLevels==0) {
+			PBlock *pb=ctx->fsMgr->getNewPage(this); if (pb==NULL) {rc=RC_NORESOURCES; break;}
+			TreePageInit *tpi=(TreePageInit*)alloca(sizeof(TreePageInit)); tpi->fmt=tr.indexFormat(); tpi->level=0; tpi->left=tpi->right=INVALID_PAGEID;
+			if ((rc=update(pb,ctx->bufMgr->getPageSize(),TRO_INIT,(byte*)tpi,sizeof(TreePageInit),0))!=RC_OK) {pb->release(PGCTL_DISCARD|QMGR_UFORCE); break;}
+			be.pages[0]=pb; be.nLevels=1;
+		}
+		if ((rc=bulkAppend(be,0,*pkey,value,lValue,fMulti))==RC_TOOBIG) {
+			ushort lk=pkey->extLength(); BulkDeferred *bd=(BulkDeferred*)malloc(sizeof(BulkDeferred)+lk+lValue,SES_HEAP);
+			if (bd==NULL) {rc=RC_NORESOURCES; break;}
+			bd->next=NULL; bd->lKey=lk; bd->lValue=lValue; bd->fMulti=fMulti;
+			pkey->serialize(bd+1); memcpy((byte*)(bd+1)+lk,value,lValue); *pdef=bd; pdef=&bd->next; rc=RC_OK;
+		}
+		if (rc!=RC_OK) break;
+	}
+	if (rc==RC_EOF) rc=RC_OK;
+	for (ulong i=0; i<be.nLevels; i++) {
+		if (rc!=RC_OK) {be.pages[i]->release(PGCTL_DISCARD|QMGR_UFORCE); continue;}
+		PageID pid=be.pages[i]->getPageID(); if ((rc=bulkWrite(be.pages[i]))==RC_OK && i+1==be.nLevels) {root=pid; height=i;}
+	}
+	for (BulkDeferred *bd=def,*next; bd!=NULL; bd=next) {
+		next=bd->next; SearchKey key;
+		if (rc==RC_OK && (rc=key.deserialize(bd+1,bd->lKey))==RC_OK) rc=tr.insert(key,(byte*)(bd+1)+bd->lKey,bd->lValue,bd->fMulti);
+		free(bd,SES_HEAP);
+	}
+	return rc;
+}
+
+RC TreePageMgr::bulkAppend(BulkEdge& be,ulong level,const SearchKey& key,const void *value,ushort lValue,bool fMulti,bool fSplit)
+{
+	PBlock *pb=be.pages[level]; const TreePage *tp=(const TreePage*)pb->getPageBuf(); ulong idx; RC rc;
+	if (tp->info.fmt.keyType()!=key.type || tp->info.fmt.isSeq() || fMulti&&tp->info.fmt.isUnique()) return RC_INVPARAM;
+	if (tp->findKey(key,idx) || idx!=tp->info.nEntries) return RC_INVPARAM;		// keys must arrive in strictly ascending order
+	const void *val0=value; ushort lVal0=lValue; bool fMulti0=fMulti,fVM=tp->info.fmt.isVarMultiData(); uint32_t nVals=1;
+	if (fMulti && (nVals=fVM?TreePage::nKeys(value):lValue/tp->info.fmt.dataLength())==1)
+		{fMulti=false; if (fVM) {value=(byte*)value+L_SHT*2; lValue-=L_SHT*2;}}
+	ushort prefixSize=tp->info.lPrefix,n=fMulti?ushort(~0u):0; size_t lInsert,lExtra=0,lKey=tp->info.calcEltSize();
+	if (fMulti && fVM && lValue-(nVals+1)<256) lValue-=ushort(nVals+1);
+	if (prefixSize!=0 && tp->info.nEntries!=0 && (prefixSize=tp->calcPrefixSize(key,idx))<tp->info.lPrefix)
+		lExtra=tp->info.extraEltSize(prefixSize)*tp->info.nEntries+1;
+	lInsert=lKey; if (!tp->info.fmt.isFixedLenKey()) lKey+=key.extra()-prefixSize;
+	lInsert+=tp->info.calcVarSize(key,lValue,prefixSize)+(fMulti||!fVM?0:lValue<254?2:L_SHT*2);
+	if (lInsert>xSize/3 || fMulti && lValue>=0x8000) return RC_TOOBIG;
+
+	ulong spaceLeft=tp->info.freeSpaceLength+tp->info.scatteredFreeSpace;
+	if (lInsert+lExtra>spaceLeft) {if (!fSplit || tp->info.nEntries==0) return RC_TOOBIG;}
+	else if (!fSplit || tp->info.nEntries==0 || lInsert+lExtra+lKey+ulong(xSize*(1.f-ctx->treeMgr->bulkFill))<spaceLeft) fSplit=false;
+	if (fSplit) return (rc=bulkSplit(be,level,key))!=RC_OK?rc:bulkAppend(be,level,key,val0,lVal0,fMulti0,false);
+
+	size_t lrec=sizeof(TreePageModify)+key.extLength(); if (!tp->isLeaf()) lrec=ceil(lrec,sizeof(PageID));
+	TreePageModify *tpm=(TreePageModify*)alloca(lrec+lValue); if (tpm==NULL) return RC_NORESOURCES;
+	key.serialize(tpm+1); tpm->newPrefSize=prefixSize<tp->info.lPrefix?prefixSize:tp->info.lPrefix;
+	tpm->newData.offset=ushort(lrec); tpm->newData.len=lValue; tpm->oldData.len=0; tpm->oldData.offset=n;
+	byte *ptr=(byte*)tpm+lrec; assert(lrec+lValue<0x10000);
+	if (!fMulti || lValue>=256) memcpy(ptr,value,lValue);
+	else {ulong j=nVals+1; for (ulong i=0; i<j; i++) *ptr++=byte(((ushort*)value)[i]-j); memcpy(ptr,(ushort*)value+j,lValue-j);}
+	return update(pb,ctx->bufMgr->getPageSize(),idx<<TRO_SHIFT|TRO_INSERT,(byte*)tpm,lrec+lValue,0);
+}
+
+RC TreePageMgr::bulkSplit(BulkEdge& be,ulong level,const SearchKey& key)
+{
+	PBlock *pb=be.pages[level],*pbn; const TreePage *tp=(const TreePage*)pb->getPageBuf(); IndexFormat fmt=tp->info.fmt; RC rc;
+	// the new key becomes the high key of the page unless it doesn't fit there, then the last entry moves to the new page
+	ushort lPref=!fmt.isNumKey()||fmt.isPrefNumKey()?tp->calcPrefixSize(key,0,true):tp->info.lPrefix;
+	ulong lSep=tp->info.calcEltSize()+(lPref<tp->info.lPrefix?tp->info.extraEltSize(lPref)*(tp->info.nEntries+1):0)+(fmt.isFixedLenKey()?0:key.extra()-lPref);
+	bool fLast=lSep>ulong(tp->info.freeSpaceLength+tp->info.scatteredFreeSpace) && tp->info.nEntries>1;
+	ulong lsk=fLast?tp->getSerKeySize(ushort(tp->info.nEntries-1)):key.extLength();
+	TreePageSplit *tps=(TreePageSplit*)alloca(sizeof(TreePageSplit)+lsk); if (tps==NULL) return RC_NORESOURCES;
+	tps->nEntriesLeft=fLast?tp->info.nEntries-1:tp->info.nEntries; tps->oldPrefSize=tp->info.lPrefix;
+	if (fLast) tp->serializeKey(tps->nEntriesLeft,tps+1); else key.serialize(tps+1);
+	if ((pbn=ctx->fsMgr->getNewPage(this))==NULL) return RC_NORESOURCES; tps->newSibling=pbn->getPageID();
+	if ((rc=update(pb,ctx->bufMgr->getPageSize(),TRO_SPLIT,(byte*)tps,sizeof(TreePageSplit)+lsk,0,pbn))!=RC_OK)
+		{pbn->release(PGCTL_DISCARD|QMGR_UFORCE); return rc;}
+	PageID left=pb->getPageID(); be.pages[level]=pbn; if ((rc=bulkWrite(pb))!=RC_OK) return rc;
+	if (level+1<be.nLevels) {
+		SearchKey sep; if ((rc=sep.deserialize(tps+1,lsk))!=RC_OK) return rc;
+		return (rc=bulkAppend(be,level+1,sep,&tps->newSibling,sizeof(PageID),false))==RC_TOOBIG?RC_INTERNAL:rc;
+	}
+	if (level+1>=TREE_MAX_DEPTH) return RC_INTERNAL;
+	ulong lrec=sizeof(TreePageInit)+lsk; TreePageInit *tpi=(TreePageInit*)alloca(lrec); if (tpi==NULL) return RC_NORESOURCES;
+	tpi->fmt=fmt; tpi->fmt.makeInternal(); tpi->level=level+1; tpi->left=left; tpi->right=tps->newSibling; memcpy(tpi+1,tps+1,lsk);
+	if ((pb=ctx->fsMgr->getNewPage(this))==NULL) return RC_NORESOURCES;
+	if ((rc=update(pb,ctx->bufMgr->getPageSize(),TRO_INIT,(byte*)tpi,lrec,0))!=RC_OK) {pb->release(PGCTL_DISCARD|QMGR_UFORCE); return rc;}
+	be.pages[be.nLevels++]=pb; return RC_OK;
+}
+
+RC TreePageMgr::bulkWrite(PBlock *pb)
+{
+	TreePage *tp=(TreePage*)pb->getPageBuf(); if (tp->info.scatteredFreeSpace!=0) tp->compact();
+	ushort lLow=ushort(tp->info.freeSpace-sizeof(TreePage)-tp->info.freeSpaceLength),lHigh=ushort(xSize+sizeof(TreePage)-tp->info.freeSpace);
+	size_t lrec=sizeof(TreePageMulti)+sizeof(TreePageInfo)+lLow+lHigh; RC rc=RC_NORESOURCES;
+	TreePageMulti *tpm=(TreePageMulti*)alloca(lrec);
+	if (tpm!=NULL) {
+		tpm->fmt=tp->info.fmt; tpm->sibling=tp->info.sibling; tpm->lPrefix=0; tpm->fLastR=1; tpm->lData=lLow;
+		byte *p=(byte*)(tpm+1); memcpy(p,&tp->info,sizeof(TreePageInfo)); p+=sizeof(TreePageInfo);
+		memcpy(p,tp+1,lLow); memcpy(p+lLow,(byte*)tp+tp->info.freeSpace,lHigh);
+		rc=ctx->txMgr->update(pb,this,TRO_MULTINIT,(byte*)tpm,lrec);
+	}
+	if (rc==RC_OK) pb->release(); else pb->release(PGCTL_DISCARD|QMGR_UFORCE);
+	return rc;
+}
+
 RC TreePageMgr::update(TreeCtx& tctx,const SearchKey& key,const void *oldValue,ushort lOldValue,
 											const void *newValue,ushort lNewValue)
 {
@@ -2486,6 +2604,21 @@ template<typename T> bool TreePageMgr::TreePage::findNumKeyVar(T sKey,ulong nEnt
 	return false;
 }
 
+PageID TreePageMgr::TreePage::getChildUnlatched(const SearchKey& key,ulong& pos,size_t lPage) const
+{
+	// the page can be changed by a writer while it's read: header fields used by findKey(), testKey() and getPageID() are checked before
+	// use, the index and the page ID after; INVALID_PAGEID is returned if they are out of bounds, the caller must then latch the page
+	const ulong nEnt=info.nSearchKeys,lElt=info.calcEltSize(); pos=~0ul;
+	if (isLeaf() || info.fmt.keyType()!=key.type || !info.fmt.isFixedLenData() || info.fmt.dataLength()!=sizeof(PageID) || nEnt==0 || nEnt>info.nEntries
+		|| info.freeSpace>lPage-FOOTERSIZE || sizeof(TreePage)+info.nEntries*lElt>info.freeSpace) return INVALID_PAGEID;
+	if (info.fmt.isFixedLenKey()) {
+		if (info.lPrefix>info.fmt.keyLength() || info.freeSpace+nEnt*sizeof(PageID)>lPage-FOOTERSIZE) return INVALID_PAGEID;
+	} else if (info.lPrefix!=0 && ((PagePtr*)&info.prefix)->offset+info.lPrefix>lPage-FOOTERSIZE) return INVALID_PAGEID;
+	if (!findKey(key,pos)) --pos;
+	if (pos!=~0ul && pos>=nEnt) return INVALID_PAGEID;
+	const PageID pid=pos==~0ul?info.leftMost:getPageID(pos); return pid!=hdr.pageID?pid:INVALID_PAGEID;
+}
+
 bool TreePageMgr::TreePage::findKey(const SearchKey& skey,ulong& pos) const
 {
 	assert(info.fmt.keyType()==skey.type && (isLeaf() || info.fmt.isFixedLenData() && info.fmt.dataLength()==sizeof(PageID)));
@@ -2549,9 +2682,10 @@ bool TreePageMgr::TreePage::findKey(const SearchKey& skey,ulong& pos) const
 			} else switch (info.lPrefix) {
 			default: assert(0);
 			case 0: return fFixed?findNumKey(skey.v.i,nEnt,pos):findNumKeyVar(skey.v.i,nEnt,pos);
-			case sizeof(uint32_t): return fFixed?findNumKey((int32_t)skey.v.i,nEnt,pos):findNumKeyVar((int32_t)skey.v.i,nEnt,pos);
-			case sizeof(uint32_t)+sizeof(uint16_t): return fFixed?findNumKey((int16_t)skey.v.i,nEnt,pos):findNumKeyVar((int16_t)skey.v.i,nEnt,pos);
-			case sizeof(uint32_t)+sizeof(uint16_t)+sizeof(uint8_t): return fFixed?findNumKey((int8_t)skey.v.i,nEnt,pos):findNumKeyVar((int8_t)skey.v.i,nEnt,pos);
+			// the sign is in the prefix, suffixes are compared as unsigned (see testKey(), getKey())
+			case sizeof(uint32_t): return fFixed?findNumKey((uint32_t)skey.v.u,nEnt,pos):findNumKeyVar((uint32_t)skey.v.u,nEnt,pos);
+			case sizeof(uint32_t)+sizeof(uint16_t): return fFixed?findNumKey((uint16_t)skey.v.u,nEnt,pos):findNumKeyVar((uint16_t)skey.v.u,nEnt,pos);
+			case sizeof(uint32_t)+sizeof(uint16_t)+sizeof(uint8_t): return fFixed?findNumKey((uint8_t)skey.v.u,nEnt,pos):findNumKeyVar((uint8_t)skey.v.u,nEnt,pos);
 			case sizeof(uint64_t): assert(info.nEntries==1); pos=0; return true;
 			}
 			break;
@@ -61,7 +61,7 @@ enum TREE_OP
 	TRO_DROP,			/**< drop page, e.g. when index is being deleted */
 	TRO_MULTIINS,		/**< insert multiple data elements for one key */
 	TRO_MULTIDEL,		/**< delete multiple data elements for one key */
-	TRO_MULTINIT,		/**< initialize page with multiple elements */
+	TRO_MULTINIT,		/**< initialize page with multiple elements or, with TreePageMulti::fLastR set, with a complete page image */
 	TRO_ALL
 };
 
@@ -107,6 +107,8 @@ struct TreeCtx
 	RC						findPageForUpdate(const SearchKey *,bool fIns=false);
 	RC						getParentPage(const SearchKey&,ulong);
 	RC						getPreviousPage(bool fRead=true);
+	PBlock					*descend(PageID& pid,const SearchKey *key,int& level,int stop,long& ver);
+	bool					revalidate(PBlock *&par,long ver,PageID& pid,PageID root,ulong d0,int& level,int l0);
 	PageID					startPage(const SearchKey*,int& level,bool=true,bool=false);
 	PageID					prevStartPage(PageID pid);
 	void					getStamps(ulong stamps[TREE_NODETYPE_ALL]) const;
@@ -202,7 +204,7 @@ public:
 		IndexFormat		fmt;
 		PageID			sibling;
 		uint16_t		lPrefix		:15;
-		uint16_t		fLastR	:1;
+		uint16_t		fLastR	:1;		/**< TRO_MULTIINS: last element replaces the sibling key; TRO_MULTINIT: TreePageInfo and page image follow, lData - length of the entry area */
 		uint16_t		lData;
 	};
 	/**
@@ -236,6 +238,22 @@ public:
 		PageID			anchor;
 		PageID			leftMost;
 	};
+	/**
+	 * right edge of a tree being bulk-loaded, one X-latched page per level
+	 */
+	struct BulkEdge {
+		PBlock			*pages[TREE_MAX_DEPTH];
+		ulong			nLevels;
+	};
+	/**
+	 * key which doesn't fit a bulk-loaded page, inserted after the tree is built
+	 */
+	struct BulkDeferred {
+		BulkDeferred	*next;
+		uint16_t		lKey;
+		uint16_t		lValue;
+		bool			fMulti;
+	};
 	/**
 	 * structure of index tree page
 	 */
@@ -265,6 +283,7 @@ public:
 			if (info.nSearchKeys==0) {pos=~0ul; return info.leftMost;}
 			if (!findKey(key,pos)||fBefore) --pos; return getPageID(pos);
 		}
+		PageID		getChildUnlatched(const SearchKey& key,ulong& pos,size_t lPage) const;
 		PageID		getPageID(ulong idx) const {
 			assert(!isLeaf()&&(idx<info.nSearchKeys||idx==~0ul&&info.leftMost!=INVALID_PAGEID)); 
 			return idx==~0ul?info.leftMost : !info.fmt.isFixedLenKey() ? ((VarKey*)(this+1))[idx].pageID :
@@ -331,6 +350,7 @@ public:
 	RC		remove(TreeCtx& tctx,const SearchKey&,const void *value,ushort lValue,bool=false);
 	RC		merge(PBlock *left,PBlock *right,PBlock *par,Tree& tr,const SearchKey&,ulong idx);
 	RC		drop(PBlock *&pb,TreeFreeData*);
+	RC		bulkLoad(Tree& tr,IMultiKey& mk,PageID& root,ulong& height);
 
 	size_t	contentSize() const {return xSize;}
 	ulong	checkTree(PageID pid,PageID sib,ulong depth,CheckTreeReport& out,CheckTreeReport *sec,bool fLM=true);
@@ -346,6 +366,9 @@ private:
 	RC		insertSubTree(TreeCtx &tctx,const void *value,ushort lValue,IndexFormat ifmt,ulong start,ulong end,ulong& pageCnt,PageID *pages,ushort *indcs,size_t xS,ulong *pResidual=NULL);
 	RC		split(TreeCtx& tctx,const SearchKey *key,ulong& idx,ushort splitIdx,bool fInsR,PBlock **right=NULL);
 	RC		spawn(TreeCtx& tctx,size_t lInsert,ulong idx=~0u);
+	RC		bulkAppend(BulkEdge& be,ulong level,const SearchKey& key,const void *value,ushort lValue,bool fMulti,bool fSplit=true);
+	RC		bulkSplit(BulkEdge& be,ulong level,const SearchKey& key);
+	RC		bulkWrite(PBlock *pb);
 	friend	struct	TreeCtx;
 	friend	class	TreeRQ;
 };
@@ -91,6 +91,7 @@ private:
 	friend	class	Cursor;
 	friend	class	CursorNav;
 	friend	class	FullScan;
+	friend	class	Exchange;
 	friend	class	TransOp;
 };
 
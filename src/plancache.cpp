@@ -0,0 +1,126 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+#include "queryprc.h"
+#include "stmt.h"
+#include "plancache.h"
+
+using namespace AfyKernel;
+
+void PlanLift::reset()
+{
+	if (key!=NULL) {ma->free(key); key=NULL;}
+	for (unsigned i=0; i<nLits; i++) freeV(lits[i]);
+	lkey=0; hash=0; nLits=nSubst=0;
+}
+
+RC PlanLift::setKey(const Session *ses,const char *str,size_t lstr,const URIID *ids,unsigned nids,unsigned sqt)
+{
+	size_t l=sizeof(uint32_t)*4+nids*sizeof(URIID)+ses->lURIBase+lstr; unsigned i;
+	for (i=0; i<ses->nQNames; i++) l+=sizeof(uint32_t)*2+ses->qNames[i].lq+ses->qNames[i].lstr+1;
+	byte *p=key=(byte*)ma->malloc(l); if (p==NULL) return RC_NORESOURCES;
+	uint32_t u=sqt|(ses->fStdOvr?0x100:0)|ses->itf<<16; memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t);
+	u=nids; memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t);
+	if (nids!=0) {memcpy(p,ids,nids*sizeof(URIID)); p+=nids*sizeof(URIID);}
+	u=uint32_t(ses->lURIBase); memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t);
+	if (ses->lURIBase!=0) {memcpy(p,ses->URIBase,ses->lURIBase); p+=ses->lURIBase;}
+	u=ses->nQNames; memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t);
+	for (i=0; i<ses->nQNames; i++) {
+		const QName& qn=ses->qNames[i];
+		u=uint32_t(qn.lq); memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t); memcpy(p,qn.qpref,qn.lq); p+=qn.lq;
+		u=uint32_t(qn.lstr); memcpy(p,&u,sizeof(uint32_t)); p+=sizeof(uint32_t); memcpy(p,qn.str,qn.lstr); p+=qn.lstr; *p++=qn.fDel;
+	}
+	// lifted literals are replaced by '\0' which can't appear in the text
+	const char *s=str;
+	for (i=0; i<nLits; i++) {memcpy(p,s,pos[i]-s); p+=pos[i]-s; *p++=0; s=pend[i];}
+	memcpy(p,s,str+lstr-s); p+=str+lstr-s; lkey=p-key;
+	uint32_t h=2166136261u; for (p=key; p<key+lkey; p++) h=(h^*p)*16777619u; hash=h;
+	return RC_OK;
+}
+
+static bool sameLiteral(const Value& v1,const Value& v2)
+{
+	if (v1.type!=v2.type) return false;
+	switch (v1.type) {
+	case VT_STRING: return v1.length==v2.length && memcmp(v1.str,v2.str,v1.length)==0;
+	case VT_INT: case VT_UINT: return v1.ui==v2.ui;
+	case VT_INT64: case VT_UINT64: case VT_DATETIME: case VT_INTERVAL: return v1.ui64==v2.ui64;
+	case VT_FLOAT: return v1.f==v2.f && v1.qval.units==v2.qval.units;
+	case VT_DOUBLE: return v1.d==v2.d && v1.qval.units==v2.qval.units;
+	default: return false;
+	}
+}
+
+bool PlanLift::subst(const char *p,Value& v)
+{
+	for (unsigned i=0; i<nLits; i++) if (pos[i]==p) {
+		if (fUsed[i] || !sameLiteral(v,lits[i])) return false;
+		fUsed[i]=true; nSubst++; freeV(v); v.setParam((byte)i); return true;
+	}
+	return false;
+}
+
+void CachedPlan::release()
+{
+	if (InterlockedDecrement(&refCnt)==0) {stmt->destroy(); ma->free(this);}
+}
+
+PlanCache::PlanCache(StoreCtx *ct) : ctx(ct),table(PLAN_CACHE_SIZE,ct,false),nPlans(0),gen(0),nHits(0),nMisses(0),nFlushes(0)
+{
+	memset(seen,0,sizeof(seen));
+}
+
+CachedPlan *PlanCache::find(const PlanLift& pl,uint32_t& gn)
+{
+	MutexP lck(&lock); CachedPlan *plan=table.find(pl.getKey()); gn=gen;
+	if (plan==NULL) {nMisses++; return NULL;}
+	plan->lru.remove(); lruList.insertFirst(&plan->lru); InterlockedIncrement(&plan->refCnt); nHits++;
+	return plan;
+}
+
+void PlanCache::insert(const PlanLift& pl,const Stmt *stmt,uint32_t gn)
+{
+	uint32_t& sn=seen[pl.hash&(PLAN_SEEN_SIZE-1)]; if (sn!=pl.hash) {sn=pl.hash; return;}		// cache only statements seen at least twice
+	Stmt *st=stmt->clone(STMT_OP_ALL,ctx); if (st==NULL) return;
+	CachedPlan *plan=new(pl.lkey,ctx) CachedPlan(ctx,st,pl.getKey()),*old=NULL;
+	if (plan==NULL) {st->destroy(); return;}
+	MutexP lck(&lock);
+	if (gn!=gen || table.find(pl.getKey())!=NULL) old=plan;		// flushed or parsed concurrently
+	else {
+		table.insert(plan); lruList.insertFirst(&plan->lru);
+		if (++nPlans>PLAN_CACHE_SIZE && (old=lruList.getLast())!=NULL) {table.remove(old); old->lru.remove(); nPlans--;}
+	}
+	lck.set(NULL); if (old!=NULL) old->release();
+}
+
+void PlanCache::invalidate()
+{
+	MutexP lck(&lock); CachedPlan *plan; gen++; nFlushes++;
+	while ((plan=lruList.removeFirst())!=NULL) {table.remove(plan); plan->release();}
+	nPlans=0;
+}
+
+void PlanCache::getStats(PlanCacheStatistics& stats)
+{
+	MutexP lck(&lock); stats.nHits=nHits; stats.nMisses=nMisses; stats.nFlushes=nFlushes; stats.nPlans=nPlans;
+}
+
+void PlanCache::printStats() const
+{
+	if (nHits+nMisses!=0) report(MSG_INFO,"\tPlan cache: %ld hits, %ld misses, %ld flushes, %u statements\n",(long)nHits,(long)nMisses,(long)nFlushes,nPlans);
+}
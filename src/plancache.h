@@ -0,0 +1,141 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+/**
+ * store-wide cache of parsed PathSQL statements
+ * statements are keyed by their text with literals compared to properties lifted into parameters,
+ * plus the session state which affects name resolution (URI base, prefixes, URIID table)
+ */
+#ifndef _PLANCACHE_H_
+#define _PLANCACHE_H_
+
+#include "affinity.h"
+#include "utils.h"
+
+using namespace AfyDB;
+
+namespace AfyKernel
+{
+
+#define	PLAN_CACHE_SIZE		512			/**< maximum number of statements in the store-wide cache */
+#define	PLAN_MAX_LITERALS	64			/**< maximum number of literals lifted from one statement */
+#define	PLAN_SEEN_SIZE		1024		/**< size of the table of recently missed key hashes */
+
+class	Stmt;
+class	Session;
+
+/**
+ * plan cache key
+ */
+struct PlanKey
+{
+	const	byte	*key;
+	size_t			lkey;
+	uint32_t		hash;
+	PlanKey(const byte *k,size_t l,uint32_t h) : key(k),lkey(l),hash(h) {}
+	operator uint32_t() const {return hash;}
+	bool operator==(const PlanKey& rhs) const {return hash==rhs.hash && lkey==rhs.lkey && memcmp(key,rhs.key,lkey)==0;}
+};
+
+/**
+ * literals lifted from statement text and the normalized key
+ * literal positions are filled by lexing the text, parser replaces literals found at these positions with parameters
+ */
+struct PlanLift
+{
+	MemAlloc		*const	ma;
+	byte			*key;
+	size_t			lkey;
+	uint32_t		hash;
+	unsigned		nLits;
+	unsigned		nSubst;
+	const	char	*pos[PLAN_MAX_LITERALS];
+	const	char	*pend[PLAN_MAX_LITERALS];
+	Value			lits[PLAN_MAX_LITERALS];
+	bool			fUsed[PLAN_MAX_LITERALS];
+	PlanLift(MemAlloc *m) : ma(m),key(NULL),lkey(0),hash(0),nLits(0),nSubst(0) {}
+	~PlanLift() {reset();}
+	void	reset();
+	RC		setKey(const Session *ses,const char *str,size_t lstr,const URIID *ids,unsigned nids,unsigned sqt);
+	bool	subst(const char *p,Value& v);
+	bool	isComplete() const {return nSubst==nLits;}
+	PlanKey	getKey() const {return PlanKey(key,lkey,hash);}
+	static	bool	isLiftable(const Value& v) {
+		switch (v.type) {
+		case VT_INT: case VT_UINT: case VT_INT64: case VT_UINT64: case VT_FLOAT: case VT_DOUBLE:
+		case VT_STRING: case VT_DATETIME: case VT_INTERVAL: return true;
+		default: return false;
+		}
+	}
+};
+
+/**
+ * cached statement
+ * allocated in store heap, shared between sessions; executed in place, cloned for createStmt()
+ */
+class CachedPlan
+{
+	friend	class		PlanCache;
+	HChain<CachedPlan>	hash;
+	HChain<CachedPlan>	lru;
+	long	volatile	refCnt;
+	MemAlloc			*const ma;
+	Stmt				*const stmt;
+	uint32_t			hkey;
+	size_t				lkey;
+	byte				key[1];
+	CachedPlan(MemAlloc *m,Stmt *st,const PlanKey& pk) : hash(this),lru(this),refCnt(1),ma(m),stmt(st),hkey(pk.hash),lkey(pk.lkey) {memcpy(key,pk.key,pk.lkey);}
+	void				*operator new(size_t s,size_t lk,MemAlloc *ma) throw() {return ma->malloc(s+lk);}
+public:
+	PlanKey				getKey() const {return PlanKey(key,lkey,hkey);}
+	const	Stmt		*getStmt() const {return stmt;}
+	void				release();
+};
+
+/**
+ * store-wide statement cache with LRU replacement
+ * a statement is admitted on its second miss, so one-off texts don't evict cached statements
+ * flushed on class and index creation or deletion; the generation counter prevents caching
+ * of statements parsed before the flush
+ */
+class PlanCache
+{
+	typedef	HashTab<CachedPlan,PlanKey,&CachedPlan::hash>	PlanHash;
+	class	StoreCtx	*const ctx;
+	PlanHash			table;
+	HChain<CachedPlan>	lruList;
+	unsigned			nPlans;
+	uint32_t			gen;
+	uint64_t			nHits;
+	uint64_t			nMisses;
+	uint64_t			nFlushes;
+	uint32_t			seen[PLAN_SEEN_SIZE];
+	Mutex				lock;
+public:
+	PlanCache(StoreCtx *ct);
+	CachedPlan	*find(const PlanLift& pl,uint32_t& gen);
+	void		insert(const PlanLift& pl,const Stmt *stmt,uint32_t gen);
+	void		invalidate();
+	uint32_t	getGen() const {return gen;}
+	void		getStats(PlanCacheStatistics& stats);
+	void		printStats() const;
+};
+
+};
+
+#endif
@@ -24,11 +24,12 @@ Written by Mark Venguerov 2004-2012
 #include "queryop.h"
 #include "stmt.h"
 #include "parser.h"
+#include <math.h>
 
 using namespace AfyKernel;
 
-QBuildCtx::QBuildCtx(Session *s,const ValueV& prs,const Stmt *st,ulong nsk,ulong md)
-	: ses(s),qx(new(s) QCtx(s)),stmt(st),nSkip(nsk),mode(md),flg(0),propsReq(s),sortReq(NULL),nSortReq(0),nqs(0),ncqs(0) 
+QBuildCtx::QBuildCtx(Session *s,const ValueV& prs,const Stmt *st,ulong nsk,ulong md,ulong nRet)
+	: ses(s),qx(new(s) QCtx(s)),stmt(st),nSkip(nsk),nReturn(nRet),mode(md),flg(0),propsReq(s),sortReq(NULL),nSortReq(0),nqs(0),ncqs(0),fReuse(true) 
 {
 	if (qx==NULL) throw RC_NORESOURCES; 
 	qx->ref(); qx->vals[QV_PARAMS]=prs; qx->vals[QV_PARAMS].fFree=false;
@@ -40,6 +41,7 @@ QBuildCtx::QBuildCtx(Session *s,const ValueV& prs,const Stmt *st,ulong nsk,ulong
 		}
 	}
 	if ((md&MODE_FOR_UPDATE)!=0) flg|=QO_FORUPDATE; if ((md&MODE_DELETED)!=0) flg|=QO_DELETED; if ((md&MODE_CLASS)!=0) flg|=QO_CLASS;
+	if ((md&MODE_ANALYZE)!=0) qx->fStats=true;
 }
 
 QBuildCtx::~QBuildCtx()
@@ -80,8 +82,9 @@ RC QBuildCtx::process(QueryOp *&qop)
 		qop->unique(false); break;
 	}
 	if (qv->stype!=SEL_CONST && qv->stype!=SEL_VALUE && qv->stype!=SEL_DERIVED) {
+		// with a limit only nSkip+nReturn first results are kept; not for other identities, ACL checks in Cursor can reject results
 		if (stmt->orderBy!=NULL)
-			rc=sort(qop,stmt->orderBy,stmt->nOrderBy);
+			rc=sort(qop,stmt->orderBy,stmt->nOrderBy,NULL,false,nReturn!=~0ul && qv->stype!=SEL_COUNT && ses->getIdentity()==STORE_OWNER?nSkip+nReturn:0);
 		/*else if ((qop->qflags&QO_DEGREE)!=0) {
 			OrderSegQ ks; ks.pid=PROP_SPEC_ANY; ks.flags=0; ks.var=0; ks.aggop=OP_SET; ks.lPref=0;
 			QueryOp *q=new(ses,1,0) Sort(qop,&ks,1,flg,1,NULL,0); if (q==NULL) delete qop; qop=q;
@@ -125,9 +128,11 @@ RC JoinVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 		// merge props
 	}
 	if (condEJ==NULL) {
-		if ((rc=vars[0].var->build(qctx,qctx.src[qctx.nqs]))==RC_OK) qctx.nqs++; else return rc;
-		if ((rc=vars[1].var->build(qctx,qctx.src[qctx.nqs]))==RC_OK) qctx.nqs++; else return rc;
-		rc=qctx.nested(q,&qctx.src[nqs0],(const Expr**)(nConds==1?&cond:conds),nConds);
+		for (unsigned i=0; i<nVars; i++) {
+			if (qctx.nqs>=sizeof(qctx.src)/sizeof(qctx.src[0])) return RC_NORESOURCES;
+			if ((rc=vars[i].var->build(qctx,qctx.src[qctx.nqs]))==RC_OK) qctx.nqs++; else return rc;
+		}
+		rc=qctx.nested(q,&qctx.src[nqs0],nVars,(const Expr**)(nConds==1?&cond:conds),nConds,type==QRY_JOIN);
 	} else for (const CondEJ *ce=condEJ; ;ce=ce->next) {
 		if (ce==NULL) {
 			// choose order of ce
@@ -152,14 +157,12 @@ RC JoinVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 #endif
 			if (qctx.sortReq!=NULL && qctx.nSortReq!=0) {
 				unsigned nP=0;
-				if (QBuildCtx::checkSort(qctx.src[nqs0],qctx.sortReq,qctx.nSortReq,nP)) {
-					if ((q=new(qctx.ses) HashOp(qctx.src[nqs0],qctx.src[nqs0+1]))==NULL) rc=RC_NORESOURCES;
-					break;
-				}
-				if (QBuildCtx::checkSort(qctx.src[nqs0+1],qctx.sortReq,qctx.nSortReq,nP)) {
-					if ((q=new(qctx.ses) HashOp(qctx.src[nqs0+1],qctx.src[nqs0]))==NULL) rc=RC_NORESOURCES;
-					break;
-				}
+				if (QBuildCtx::checkSort(qctx.src[nqs0],qctx.sortReq,qctx.nSortReq,nP)) {rc=qctx.hash(q,qctx.src[nqs0],qctx.src[nqs0+1]); break;}
+				if (QBuildCtx::checkSort(qctx.src[nqs0+1],qctx.sortReq,qctx.nSortReq,nP)) {rc=qctx.hash(q,qctx.src[nqs0+1],qctx.src[nqs0]); break;}
+			} else if ((qctx.src[nqs0]->getQFlags()&qctx.src[nqs0+1]->getQFlags()&QO_IDSORT)==0) {
+				// at least one side would have to be sorted for merging: build the hash table from the smaller one instead
+				QueryOp *const q0=qctx.src[nqs0],*const q1=qctx.src[nqs0+1];
+				rc=q0->getCost().nRows<q1->getCost().nRows?qctx.hash(q,q1,q0):qctx.hash(q,q0,q1); break;
 			}
 			rc=qctx.mergeN(q,&qctx.src[nqs0],nVars,QRY_INTERSECT); break;
 		}
@@ -174,6 +177,7 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 	RC rc=RC_OK; QueryOp *qq,*primary=NULL; const ulong nqs0=qctx.nqs,ncqs0=qctx.ncqs;
 	const bool fTrans=groupBy!=NULL && nGroupBy!=0 || outs!=NULL && nOuts!=0;
 	if (stype==SEL_CONST) {assert(fTrans); return qctx.out(q,this);}
+	struct ClassSrc {ulong idx; Class *cls; const ClassSpec *cs; bool fCond;} *csrc=nClasses!=0?(ClassSrc*)alloca(nClasses*sizeof(ClassSrc)):(ClassSrc*)0; unsigned ncsrc=0;
 	
 	if (fTrans) {
 		// merge props
@@ -188,14 +192,14 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 	} else for (ulong i=0; rc==RC_OK && i<nClasses; i++) {
 		const ClassSpec &cs=classes[i]; ClassID cid=cs.classID; PID *pids; unsigned nPids,j;
 		if ((cid&CLASS_PARAM_REF)!=0) {
-			ulong idx=cid&~CLASS_PARAM_REF; if (idx>qctx.qx->vals[QV_PARAMS].nValues) return RC_INVPARAM;
+			ulong idx=cid&~CLASS_PARAM_REF; qctx.fReuse=false; if (idx>qctx.qx->vals[QV_PARAMS].nValues) {rc=RC_INVPARAM; break;}
 			const Value& par=qctx.qx->vals[QV_PARAMS].vals[idx];
 			switch (par.type) {
 			case VT_URIID: cid=par.uid; break;
 			case VT_REFID:
 				if (qctx.nqs>=sizeof(qctx.src)/sizeof(qctx.src[0])) rc=RC_NORESOURCES;
 				else if ((qctx.src[qctx.nqs]=new(qctx.ses,1) ArrayScan(qctx.qx,&par.id,1,qctx.flg))==NULL) rc=RC_NORESOURCES;
-				else {qctx.nqs++; continue;}
+				else {qctx.src[qctx.nqs++]->est=QueryCost(1.,QCOST_CPU); continue;}
 				break;
 			case VT_ARRAY:
 				pids=NULL;
@@ -207,7 +211,7 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 				if (rc==RC_OK) {
 					if (pids==NULL) continue; if (nPids>1) qsort(pids,nPids,sizeof(PID),cmpPIDs);
 					if ((qctx.src[qctx.nqs]=new(qctx.ses,nPids) ArrayScan(qctx.qx,pids,nPids,qctx.flg))==NULL) rc=RC_NORESOURCES;
-					else {qctx.nqs++; qctx.ses->free(pids); continue;}
+					else {qctx.src[qctx.nqs++]->est=QueryCost(nPids,nPids*QCOST_CPU); qctx.ses->free(pids); continue;}
 				}
 				if (pids!=NULL) qctx.ses->free(pids);
 				break;
@@ -224,7 +228,7 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 			if (rc!=RC_OK) break;
 		}
 		Class *cls=qctx.ses->getStore()->classMgr->getClass(cid); if (cls==NULL) {rc=RC_NOTFOUND; break;}
-		const Stmt *cqry=cls->getQuery(); ClassIndex *cidx=cls->getIndex(); const ulong cflg=cls->getFlags(); IndexScan *is=NULL;
+		const Stmt *cqry=cls->getQuery(); ClassIndex *cidx=cls->getIndex(); const ulong cflg=cls->getFlags(); IndexScan *is=NULL; bool fKeep=false;
 		if (qctx.nqs>=sizeof(qctx.src)/sizeof(qctx.src[0])) rc=RC_NORESOURCES;
 		else if ((cflg&(CLASS_INDEXED|CLASS_VIEW))!=CLASS_INDEXED || (qctx.mode&MODE_DELETED)!=0 && ((cflg&CLASS_SDELETE)==0||cs.nParams!=0&&cidx!=NULL)) {
 			if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) rc=RC_NORESOURCES;
@@ -236,71 +240,31 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 				if ((qs.qry=cqry->clone(STMT_QUERY,qctx.ses))==NULL) rc=RC_NORESOURCES; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
 			}
 		} else if (cidx==NULL) {
+			bool fCond=false;
 			if ((qctx.src[qctx.nqs++]=new(qctx.ses) ClassScan(qctx.qx,cls,qctx.flg))==NULL) rc=RC_NORESOURCES;
-			else if (cqry!=NULL && cqry->hasParams() && cs.params!=NULL && cs.nParams!=0) {
-				if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) rc=RC_NORESOURCES;
-				else {
-					QueryWithParams &qs=qctx.condQs[qctx.ncqs++]; qs.params=NULL; qs.nParams=0;
-					if ((qs.qry=cqry->clone(STMT_QUERY,qctx.ses))==NULL) rc=RC_NORESOURCES; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
+			else {
+				qctx.classCost(qctx.src[qctx.nqs-1],cid);
+				if (cqry!=NULL && cqry->hasParams() && cs.params!=NULL && cs.nParams!=0) {
+					if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) rc=RC_NORESOURCES;
+					else {
+						QueryWithParams &qs=qctx.condQs[qctx.ncqs++]; qs.params=NULL; qs.nParams=0; fCond=true;
+						if ((qs.qry=cqry->clone(STMT_QUERY,qctx.ses))==NULL) rc=RC_NORESOURCES; else {qs.params=(Value*)cs.params; qs.nParams=cs.nParams;}
+					}
 				}
 			}
+			if (rc==RC_OK && cqry!=NULL && (qctx.mode&(MODE_CLASS|MODE_DELETED))==0) {ClassSrc& c=csrc[ncsrc++]; c.idx=qctx.nqs-1; c.cls=cls; c.cs=&cs; c.fCond=fCond; fKeep=true;}
 		} else {
 			assert(cqry!=NULL && cqry->top!=NULL && cqry->top->getType()==QRY_SIMPLE && ((SimpleVar*)cqry->top)->condIdx!=NULL);
-			ushort flags=SCAN_EXACT; ulong i=0,nRanges=0; const Value *param; const unsigned nSegs=((SimpleVar*)cqry->top)->nCondIdx;
-			struct IdxParam {const Value *param; uint32_t idx;} *iparams=(IdxParam*)alloca(nSegs*sizeof(IdxParam));
-			const Value **curValues=(const Value**)alloca(nSegs*sizeof(Value*)),*cv;
-			if (iparams==NULL || curValues==NULL) rc=RC_NORESOURCES;
+			ulong flags=SCAN_EXACT,nRanges=0; const SimpleVar *cv=(SimpleVar*)cqry->top;
+			IndexScan::IdxParam *iparams=(IndexScan::IdxParam*)alloca(cv->nCondIdx*sizeof(IndexScan::IdxParam));
+			if (iparams==NULL) rc=RC_NORESOURCES;
 			else {
 				if (cs.nParams==0) flags&=~SCAN_EXACT;
-				else for (CondIdx *pci=((SimpleVar*)cqry->top)->condIdx; pci!=NULL; pci=pci->next,++i) {
-					if (pci->param>=cs.nParams || (param=&cs.params[pci->param])->type==VT_RANGE && param->varray[0].type==VT_ANY && param->varray[1].type==VT_ANY) {
-						iparams[i].param=NULL; flags&=~SCAN_EXACT;
-					} else if (param->type==VT_ANY) {
-						if ((pci->ks.flags&(ORD_NULLS_BEFORE|ORD_NULLS_AFTER))!=0 && nRanges==0) nRanges=1;
-						iparams[i].param=NULL; flags&=~SCAN_EXACT;
-					} else {
-						if (param->type==VT_VARREF && (param->refV.flags&VAR_TYPE_MASK)==VAR_PARAM) {
-							if (param->length!=0 || param->refV.refN>=qctx.qx->vals[QV_PARAMS].nValues) {rc=RC_INVPARAM; break;}
-							param=&qctx.qx->vals[QV_PARAMS].vals[param->refV.refN];
-						}
-						iparams[i].param=param; iparams[i].idx=0; ulong nVals=1;
-						if (param->type==VT_ARRAY) nVals=param->length;
-						else if (param->type==VT_COLLECTION) nVals=param->nav->count();
-						if (nVals>1) {
-							if (pci->ks.op!=OP_EQ && pci->ks.op!=OP_IN && pci->ks.op!=OP_BEGINS) {rc=RC_TYPE; break;}
-							flags&=~SCAN_EXACT;
-						}
-						if (nVals>nRanges) nRanges=nVals;
-					}
-				}
+				else rc=IndexScan::getParams(cv->condIdx,cs.params,cs.nParams,qctx.qx->vals[QV_PARAMS],iparams,flags,nRanges);
 				if (rc==RC_OK && (is=new(qctx.ses,nRanges,*cidx) IndexScan(qctx.qx,*cidx,flags,nRanges,qctx.flg))==NULL) rc=RC_NORESOURCES;
-				for (ulong i=0; rc==RC_OK && i<nRanges; i++) {
-					bool fRange=false; byte op;
-					for (ulong k=0; k<nSegs; k++) if ((cv=curValues[k]=iparams[k].param)!=NULL) {
-						if (cv->type==VT_ARRAY) {
-							if (iparams[k].idx<cv->length) cv=&cv->varray[iparams[k].idx++]; else cv=iparams[k].param=NULL;
-						} else if (cv->type==VT_COLLECTION) {
-							if ((cv=cv->nav->navigate(i==0?GO_FIRST:GO_NEXT))==NULL) iparams[k].param=NULL;
-						}
-						if ((curValues[k]=cv)==NULL) is->flags&=~SCAN_EXACT;
-						else switch (cv->type) {
-						case VT_RANGE:
-							if (cidx->getIndexSegs()[k].op==OP_IN) {fRange=true; is->flags&=~SCAN_EXACT;} else rc=RC_TYPE;
-							break;
-						case VT_EXPR: case VT_STMT: case VT_EXPRTREE: case VT_VARREF:
-							rc=RC_TYPE; break;
-						default:
-							op=cidx->getIndexSegs()[k].op;
-							if (op!=OP_EQ && op!=OP_IN) {is->flags&=~SCAN_EXACT; if (op!=OP_BEGINS) fRange=true;}
-							break;
-						}
-					}
-					if (rc!=RC_OK || (rc=((SearchKey*)(is+1))[i*2].toKey(curValues,nSegs,cidx->getIndexSegs(),0,qctx.ses))!=RC_OK) break;
-					if (!fRange) ((SearchKey*)(is+1))[i*2+1].copy(((SearchKey*)(is+1))[i*2]);
-					else if ((rc=((SearchKey*)(is+1))[i*2+1].toKey(curValues,nSegs,cidx->getIndexSegs(),1,qctx.ses))!=RC_OK) break;
-				}
+				if (rc==RC_OK && (rc=is->setKeys(iparams))==RC_OK && cs.nParams!=0) {is->condIdx=cv->condIdx; is->cpars=cs.params; is->nCPars=cs.nParams;}
 				if (rc==RC_OK) {
-					QVar *cqv=cqry->top; is->initInfo();
+					QVar *cqv=cqry->top; is->initInfo(); qctx.indexCost(is,*cidx,(SearchKey*)(is+1),is->nScans,(is->flags&SCAN_EXACT)!=0);
 					if (cqv->nConds>0 && cqry->hasParams()) {
 						const Expr *const *pc=cqv->nConds==1?&cqv->cond:cqv->conds; cqry=NULL;
 						for (unsigned i=0; i<cqv->nConds; i++) if ((pc[i]->getFlags()&EXPR_PARAMS)!=0) {
@@ -335,12 +299,28 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 				}
 			}
 		}
-		if (cidx==NULL || rc!=RC_OK) cls->release();
+		if (cidx==NULL && !fKeep || rc!=RC_OK) cls->release();
 	}
 	if ((qctx.mode&MODE_DELETED)==0 && rc==RC_OK) for (CondFT *cf=condFT; cf!=NULL; cf=cf->next) {
 		if ((rc=qctx.mergeFT(qq,cf))!=RC_OK) break;
 		if (qctx.nqs<sizeof(qctx.src)/sizeof(qctx.src[0])) qctx.src[qctx.nqs++]=qq; else {rc=RC_NORESOURCES; break;}
 	}
+	if (rc==RC_OK && ncsrc!=0 && qctx.nqs>nqs0+1) {
+		// class scans returning many more PINs than the most selective source are replaced by class membership filters
+		double minRows=qctx.src[nqs0]->est.nRows;
+		for (ulong i=nqs0+1; i<qctx.nqs; i++) if (qctx.src[i]->est.nRows<minRows) minRows=qctx.src[i]->est.nRows;
+		for (unsigned i=ncsrc; i--!=0; ) {
+			const ClassSrc& c=csrc[i]; QueryOp *const qop=qctx.src[c.idx];
+			if (qop->est.nRows<=minRows*QCOST_FILTER_RATIO) continue;
+			if (!c.fCond) {
+				if (qctx.ncqs>=sizeof(qctx.condQs)/sizeof(qctx.condQs[0])) {rc=RC_NORESOURCES; break;}
+				QueryWithParams &qs=qctx.condQs[qctx.ncqs++]; qs.params=(Value*)c.cs->params; qs.nParams=c.cs->nParams;
+				if ((qs.qry=c.cls->getQuery()->clone(STMT_QUERY,qctx.ses))==NULL) {rc=RC_NORESOURCES; break;}
+			}
+			delete qop; memmove(&qctx.src[c.idx],&qctx.src[c.idx+1],(qctx.nqs-c.idx-1)*sizeof(QueryOp*)); qctx.nqs--;
+		}
+	}
+	for (unsigned i=0; i<ncsrc; i++) csrc[i].cls->release();
 	if (rc==RC_OK) {
 		bool fArrayFilter=pids!=NULL && nPids!=0;
 		if (qctx.nqs>nqs0) {
@@ -350,13 +330,14 @@ RC SimpleVar::build(class QBuildCtx& qctx,class QueryOp *&q) const
 		else if (primary!=NULL) {qctx.src[qctx.nqs++]=primary; primary=NULL;}
 		else if (fArrayFilter) {
 			fArrayFilter=false;
-			if ((qctx.src[qctx.nqs]=new(qctx.ses,nPids) ArrayScan(qctx.qx,pids,nPids,qctx.flg))!=NULL) qctx.nqs++; else rc=RC_NORESOURCES;
+			if ((qctx.src[qctx.nqs]=new(qctx.ses,nPids) ArrayScan(qctx.qx,pids,nPids,qctx.flg))==NULL) rc=RC_NORESOURCES;
+			else qctx.src[qctx.nqs++]->est=QueryCost(nPids,nPids*QCOST_CPU);
 		} else {
 #ifdef _DEBUG
 			if ((qctx.mode&(MODE_CLASS|MODE_DELETED))==0) {char *s=qctx.stmt->toString(); report(MSG_WARNING,"Full scan query: %.512s\n",s); qctx.ses->free(s);}
 #endif
 			qctx.src[qctx.nqs]=new(qctx.ses) FullScan(qctx.qx,(qctx.mode&(MODE_CLASS|MODE_NODEL))==QO_CLASS?HOH_HIDDEN:(qctx.mode&MODE_DELETED)!=0?HOH_DELETED<<16|HOH_DELETED|HOH_HIDDEN:HOH_DELETED|HOH_HIDDEN,qctx.flg);
-			if (qctx.src[qctx.nqs]!=NULL) qctx.nqs++; else rc=RC_NORESOURCES;
+			if (qctx.src[qctx.nqs]!=NULL) qctx.src[qctx.nqs++]->est=QueryCost(QCOST_NROWS_FULL,QCOST_NROWS_FULL*QCOST_FETCH); else rc=RC_NORESOURCES;
 		}
 		if (rc==RC_OK) {
 			if (fArrayFilter) {if ((qq=new(nPids,qctx.ses) ArrayFilter(qctx.src[nqs0],pids,nPids))!=NULL) qctx.src[nqs0]=qq; else rc=RC_NORESOURCES;}
@@ -402,7 +383,7 @@ bool QBuildCtx::checkSort(QueryOp *q,const OrderSegQ *req,unsigned nReq,unsigned
 		else if (nP==0) fRev=true; else if (!fRev) return false;
 }
 
-RC QBuildCtx::sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *pl,bool fTmp)
+RC QBuildCtx::sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *pl,bool fTmp,ulong nTop)
 {
 	if (os==NULL || no==1 && (os->flags&ORDER_EXPR)==0 && os->pid==PROP_SPEC_PINID) no=0;
 	if (no==0 && (qop->qflags&QO_IDSORT)!=0) return RC_OK;
@@ -418,8 +399,12 @@ RC QBuildCtx::sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *pl,b
 			else if (os[i].pid==PROP_SPEC_PINID) {no=i+1; break;}
 			else if ((rc=plp.merge(os[i].var,&os[i].pid,1,fTmp))!=RC_OK) return rc;
 		if ((rc=load(qop,plp))==RC_OK) {
-			Sort *srt=new(ses,no,plp.nPls) Sort(qop,os,no,flg,nP,plp.pls,plp.nPls);
-			if (srt!=NULL) {qop=srt; for (unsigned i=0; i<plp.nPls; i++) plp.pls[i].fFree=false;} else rc=RC_NORESOURCES;
+			Sort *srt=new(ses,no,plp.nPls) Sort(qop,os,no,flg,nP,plp.pls,plp.nPls,nTop);
+			if (srt==NULL) rc=RC_NORESOURCES;
+			else {
+				if (srt->est.nRows>1.) srt->est.cost+=srt->est.nRows*log(nTop!=0&&nTop<srt->est.nRows?double(nTop)+1.:srt->est.nRows)*QCOST_CPU;
+				qop=srt; for (unsigned i=0; i<plp.nPls; i++) plp.pls[i].fFree=false;
+			}
 		}
 	} catch (RC rc2) {rc=rc2;}
 	return rc;
@@ -429,7 +414,18 @@ RC QBuildCtx::mergeN(QueryOp *&res,QueryOp **o,unsigned no,QUERY_SETOP op)
 {
 	res=NULL; RC rc; if (o==NULL || no<2) return RC_INTERNAL;
 	for (unsigned i=0; i<no; i++) {if ((o[i]->getQFlags()&(QO_IDSORT|QO_UNIQUE))!=(QO_IDSORT|QO_UNIQUE) && (rc=sort(o[i],NULL,0))!=RC_OK) return rc;}
-	return (res=new(ses,no) MergeIDs(qx,o,no,op,flg))!=NULL?RC_OK:RC_NORESOURCES;
+	if ((res=new(ses,no) MergeIDs(qx,o,no,op,flg))==NULL) return RC_NORESOURCES;
+	double nRows=o[0]->est.nRows,cost=o[0]->est.cost;
+	for (unsigned i=1; i<no; i++) {
+		const QueryCost& c=o[i]->est; cost+=c.cost;
+		if (op==QRY_UNION) nRows+=c.nRows; else if (op==QRY_INTERSECT && c.nRows<nRows) nRows=c.nRows;
+	}
+	res->est=QueryCost(nRows,cost); return RC_OK;
+}
+
+static double sortCost(double nRows)
+{
+	return nRows>1.?nRows*log(nRows)*QCOST_CPU+(nRows*QCOST_ROW_MEM>DEFAULT_QUERY_MEM?nRows*QCOST_SPILL:0.):0.;
 }
 
 RC QBuildCtx::merge2(QueryOp *&res,QueryOp **qs,const CondEJ *cej,QUERY_SETOP qo,const Expr *const *conds,unsigned nConds)
@@ -452,6 +448,15 @@ RC QBuildCtx::merge2(QueryOp *&res,QueryOp **qs,const CondEJ *cej,QUERY_SETOP qo
 		if (fI1) {fS1=true; fR1=false;} else if (qo==QRY_SEMIJOIN) qs[0]->unique(false);
 		if (fI2) {fS2=true; fR2=false;} else if (qo==QRY_SEMIJOIN) qs[1]->unique(false);
 	}
+	if ((!fS1 || !fS2 || fR1 || fR2) && qo!=QRY_FULL_OUTER_JOIN && qs[0]->nOuts==1 && qs[1]->nOuts==1) {
+		// at least one input would have to be sorted: build a hash table from the smaller input instead if it's cheaper, the preserved side of an outer join is probed
+		// HashJoin keeps and spills single PIN references, so both inputs must have one output
+		const bool fB1=qo!=QRY_SEMIJOIN && qo!=QRY_LEFT_OUTER_JOIN,fB2=qo!=QRY_RIGHT_OUTER_JOIN;
+		const double n1=qs[0]->est.nRows,n2=qs[1]->est.nRows; const bool fSwap=fB1 && (!fB2 || n1<n2);
+		const double mcost=(fI1||fS1&&!fR1?0.:sortCost(n1))+(fI2||fS2&&!fR2?0.:sortCost(n2))+(n1+n2)*QCOST_CPU;
+		const double hcost=(n1+n2)*QCOST_CPU*2.+((fSwap?n1:n2)*QCOST_ROW_MEM>DEFAULT_QUERY_MEM?(n1+n2)*QCOST_SPILL:0.);
+		if ((fB1 || fB2) && hcost<mcost) return hashJoin(res,qs,cej,nej,qo,conds,nConds,fSwap);
+	}
 	if (!fS1 || !fS2 || fR1 || fR2) {
 		if (fS1 && fS2) {
 			if (!fR1) fS2=false; else if (!fR2) fS1=false;
@@ -494,23 +499,61 @@ RC QBuildCtx::merge2(QueryOp *&res,QueryOp **qs,const CondEJ *cej,QUERY_SETOP qo
 	if ((qs[0]->qflags&QO_UNIQUE)!=0 && cej->propID1==PROP_SPEC_PINID) ff|=QO_UNI1;
 	if ((qs[1]->qflags&QO_UNIQUE)!=0 && cej->propID2==PROP_SPEC_PINID) ff|=QO_UNI2;
 	try {if ((res=new(ses,nej) MergeOp(qs[0],qs[1],cej,nej,qo,conds,nConds,flg|ff))==NULL) return RC_NORESOURCES;} catch (RC rc) {return rc;}
+	const QueryCost &c1=qs[0]->est,&c2=qs[1]->est;
+	res->est.nRows=qo==QRY_SEMIJOIN||c1.nRows>c2.nRows?c1.nRows:c2.nRows; res->est.cost=c1.cost+c2.cost+(c1.nRows+c2.nRows)*QCOST_CPU;
 	return RC_OK;
 }
 
-RC QBuildCtx::nested(QueryOp *&res,QueryOp **qs,const Expr **conds,unsigned nConds)
+RC QBuildCtx::hashJoin(QueryOp *&res,QueryOp **qs,const CondEJ *cej,unsigned nej,QUERY_SETOP qo,const Expr *const *conds,unsigned nConds,bool fSwap)
 {
-	PropListP plp(ses); RC rc=RC_OK;
+	QueryOp *qop=qs[fSwap?1:0],*qop2=qs[fSwap?0:1]; PropListP plp(ses),plp2(ses); RC rc; res=NULL;
+	for (const CondEJ *ce=cej; ce!=NULL; ce=ce->next) {
+		const PropertyID pid=fSwap?ce->propID2:ce->propID1,pid2=fSwap?ce->propID1:ce->propID2;
+		if (pid!=PROP_SPEC_PINID && (rc=plp.merge(0,&pid,1,true))!=RC_OK || pid2!=PROP_SPEC_PINID && (rc=plp2.merge(0,&pid2,1,true))!=RC_OK) return rc;
+	}
+	if ((rc=load(qop,plp))!=RC_OK || (rc=load(qop2,plp2))!=RC_OK) return rc;
+	if ((flg&QO_VCOPIED)!=0) {
+		CondEJ *ej=(CondEJ*)ses->malloc(nej*sizeof(CondEJ)); if (ej==NULL) return RC_NORESOURCES;
+		for (unsigned i=0; i<nej; i++,cej=cej->next) {memcpy(&ej[i],cej,sizeof(CondEJ)); ej[i].next=i+1<nej?&ej[i+1]:NULL;}
+		cej=ej;
+	}
+	try {if ((res=new(ses,nej) HashJoin(qop,qop2,cej,nej,qo,conds,nConds,flg,fSwap))==NULL) return RC_NORESOURCES;} catch (RC rc) {return rc;}
+	const QueryCost &c1=qop->est,&c2=qop2->est;
+	res->est.nRows=qo==QRY_SEMIJOIN||c1.nRows>c2.nRows?c1.nRows:c2.nRows; res->est.cost=c1.cost+c2.cost+(c1.nRows+c2.nRows)*QCOST_CPU;
+	return RC_OK;
+}
+
+RC QBuildCtx::nested(QueryOp *&res,QueryOp **qs,unsigned nqs,const Expr **conds,unsigned nConds,bool fReorder)
+{
+	PropListP plp(ses); RC rc=RC_OK; res=NULL; if (nqs<2) return RC_INTERNAL;
 	for (unsigned i=0; i<nConds; i++) if ((rc=conds[i]->mergeProps(plp))!=RC_OK) return rc;
-	const unsigned nLeft=qs[0]->getNOuts(),save=plp.nPls;
-	if (save>nLeft) plp.nPls=nLeft;
-	if ((rc=load(qs[0],plp))!=RC_OK) {plp.nPls=save; return rc;}
-	if (save>nLeft) {
-		plp.pls+=nLeft; plp.nPls=save-nLeft;
-		rc=load(qs[1],plp);
-		plp.pls-=nLeft; plp.nPls=save;
+	const unsigned save=plp.nPls;
+	for (unsigned i=0,var=0; i<nqs && var<save; var+=qs[i++]->getNOuts()) {
+		const unsigned nOuts=qs[i]->getNOuts();
+		plp.pls+=var; plp.nPls=save-var>nOuts?nOuts:save-var;
+		rc=load(qs[i],plp);
+		plp.pls-=var; plp.nPls=save;
 		if (rc!=RC_OK) return rc;
 	}
-	return (res=new(ses) NestedLoop(qs[0],qs[1],flg))!=NULL?RC_OK:RC_NORESOURCES;
+	QueryOp *qop=qs[0]; unsigned nP=0;
+	for (unsigned i=1; i<nqs; i++) {
+		// inputs are joined left to right, the side with the lower estimated cost of repeated rewinds drives the loop
+		QueryOp *const q2=qs[i]; const QueryCost &c1=qop->est,&c2=q2->est;
+		const bool fSwap=fReorder && c2.cost+c2.nRows*c1.cost<c1.cost+c1.nRows*c2.cost && !checkSort(qop,sortReq,nSortReq,nP);
+		NestedLoop *nl=fSwap?new(ses) NestedLoop(q2,qop,flg,true):new(ses) NestedLoop(qop,q2,flg);
+		if (nl==NULL) return RC_NORESOURCES;
+		nl->est.nRows=c1.nRows*c2.nRows; if (i+1==nqs) for (unsigned j=0; j<nConds; j++) nl->est.nRows*=QCOST_SEL_COND;
+		nl->est.cost=fSwap?c2.cost+c2.nRows*c1.cost:c1.cost+c1.nRows*c2.cost; qop=nl;
+	}
+	res=qop; return RC_OK;
+}
+
+RC QBuildCtx::hash(QueryOp *&res,QueryOp *qop1,QueryOp *qop2)
+{
+	if ((res=new(ses) HashOp(qop1,qop2))==NULL) return RC_NORESOURCES;
+	const QueryCost &c1=qop1->est,&c2=qop2->est;
+	res->est.nRows=c1.nRows<c2.nRows?c1.nRows:c2.nRows; res->est.cost=c1.cost+c2.cost+(c1.nRows+c2.nRows)*QCOST_CPU;
+	return RC_OK;
 }
 
 RC QBuildCtx::mergeFT(QueryOp *&res,const CondFT *cft)
@@ -545,6 +588,7 @@ RC QBuildCtx::mergeFT(QueryOp *&res,const CondFT *cft)
 			if (loc->stemmer!=NULL) pW=loc->stemmer->process(pW,lW,buf);
 			FTScan *ft=new(ses,cft->nPids,lW+1) FTScan(qx,pW,lW,cft->pids,cft->nPids,flg,cft->flags,fStop);
 			if (ft==NULL) {rc=RC_NORESOURCES; break;}
+			ft->est=QueryCost(QCOST_NROWS_FT,1.+QCOST_NROWS_FT/QCOST_FANOUT);
 			if (nqops>=xqops) {
 				if (qops!=qopsbuf) qops=(QueryOp**)ses->realloc(qops,(xqops*=2)*sizeof(QueryOp*));
 				else if ((qops=(QueryOp**)ses->malloc((xqops*=2)*sizeof(QueryOp*)))!=NULL) memcpy(qops,qopsbuf,nqops*sizeof(QueryOp*));
@@ -564,6 +608,8 @@ RC QBuildCtx::mergeFT(QueryOp *&res,const CondFT *cft)
 
 RC QBuildCtx::filter(QueryOp *&qop,const Expr *const *conds,unsigned nConds,const CondIdx *condIdx,unsigned ncq)
 {
+	QueryOp *const src=(qop->qflags&QO_SPLIT)!=0 && qop->est.nRows>=XCH_MIN_ROWS && (flg&(QO_FORUPDATE|QO_CLASS))==0
+		&& (ses->getStore()->mode&STARTUP_SINGLE_SESSION)==0 && !ses->inWriteTx() ? qop : (QueryOp*)0;
 	if ((qop->qflags&QO_ALLPROPS)==0) {
 		PropListP req(ses); flg|=QO_NODATA; RC rc=RC_OK; 		// force?
 		if (conds!=NULL) for (unsigned i=0; i<nConds; i++) if ((rc=conds[i]->mergeProps(req))!=RC_OK) return rc;
@@ -598,13 +644,23 @@ RC QBuildCtx::filter(QueryOp *&qop,const Expr *const *conds,unsigned nConds,cons
 					QueryWithParams& qwp=flt->queries[i]; RC rc;
 					if (qwp.params!=NULL && qwp.nParams!=0) {
 						if ((rc=copyV(qwp.params,qwp.nParams,qwp.params,ses))!=RC_OK) {for (;i<ncq;i++) flt->queries[i].params=NULL; fOK=false; break;}
-						for (unsigned j=0; j<qwp.nParams; j++) if (qwp.params[j].type==VT_VARREF && (qwp.params[j].refV.flags&VAR_TYPE_MASK)==VAR_PARAM)
+						for (unsigned j=0; j<qwp.nParams; j++) if (qwp.params[j].type==VT_VARREF && (qwp.params[j].refV.flags&VAR_TYPE_MASK)==VAR_PARAM) {
 							if (qwp.params[j].refV.refN<qx->vals[QV_PARAMS].nValues) {qwp.params[j]=qx->vals[QV_PARAMS].vals[qwp.params[j].refV.refN]; qwp.params[j].flags=NO_HEAP;} else qwp.params[j].setError();
+							fReuse=false;
+						}
 					}
 				}
 			}
 		}
-		if (!fOK) {delete flt; return RC_NORESOURCES;} else qop=flt;
+		if (!fOK) {delete flt; return RC_NORESOURCES;}
+		for (const CondIdx *ci=condIdx; ci!=NULL; ci=ci->next) flt->est.nRows*=QCOST_SEL_COND;
+		for (unsigned i=0; i<nConds+ncq; i++) flt->est.nRows*=QCOST_SEL_COND;
+		qop=flt;
+		// filtering of a large scan is spread between RequestQueue threads unless only PIN IDs are checked
+		const unsigned nw=min(getNProcessors()-1,XCH_MAX_THREADS);
+		if (src!=NULL && nw!=0 && ((src->qflags&QO_ALLPROPS)!=0 || (flg&QO_NODATA)==0)) {
+			Exchange *xch=new(ses) Exchange(flt,src,nw,0); if (xch!=NULL) qop=xch;
+		}
 	} catch (RC rc) {return rc;}
 	return RC_OK;
 }
@@ -630,6 +686,7 @@ RC QBuildCtx::load(QueryOp *&qop,const PropListP& plp)
 	// all pins, all props
 	QueryOp *q=new(ses,plp.nPls) LoadOp(qop,plp.pls,plp.nPls,flg); if (q==NULL) return RC_NORESOURCES;
 	for (unsigned i=0; i<plp.nPls; i++) plp.pls[i].fFree=false;
+	q->est.cost+=q->est.nRows*QCOST_FETCH;
 	qop=q; return RC_OK;
 }
 
@@ -671,6 +728,28 @@ RC QBuildCtx::out(QueryOp *&qop,const QVar *qv)
 	catch (RC rc) {return rc;}
 }
 
+void QBuildCtx::classCost(QueryOp *qop,ClassID cid)
+{
+	Class *cls=NULL; uint64_t nPINs=~0ULL,nDeleted=0;
+	if (ses->getStore()->classMgr->getClassInfo(cid,cls,nPINs,nDeleted)==RC_OK && nPINs!=(uint64_t)~0u) {
+		const double nRows=double((flg&QO_DELETED)!=0?nDeleted:nPINs);
+		qop->est=QueryCost(nRows,1.+nRows/QCOST_FANOUT);
+	} else qop->est=QueryCost(QCOST_NROWS_FULL,QCOST_NROWS_FULL/QCOST_FANOUT);
+	if (cls!=NULL) cls->release();
+}
+
+void QBuildCtx::indexCost(QueryOp *qop,ClassIndex& cidx,const SearchKey *keys,ulong nRanges,bool fExact)
+{
+	// without statistics (see ISession::analyzeIndices()) the number of entries is derived from the tree height
+	const ulong nLevels=cidx.getNLevels(); double nRows;
+	if (!cidx.estimate(keys,nRanges,fExact,nRows)) {
+		const double nKeys=nLevels!=0?pow(QCOST_FANOUT,double(nLevels))/2.:0.;
+		nRows=nRanges==0?nKeys:nKeys*nRanges*(fExact?QCOST_SEL_EQ:QCOST_SEL_RANGE);
+	}
+	if (nRows<1.) nRows=1.;
+	qop->est=QueryCost(nRows,(nRanges!=0?nRanges:1)*double(nLevels)+nRows/QCOST_FANOUT);
+}
+
 RC PropListP::checkVar(uint16_t var)
 {
 	if (var>=nPls) {
@@ -152,9 +152,10 @@ class	QCtx
 	int		refc;
 	void	operator	delete(void *) {}
 public:
-	QCtx(Session *s) : refc(0),ses(s) {memset(vals,0,sizeof(vals));}
+	QCtx(Session *s) : refc(0),ses(s),fStats(false) {memset(vals,0,sizeof(vals));}
 	Session	*const	ses;
 	ValueV	vals[QV_ALL];
+	bool	fStats;
 	void	ref() {refc++;}
 	void	destroy();
 	friend	class	QBuildCtx;
@@ -178,6 +179,7 @@ class QBuildCtx
 	QCtx			*const	qx;
 	const Stmt				*stmt;
 	ulong					nSkip;
+	ulong					nReturn;
 	ulong					mode;
 	ulong					flg;
 	PropListP				propsReq;
@@ -187,19 +189,25 @@ class QBuildCtx
 	ulong					nqs;
 	QueryWithParams			condQs[256];
 	ulong					ncqs;
+	bool					fReuse;
 public:
-	QBuildCtx(Session *s,const ValueV& prs,const Stmt *st,ulong nsk,ulong f);
+	QBuildCtx(Session *s,const ValueV& prs,const Stmt *st,ulong nsk,ulong f,ulong nRet=~0ul);
 	~QBuildCtx();
 	RC	process(QueryOp *&qop);
+	bool	isReusable() const {return fReuse;}		/**< parameter values were not bound into the plan at build time */
 private:
-	RC	sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *props=NULL,bool fTmp=false);
+	RC	sort(QueryOp *&qop,const OrderSegQ *os,unsigned no,PropListP *props=NULL,bool fTmp=false,ulong nTop=0);
 	RC	mergeN(QueryOp *&res,QueryOp **o,unsigned no,QUERY_SETOP op);
 	RC	merge2(QueryOp *&res,QueryOp **qs,const CondEJ *cej,QUERY_SETOP qo,const Expr *const *conds=NULL,unsigned nConds=0);
+	RC	hashJoin(QueryOp *&res,QueryOp **qs,const CondEJ *cej,unsigned nej,QUERY_SETOP qo,const Expr *const *conds,unsigned nConds,bool fSwap);
 	RC	mergeFT(QueryOp *&res,const CondFT *cft);
-	RC	nested(QueryOp *&res,QueryOp **qs,const Expr **conds,unsigned nConds);
+	RC	nested(QueryOp *&res,QueryOp **qs,unsigned nqs,const Expr **conds,unsigned nConds,bool fReorder=false);
+	RC	hash(QueryOp *&res,QueryOp *qop1,QueryOp *qop2);
 	RC	filter(QueryOp *&qop,const Expr *const *c,unsigned nConds,const CondIdx *condIdx=NULL,unsigned ncq=0);
 	RC	load(QueryOp *&qop,const PropListP& plp);
 	RC	out(QueryOp *&qop,const QVar *qv);
+	void	classCost(QueryOp *qop,ClassID cid);
+	void	indexCost(QueryOp *qop,class ClassIndex& cidx,const struct SearchKey *keys,ulong nRanges,bool fExact);
 	static	bool	checkSort(QueryOp *qop,const OrderSegQ *req,unsigned nReq,unsigned& nP);
 	friend	class	SimpleVar;
 	friend	class	SetOpVar;
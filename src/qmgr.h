@@ -41,11 +41,26 @@ namespace AfyKernel
 
 enum QID {_NONE,_T1,_T2,_B1,_B2};
 
+/**
+ * private ring of cache elements used by scan and bulk resource access strategies
+ * resources acquired through a ring are not placed in ARC queues, they're recycled when the ring wraps around
+ */
+template<typename Key> struct QRing {
+	Key				*const	keys;
+	unsigned				xKeys;
+	unsigned				nKeys;
+	unsigned				pos;
+	ulong					nEvicted;
+	ulong					nEscaped;
+	QRing(Key *ks,unsigned xk) : keys(ks),xKeys(xk),nKeys(0),pos(0),nEvicted(0),nEscaped(0) {}
+};
+
 /**
  * tamplate for the cache element descriptor
  */
 template<class T,typename Key,typename KeyArg> struct QElt : public DLList {
 	void			*mgr;
+	void			*owner;
 	Key				key;
 	RWLock			lock;
 	T				*rsrc;
@@ -54,12 +69,14 @@ template<class T,typename Key,typename KeyArg> struct QElt : public DLList {
 	QID				qid;
 	RC				rc;
 	bool			fDiscard;
-	QElt(void *mg,KeyArg k,QID qi,T *r=NULL) : mgr(mg),key(k),rsrc(r),hash(this),fixCount(1),qid(qi),rc(RC_OK),fDiscard(false) {}
+	volatile bool	fRef;
+	QElt(void *mg,KeyArg k,QID qi,T *r=NULL) : mgr(mg),owner(NULL),key(k),rsrc(r),hash(this),fixCount(1),qid(qi),rc(RC_OK),fDiscard(false),fRef(false) {}
 	KeyArg			getKey() const {return key;}
 	bool			isFixed() const {return fixCount>0;}
 	bool			isLocked() const {return lock.isLocked();}
 	bool			isULocked() const {return lock.isULocked();}
 	bool			isXLocked() const {return lock.isXLocked();}
+	long			getVersion() const {return lock.getVersion();}
 	void			upgradeLock(RW_LockType lt) {lock.upgradelock(lt);}
 	void			downgradeLock(RW_LockType lt) {lock.downgradelock(lt);}
 	bool			tryupgrade() {return lock.tryupgrade();}
@@ -88,51 +105,61 @@ public:
 		Queue						B2;
 		Mutex						lock;
 		FreeQ<QE_ALLOC_BLOCK_SIZE,Std_Alloc<alc> >	freeQE;
-		QueueCtrl(int nb) : nElts(nb),T1TargetL(0),T1(_T1),T2(_T2),B1(_B1),B2(_B2) {}
+		unsigned					nParts;
+		ulong						nHits;
+		ulong						nMisses;
+		ulong						nEvicted;
+		QueueCtrl(int nb=0) : nElts(nb),T1TargetL(0),T1(_T1),T2(_T2),B1(_B1),B2(_B2),nParts(1),nHits(0),nMisses(0),nEvicted(0) {}
 	};
 protected:
 	QueueCtrl<allc>			&ctrl;
+	const	unsigned		nParts;
+	const	int				partShift;
 	RW_LockType				saveLock;
 	QEHash					hashTable;
 public:
-	QMgr(QueueCtrl<allc>& ct,int lH) : ctrl(ct),saveLock(RW_U_LOCK),hashTable(nextP2(lH)) {}
+	QMgr(QueueCtrl<allc>& ct,int lH) : ctrl(ct),nParts(ct.nParts),partShift(32-pop(ct.nParts-1)),saveLock(RW_U_LOCK),hashTable(nextP2(lH)) {}
+	unsigned part(KeyArg key) const {return nParts<=1?0u:unsigned(uint32_t(uint32_t(key)*0x85EBCA6Bu)>>partShift);}
+	QueueCtrl<allc>& getCtrl(KeyArg key) const {return (&ctrl)[part(key)];}
 protected:
-	RC get(T* &rsrc,KeyArg key,Info info,ulong flags=RW_S_LOCK,T *old=NULL) {
-		typename QEHash::Find findQE(hashTable,key); rsrc=NULL; Queue *pA=NULL;
+	RC get(T* &rsrc,KeyArg key,Info info,ulong flags=RW_S_LOCK,T *old=NULL,QRing<Key> *ring=NULL) {
+		typename QEHash::Find findQE(hashTable,key); rsrc=NULL; Queue *pA=NULL; QueueCtrl<allc>& qc=getCtrl(key);
 		if (old!=NULL) old->getQE()->lock.unlock((flags&QMGR_UFORCE)!=0);
-		QE *qe,*qe2; QEHash *ht; RW_LockType lt=(RW_LockType)(flags&RW_MASK); bool fT1=false;
+		QE *qe,*qe2; QEHash *ht; RW_LockType lt=(RW_LockType)(flags&RW_MASK); bool fT1=false,fLocked=true;
 		for (;;) {
 			if ((qe=findQE.findLock(RW_S_LOCK))==NULL) {findQE.unlock(); qe=findQE.findLock(RW_X_LOCK);}
 			if (qe==NULL) {
 				if ((flags&QMGR_INMEM)!=0) return RC_NOTFOUND;
-				if ((qe=new(ctrl.freeQE.alloc(sizeof(QE))) QE(this,key,_T1))==NULL) return RC_NORESOURCES;
-				qe->lock.lock(RW_X_LOCK);
+				if ((qe=new(qc.freeQE.alloc(sizeof(QE))) QE(this,key,ring!=NULL?_NONE:_T1))==NULL) return RC_NORESOURCES;
+				qe->lock.lock(RW_X_LOCK); qe->owner=ring;
 				hashTable.insertNoLock(qe,findQE.getIdx()); findQE.unlock();
-				ctrl.lock.lock(); ctrl.T1.l++; if (old!=NULL) releaseNoLock(old);
-				if (ctrl.T1.l+ctrl.T2.l+ctrl.B1.l+ctrl.B2.l>=ctrl.nElts) {
-					if (ctrl.T1.l+ctrl.B1.l!=ctrl.nElts) {
-						assert(ctrl.T1.l+ctrl.T2.l+ctrl.B1.l+ctrl.B2.l>=ctrl.nElts);
-						if (ctrl.T1.l+ctrl.T2.l+ctrl.B1.l+ctrl.B2.l==ctrl.nElts*2) {
+				if (ring!=NULL) {fLocked=false; if (old!=NULL) release(old,old->getQE()); break;}
+				if (old!=NULL) release(old,old->getQE());
+				qc.lock.lock(); qc.T1.l++; qc.nMisses++;
+				if (qc.T1.l+qc.T2.l+qc.B1.l+qc.B2.l>=qc.nElts) {
+					if (qc.T1.l+qc.B1.l!=qc.nElts) {
+						assert(qc.T1.l+qc.T2.l+qc.B1.l+qc.B2.l>=qc.nElts);
+						if (qc.T1.l+qc.T2.l+qc.B1.l+qc.B2.l>=qc.nElts*2) {
 							bool fB1=true;
-							for (; (qe2=ctrl.B2.removeLast())!=NULL; ht->unlock(qe2)) {
+							for (; (qe2=qc.B2.removeLast())!=NULL; ht->unlock(qe2)) {
 								assert(qe2->qid==_B2 && qe2->rsrc==NULL); ht=&((QMgr*)qe2->mgr)->hashTable; ht->lock(qe2,RW_X_LOCK);
-								if (qe2->fixCount==0) {ht->removeNoLock(qe2); ctrl.B2.l--; ctrl.freeQE.dealloc(qe2); fB1=false; break;}
+								if (qe2->fixCount==0) {ht->removeNoLock(qe2); qc.B2.l--; qc.freeQE.dealloc(qe2); fB1=false; break;}
 							}
-							if (fB1) for (; (qe2=ctrl.B1.removeLast())!=NULL; ht->unlock(qe2)) {
+							if (fB1) for (; (qe2=qc.B1.removeLast())!=NULL; ht->unlock(qe2)) {
 								assert(qe2->qid==_B1 && qe2->rsrc==NULL); ht=&((QMgr*)qe2->mgr)->hashTable; ht->lock(qe2,RW_X_LOCK);
-								if (qe2->fixCount==0) {ht->removeNoLock(qe2); ctrl.B1.l--; ctrl.freeQE.dealloc(qe2); break;}
+								if (qe2->fixCount==0) {ht->removeNoLock(qe2); qc.B1.l--; qc.freeQE.dealloc(qe2); break;}
 							}
 						}
-					} else for (fT1=true; ctrl.T1.l<ctrl.nElts && (qe2=ctrl.B1.removeLast())!=NULL; ht->unlock(qe2)) {
+					} else for (fT1=true; qc.T1.l<qc.nElts && (qe2=qc.B1.removeLast())!=NULL; ht->unlock(qe2)) {
 						assert(qe2->qid==_B1 && qe2->rsrc==NULL); ht=&((QMgr*)qe2->mgr)->hashTable; ht->lock(qe2,RW_X_LOCK);
-						if (qe2->fixCount==0) {ht->removeNoLock(qe2); ctrl.B1.l--; ctrl.freeQE.dealloc(qe2); fT1=false; break;}
+						if (qe2->fixCount==0) {ht->removeNoLock(qe2); qc.B1.l--; qc.freeQE.dealloc(qe2); fT1=false; break;}
 					}
 				}
 			} else {
 				bool fLoad=qe->rsrc==NULL; //assert(!fLoad || qe->fDiscard || qe->fixCount==0 || qe->fixCount==1 && qe->lock.isXLocked());
 				if ((flags&QMGR_NEW)!=0 && !fLoad && !qe->fDiscard) return RC_ALREADYEXISTS;
 				if (fLoad && (flags&QMGR_INMEM)!=0) return RC_NOTFOUND;
-				++qe->fixCount;
+				++qe->fixCount; if (ring==NULL) {qe->owner=NULL; qe->fRef=true;}
 				if ((flags&QMGR_TRY)!=0 && !fLoad) {
 					RC rc=qe->rc;
 					if (rc!=RC_OK) {assert(qe->fixCount>0); --qe->fixCount;}
@@ -146,49 +173,63 @@ protected:
 				qe->lock.lock(fLoad?RW_X_LOCK:qe->rsrc->lockType(lt));
 				if (qe->fDiscard) continue;
 				if (qe->rsrc!=NULL) {
-					if (fLoad && (lt=qe->rsrc->lockType(lt))!=RW_X_LOCK) qe->lock.downgradelock(lt);
+					qc.nHits++; if (fLoad && (lt=qe->rsrc->lockType(lt))!=RW_X_LOCK) qe->lock.downgradelock(lt);
 					if (old!=NULL) release(old,old->getQE());
 					if (qe->rc==RC_OK) rsrc=qe->rsrc; 
 					return qe->rc;
 				}
-				ctrl.lock.lock(); assert(qe->lock.isXLocked());
+				if (old!=NULL) release(old,old->getQE());
+				qc.lock.lock(); assert(qe->lock.isXLocked()); qc.nMisses++;
+				if (ring!=NULL) {
+					if (qe->isInList()) {qe->remove(); if (qe->qid==_B1) --qc.B1.l; else if (qe->qid==_B2) --qc.B2.l;}
+					qe->qid=_NONE; qe->owner=ring; qc.lock.unlock(); fLocked=false; break;
+				}
 				if (qe->isInList()) {
-					if (qe->qid==_B1) {ctrl.T1TargetL=min(ctrl.T1TargetL+max(ctrl.B2.l/ctrl.B1.l,1l),ctrl.nElts); --ctrl.B1.l;}
-					else {assert(qe->qid==_B2); ctrl.T1TargetL=max(ctrl.T1TargetL-max(ctrl.B1.l/ctrl.B2.l,1l),0l); --ctrl.B2.l;}
+					if (qe->qid==_B1) {qc.T1TargetL=min(qc.T1TargetL+max(qc.B2.l/qc.B1.l,1l),qc.nElts); --qc.B1.l;}
+					else {assert(qe->qid==_B2); qc.T1TargetL=max(qc.T1TargetL-max(qc.B1.l/qc.B2.l,1l),0l); --qc.B2.l;}
 					qe->remove();
 				}
-				qe->qid=_T2; ctrl.T2.l++; if (old!=NULL) releaseNoLock(old);
+				qe->qid=_T2; qc.T2.l++;
 			}
 			break;
 		}
 		bool fNew=true; assert(qe->rsrc==NULL);
-		if (fT1 || (rsrc=T::createNew(key,this))==NULL) for (;;fT1=false) {
-			pA = fT1 || ctrl.T1.l>=max(ctrl.T1TargetL,1l) ? &ctrl.T1 : &ctrl.T2;
+		if (ring!=NULL) {
+			if ((rsrc=recycle(*ring,key))!=NULL) fNew=false;
+			else if ((rsrc=T::createNew(key,this))==NULL) {qc.lock.lock(); fLocked=true;}
+		}
+		if (rsrc==NULL && (fT1 || (rsrc=T::createNew(key,this))==NULL)) for (;;fT1=false) {
+			pA = fT1 || qc.T1.l>=max(qc.T1TargetL,1l) ? &qc.T1 : &qc.T2;
 			if (pA->prev==pA) {
-				pA=pA==&ctrl.T1?&ctrl.T2:&ctrl.T1; 
+				pA=pA==&qc.T1?&qc.T2:&qc.T1; 
 				if (pA->prev==pA) {
-					ctrl.lock.unlock(); T::waitResource(this); ctrl.lock.lock();
+					qc.lock.unlock(); if ((rsrc=reclaim(key))!=NULL) {qc.lock.lock(); fNew=false; break;}
+					T::waitResource(this); qc.lock.lock();
 					if ((rsrc=T::createNew(key,this))==NULL) continue; else break;
 				}
 			}
 			QE *stolen=pA->removeLast(); assert(stolen->rsrc!=NULL); ht=&((QMgr*)stolen->mgr)->hashTable;
 			ht->lock(stolen,RW_X_LOCK); if (stolen->fixCount!=0) {ht->unlock(stolen); continue;}
+			if (stolen->fRef) {
+				stolen->fRef=false; if (pA==&qc.T1) {qc.T1.l--; qc.T2.l++; stolen->qid=_T2;}
+				qc.T2.insertFirst(stolen); ht->unlock(stolen); continue;
+			}
 			if (!stolen->rsrc->isDirty()) {
-				pA->l--; rsrc=stolen->rsrc; stolen->rsrc=NULL; 
-				if (fT1) {ht->removeNoLock(stolen); ctrl.freeQE.dealloc(stolen);}
-				else {pA=pA==&ctrl.T1?&ctrl.B1:&ctrl.B2; stolen->qid=pA->type; pA->insertFirst(stolen); pA->l++; ht->unlock(stolen);}
+				pA->l--; rsrc=stolen->rsrc; stolen->rsrc=NULL; qc.nEvicted++;
+				if (fT1) {ht->removeNoLock(stolen); qc.freeQE.dealloc(stolen);}
+				else {pA=pA==&qc.T1?&qc.B1:&qc.B2; stolen->qid=pA->type; pA->insertFirst(stolen); pA->l++; ht->unlock(stolen);}
 				fNew=false; break;
 			}
-			stolen->lock.lock(saveLock); ++stolen->fixCount; ht->unlock(stolen); ctrl.lock.unlock(); 
+			stolen->lock.lock(saveLock); ++stolen->fixCount; ht->unlock(stolen); qc.lock.unlock(); 
 			bool fSaved=stolen->rsrc->save();
-			if (fSaved) ctrl.lock.lock();
+			if (fSaved) qc.lock.lock();
 			else {
-				stolen->lock.unlock(); ctrl.lock.lock(); ht->lock(stolen,RW_X_LOCK);
+				stolen->lock.unlock(); qc.lock.lock(); ht->lock(stolen,RW_X_LOCK);
 				bool fDiscard=--stolen->fixCount==0&&stolen->fDiscard; ht->unlock(stolen);
-				if (fDiscard) {stolen->rsrc->destroy(); ctrl.freeQE.dealloc(stolen);}
+				if (fDiscard) {stolen->rsrc->destroy(); qc.freeQE.dealloc(stolen);}
 			}
 		}
-		qe->rsrc=rsrc; rsrc->setQE(qe); ctrl.lock.unlock(); assert(!qe->isInList());
+		qe->rsrc=rsrc; rsrc->setQE(qe); if (fLocked) qc.lock.unlock(); assert(!qe->isInList());
 		if (fNew) rsrc->initNew(); else rsrc->setKey(key,this);
 		if ((flags&(QMGR_NOLOAD|QMGR_NEW))==0 && (qe->rc=rsrc->load(info,flags))!=RC_OK) {
 			if (drop(rsrc)) rsrc->destroy(); rsrc=NULL;
@@ -200,19 +241,25 @@ protected:
 	void relock(T *t,RW_LockType lt) {
 		QE *qe=t->getQE(); assert(qe!=NULL); qe->lock.unlock(); qe->lock.lock(lt);
 	}
-	void setNElts(long nE) {if (nE>ctrl.nElts) ctrl.nElts=nE;}
+	void setNElts(long nE) {nE/=nParts; for (unsigned i=0; i<nParts; i++) if (nE>(&ctrl)[i].nElts) (&ctrl)[i].nElts=nE;}
 	void setLockType(RW_LockType lt) {saveLock=lt;}
 	void cleanup() {
-		ctrl.lock.lock(); QE *qe,*qe2;
-		for (qe=(QE*)ctrl.B1.next; qe!=(QE*)&ctrl.B1; qe=qe2) {
-			qe2=(QE*)qe->next;
-			if (qe->mgr==this) {assert(ctrl.B1.l>0); qe->remove(); ctrl.B1.l--; hashTable.remove(qe); ctrl.freeQE.dealloc(qe);}
-		}
-		for (qe=(QE*)ctrl.B2.next; qe!=(QE*)&ctrl.B2; qe=qe2) {
-			qe2=(QE*)qe->next;
-			if (qe->mgr==this) {assert(ctrl.B2.l>0); qe->remove(); ctrl.B2.l--; hashTable.remove(qe); ctrl.freeQE.dealloc(qe);}
+		for (unsigned i=0; i<nParts; i++) {
+			QueueCtrl<allc>& qc=(&ctrl)[i]; qc.lock.lock(); QE *qe,*qe2;
+			for (qe=(QE*)qc.B1.next; qe!=(QE*)&qc.B1; qe=qe2) {
+				qe2=(QE*)qe->next;
+				if (qe->mgr==this) {assert(qc.B1.l>0); qe->remove(); qc.B1.l--; hashTable.remove(qe); qc.freeQE.dealloc(qe);}
+			}
+			for (qe=(QE*)qc.B2.next; qe!=(QE*)&qc.B2; qe=qe2) {
+				qe2=(QE*)qe->next;
+				if (qe->mgr==this) {assert(qc.B2.l>0); qe->remove(); qc.B2.l--; hashTable.remove(qe); qc.freeQE.dealloc(qe);}
+			}
+			qc.lock.unlock();
 		}
-		ctrl.lock.unlock();
+	}
+	void releaseRing(QRing<Key>& ring) {
+		for (unsigned i=0; i<ring.nKeys; i++) {T *t=evict(ring,ring.keys[i]); if (t!=NULL) t->destroy();}
+		ring.nKeys=ring.pos=0;
 	}
 public:
 #ifdef _DEBUG
@@ -226,38 +273,41 @@ public:
 		bool f=qe->rsrc!=NULL&&!qe->fDiscard; findQE.unlock(); return f;
 	}
 	void release(T *t,bool fUF=false) {QE *qe=t->getQE(); assert(qe!=NULL); qe->lock.unlock(fUF); release(t,qe);}
+	void unfix(T *t) {QE *qe=t->getQE(); assert(qe!=NULL); release(t,qe);}
 	bool drop(T* t,bool fUF=false,bool fFixed=true) {
-		QE *qe=t->getQE(); assert(qe!=NULL&&qe->mgr==this); bool fDel;
+		QE *qe=t->getQE(); assert(qe!=NULL&&qe->mgr==this); bool fDel; QueueCtrl<allc>& qc=getCtrl(qe->getKey());
 		if (fFixed) qe->lock.unlock(fUF);
 		if (qe->fDiscard) fDel=(fFixed?--qe->fixCount:(long)qe->fixCount)==0;
 		else {
-			ctrl.lock.lock(); qe->remove();
+			qc.lock.lock(); qe->remove();
 			switch (qe->qid) {
 			default: assert(0);
-			case _T1: --ctrl.T1.l; break;
-			case _T2: --ctrl.T2.l; break;
+			case _T1: --qc.T1.l; break;
+			case _T2: --qc.T2.l; break;
+			case _NONE: break;
 			}
 			assert(qe->hash.isInList() && qe->hash.getIndex()!=~0u);
 			hashTable.lock(qe,RW_X_LOCK); assert(!fFixed||qe->fixCount>0);
 			fDel=(fFixed?--qe->fixCount:(long)qe->fixCount)==0; 
-			qe->fDiscard=true; hashTable.removeNoLock(qe); ctrl.lock.unlock(); 
+			qe->fDiscard=true; hashTable.removeNoLock(qe); qc.lock.unlock(); 
 		}
-		if (fDel) ctrl.freeQE.dealloc(qe); return fDel;
+		if (fDel) qc.freeQE.dealloc(qe); return fDel;
 	}
 	void drop(KeyArg key) {
-		typename QEHash::Find findQE(hashTable,key);
-		MutexP lck(&ctrl.lock); QE *qe=findQE.findLock(RW_X_LOCK);
+		typename QEHash::Find findQE(hashTable,key); QueueCtrl<allc>& qc=getCtrl(key);
+		MutexP lck(&qc.lock); QE *qe=findQE.findLock(RW_X_LOCK);
 		if (qe!=NULL) {
 			qe->remove();
 			switch (qe->qid) {
 			default: assert(0);
-			case _T1: --ctrl.T1.l; break;
-			case _T2: --ctrl.T2.l; break;
-			case _B1: --ctrl.B1.l; break;
-			case _B2: --ctrl.B2.l; break;
+			case _T1: --qc.T1.l; break;
+			case _T2: --qc.T2.l; break;
+			case _B1: --qc.B1.l; break;
+			case _B2: --qc.B2.l; break;
+			case _NONE: break;
 			}
 			bool fDel=qe->fixCount==0; qe->fDiscard=true; findQE.remove(qe); lck.set(NULL);
-			if (fDel) {if (qe->rsrc!=NULL) qe->rsrc->destroy(); ctrl.freeQE.dealloc(qe);}
+			if (fDel) {if (qe->rsrc!=NULL) qe->rsrc->destroy(); qc.freeQE.dealloc(qe);}
 		}
 	}
 	bool prepareForSave(T *t) {
@@ -285,58 +335,89 @@ public:
 		hashTable.unlock(qe); return t;
 	}
 	void endLoad(T *t) {
-		QE *qe=t->getQE(); assert(qe!=NULL && !qe->fDiscard && qe->mgr==this);
-		qe->lock.unlock(); ctrl.lock.lock(); hashTable.lock(qe,RW_X_LOCK); assert(qe->fixCount>0);
-		if (--qe->fixCount==0) {qe->remove(); (qe->qid==_T1?&ctrl.T1:&ctrl.T2)->insertFirst(qe); T::signal(this);}
-		hashTable.unlock(qe); ctrl.lock.unlock();
+		QE *qe=t->getQE(); assert(qe!=NULL && !qe->fDiscard && qe->mgr==this); QueueCtrl<allc>& qc=getCtrl(qe->getKey());
+		qe->lock.unlock(); qc.lock.lock(); hashTable.lock(qe,RW_X_LOCK); assert(qe->fixCount>0);
+		if (--qe->fixCount==0) {qe->remove(); requeue(qe);}
+		hashTable.unlock(qe); qc.lock.unlock();
 	}
 	void endSave(T *t) {
-		QE *qe=t->getQE(); assert(qe!=NULL && qe->mgr==this);
+		QE *qe=t->getQE(); assert(qe!=NULL && qe->mgr==this); QueueCtrl<allc>& qc=getCtrl(qe->getKey());
 		qe->lock.unlock(saveLock==RW_U_LOCK&&qe->lock.isULocked());
 		if (qe->fDiscard) {
 			assert(qe->fixCount>0 && !qe->isInList() && !qe->hash.isInList() && qe->hash.getIndex()==~0u);
-			if (--qe->fixCount==0) {t->destroy(); ctrl.freeQE.dealloc(qe);}
+			if (--qe->fixCount==0) {t->destroy(); qc.freeQE.dealloc(qe);}
 		} else {
-			ctrl.lock.lock(); hashTable.lock(qe,RW_X_LOCK); assert(qe->fixCount>0);
-			if (--qe->fixCount==0) {qe->remove(); (qe->qid==_T1?&ctrl.T1:&ctrl.T2)->insertFirst(qe); T::signal(this);}
-			hashTable.unlock(qe); ctrl.lock.unlock();
+			qc.lock.lock(); hashTable.lock(qe,RW_X_LOCK); assert(qe->fixCount>0);
+			if (--qe->fixCount==0) {qe->remove(); requeue(qe);}
+			hashTable.unlock(qe); qc.lock.unlock();
 		}
 	}
 private:
 	void release(T *t,QE *qe) {
-		bool fDel=false;
+		bool fDel=false; QueueCtrl<allc>& qc=getCtrl(qe->getKey());
 		if (qe->fDiscard) {
 			assert(qe->fixCount>0 && !qe->isInList() && !qe->hash.isInList() && qe->hash.getIndex()==~0u);
 			fDel=--qe->fixCount==0;
 		} else {
 			assert(qe->rsrc==t && qe->fixCount>0 && qe->hash.isInList() && qe->hash.getIndex()!=~0u);
 			hashTable.lock(qe,RW_X_LOCK); assert(qe->fixCount>0);
-			if (--qe->fixCount!=0) hashTable.unlock(qe);
+			if (--qe->fixCount!=0 || qe->owner!=NULL || qe->isInList()) hashTable.unlock(qe);
 			else {
 				++qe->fixCount; hashTable.unlock(qe);
-				ctrl.lock.lock(); qe->remove(); hashTable.lock(qe,RW_X_LOCK);
+				qc.lock.lock(); qe->remove(); hashTable.lock(qe,RW_X_LOCK);
 				fDel=qe->fDiscard; assert(qe->fixCount>0);
 				if (--qe->fixCount!=0) fDel=false;
-				else if (!fDel) {(qe->qid==_T1?&ctrl.T1:&ctrl.T2)->insertFirst(qe); T::signal(this);}
-				hashTable.unlock(qe); ctrl.lock.unlock();
+				else if (!fDel) requeue(qe);
+				hashTable.unlock(qe); qc.lock.unlock();
 			}
 		}
-		if (fDel) {t->destroy(); ctrl.freeQE.dealloc(qe);}
+		if (fDel) {t->destroy(); qc.freeQE.dealloc(qe);}
 	}
-	void releaseNoLock(T *t) {
-		QE *qe=t->getQE(); assert(qe!=NULL); bool fDel;
-		if (qe->fDiscard) {
-			assert(qe->fixCount>0 && !qe->isInList() && !qe->hash.isInList() && qe->hash.getIndex()==~0u);
-			fDel=--qe->fixCount==0;
-		} else {
-			assert(qe->hash.isInList() && qe->hash.getIndex()!=~0u);
-			qe->remove(); hashTable.lock(qe,RW_X_LOCK);
-			fDel=qe->fDiscard; assert(qe->fixCount>0);
-			if (--qe->fixCount!=0) fDel=false;
-			else if (!fDel) {(qe->qid==_T1?&ctrl.T1:&ctrl.T2)->insertFirst(qe); T::signal(this);}
-			hashTable.unlock(qe); 
+	void requeue(QE *qe) {
+		if (qe->owner==NULL) {
+			QueueCtrl<allc>& qc=getCtrl(qe->getKey());
+			if (qe->qid==_NONE) {qe->qid=_T1; qc.T1.l++;}
+			(qe->qid==_T1?&qc.T1:&qc.T2)->insertFirst(qe); T::signal(this);
+		}
+	}
+	T *evict(QRing<Key>& ring,KeyArg key) {
+		typename QEHash::Find findQE(hashTable,key); QE *qe=findQE.findLock(RW_X_LOCK); T *t=NULL; QueueCtrl<allc>& qc=getCtrl(key);
+		if (qe!=NULL && qe->owner==&ring) {
+			assert(qe->qid==_NONE && !qe->isInList());
+			if (qe->fixCount!=0 || qe->rsrc->isDirty()) {findQE.unlock(); escape(ring,key);}
+			else {t=qe->rsrc; qe->rsrc=NULL; findQE.remove(qe); qc.freeQE.dealloc(qe);}
+		}
+		return t;
+	}
+	void escape(QRing<Key>& ring,KeyArg key) {
+		typename QEHash::Find findQE(hashTable,key); QueueCtrl<allc>& qc=getCtrl(key); MutexP lck(&qc.lock); QE *qe=findQE.findLock(RW_X_LOCK);
+		if (qe!=NULL && qe->owner==&ring) {
+			qe->owner=NULL; ring.nEscaped++;
+			if (qe->fixCount==0) {qe->qid=_T1; qc.T1.l++; qc.T1.insertLast(qe);}
 		}
-		if (fDel) {t->destroy(); ctrl.freeQE.dealloc(qe);}
+	}
+	T *reclaim(KeyArg key) {
+		// partition of key has nothing to evict: take the least recently used clean page of another partition
+		for (unsigned i=1; i<nParts; i++) {
+			QueueCtrl<allc>& qc=(&ctrl)[(part(key)+i)&(nParts-1)]; MutexP lck(&qc.lock);
+			for (Queue *pA=&qc.T1; ; pA=&qc.T2) {
+				for (QE *qe=(QE*)pA->prev; qe!=(QE*)pA; qe=(QE*)qe->prev) {
+					assert(qe->rsrc!=NULL); QEHash *ht=&((QMgr*)qe->mgr)->hashTable; ht->lock(qe,RW_X_LOCK);
+					if (qe->fixCount==0 && !qe->rsrc->isDirty()) {
+						T *t=qe->rsrc; qe->rsrc=NULL; qe->remove(); pA->l--; qc.nEvicted++;
+						pA=pA==&qc.T1?&qc.B1:&qc.B2; qe->qid=pA->type; pA->insertFirst(qe); pA->l++; ht->unlock(qe); return t;
+					}
+					ht->unlock(qe);
+				}
+				if (pA==&qc.T2) break;
+			}
+		}
+		return NULL;
+	}
+	T *recycle(QRing<Key>& ring,KeyArg key) {
+		if (ring.nKeys<ring.xKeys) {ring.keys[ring.nKeys++]=key; return NULL;}
+		const Key old=ring.keys[ring.pos]; ring.keys[ring.pos]=key; if (++ring.pos>=ring.nKeys) ring.pos=0;
+		T *t=evict(ring,old); if (t!=NULL) ring.nEvicted++; return t;
 	}
 };
 
@@ -42,7 +42,7 @@ QueryOp::QueryOp(QCtx *qc,ulong qf) : qx(qc),queryOp(NULL),state(QST_INIT),nSkip
 	qc->ref();
 }
 
-QueryOp::QueryOp(QueryOp *qop,ulong qf) : qx(qop->qx),queryOp(qop),state(QST_INIT),nSkip(0),res(NULL),nOuts(qop->nOuts),qflags(qf),sort(NULL),nSegs(0),props(NULL),nProps(0)
+QueryOp::QueryOp(QueryOp *qop,ulong qf) : qx(qop->qx),queryOp(qop),state(QST_INIT),nSkip(0),res(NULL),nOuts(qop->nOuts),qflags(qf),sort(NULL),nSegs(0),props(NULL),nProps(0),est(qop->est)
 {
 	qx->ref();
 }
@@ -55,10 +55,29 @@ QueryOp::~QueryOp()
 RC QueryOp::initSkip()
 {
 	RC rc=RC_OK;
-	while (nSkip!=0) if ((rc=next())!=RC_OK || (--nSkip,rc=qx->ses->testAbortQ())!=RC_OK) break;
+	while (nSkip!=0) if ((rc=advance())!=RC_OK || (--nSkip,rc=qx->ses->testAbortQ())!=RC_OK) break;
 	return rc;
 }
 
+RC QueryOp::measure(const PINEx *skip)
+{
+	Session *ses=qx->ses; const uint64_t nGets=ses->nPageGets,nReads=ses->nPageReads;
+	TIMESTAMP start,end; getTimestamp(start); RC rc=advance(skip); getTimestamp(end);
+	stats.nCalls++; if (rc==RC_OK) stats.nRows++; stats.time+=end-start;
+	const uint64_t dReads=ses->nPageReads-nReads; stats.nReads+=dReads; stats.nHits+=ses->nPageGets-nGets-dReads;
+	return rc;
+}
+
+void QueryOp::printStats(SOutCtx& buf) const
+{
+	if (qx->fStats) {
+		char sbuf[256]; int l=sprintf(sbuf," (est=%.0f, cost=%.0f, rows=%ld, calls=%ld, time=%.3fms, reads=%ld, hits=%ld",est.nRows,est.cost,(long)stats.nRows,
+						(long)stats.nCalls,double(stats.time)/1000.,(long)stats.nReads,(long)stats.nHits);
+		if (stats.lSpill!=0) l+=sprintf(sbuf+l,", spill=%ld",(long)stats.lSpill);
+		buf.append(sbuf,l); buf.append(")",1);
+	}
+}
+
 void QueryOp::connect(PINEx **results,unsigned nRes)
 {
 	if (results!=NULL && nRes==1) res=results[0];
@@ -72,13 +91,94 @@ RC QueryOp::rewind()
 	return rc;
 }
 
+RC QueryOp::reset()
+{
+	// unlike rewind() the results are recalculated, e.g. for new parameter values of a prepared plan
+	RC rc=queryOp!=NULL?queryOp->reset():RC_OK;
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
 RC QueryOp::count(uint64_t& cnt,ulong nAbort)
 {
-	uint64_t c=0; RC rc; PINEx qr(qx->ses),*pqr=&qr; if (res==NULL) connect(&pqr);
-	while ((rc=next())==RC_OK) if (++c>nAbort) return RC_TIMEOUT;
+	uint64_t c=0; RC rc; PINEx qr(qx->ses),*pqr=&qr;
+	if (nOuts==1) {
+		// batches are filled through a private result: QBatch::add() packs it and must not touch the caller's PIN
+		connect(&pqr); QBatch qb(qx->ses); while ((rc=nextBatch(qb))==RC_OK) if ((c+=qb.nRows)>nAbort) return RC_TIMEOUT;
+	} else {
+		if (res==NULL) connect(&pqr);
+		while ((rc=next())==RC_OK) if (++c>nAbort) return RC_TIMEOUT;
+	}
 	cnt=c; return rc==RC_EOF?RC_OK:rc;
 }
 
+RC QueryOp::nextBatch(QBatch& qb)
+{
+	qb.cleanup(); if (qb.fEOF) return RC_EOF;
+	RC rc=qx->fStats?QueryOp::batch(qb):batch(qb);
+	if (rc==RC_EOF) {qb.fEOF=true; if (qb.nRows!=0) rc=RC_OK;}
+	return rc;
+}
+
+RC QueryOp::batch(QBatch& qb)
+{
+	RC rc=RC_OK; assert(res!=NULL);
+	while (qb.nRows<QB_ROWS && (rc=next())==RC_OK) {
+		if (qb.nProps!=0 && (res->getState()&(PEX_PAGE|PEX_PROPS))==0) {
+			res->epr.flags|=PINEX_RLOAD;
+			if ((rc=getBody(*res))!=RC_OK || res->isHidden()) {if (rc==RC_OK || rc==RC_NOACCESS || rc==RC_REPEAT || rc==RC_DELETED) continue; break;}
+		}
+		if (qb.flt!=NULL) {
+			if ((qb.flt->getQFlags()&QO_NODATA)==0 && (rc=getData(*res,NULL,0))!=RC_OK) break;
+			if (!qb.flt->check(&res,1,qx->ses)) continue;
+		}
+		if ((rc=qb.add(*res))!=RC_OK) break;
+	}
+	return rc;
+}
+
+RC QBatch::add(PINEx& pe)
+{
+	RC rc; assert(nRows<QB_ROWS);
+	// derived results (e.g. aggregates) have no PIN id and are batched without a reference
+	if (pe.epr.lref==0 && (rc=pe.pack())!=RC_OK && rc!=RC_NOTFOUND) return rc;
+	memcpy(&refs[nRows],&pe.epr,pe.epr.trunc<8>()); unsigned n=0;
+	for (unsigned i=0; i<nProps; i++) {
+		Value& v=vals[nRows*nProps+n];
+		if ((rc=pe.getValue(props[i],v,LOAD_SSV,ma))==RC_NOTFOUND) continue;
+		if (rc==RC_OK && (v.flags&HEAP_TYPE_MASK)==NO_HEAP && v.type>=VT_STRING) rc=copyV0(v,ma);
+		if (rc!=RC_OK) {while (n!=0) freeV(vals[nRows*nProps+--n]); return rc;}
+		n++;
+	}
+	nVals[nRows++]=n; return RC_OK;
+}
+
+void QBatch::get(unsigned i,PINEx& pe) const
+{
+	assert(i<nRows); pe.cleanup(); memcpy(&pe.epr,&refs[i],refs[i].trunc<8>()); pe.epr.flags&=~PINEX_ADDRSET;
+	if (nProps!=0) pe.setProps(getRow(i),nVals[i]);
+}
+
+unsigned QBatch::select(const unsigned *sel,unsigned nSel)
+{
+	for (unsigned i=0,j=0; i<nRows; i++) {
+		if (j<nSel && sel[j]==i) {
+			if (j!=i) {
+				memcpy(&refs[j],&refs[i],refs[i].trunc<8>()); nVals[j]=nVals[i];
+				if (nVals[i]!=0) memcpy(getRow(j),getRow(i),nVals[i]*sizeof(Value));
+			}
+			j++;
+		} else for (unsigned k=0; k<nVals[i]; k++) freeV(vals[i*nProps+k]);
+	}
+	return nRows=nSel;
+}
+
+RC QBatch::next(QueryOp *qop,PINEx& pe)
+{
+	while (pos>=nRows) {RC rc=qop->nextBatch(*this); if (rc!=RC_OK) return rc;}
+	get(pos++,pe); return RC_OK;
+}
+
 RC QueryOp::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	return queryOp!=NULL?queryOp->loadData(qr,pv,nv,eid,fSort,ma):RC_NOTFOUND;
@@ -130,7 +230,7 @@ RC QueryOp::getBody(PINEx& pe)
 
 //------------------------------------------------------------------------------------------------
 
-LoadOp::LoadOp(QueryOp *q,const PropList *p,unsigned nP,ulong qf) : QueryOp(q,qf),nPls(nP) {
+LoadOp::LoadOp(QueryOp *q,const PropList *p,unsigned nP,ulong qf) : QueryOp(q,qf),nPls(nP),strategy(BAS_SCAN) {
 	qf=q->getQFlags(); qflags|=qf&(QO_UNIQUE|QO_STREAM);
 	if ((qflags&QO_REORDER)==0) {qflags|=qf&(QO_IDSORT|QO_REVERSIBLE); sort=q->getSort(nSegs);}
 	if (p!=NULL && nP!=0) {
@@ -152,12 +252,13 @@ LoadOp::~LoadOp()
 
 void LoadOp::connect(PINEx **rs,unsigned nR)
 {
+	if (rs!=NULL && nR!=0) res=rs[0];
 	results=rs; nResults=nR; queryOp->connect(rs,nR);
 }
 
-RC LoadOp::next(const PINEx *skip)
+RC LoadOp::advance(const PINEx *skip)
 {
-	RC rc=RC_OK; assert(qx->ses!=NULL);
+	RC rc=RC_OK; assert(qx->ses!=NULL); BufStrategyP bsp(qx->ses,&strategy);
 	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
 	for (; (rc=queryOp->next(skip))==RC_OK; skip=NULL) {
 		for (unsigned i=0; i<nResults; i++) {
@@ -188,6 +289,24 @@ RC LoadOp::next(const PINEx *skip)
 	return rc;
 }
 
+RC LoadOp::batch(QBatch& qb)
+{
+	if ((state&QST_INIT)!=0 || nResults!=1) return QueryOp::batch(qb);
+	if ((state&QST_EOF)!=0) return RC_EOF;
+	BufStrategyP bsp(qx->ses,&strategy); QBatch in(qx->ses); PINEx qr(qx->ses),*pqr=&qr; RC rc;
+	do {
+		if ((rc=queryOp->nextBatch(in))!=RC_OK) {state|=QST_EOF; return rc;}
+		for (unsigned i=0; i<in.nRows; i++) {
+			in.get(i,qr); qr.epr.flags|=PINEX_RLOAD;
+			if ((rc=getBody(qr))!=RC_OK || qr.isHidden()) {if (rc==RC_OK || rc==RC_NOACCESS || rc==RC_REPEAT || rc==RC_DELETED) continue; return rc;}
+			if (qb.flt!=NULL && !qb.flt->check(&pqr,1,qx->ses)) continue;
+			if ((rc=qb.add(qr))!=RC_OK) return rc;
+		}
+	} while (qb.nRows==0 && !in.fEOF);
+	if (in.fEOF) {state|=QST_EOF; return RC_EOF;}
+	return RC_OK;
+}
+
 RC LoadOp::count(uint64_t& cnt,ulong nAbort)
 {
 	return queryOp->count(cnt,nAbort);
@@ -210,12 +329,13 @@ RC LoadOp::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,Mem
 void LoadOp::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("access: ",8);
-	if (nProps==0) buf.append("*\n",2);
+	if (nProps==0) buf.append("*",1);
 	else if (nProps==1) {
-		for (unsigned i=0; i<props[0].nProps; i++) {buf.renderName(props[0].props[i]); if (i+1<props[0].nProps) buf.append(", ",2); else buf.append("\n",1);}
+		for (unsigned i=0; i<props[0].nProps; i++) {buf.renderName(props[0].props[i]); if (i+1<props[0].nProps) buf.append(", ",2);}
 	} else {
-		buf.append("...\n",4);
+		buf.append("...",3);
 	}
+	printStats(buf); buf.append("\n",1);
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
 
@@ -235,7 +355,7 @@ void PathOp::connect(PINEx **results,unsigned nRes)
 	res=results[0]; queryOp->connect(&ppx);
 }
 
-RC PathOp::next(const PINEx *)
+RC PathOp::advance(const PINEx *)
 {
 	if ((state&QST_EOF)!=0) return RC_EOF;
 	RC rc; const Value *pv; bool fOK; PID id; PathState *spst;
@@ -317,17 +437,25 @@ RC PathOp::rewind()
 	return rc;
 }
 
+RC PathOp::reset()
+{
+	pex.cleanup(); while(pst!=NULL) pop(); saveID=PIN::defPID; saveEPR.lref=0;
+	RC rc=queryOp!=NULL?queryOp->reset():RC_OK;
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
 void PathOp::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("path: ",6);
 	for (unsigned i=0; i<nPathSeg; i++) buf.renderPath(path[i]);
-	buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
+	printStats(buf); buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
 
 //------------------------------------------------------------------------------------------------
 
 Filter::Filter(QueryOp *qop,ulong nqs,ulong qf)
-	: QueryOp(qop,qf|qop->getQFlags()),conds(NULL),nConds(0),condIdx(NULL),nCondIdx(0),queries(NULL),nQueries(nqs)
+	: QueryOp(qop,(qf|qop->getQFlags())&~QO_SPLIT),conds(NULL),nConds(0),condIdx(NULL),nCondIdx(0),queries(NULL),nQueries(nqs)
 {
 	sort=qop->getSort(nSegs); props=qop->getProps(nProps);
 }
@@ -349,53 +477,82 @@ Filter::~Filter()
 
 void Filter::connect(PINEx **rs,unsigned nR)
 {
+	if (rs!=NULL && nR!=0) res=rs[0];
 	results=rs; nResults=nR; queryOp->connect(rs,nR);
 }
 
-RC Filter::next(const PINEx *skip)
+RC Filter::advance(const PINEx *skip)
 {
 	RC rc=RC_OK; assert(qx->ses!=NULL && results!=NULL);
 	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
 	if ((state&QST_EOF)!=0) return RC_EOF;
 	for (; (rc=queryOp->next(skip))==RC_OK; skip=NULL) {
 		if ((qflags&QO_NODATA)==0 && (rc=queryOp->getData(*results[0],NULL,0))!=RC_OK) break;		// other vars ???
-		if (conds==NULL || Expr::condSatisfied(conds,nConds,results,nResults,qx->vals,QV_ALL,qx->ses,(qflags&QO_CLASS)!=0)) {
-			if ((qflags&QO_CLASS)==0) {
-				bool fOK=true;
-				for (CondIdx *ci=condIdx; ci!=NULL; ci=ci->next) {
-					if (ci->param>=qx->vals[QV_PARAMS].nValues) {fOK=false; break;}
-					const Value *pv=&qx->vals[QV_PARAMS].vals[ci->param];
-					if (ci->expr!=NULL) {
-						// ???
-					} else {
-						Value vv; if (results[0]->getValue(ci->ks.propID,vv,LOAD_SSV,NULL)!=RC_OK) {fOK=false; break;}
-						RC rc=Expr::calc((ExprOp)ci->ks.op,vv,pv,2,(ci->ks.flags&ORD_NCASE)!=0?CND_NCASE:0,qx->ses);
-						freeV(vv); if (rc!=RC_TRUE) {fOK=false; break;}
-					}
-				}
-				if (!fOK) continue;
-			}
-			if (queries!=NULL && nQueries>0) {
-				bool fOK=true;
-				for (ulong i=0; i<nQueries; i++) if (!queries[i].qry->checkConditions(results[0],ValueV(queries[i].params,queries[i].nParams),qx->ses)) {fOK=false; break;}
-				if (!fOK) continue;
-			}
-			break;
-		}
+		if (check(results,nResults,qx->ses)) break;
 	}
 	if (rc!=RC_OK) state|=QST_EOF;		//op==GO_FIRST||op==GO_LAST?QST_BOF|QST_EOF:op==GO_NEXT?QST_EOF:QST_BOF;
 	return rc;
 }
 
+RC Filter::batch(QBatch& qb)
+{
+	RC rc=RC_OK; assert(qx->ses!=NULL && results!=NULL);
+	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
+	if ((state&QST_EOF)!=0) return RC_EOF;
+	if (nResults!=1 || qb.flt!=NULL) return QueryOp::batch(qb);
+	if (qb.nProps==0 || !covers(qb)) {qb.flt=this; rc=queryOp->nextBatch(qb); qb.flt=NULL;}
+	else {
+		unsigned sel[QB_ROWS];
+		while ((rc=queryOp->nextBatch(qb))==RC_OK && qb.select(sel,Expr::condBatch(conds,nConds,qb,sel,qx->vals,QV_ALL,qx->ses))==0 && !qb.fEOF);
+		if (rc==RC_OK && qb.nRows==0) rc=RC_EOF;
+	}
+	if (rc==RC_EOF || qb.fEOF) state|=QST_EOF;
+	return rc;
+}
+
+bool Filter::covers(const QBatch& qb) const
+{
+	if (conds==NULL || condIdx!=NULL || queries!=NULL || (qflags&QO_CLASS)!=0) return false;
+	for (ulong i=0; i<nConds; i++) {
+		const PropertyID *pp; unsigned np; if (!conds[i]->isBatch()) return false;
+		for (conds[i]->getExtRefs(0,pp,np); np!=0; ++pp,--np) {
+			const PropertyID pid=*pp&STORE_MAX_URIID; unsigned k=0;
+			if (pid==PROP_SPEC_PINID) continue; if (pid==PROP_SPEC_STAMP) return false;
+			while (k<qb.nProps && qb.props[k]<pid) k++;
+			if (k>=qb.nProps || qb.props[k]!=pid) return false;
+		}
+	}
+	return true;
+}
+
+bool Filter::check(PINEx **rs,unsigned nRs,Session *ses) const
+{
+	if (conds!=NULL && !Expr::condSatisfied(conds,nConds,rs,nRs,qx->vals,QV_ALL,ses,(qflags&QO_CLASS)!=0)) return false;
+	if ((qflags&QO_CLASS)==0) for (CondIdx *ci=condIdx; ci!=NULL; ci=ci->next) {
+		if (ci->param>=qx->vals[QV_PARAMS].nValues) return false;
+		const Value *pv=&qx->vals[QV_PARAMS].vals[ci->param];
+		if (ci->expr!=NULL) {
+			// ???
+		} else {
+			Value vv; if (rs[0]->getValue(ci->ks.propID,vv,LOAD_SSV,NULL)!=RC_OK) return false;
+			RC rc=Expr::calc((ExprOp)ci->ks.op,vv,pv,2,(ci->ks.flags&ORD_NCASE)!=0?CND_NCASE:0,ses);
+			freeV(vv); if (rc!=RC_TRUE) return false;
+		}
+	}
+	if (queries!=NULL) for (ulong i=0; i<nQueries; i++)
+		if (!queries[i].qry->checkConditions(rs[0],ValueV(queries[i].params,queries[i].nParams),ses)) return false;
+	return true;
+}
+
 void Filter::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("filter: \n",9);		// property etc.
+	buf.fill('\t',level); buf.append("filter: ",8); printStats(buf); buf.append("\n",1);		// property etc.
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
 
 //------------------------------------------------------------------------------------------------
 
-ArrayFilter::ArrayFilter(QueryOp *q,const PID *pds,ulong nP) : QueryOp(q,q->getQFlags()),pids((PID*)(this+1)),nPids(0)
+ArrayFilter::ArrayFilter(QueryOp *q,const PID *pds,ulong nP) : QueryOp(q,q->getQFlags()&~QO_SPLIT),pids((PID*)(this+1)),nPids(0)
 {
 	sort=q->getSort(nSegs); props=q->getProps(nProps);
 	if (nP>0) {pids[0]=pds[0]; nPids++; for (ulong i=1; i<nP; i++) if (pds[i]!=pds[i-1]) pids[nPids++]=pds[i];}
@@ -405,7 +562,7 @@ ArrayFilter::~ArrayFilter()
 {
 }
 
-RC ArrayFilter::next(const PINEx *skip)
+RC ArrayFilter::advance(const PINEx *skip)
 {
 	RC rc=RC_EOF; assert(qx->ses!=NULL && res!=NULL);
 	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
@@ -416,6 +573,6 @@ RC ArrayFilter::next(const PINEx *skip)
 
 void ArrayFilter::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("array filter\n",13);
+	buf.fill('\t',level); buf.append("array filter",12); printStats(buf); buf.append("\n",1);
 	if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
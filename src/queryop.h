@@ -50,6 +50,7 @@ namespace AfyKernel
 #define	QO_NODATA		0x00002000			/**< no property values is necessary to filter PINs, e.g. when only local PINs are required */
 #define	QO_UNI1			0x00004000			/**< first source is unique */
 #define	QO_UNI2			0x00008000			/**< second source is unique */
+#define	QO_SPLIT		0x00010000			/**< scan results can be partitioned between threads by heap page or index key ranges */
 
 /**
  * query operator state flags
@@ -67,9 +68,96 @@ namespace AfyKernel
 #define	QOS_EOF1		0x0004				/**< end of results from first source */
 #define	QOS_EOF2		0x0008				/**< end of results from second source */
 
+/**
+ * parallel scan parameters
+ */
+#define	XCH_MAX_THREADS		8					/**< maximum number of worker threads used by one Exchange operator */
+#define	XCH_UNIT_PAGES		16					/**< number of heap pages in one unit of work */
+#define	XCH_UNIT_REFS		256					/**< number of PIN references in one unit of work */
+#define	XCH_UNITS_PER_THREAD	4				/**< number of units queued or buffered per worker thread */
+#define	XCH_MIN_ROWS		4096.				/**< minimum estimated number of scanned PINs to run a filtered scan in parallel */
+#define	XCH_STOP_WAIT		100					/**< timeout (ms) of each wait for running workers in Exchange::stop() */
+
 struct	CondIdx;
 class	ExtSortFile;
 class	SOutCtx;
+class	QueryOp;
+class	Filter;
+struct	XUnit;
+
+/**
+ * query operator run-time statistics
+ * collected when the query is built for IStmt::analyze() with MODE_ANALYZE
+ * time and page counters include time spent in input operators
+ */
+struct QueryOpStats
+{
+	uint64_t	nCalls;			/**< number of next() calls */
+	uint64_t	nRows;			/**< number of results returned */
+	uint64_t	time;			/**< wall time spent in next(), microseconds */
+	uint64_t	nReads;			/**< number of pages read from disk */
+	uint64_t	nHits;			/**< number of pages found in the buffer pool */
+	uint64_t	lSpill;			/**< number of bytes written to external sort files */
+	QueryOpStats() : nCalls(0),nRows(0),time(0),nReads(0),nHits(0),lSpill(0) {}
+};
+
+/**
+ * cost model parameters
+ * costs are expressed in page accesses
+ */
+#define	QCOST_FANOUT		100.				/**< average number of entries in an index page */
+#define	QCOST_FETCH			1.					/**< cost of reading one PIN */
+#define	QCOST_CPU			0.01				/**< cost of comparing or hashing one result */
+#define	QCOST_SEL_EQ		0.01				/**< selectivity of an exact index lookup */
+#define	QCOST_SEL_RANGE		0.25				/**< selectivity of an index range */
+#define	QCOST_SEL_COND		0.33				/**< selectivity of a filter condition */
+#define	QCOST_NROWS_FT		100.				/**< estimated number of PINs containing a full-text word */
+#define	QCOST_NROWS_FULL	1000000.			/**< estimated number of PINs returned by a full scan */
+#define	QCOST_FILTER_RATIO	16.					/**< class scan is replaced by a filter when it returns that many times more PINs than another source */
+#define	QCOST_ROW_MEM		64.					/**< estimated memory used by one result kept by Sort or HashJoin */
+#define	QCOST_SPILL			(2./QCOST_FANOUT)	/**< cost of writing and reading back one result spilled to a temporary file */
+
+/**
+ * query operator cost estimate
+ * set by QBuildCtx when the operator is created, used to choose access paths and join order
+ */
+struct QueryCost
+{
+	double		nRows;			/**< estimated number of results */
+	double		cost;			/**< estimated cost of producing all results */
+	QueryCost(double nr=1.,double c=1.) : nRows(nr),cost(c) {}
+};
+
+#define	QB_ROWS				64					/**< maximum number of results in a batch */
+
+/**
+ * batch of query results returned by QueryOp::nextBatch()
+ * contains encoded PIN references and, if nProps!=0, values of projected properties stored row by row in vals;
+ * props must be sorted, properties missing in a PIN are skipped, so the first nVals[i] values of row i are valid;
+ * only the first output of an operator is batched, the operator must be connected before nextBatch() is called;
+ * if flt is set, the producing operator applies the filter conditions to each PIN before it is added to the batch
+ */
+struct QBatch
+{
+	MemAlloc			*const	ma;
+	const	PropertyID	*const	props;
+	const	unsigned	nProps;
+	Value				*const	vals;
+	const	Filter		*flt;
+	unsigned			nRows;
+	unsigned			pos;
+	bool				fEOF;
+	unsigned			nVals[QB_ROWS];
+	EncPINRef			refs[QB_ROWS];
+	QBatch(MemAlloc *m,const PropertyID *pp=NULL,unsigned np=0,Value *vv=NULL) : ma(m),props(pp),nProps(vv!=NULL?np:0),vals(vv),flt(NULL),nRows(0),pos(0),fEOF(false) {}
+	~QBatch() {cleanup();}
+	void		cleanup() {for (unsigned i=0; i<nRows; i++) for (unsigned j=0; j<nVals[i]; j++) freeV(vals[i*nProps+j]); nRows=pos=0;}
+	Value		*getRow(unsigned i) const {return vals+i*nProps;}
+	RC			add(PINEx& pe);
+	void		get(unsigned i,PINEx& pe) const;
+	unsigned	select(const unsigned *sel,unsigned nSel);
+	RC			next(QueryOp *qop,PINEx& pe);
+};
 
 /**
  * query operator abstract class
@@ -90,14 +178,23 @@ protected:
 	ulong				nSegs;
 	const PropList		*props;
 	ulong				nProps;
+	QueryOpStats		stats;
+	QueryCost			est;
 	RC					initSkip();
+	virtual	RC			advance(const PINEx *skip=NULL) = 0;
+	virtual	RC			batch(QBatch& qb);
+	void				printStats(SOutCtx& buf) const;
+private:
+	RC					measure(const PINEx *skip);
 public:
 						QueryOp(QCtx *qc,ulong qf);
 						QueryOp(QueryOp *qop,ulong qf);
 	virtual				~QueryOp();
 	virtual	void		connect(PINEx **results,unsigned nRes=1);
-	virtual	RC			next(const PINEx *skip=NULL) = 0;
+	RC					next(const PINEx *skip=NULL) {return qx->fStats?measure(skip):advance(skip);}
+	RC					nextBatch(QBatch& qb);
 	virtual	RC			rewind();
+	virtual	RC			reset();
 	virtual	RC			count(uint64_t& cnt,ulong nAbort=~0ul);
 	virtual	RC			loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
 	virtual	void		unique(bool);
@@ -112,6 +209,8 @@ public:
 	ulong				getQFlags() const {return qflags;}
 	const	OrderSegQ	*getSort(ulong& nS) const {nS=nSegs; return sort;}
 	const	PropList	*getProps(ulong& nP) const {nP=nProps; return props;}
+	const	QueryOpStats&	getStats() const {return stats;}
+	const	QueryCost&	getCost() const {return est;}
 	RC					getData(PINEx& qr,Value *pv,unsigned nv,const PINEx *qr2=NULL,ElementID eid=STORE_COLLECTION_ID,MemAlloc *ma=NULL);
 	RC					getData(PINEx **pqr,unsigned npq,const PropList *pl,unsigned npl,Value *vals,MemAlloc *ma=NULL);
 	RC					getBody(PINEx& pe);
@@ -130,13 +229,17 @@ class FullScan : public QueryOp
 	ulong			slot;
 	SubTx			*stx;
 	PageSet::it		*it;
+	BufStrategy		strategy;
 	PBlock			*init();
+	friend	class	Exchange;
 public:
 	FullScan(QCtx *s,uint32_t msk=HOH_DELETED|HOH_HIDDEN,ulong qf=0,bool fCl=false)
-		: QueryOp(s,qf|QO_UNIQUE|QO_STREAM|QO_ALLPROPS),mask(msk),fClasses(fCl),dirPageID(INVALID_PAGEID),heapPageID(INVALID_PAGEID),idx(~0u),slot(0),stx(&s->ses->tx),it(NULL) {}
+		: QueryOp(s,qf|QO_UNIQUE|QO_STREAM|QO_ALLPROPS|QO_SPLIT),mask(msk),fClasses(fCl),dirPageID(INVALID_PAGEID),heapPageID(INVALID_PAGEID),idx(~0u),slot(0),stx(&s->ses->tx),it(NULL),strategy(BAS_SCAN) {}
 	virtual		~FullScan();
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
 	RC			rewind();
+	RC			reset();
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -151,8 +254,10 @@ class ClassScan : public QueryOp
 public:
 	ClassScan(QCtx *ses,class Class *cls,ulong md);
 	virtual		~ClassScan();
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
 	RC			rewind();
+	RC			reset();
 	RC			count(uint64_t& cnt,ulong nAbort=~0ul);
 	void		print(SOutCtx& buf,int level) const;
 };
@@ -171,17 +276,31 @@ class IndexScan : public QueryOp
 	class	PIDStore	*pids;
 	PropList			pl;
 	const	ulong		nRanges;
+	ulong				nScans;
 	Value				*vals;
+	const	CondIdx		*condIdx;
+	const	Value		*cpars;
+	unsigned			nCPars;
 	void				initInfo();
+	bool				isPoint() const;
 	RC					init();
 	RC					setScan(ulong=0);
+	void				sortRanges();
 	void				printKey(const SearchKey& key,SOutCtx& buf,const char *def,size_t ldef) const;
 public:
+	struct	IdxParam {
+		const	Value	*param;
+		uint32_t		idx;
+	};
 	IndexScan(QCtx *ses,ClassIndex& idx,ulong flg,ulong np,ulong md);
 	virtual				~IndexScan();
 	void				*operator new(size_t s,Session *ses,ulong nRng,ClassIndex& idx) {return ses->malloc(s+nRng*2*sizeof(SearchKey)+idx.getNSegs()*(sizeof(OrderSegQ)+sizeof(PropertyID)));}
-	RC					next(const PINEx *skip=NULL);
+	static	RC			getParams(const CondIdx *ci,const Value *cpars,unsigned ncp,const ValueV& pars,IdxParam *iparams,ulong& flags,ulong& nRanges);
+	RC					setKeys(IdxParam *iparams);
+	RC					advance(const PINEx *skip=NULL);
+	RC					batch(QBatch& qb);
 	RC					rewind();
+	RC					reset();
 	RC					count(uint64_t& cnt,ulong nAbort=~0ul);
 	RC					loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
 	void				unique(bool);
@@ -202,8 +321,9 @@ public:
 	ArrayScan(QCtx *s,const PID *pds,ulong nP,ulong md);
 	void*		operator new(size_t s,Session *ses,ulong nPids) throw() {return ses->malloc(s+nPids*sizeof(PID));}
 	virtual		~ArrayScan();
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
 	RC			rewind();
+	RC			reset();
 	RC			count(uint64_t& cnt,ulong nAbort=~0ul);
 	void		print(SOutCtx& buf,int level) const;
 };
@@ -229,8 +349,9 @@ public:
 	void	*operator new(size_t s,Session *ses,ulong nps,size_t lw) throw() {return ses->malloc(s+lw+(nps==0?0:(nps-1)*sizeof(PropertyID)));}
 	FTScan(QCtx *s,const char *w,size_t lW,const PropertyID *pids,ulong nps,ulong md,ulong f,bool fStp);
 	virtual		~FTScan();
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
 	RC			rewind();
+	RC			reset();
 	void		print(SOutCtx& buf,int level) const;
 	friend	class	PhraseFlt;
 };
@@ -253,8 +374,9 @@ public:
 	PhraseFlt(QCtx *s,FTScan *const *fts,ulong ns,ulong md);
 	virtual		~PhraseFlt();
 	void		*operator new(size_t s,Session *ses,ulong ns) throw() {return ses->malloc(s+int(ns-1)*sizeof(FTScanS));}
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
 	RC			rewind();
+	RC			reset();
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -280,8 +402,9 @@ public:
 	void	*operator new(size_t s,Session *ses,ulong no) throw() {return ses->malloc(s+int(no-1)*sizeof(QueryOpS));}
 	virtual	~MergeIDs();
 	void	connect(PINEx **results,unsigned nRes);
-	RC		next(const PINEx *skip=NULL);
+	RC		advance(const PINEx *skip=NULL);
 	RC		rewind();
+	RC		reset();
 	RC		loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
 	void	print(SOutCtx& buf,int level) const;
 	friend	class	QBuildCtx;
@@ -320,8 +443,9 @@ public:
 	void	*operator new(size_t s,MemAlloc *ma,unsigned ne) {return ma->malloc(s+(ne*3-1)*sizeof(Value));}
 	virtual	~MergeOp();
 	void	connect(PINEx **results,unsigned nRes);
-	RC		next(const PINEx *skip=NULL);
+	RC		advance(const PINEx *skip=NULL);
 	RC		rewind();
+	RC		reset();
 	RC		loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
 	void	unique(bool);
 	void	print(SOutCtx& buf,int level) const;
@@ -338,7 +462,72 @@ class HashOp : public QueryOp
 public:
 	HashOp(QueryOp *qop1,QueryOp *qop2) : QueryOp(qop1,QO_JOIN|(qop1->getQFlags()&(QO_IDSORT|QO_ALLPROPS|QO_REVERSIBLE))),queryOp2(qop2),pids(NULL) {sort=qop1->getSort(nSegs); props=qop1->getProps(nProps);}
 	virtual	~HashOp();
-	RC		next(const PINEx *skip=NULL);
+	RC		advance(const PINEx *skip=NULL);
+	RC		reset();
+	void	print(SOutCtx& buf,int level) const;
+};
+
+/**
+ * hash join on property values
+ * builds a hash table from one input keyed on the equi-join property values and probes it with the other input;
+ * when the table exceeds the memory limit both inputs are partitioned by hash value into runs of an external sort file
+ */
+class HashJoin : public QueryOp
+{
+	QueryOp	*const		queryOp2;		/**< build input */
+	const	QUERY_SETOP	op;				/**< QRY_JOIN, QRY_SEMIJOIN or QRY_LEFT_OUTER_JOIN/QRY_RIGHT_OUTER_JOIN (probe side is preserved) */
+	const	CondEJ		*ej;
+	const	unsigned	nej;
+	const	bool		fSwap;			/**< build input produces the first part of results */
+	const	Expr *const	*conds;
+	ulong				nConds;
+	PINEx				pexR;
+	PINEx				*pP;			/**< current probe side result */
+	PINEx				*pB;			/**< current build side result */
+	SubAlloc			mem;
+	struct	HJEntry		**table;
+	ulong				nBuckets;
+	ulong				nEntries;
+	size_t				memUsed;
+	struct	HJEntry		*cur;
+	uint32_t			hash;
+	bool				fKey;
+	bool				fMatched;
+	ExtSortFile			*esFile;
+	class	OutRun		**parts;
+	class	InRun		*inRun;
+	unsigned			curPart;
+	bool				fNext;
+	bool				fMulti;
+	ulong				nMulti;
+	ulong				iMulti;
+	byte				*mflags;
+	const	Value		*pK;			/**< key values of the current probe result */
+	Value	*const		pVP;
+	Value	*const		pVB;
+	const	Value		**keys;
+	unsigned			*pos;
+	Value				vls[1];
+
+	void				cleanup(Value *pv) {for (unsigned i=0; i<nej; i++) {freeV(pv[i]); pv[i].setError();}}
+	RC					loadKeys(QueryOp *qop,PINEx& qr,Value *pv,bool fBuild);
+	uint32_t			hashKey() const;
+	bool				match(const struct HJEntry *he) const;
+	RC					insert(const EncPINRef& epr,bool fPart);
+	RC					build();
+	RC					spill();
+	RC					partition();
+	RC					loadPart(unsigned part);
+	RC					nextProbe();
+	void				release();
+public:
+	HashJoin(QueryOp *qop1,QueryOp *qop2,const CondEJ *ce,unsigned ne,QUERY_SETOP qo,const Expr *const *conds,unsigned nConds,ulong qf,bool fS);
+	void	*operator new(size_t s,MemAlloc *ma,unsigned ne) {return ma->malloc(s+(ne*2-1)*sizeof(Value)+ne*(sizeof(Value*)+sizeof(unsigned)));}
+	virtual	~HashJoin();
+	void	connect(PINEx **results,unsigned nRes);
+	RC		advance(const PINEx *skip=NULL);
+	RC		rewind();
+	RC		reset();
 	void	print(SOutCtx& buf,int level) const;
 };
 
@@ -355,14 +544,16 @@ class NestedLoop : public QueryOp
 		class	Expr	*cond;
 	};
 	ulong				nConds;
+	const	bool		fSwap;		/**< qop1 (outer loop) produces the second part of results */
 public:
-	NestedLoop(QueryOp *qop1,QueryOp *qop2,ulong qf)
-		: QueryOp(qop1,qf|QO_JOIN|(qop1->getQFlags()&(QO_IDSORT|QO_ALLPROPS|QO_REVERSIBLE))),queryOp2(qop2),pexR(qx->ses),pR(&pexR),nConds(0)
-		{conds=NULL; nOuts+=qop2->getNOuts(); sort=qop1->getSort(nSegs); props=qop1->getProps(nProps);}
+	NestedLoop(QueryOp *qop1,QueryOp *qop2,ulong qf,bool fS=false)
+		: QueryOp(qop1,qf|QO_JOIN|(fS?0:qop1->getQFlags()&(QO_IDSORT|QO_ALLPROPS|QO_REVERSIBLE))),queryOp2(qop2),pexR(qx->ses),pR(&pexR),nConds(0),fSwap(fS)
+		{conds=NULL; nOuts+=qop2->getNOuts(); if (!fS) {sort=qop1->getSort(nSegs); props=qop1->getProps(nProps);}}
 	virtual	~NestedLoop();
 	void	connect(PINEx **results,unsigned nRes);
-	RC		next(const PINEx *skip=NULL);
+	RC		advance(const PINEx *skip=NULL);
 	RC		rewind();
+	RC		reset();
 	void	print(SOutCtx& buf,int level) const;
 };
 
@@ -374,13 +565,15 @@ class LoadOp : public QueryOp
 	PINEx				**results;
 	unsigned			nResults;
 	const	unsigned	nPls;
+	BufStrategy			strategy;
 	PropList			pls[1];
 public:
 	LoadOp(QueryOp *q,const PropList *p,unsigned nP,ulong qf=0);
 	virtual		~LoadOp();
 	void*		operator new(size_t s,Session *ses,unsigned nP) throw() {return ses->malloc(s+nP*sizeof(PropList));}
 	void		connect(PINEx **results,unsigned nRes);
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
 	RC			count(uint64_t& cnt,ulong nAbort=~0ul);
 	RC			rewind();
 	RC			loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
@@ -400,15 +593,68 @@ class Filter : public QueryOp
 	const	ulong	nQueries;
 	PINEx			**results;
 	unsigned		nResults;
+	bool		covers(const QBatch& qb) const;
 public:
 	Filter(QueryOp *qop,ulong nqs,ulong qf);
 	virtual		~Filter();
 	void		connect(PINEx **results,unsigned nRes);
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
+	bool		check(PINEx **results,unsigned nRes,Session *ses) const;
 	void		print(SOutCtx& buf,int level) const;
 	friend	class	QBuildCtx;
 };
 
+/**
+ * exchange operator
+ * runs a filtered full or class/family index scan on RequestQueue threads; the scan is split into units
+ * of heap pages or index key ranges, each unit is loaded and filtered by a worker in its own session,
+ * qualifying references are gathered either in scan order or in order of completion
+ */
+class Exchange : public QueryOp
+{
+	const	Filter		*const	filter;
+	QueryOp				*const	src;
+	StoreCtx			*const	ctx;
+	const	unsigned	nWorkers;
+	const	bool		fPages;
+	const	bool		fOrdered;
+	PINEx				sres;
+	Mutex				lock;
+	Event				done;
+	XUnit				*pending;
+	XUnit				*lastPending;
+	XUnit				*units;
+	XUnit				*lastUnit;
+	XUnit				*cur;
+	class	XWorker		*workers;		/**< posted workers which haven't finished */
+	unsigned			nUnits;
+	unsigned			nPending;
+	unsigned			nReqs;
+	bool				fStop;
+	bool				fSrcEOF;
+	bool				fThreads;
+	BufStrategy			strategy;
+	RC					fill();
+	RC					getPages(XUnit *u);
+	RC					getRefs(XUnit *u);
+	RC					wait();
+	void				post();
+	void				stop();
+	void				process(XUnit *u,Session *ses);
+	void				freeUnit(XUnit *u);
+public:
+	Exchange(Filter *flt,QueryOp *sc,unsigned nw,ulong qf);
+	virtual		~Exchange();
+	void		connect(PINEx **results,unsigned nRes);
+	RC			advance(const PINEx *skip=NULL);
+	RC			rewind();
+	RC			reset();
+	void		print(SOutCtx& buf,int level) const;
+	void		work(Session *ses,class XWorker *w);
+	void		finish(class XWorker *w);
+};
+
 /**
  * filter operator based on an array of predefined PIN IDs
  */
@@ -420,7 +666,7 @@ public:
 	ArrayFilter(QueryOp *q,const PID *pds,ulong nP);
 	void*		operator	new(size_t s,ulong nPids,Session *ses) throw() {return ses->malloc(s+nPids*sizeof(PID));}
 	virtual		~ArrayFilter();
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -440,8 +686,10 @@ class Sort : public QueryOp
 	ExtSortFile				*esFile;
 	class	InRun			*esRuns;
 	class	OutRun			*esOutRun;
+	unsigned				*esTree;		/**< loser tree for merging of runs */
 	ulong					nIns;
 	ulong					curRun;
+	ulong					nTop;			/**< top-N mode: only nTop first results are kept in a bounded heap */
 	
 	size_t					peakSortMem;
 	size_t					maxSortMem;
@@ -456,28 +704,36 @@ class Sort : public QueryOp
 public:
 	virtual		~Sort();
 	void		connect(PINEx **results,unsigned nRes);
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
 	RC			rewind();
+	RC			reset();
 	RC			count(uint64_t& cnt,ulong nAbort=~0ul);
 	RC			loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid=STORE_COLLECTION_ID,bool fSort=false,MemAlloc *ma=NULL);
 	void		unique(bool);
 	void		print(SOutCtx& buf,int level) const;
-	Sort(QueryOp *qop,const OrderSegQ *os,unsigned nSegs,ulong qf,unsigned nP,const PropList *pids,unsigned nPids);
+	Sort(QueryOp *qop,const OrderSegQ *os,unsigned nSegs,ulong qf,unsigned nP,const PropList *pids,unsigned nPids,ulong nT=0);
 	void*		operator new(size_t s,Session *ses,unsigned nSegs,unsigned nPids) throw() {return ses->malloc(s+int(nSegs-1)*sizeof(OrderSegQ)+nPids*sizeof(PropList)+nSegs*sizeof(unsigned));}
 	const	Value	*getvalues() const;
 private:
 	__forceinline void	swap(unsigned i,unsigned j) {EncPINRef *tmp=pins[i]; pins[i]=pins[j]; pins[j]=tmp;}
 	__forceinline EncPINRef *storeSortData(const PINEx& qr,SubAlloc& pinMem);
+	__forceinline static void getRef(const EncPINRef *ep,EncPINRef& er);
 	RC			sort(ulong nAbort=~0u);
-	void		quickSort(ulong);
+	void		quickSort(ulong nPins,ulong first=0);
+	RC			pushTop(ulong& nPins);
+	void		freePins();
 	int			cmp(const EncPINRef *ep1,const EncPINRef *ep2) const;
-	RC			writeRun(ulong nRunPins,size_t&);
+	RC			writeRun(ulong nRunPins,size_t&,bool fSort=false);
 	RC          prepMerge();
 	RC			esnext(PINEx&);
 	RC			readRunPage(ulong runid);
 	void		esCleanup();
 	friend	class	InRun;
 	friend	class	OutRun;
+	friend	class	MergeRuns;
+	friend	class	MergeParts;
+	friend	class	SortPartReq;
 };
 
 /**
@@ -493,8 +749,9 @@ public:
 	PathOp(QueryOp *qop,const PathSeg *ps,unsigned nSegs,unsigned qf);
 	virtual		~PathOp();
 	void		connect(PINEx **results,unsigned nRes);
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
 	RC			rewind();
+	RC			reset();
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -515,13 +772,19 @@ class TransOp : public QueryOp
 	const	unsigned	nGroup;
 	const	Expr		*having;
 	AggAcc				*ac;
+	QBatch				*inb;			/**< input batch with projected properties, see initBatch() */
+	RC					initBatch();
+	RC					nextIn() {return inb!=NULL?inb->next(queryOp,*ins[0]):queryOp->next();}
+	void				freeBatch();
 public:
 	TransOp(QueryOp *q,const ValueV *d,unsigned nD,const ValueV& aggs,const OrderSegQ *gs,unsigned nG,const Expr *hv,ulong qf);
 	TransOp(QCtx *qc,const ValueV *d,unsigned nD,ulong qf);
 	virtual		~TransOp();
 	void		connect(PINEx **results,unsigned nRes);
-	RC			next(const PINEx *skip=NULL);
+	RC			advance(const PINEx *skip=NULL);
+	RC			batch(QBatch& qb);
 	RC			rewind();
+	RC			reset();
 	void		print(SOutCtx& buf,int level) const;
 };
 
@@ -31,7 +31,7 @@ Written by Mark Venguerov 2004-2012
 using namespace AfyKernel;
 
 QueryPrc::QueryPrc(StoreCtx *c,IStoreNotification *notItf) 
-	: notification(notItf),ctx(c),bigThreshold(c->bufMgr->getPageSize()*SKEW_PAGE_PCT/100),calcProps(NULL),nCalcProps(0)
+	: notification(notItf),ctx(c),bigThreshold(c->bufMgr->getPageSize()*SKEW_PAGE_PCT/100),calcProps(NULL),nCalcProps(0),rxCache(c),planCache(c)
 {
 }
 
@@ -90,15 +90,32 @@ RC Stmt::execute(ICursor **pResult,const Value *pars,unsigned nPars,unsigned nPr
 			}
 			break;
 		}
-		if (qop==NULL) {QBuildCtx qctx(ses,ValueV(pars,nPars),this,nSkip,md); if ((rc=qctx.process(qop))!=RC_OK && rc!=RC_EOF) {delete qop; return rc;}}
 		if (txl==TXI_DEFAULT && (txl=(TXI_LEVEL)ses->getIsolationLevel())==TXI_DEFAULT) txl=TXI_REPEATABLE_READ;
+		if (prep!=NULL && prep->fIdle) {
+			// re-execution of a query with new parameters: the plan built for the previous execution is reset instead of rebuilt
+			if (op==STMT_QUERY && nSkip==0 && prep->ses==ses && prep->nReturn==nProcess && prep->mode==(mode|md)
+				&& prep->rebind(pars,nPars,txl>=TXI_REPEATABLE_READ)==RC_OK) {
+				if ((ses->getTraceMode()&TRACE_SESSION_QUERIES)!=0) trace(ses,stmtOpName[op],RC_OK,0,pars,nPars);
+				*pResult=prep; return RC_OK;
+			}
+			delete prep; prep=NULL;
+		}
+		bool fReuse=false; const uint32_t gen=ctx->queryMgr->getPlanCache().getGen();
+		if (qop==NULL) {
+			QBuildCtx qctx(ses,ValueV(pars,nPars),this,nSkip,md,op==STMT_QUERY && nProcess!=~0u?nProcess:~0ul); if ((rc=qctx.process(qop))!=RC_OK && rc!=RC_EOF) {delete qop; return rc;}
+			fReuse=qctx.isReusable();
+		}
 		if (pResult!=NULL) {
 			Value *vals=NULL; unsigned nVals=0;
 			if (sop==STMT_QUERY || values==NULL || op==STMT_INSERT && top==NULL || (rc=copyV(values,nVals=nValues,vals,ses))==RC_OK) {
 				Cursor *result=new(ses) Cursor(qop,nProcess,mode|md,vals,nVals,ses,sop,top!=NULL?top->stype:SEL_PINSET,txl>=TXI_REPEATABLE_READ);
 				if (result==NULL) {if (vals!=NULL) freeV(vals,nVals,ses); rc=RC_NORESOURCES;}
 				else if ((rc=result->connect())!=RC_OK) {result->destroy(); if (vals!=NULL) freeV(vals,nVals,ses);}
-				else {*pResult=result; qop=NULL;}
+				else {
+					*pResult=result;
+					if (fReuse && qop!=NULL && prep==NULL && op==STMT_QUERY && nSkip==0 && ma==(MemAlloc*)ses) {result->stmt=this; result->gen=gen; prep=result;}
+					qop=NULL;
+				}
 			}
 		} else if (rc!=RC_EOF) {
 			PINEx qr(ses),*pqr=&qr; qop->connect(&pqr); TxSP tx(ses); if ((rc=tx.start(txl))!=RC_OK) return rc;
@@ -363,9 +380,17 @@ RC Stmt::analyze(char *&plan,const Value *pars,unsigned nPars,unsigned long md)
 		Session *ses=Session::getSession(); plan=NULL;
 		if (ses==NULL) return RC_NOSESSION; if (ses->getStore()->inShutdown()) return RC_SHUTDOWN;
 		TxGuard txg(ses); ses->resetAbortQ();
-		QBuildCtx qctx(ses,ValueV(pars,nPars),this,0,md&(MODE_ALL_WORDS|MODE_DELETED));
+		QBuildCtx qctx(ses,ValueV(pars,nPars),this,0,md&(MODE_ALL_WORDS|MODE_DELETED|MODE_ANALYZE));
 		QueryOp *qop=NULL; RC rc=qctx.process(qop);
-		if (rc==RC_OK && qop!=NULL) {SOutCtx buf(ses); qop->print(buf,0); plan=(char*)buf;}
+		if (rc==RC_OK && qop!=NULL) {
+			if ((md&MODE_ANALYZE)!=0) {
+				// the query is run to the end, results are discarded
+				PINEx qr(ses),*pqr=&qr; qop->connect(&pqr);
+				while ((rc=qop->next())==RC_OK && (rc=ses->testAbortQ())==RC_OK);
+				qr.cleanup(); if (rc==RC_EOF) rc=RC_OK;
+			}
+			if (rc==RC_OK) {SOutCtx buf(ses); qop->print(buf,0); plan=(char*)buf;}
+		}
 		delete qop; return rc==RC_EOF?RC_OK:rc;
 	} catch (RC rc) {return rc;} catch (...) {report(MSG_ERROR,"Exception in IStmt::analyze()\n"); return RC_INTERNAL;}
 }
@@ -636,7 +661,30 @@ RC Cursor::rewind()
 
 void Cursor::destroy()
 {
-	try {delete this;} catch (RC) {} catch (...) {report(MSG_ERROR,"Exception in ICursor::destroy()\n");}
+	try {
+		if (stmt==NULL) delete this;
+		else {
+			// kept by the statement until it's executed again or destroyed
+			if (txcid!=NO_TXCID) {ses->getStore()->txMgr->releaseSnapshot(txcid); txcid=NO_TXCID;}
+			qr.cleanup(); for (unsigned i=1; i<nResults; i++) if (results[i]!=NULL) results[i]->cleanup();
+			ses->releaseAllLatches(); fIdle=true;
+		}
+	} catch (RC) {} catch (...) {report(MSG_ERROR,"Exception in ICursor::destroy()\n");}
+}
+
+RC Cursor::rebind(const Value *pars,unsigned nPars,bool fSS)
+{
+	if (queryOp==NULL || gen!=ses->getStore()->queryMgr->getPlanCache().getGen()) return RC_CLOSED;
+	QCtx *qx=queryOp->getQCtx(); ValueV& prs=qx->vals[QV_PARAMS]; RC rc;
+	if (prs.fFree && prs.vals!=NULL) freeV((Value*)prs.vals,prs.nValues,ses);
+	prs.vals=pars; prs.nValues=(uint16_t)nPars; prs.fFree=false;
+	if ((mode&MODE_COPY_VALUES)!=0 && pars!=NULL && nPars!=0) {
+		if ((rc=copyV(pars,nPars,*(Value**)&prs.vals,ses))!=RC_OK) {prs.vals=NULL; prs.nValues=0; return rc;}
+		prs.fFree=true;
+	}
+	if ((rc=queryOp->reset())!=RC_OK) return rc;
+	cnt=0; txid=INVALID_TXID; fSnapshot=fSS; fProc=false; fAdvance=true; fIdle=false;
+	return RC_OK;
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------
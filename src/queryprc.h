@@ -28,6 +28,8 @@ Written by Mark Venguerov 2004-2012
 #include "queryop.h"
 #include "txmgr.h"
 #include "lock.h"
+#include "regex.h"
+#include "plancache.h"
 
 class IStoreNotification;
 
@@ -217,8 +219,11 @@ private:
 	PropertyID			*calcProps;
 	unsigned			nCalcProps;
 	RWLock				cPropLock;
+	RegexCache			rxCache;
+	PlanCache			planCache;
 public:
 	QueryPrc(StoreCtx *,IStoreNotification *notItf);
+	PlanCache&	getPlanCache() {return planCache;}
 
 	RC		loadPIN(Session *ses,const PID& id,PIN *&pin,unsigned mode=0,PINEx *pcb=NULL,VersionID=STORE_CURRENT_VERSION);
 	RC		loadValue(Session *ses,const PID& id,PropertyID pid,ElementID eid,Value& res,ulong mode=0);
@@ -241,6 +246,7 @@ public:
 	bool	checkCalcPropID(PropertyID pid);
 
 	friend	class	Expr;
+	friend	class	Regex;
 	friend	class	Stmt;
 	friend	class	Cursor;
 	friend	class	Navigator;
@@ -259,6 +265,7 @@ public:
 	friend	class	MergeOp;
 	friend	class	NestedLoop;
 	friend	class	Filter;
+	friend	class	Exchange;
 	friend	class	LoadOp;
 	friend	class	TransOp;
 	friend	class	PathOp;
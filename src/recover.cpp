@@ -34,6 +34,99 @@ const static char *LR_Tab[LR_ALL] =
 	"LR_COMPENSATE2", "LR_DISCARD", "LR_COMPENSATE3"
 };
 
+static void dispatchRedo(StoreCtx *ctx,RedoBatch& batch,RedoWorker **workers,int nWorkers)
+{
+	if (batch.nPages!=0) ctx->bufMgr->prefetch(batch.pages,batch.nPages,NULL,batch.mgrs);
+	for (int i=0; i<batch.nRecs; i++) workers[batch.recs[i]->pageID%nWorkers]->post(batch.recs[i]);
+	batch.nRecs=batch.nPages=0;
+}
+
+RC RedoWorker::start()
+{
+	HTHREAD thread; RC rc;
+	while ((rc=createThread(_run,this,thread))==RC_REPEAT);
+	return rc;
+}
+
+THREAD_SIGNATURE RedoWorker::_run(void *param)
+{
+	((RedoWorker*)param)->run(); return 0;
+}
+
+void RedoWorker::run()
+{
+	Session *ses=Session::createSession(ctx); if (ses==NULL) ctx->set();
+	PBlock *pb=NULL; RedoRec *rr; lock.lock();
+	for (;;) {
+		if ((rr=first)!=NULL) {
+			first=last=NULL; nQueued=0; fBusy=true; idle.signalAll(); lock.unlock();
+			do {RedoRec *next=rr->next; apply(ctx,*rr,pb,ses,NULL); free(rr,STORE_HEAP); rr=next;} while (rr!=NULL);
+			lock.lock();
+		} else if (pb!=NULL) {
+			lock.unlock(); pb->release(QMGR_UFORCE,ses); pb=NULL; lock.lock();
+		} else {
+			fBusy=false; idle.signalAll(); if (fStop) break;
+			work.wait(lock,0);
+		}
+	}
+	lock.unlock(); if (ses!=NULL) Session::terminateSession();
+	lock.lock(); fDone=true; idle.signalAll(); lock.unlock();
+#ifndef WIN32
+	pthread_detach(pthread_self());
+#endif
+}
+
+void RedoWorker::post(RedoRec *rr)
+{
+	MutexP lck(&lock); rr->next=NULL;
+	while (nQueued>=REDO_QUEUE_SIZE) idle.wait(lock,0);
+	if (last==NULL) first=rr; else last->next=rr;
+	last=rr; if (nQueued++==0) work.signal();
+}
+
+void RedoWorker::drain()
+{
+	MutexP lck(&lock);
+	while (first!=NULL || fBusy) idle.wait(lock,0);
+}
+
+void RedoWorker::stop()
+{
+	MutexP lck(&lock); fStop=true; work.signal();
+	while (!fDone) idle.wait(lock,0);
+}
+
+void RedoWorker::apply(StoreCtx *ctx,const RedoRec& rr,PBlock *&pb,Session *ses,DirtyPageSet *dirtyPages)
+{
+	LogMgr *logMgr=ctx->logMgr; PageMgr *pageMgr=rr.pageMgr; PBlock *pb2; DirtyPg *dpg;
+	switch (rr.type) {
+	default: break;
+	case LR_COMPENSATE2: case LR_DISCARD:
+		if (pb!=NULL && pb->getPageID()==rr.pageID) {pb->release(PGCTL_DISCARD|QMGR_UFORCE,ses); pb=NULL;}
+		else ctx->bufMgr->drop(rr.pageID);
+		break;
+	case LR_UPDATE: case LR_CREATE: case LR_COMPENSATE: case LR_COMPENSATE3:
+		pb=rr.type==LR_CREATE||rr.type==LR_COMPENSATE3 ? ctx->bufMgr->newPage(rr.pageID,pageMgr,pb,0,ses) :
+													ctx->bufMgr->getPage(rr.pageID,pageMgr,PGCTL_XLOCK,pb,ses);
+		if (pb==NULL)
+			report(MSG_ERROR,"%s redo: cannot read page %08X , LSN: "_LX_FM"\n",LR_Tab[rr.type],rr.pageID,rr.lsn.lsn);
+		else if (pageMgr->getLSN(pb->getPageBuf(),logMgr->lPage)<rr.lsn) {
+			if (rr.type!=LR_COMPENSATE3||rr.rbuf!=NULL&&rr.lrec!=0) {
+				RC rc=pageMgr->update(pb,logMgr->lPage,rr.extra>>PGID_SHIFT,rr.rbuf,rr.lrec,rr.type==LR_COMPENSATE?TXMGR_UNDO:TXMGR_RECV);
+				if (rc!=RC_OK) report(MSG_ERROR,"%s redo: page %08X update failed: %d, LSN: "_LX_FM"\n",LR_Tab[rr.type],rr.pageID,rc,rr.lsn.lsn);
+			}
+			pageMgr->setLSN(rr.lsn,pb->getPageBuf(),logMgr->lPage); pb->setRedo(rr.lsn);
+			if ((pb2=logMgr->newPage)!=NULL) {
+				bool fDiscard=true; assert(dirtyPages!=NULL);
+				if (dirtyPages!=NULL && (dpg=dirtyPages->find(pb2->getPageID()))!=NULL && dpg->redoLSN<=rr.lsn)
+					{pageMgr->setLSN(rr.lsn,pb2->getPageBuf(),logMgr->lPage); pb2->setRedo(rr.lsn); fDiscard=false;}
+				pb2->release(fDiscard?PGCTL_DISCARD|QMGR_UFORCE:QMGR_UFORCE,ses); logMgr->newPage=NULL;
+			}
+		}
+		break;
+	}
+}
+
 RC LogMgr::recover(Session *ses,bool fRollforward)
 {
 	if ((ctx->mode&STARTUP_NO_RECOVERY)!=0) return RC_OK;
@@ -51,7 +144,7 @@ RC LogMgr::recover(Session *ses,bool fRollforward)
 			if (recFileSize<bufLen) {offset=0; lread=ceil(recFileSize,sectorSize);}
 			else if (recFileSize-offset>=bufLen) lread=bufLen;
 			else {offset=ceil(recFileSize,lPage)-bufLen; lread=recFileSize-offset;}
-			minLSN=LSNFromOffset(LSNToFileN(chkp),offset); maxLSN=minLSN+lread;
+			baseLSN=minLSN=LSNFromOffset(LSNToFileN(chkp),offset); doneLSN=maxLSN=minLSN+lread;
 			pcb->aio_fildes=logFile; pcb->aio_buf=logBufBeg; pcb->aio_lio_opcode=LIO_READ;
 			pcb->aio_offset=offset; pcb->aio_nbytes=ceil(lread,sectorSize);
 			rc=ctx->fileMgr->listIO(LIO_WAIT,1,&pcb);
@@ -182,18 +275,25 @@ RC LogMgr::recover(Session *ses,bool fRollforward)
 	}
 	if (logFile==INVALID_FILEID && (rc=openLogFile(sMinLSN))!=RC_OK)
 		{lock.unlock(); report(MSG_CRIT,"Recovery: cannot re-open log file segment(%d)\n",rc); fRecovery=false; return rc;}
-	this->prevLSN=prevLSN; writtenLSN=maxLSN=lastLSN; assert(maxLSN>=minLSN);
-	if ((ptrInsert=logBufBeg+(maxLSN-minLSN))==logBufEnd) ptrInsert=ptrRead=logBufBeg;
-	ptrWrite=floor(ptrInsert,sectorSize);
+	this->prevLSN=prevLSN; writtenLSN=maxLSN=doneLSN=lastLSN; baseLSN=minLSN; assert(maxLSN>=minLSN);
 	lock.unlock();
 
 	// REDO pass
 
-	LSN redo(logEnd); PBlock *pb=NULL,*pb2;
+	LSN redo(logEnd); PBlock *pb=NULL;
 	for (DirtyPageSet::it it(dirtyPages); ++it;) {dpg=it.get(); if (redo>dpg->redoLSN) redo=dpg->redoLSN;}
 
+	RedoWorker *workers[REDO_MAX_WORKERS]; int nWorkers=0; RedoBatch batch;
+	if ((ctx->mode&STARTUP_SINGLE_SESSION)==0 && redo<lastLSN) {
+		for (int nw=min(getNProcessors(),(int)REDO_MAX_WORKERS); nw>1 && nWorkers<nw; nWorkers++) {
+			RedoWorker *rw=new(ctx) RedoWorker(ctx); if (rw==NULL) break;
+			if (rw->start()!=RC_OK) {rw->~RedoWorker(); ctx->free(rw); break;}
+			workers[nWorkers]=rw;
+		}
+	}
+
 #ifdef _DEBUG
-	report(MSG_DEBUG,"\tRecovery: redo start at "_LX_FM", end at "_LX_FM"\n",redo.lsn,lastLSN.lsn);
+	report(MSG_DEBUG,"\tRecovery: redo start at "_LX_FM", end at "_LX_FM", %d thread(s)\n",redo.lsn,lastLSN.lsn,nWorkers);
 #endif
 	
 	while (redo < lastLSN) {
@@ -201,48 +301,43 @@ RC LogMgr::recover(Session *ses,bool fRollforward)
 		if ((rc=rctx.read(redo))!=RC_OK) {
 			report(MSG_ERROR,"Recovery:redo: cannot read record at "_LX_FM" (%d)\n",ctx->logMgr->recv.lsn,rc); break;
 		}
-		rctx.type=rctx.logRec.getType(); bool fUndo=false;
-		switch (rctx.type) {
-		default: break;
-		case LR_COMPENSATE2: case LR_DISCARD:
-			if (rctx.logRec.pageID!=INVALID_PAGEID && (dpg=dirtyPages.find(rctx.logRec.pageID))!=NULL && dpg->redoLSN<redo) {
-				if (pb!=NULL && pb->getPageID()==rctx.logRec.pageID) {pb->release(PGCTL_DISCARD|QMGR_UFORCE,ses); pb=NULL;}
-				else if (rctx.logRec.pageID!=INVALID_PAGEID) ctx->bufMgr->drop(rctx.logRec.pageID);
-			}
-			break;
-		case LR_COMPENSATE: if (rctx.logRec.pageID!=INVALID_PAGEID) fUndo=true; else break;
+		RedoRec rr={NULL,recv,rctx.logRec.pageID,rctx.logRec.getType(),rctx.logRec.getExtra(),NULL,rctx.rbuf,rctx.lrec}; bool fMerge;
+		switch (rr.type) {
+		default: continue;
+		case LR_COMPENSATE2: case LR_DISCARD: break;
+		case LR_COMPENSATE: if (rr.pageID==INVALID_PAGEID) continue;
 		case LR_UPDATE: case LR_CREATE: case LR_COMPENSATE3:
-			if (TxMgr::isMaster(extra=rctx.logRec.getExtra())) {
-				if (rctx.logRec.pageID==INVALID_PAGEID && logEnd<ctx->logMgr->recv) {
-					RC rc=ctx->theCB->update(ctx,extra>>PGID_SHIFT,rctx.rbuf,rctx.lrec,fUndo);
-					if (rc!=RC_OK) report(MSG_ERROR,"%s redo: master page update failed: %d, LSN: "_LX_FM"\n",LR_Tab[rctx.type],rc,ctx->logMgr->recv.lsn);
+			if (TxMgr::isMaster(rr.extra)) {
+				if (rr.pageID==INVALID_PAGEID && logEnd<ctx->logMgr->recv) {
+					RC rc=ctx->theCB->update(ctx,rr.extra>>PGID_SHIFT,rr.rbuf,rr.lrec,rr.type==LR_COMPENSATE);
+					if (rc!=RC_OK) report(MSG_ERROR,"%s redo: master page update failed: %d, LSN: "_LX_FM"\n",LR_Tab[rr.type],rc,ctx->logMgr->recv.lsn);
 					ctx->theCB->logEnd=ctx->logMgr->recv;
 				}
-			} else if (rctx.logRec.pageID!=INVALID_PAGEID && (dpg=dirtyPages.find(rctx.logRec.pageID))!=NULL && dpg->redoLSN<redo) {
-				pageMgr=TxMgr::getPageMgr(extra,ctx);
-				if (pageMgr==NULL)
-					report(MSG_ERROR,"Invalid PGID %d in recovery:redo, LSN: "_LX_FM"\n",extra&PGID_MASK,ctx->logMgr->recv.lsn);
-				else {
-					pb=rctx.type==LR_CREATE||rctx.type==LR_COMPENSATE3 ? ctx->bufMgr->newPage(rctx.logRec.pageID,pageMgr,pb,0,ses) :
-															ctx->bufMgr->getPage(rctx.logRec.pageID,pageMgr,PGCTL_XLOCK,pb,ses);
-					if (pb==NULL)
-						report(MSG_ERROR,"%s redo: cannot read page %08X , LSN: "_LX_FM"\n",LR_Tab[rctx.type],rctx.logRec.pageID,ctx->logMgr->recv.lsn);
-					else if (pageMgr->getLSN(pb->getPageBuf(),lPage)<ctx->logMgr->recv) {
-						if (rctx.type!=LR_COMPENSATE3||rctx.rbuf!=NULL&&rctx.lrec!=0) {
-							RC rc=pageMgr->update(pb,lPage,extra>>PGID_SHIFT,rctx.rbuf,rctx.lrec,fUndo?TXMGR_UNDO:TXMGR_RECV);
-							if (rc!=RC_OK) report(MSG_ERROR,"%s redo: page %08X update failed: %d, LSN: "_LX_FM"\n",LR_Tab[rctx.type],rctx.logRec.pageID,rc,ctx->logMgr->recv.lsn);
-						}
-						pageMgr->setLSN(ctx->logMgr->recv,pb->getPageBuf(),lPage); pb->setRedo(ctx->logMgr->recv);
-						if ((pb2=ctx->logMgr->newPage)!=NULL) {
-							bool fDiscard=true;
-							if ((dpg=dirtyPages.find(pb2->getPageID()))!=NULL && dpg->redoLSN<redo)
-								{pageMgr->setLSN(ctx->logMgr->recv,pb2->getPageBuf(),lPage); pb2->setRedo(ctx->logMgr->recv); fDiscard=false;}
-							pb2->release(fDiscard?PGCTL_DISCARD|QMGR_UFORCE:QMGR_UFORCE,ses); ctx->logMgr->newPage=NULL;
-						}
-					}
-				}
+				continue;
 			}
+			break;
+		}
+		if (rr.pageID==INVALID_PAGEID || (dpg=dirtyPages.find(rr.pageID))==NULL || dpg->redoLSN>=redo) continue;
+		if (rr.type!=LR_COMPENSATE2 && rr.type!=LR_DISCARD && (rr.pageMgr=TxMgr::getPageMgr(rr.extra,ctx))==NULL) {
+			report(MSG_ERROR,"Invalid PGID %d in recovery:redo, LSN: "_LX_FM"\n",rr.extra&PGID_MASK,ctx->logMgr->recv.lsn); continue;
 		}
+		RedoRec *qr=NULL;
+		if (nWorkers==0 || rr.pageMgr!=NULL && (rr.type==LR_UPDATE||rr.type==LR_COMPENSATE) && rr.pageMgr->multiPage(rr.extra>>PGID_SHIFT,rr.rbuf,rr.lrec,fMerge)!=INVALID_PAGEID
+			|| (qr=(RedoRec*)malloc(sizeof(RedoRec)+rr.lrec,STORE_HEAP))==NULL) {
+			// a record changing two pages is applied when all preceding records for both pages are done
+			if (nWorkers!=0) {dispatchRedo(ctx,batch,workers,nWorkers); for (int i=0; i<nWorkers; i++) workers[i]->drain();}
+			RedoWorker::apply(ctx,rr,pb,ses,&dirtyPages);
+			if (nWorkers!=0 && pb!=NULL) {pb->release(QMGR_UFORCE,ses); pb=NULL;}
+		} else {
+			*qr=rr; if (rr.lrec!=0) {byte *p=(byte*)(qr+1); memcpy(p,rr.rbuf,rr.lrec); qr->rbuf=p;}
+			if (rr.type!=LR_UPDATE && rr.type!=LR_COMPENSATE) dpg->flag|=DPG_NOPREFETCH;
+			else if ((dpg->flag&DPG_NOPREFETCH)==0) {batch.pages[batch.nPages]=rr.pageID; batch.mgrs[batch.nPages++]=rr.pageMgr;}
+			batch.recs[batch.nRecs++]=qr; if (batch.nRecs>=REDO_PREFETCH) dispatchRedo(ctx,batch,workers,nWorkers);
+		}
+	}
+	if (nWorkers!=0) {
+		dispatchRedo(ctx,batch,workers,nWorkers);
+		for (int i=0; i<nWorkers; i++) {workers[i]->stop(); workers[i]->~RedoWorker(); ctx->free(workers[i]);}
 	}
 
 #ifdef _DEBUG
@@ -445,11 +540,10 @@ RC LogMgr::rollback(Session *ses,bool fSavepoint)
 RC LogMgr::checkpoint()
 {
 	if ((ctx->mode&STARTUP_NO_RECOVERY)!=0) return RC_OK;
-	bufferLock.lock(); RC rc=RC_OK; LSN start(~0ULL);
+	bufferLock.lock(RW_X_LOCK); RC rc=RC_OK; LSN start(~0ULL);
 	if (!fRecovery && ctx->theCB->checkpoint==prevLSN) {bufferLock.unlock(); return RC_OK;}
-	PageID asyncPages[MAX_ASYNC_PAGES]; ulong nAsyncPages=0;
-	LogDirtyPages *ldp=ctx->bufMgr->getDirtyPageInfo(maxLSN<logSegSize?LSN(0):maxLSN-logSegSize,
-								start,asyncPages,nAsyncPages,sizeof(asyncPages)/sizeof(asyncPages[0]));
+	// checkpoint only records the dirty page table; pages are written continuously by the buffer manager background writer
+	LogDirtyPages *ldp=ctx->bufMgr->getDirtyPageInfo(start);
 	LogActiveTransactions *lat=ctx->txMgr->getActiveTx(start);
 	if (ldp==NULL || lat==NULL) {bufferLock.unlock(); return RC_NORESOURCES;}
 	assert(!fRecovery || lat->nTransactions==0);
@@ -471,7 +565,6 @@ RC LogMgr::checkpoint()
 		} 
 		ctx->free(pData);
 	}
-	if (nAsyncPages>0) ctx->bufMgr->writeAsyncPages(asyncPages,nAsyncPages);
 	ctx->free(ldp); ctx->free(lat);
 	return rc;
 }
@@ -31,6 +31,11 @@ Written by Mark Venguerov 2004-2012
 #define LOSERSETSIZE		2000		/**< initial size of hash table for 'loser' transactions */
 #define ACTIVESETSIZE		2000		/**< initial size of hash table for active transactions */
 #define DIRTYPAGESETSIZE	3000		/**< initial size of dirty page hash table */
+#define	REDO_MAX_WORKERS	16			/**< maximum number of parallel redo threads */
+#define	REDO_QUEUE_SIZE		512			/**< maximum number of log records queued for one redo thread */
+#define	REDO_PREFETCH		64			/**< number of log records dispatched together, their pages are read ahead */
+
+#define	DPG_NOPREFETCH		0x0001		/**< page is created or dropped by redo and mustn't be read ahead */
 
 namespace AfyKernel
 {
@@ -79,6 +84,62 @@ struct DirtyPg
 
 typedef HashTab<DirtyPg,PageID,&DirtyPg::list> DirtyPageSet;
 
+/**
+ * log record to be re-applied to a page
+ */
+struct RedoRec
+{
+	RedoRec			*next;
+	LSN				lsn;
+	PageID			pageID;
+	LRType			type;
+	ulong			extra;
+	PageMgr			*pageMgr;
+	const	byte	*rbuf;
+	size_t			lrec;
+};
+
+/**
+ * group of log records dispatched to redo threads together
+ */
+struct RedoBatch
+{
+	RedoRec			*recs[REDO_PREFETCH];
+	PageID			pages[REDO_PREFETCH];
+	PageMgr			*mgrs[REDO_PREFETCH];
+	int				nRecs;
+	int				nPages;
+	RedoBatch() : nRecs(0),nPages(0) {}
+};
+
+/**
+ * parallel redo thread
+ * log records are partitioned by PageID, so records for any given page are applied by the same thread in LSN order
+ */
+class RedoWorker
+{
+	StoreCtx		*const ctx;
+	Mutex			lock;
+	Event			work;
+	Event			idle;
+	RedoRec			*first;
+	RedoRec			*last;
+	ulong			nQueued;
+	bool			fBusy;
+	bool			fStop;
+	bool			fDone;
+	void			run();
+	static	THREAD_SIGNATURE	_run(void *param);
+public:
+	RedoWorker(StoreCtx *ct) : ctx(ct),first(NULL),last(NULL),nQueued(0),fBusy(false),fStop(false),fDone(false) {}
+	void *operator	new(size_t s,StoreCtx *ctx) {return ctx->malloc(s);}
+	RC				start();
+	void			post(RedoRec *rr);
+	void			drain();
+	void			stop();
+	static	void	apply(StoreCtx *ctx,const RedoRec& rr,PBlock *&pb,Session *ses,DirtyPageSet *dirtyPages);
+};
+
 };
 
 #endif
@@ -0,0 +1,607 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+#include "regex.h"
+#include "session.h"
+#include "queryprc.h"
+
+using namespace AfyKernel;
+
+namespace AfyKernel
+{
+
+enum RxOp
+{
+	RXS_CLASS, RXS_SPLIT, RXS_NOP, RXS_BOL, RXS_EOL, RXS_MATCH
+};
+
+enum RxAstType
+{
+	RXA_CLS, RXA_CAT, RXA_ALT, RXA_REP, RXA_BOL, RXA_EOL, RXA_EMPTY
+};
+
+#define	RX_NIL			(~0u)
+#define	RX_INF			0xFFFF
+#define	RX_MAX_REP		1000
+#define	RX_MAX_PREFIX	256
+#define	RX_MAX_SET		0x40000		/**< maximum total size of NFA state sets of DFA states */
+#define	RX_HASH_SIZE	(RX_MAX_DFA*4)
+
+#define	RXD_MATCH		0x01
+#define	RXD_MATCHEND	0x02
+#define	RXD_DEAD		0x04
+
+/**
+ * pattern syntax tree node
+ */
+struct RxAst
+{
+	byte		type;
+	uint16_t	cls;
+	uint16_t	min;
+	uint16_t	max;
+	uint32_t	left;
+	uint32_t	right;
+};
+
+/**
+ * growing array of POD elements for pattern compilation
+ */
+template<typename T> struct RxVec
+{
+	MemAlloc	*const ma;
+	T			*v;
+	uint32_t	n;
+	uint32_t	x;
+	RxVec(MemAlloc *m) : ma(m),v(NULL),n(0),x(0) {}
+	~RxVec() {if (v!=NULL) ma->free(v);}
+	T	*add() {if (n>=x) {T *pv=(T*)ma->realloc(v,(x=x==0?32:x*2)*sizeof(T)); if (pv==NULL) return NULL; v=pv;} return &v[n++];}
+};
+
+/**
+ * pattern compiler
+ * pattern syntax: POSIX ERE with Perl escapes \d \w \s \D \W \S, \xHH, non-capturing groups (?:...) and lazy quantifiers (ignored)
+ * pattern is matched anywhere in the string, ^ and $ match at the beginning and at the end of the string
+ */
+class RxCompiler
+{
+	const	byte	*const	pat;
+	const	size_t			lpat;
+	const	bool			fNCase;
+	size_t					pos;
+	uint32_t				anyMB;
+	MemAlloc				*const ma;
+	RxVec<RxAst>			ast;
+	RxVec<RxBits>			bits;
+	RxVec<RxState>			states;
+	RxVec<uint32_t>			pool;
+	RxVec<uint32_t>			offs;
+	RxVec<uint16_t>			trans;
+	RxVec<byte>				dflags;
+	uint32_t				*htab;
+	uint32_t				*mark;
+	uint32_t				*stk;
+	uint32_t				*tmp;
+	uint32_t				gen;
+public:
+	RxCompiler(const byte *p,size_t l,bool fNC,MemAlloc *m) : pat(p),lpat(l),fNCase(fNC),pos(0),anyMB(RX_NIL),ma(m),ast(m),bits(m),states(m),
+		pool(m),offs(m),trans(m),dflags(m),htab(NULL),mark(NULL),stk(NULL),tmp(NULL),gen(0) {}
+	~RxCompiler() {if (mark!=NULL) ma->free(mark); if (htab!=NULL) ma->free(htab);}
+	RC			compile(MemAlloc *sm,Regex *&rx);
+private:
+	RC			node(byte type,uint32_t& res,uint32_t left=RX_NIL,uint32_t right=RX_NIL,unsigned min=0,unsigned max=0);
+	RC			cls(const RxBits& bs,uint32_t& res);
+	RC			lit(byte c,uint32_t& res);
+	RC			seq(const byte *s,size_t l,uint32_t& res);
+	RC			multiByte(uint32_t& res);
+	RC			negated(const RxBits& bs,uint32_t& res);
+	RC			parseAlt(uint32_t& res);
+	RC			parseCat(uint32_t& res);
+	RC			parseAtom(uint32_t& res);
+	RC			parseClass(uint32_t& res);
+	int			parseEscape(RxBits& bs,byte& c);
+	bool		parseNum(unsigned& n);
+	bool		prefix(uint32_t n,char *buf,size_t& l) const;
+	RC			state(byte op,uint32_t& res,uint32_t out=RX_NIL,uint32_t out1=RX_NIL,uint16_t cls=0);
+	RC			emit(uint32_t n,uint32_t& st,uint32_t& pl);
+	RC			addState(uint32_t *set,uint32_t n,bool fStart,uint32_t& idx);
+	RC			buildDFA(uint32_t st,const byte *rep,unsigned nb,uint32_t& dStart0,uint32_t& dStart1);
+	uint32_t	*slot(uint32_t p) const {RxState& st=states.v[p>>1]; return (p&1)!=0?&st.out1:&st.out;}
+	void		patch(uint32_t pl,uint32_t to) const {while (pl!=RX_NIL) {uint32_t *ps=slot(pl); pl=*ps; *ps=to;}}
+	uint32_t	append(uint32_t pl1,uint32_t pl2) const {if (pl1==RX_NIL) return pl2; uint32_t *ps=slot(pl1); while (*ps!=RX_NIL) ps=slot(*ps); *ps=pl2; return pl1;}
+	void		link(uint32_t& st,uint32_t& pl,uint32_t st2,uint32_t pl2) const {if (st==RX_NIL) st=st2; else patch(pl,st2); pl=pl2;}
+	static	int	__cdecl	cmpStates(const void *p1,const void *p2) {return cmp3(*(const uint32_t*)p1,*(const uint32_t*)p2);}
+};
+
+}
+
+void RxBits::fold()
+{
+	for (unsigned c='A'; c<='Z'; c++) if (test(byte(c))||test(byte(c|0x20))) {set(byte(c)); set(byte(c|0x20));}
+}
+
+/**
+ * epsilon closure of NFA state s, adds CLASS, MATCH and pending EOL states to set
+ */
+static void closure(const RxState *states,uint32_t s,uint32_t *set,uint32_t& n,uint32_t *mark,uint32_t gen,uint32_t *stk,bool fStart,bool fEnd)
+{
+	uint32_t sp=0; if (mark[s]!=gen) {mark[s]=gen; stk[sp++]=s;}
+	while (sp!=0) {
+		const RxState& st=states[s=stk[--sp]]; uint32_t nx=RX_NIL,nx1=RX_NIL;
+		switch (st.op) {
+		case RXS_CLASS: case RXS_MATCH: set[n++]=s; continue;
+		case RXS_SPLIT: nx=st.out; nx1=st.out1; break;
+		case RXS_NOP: nx=st.out; break;
+		case RXS_BOL: if (fStart) nx=st.out; break;
+		case RXS_EOL: if (fEnd) nx=st.out; else set[n++]=s; break;
+		}
+		if (nx!=RX_NIL && mark[nx]!=gen) {mark[nx]=gen; stk[sp++]=nx;}
+		if (nx1!=RX_NIL && mark[nx1]!=gen) {mark[nx1]=gen; stk[sp++]=nx1;}
+	}
+}
+
+/**
+ * checks if set of NFA states matches at the end of the string (through pending EOL states)
+ */
+static bool endMatch(const RxState *states,const uint32_t *set,uint32_t n,uint32_t *tmp,uint32_t *mark,uint32_t gen,uint32_t *stk,bool fStart)
+{
+	uint32_t nt=0;
+	for (uint32_t i=0; i<n; i++) if (states[set[i]].op==RXS_EOL) closure(states,states[set[i]].out,tmp,nt,mark,gen,stk,fStart,true);
+	for (uint32_t i=0; i<nt; i++) if (states[tmp[i]].op==RXS_MATCH) return true;
+	return false;
+}
+
+RC RxCompiler::node(byte type,uint32_t& res,uint32_t left,uint32_t right,unsigned min,unsigned max)
+{
+	RxAst *pa=ast.add(); if (pa==NULL) return RC_NORESOURCES;
+	pa->type=type; pa->cls=0; pa->min=uint16_t(min); pa->max=uint16_t(max); pa->left=left; pa->right=right;
+	res=ast.n-1; return RC_OK;
+}
+
+RC RxCompiler::cls(const RxBits& bs,uint32_t& res)
+{
+	uint32_t i=0; while (i<bits.n && memcmp(&bits.v[i],&bs,sizeof(RxBits))!=0) i++;
+	if (i>=bits.n) {if (i>=0xFFFF) return RC_TOOBIG; RxBits *pb=bits.add(); if (pb==NULL) return RC_NORESOURCES; *pb=bs;}
+	RC rc=node(RXA_CLS,res); if (rc==RC_OK) ast.v[res].cls=uint16_t(i);
+	return rc;
+}
+
+RC RxCompiler::lit(byte c,uint32_t& res)
+{
+	RxBits bs; memset(&bs,0,sizeof(RxBits)); bs.set(c); if (fNCase) bs.fold();
+	return cls(bs,res);
+}
+
+RC RxCompiler::seq(const byte *s,size_t l,uint32_t& res)
+{
+	RC rc=lit(s[0],res); uint32_t n;
+	for (size_t i=1; rc==RC_OK && i<l; i++) if ((rc=lit(s[i],n))==RC_OK) rc=node(RXA_CAT,res,res,n);
+	return rc;
+}
+
+RC RxCompiler::multiByte(uint32_t& res)
+{
+	if (anyMB!=RX_NIL) {res=anyMB; return RC_OK;}
+	RxBits l2,l3,l4,cb; memset(&l2,0,sizeof(RxBits)); memset(&l3,0,sizeof(RxBits)); memset(&l4,0,sizeof(RxBits)); memset(&cb,0,sizeof(RxBits));
+	l2.set(0xC0,0xDF); l3.set(0xE0,0xEF); l4.set(0xF0,0xF7); cb.set(0x80,0xBF);
+	uint32_t n2,n3,n4,k,s2,s3,s4; RC rc;
+	if ((rc=cls(l2,n2))!=RC_OK || (rc=cls(l3,n3))!=RC_OK || (rc=cls(l4,n4))!=RC_OK || (rc=cls(cb,k))!=RC_OK) return rc;
+	if ((rc=node(RXA_CAT,s2,n2,k))!=RC_OK || (rc=node(RXA_CAT,s3,k,k))!=RC_OK || (rc=node(RXA_CAT,s4,k,s3))!=RC_OK
+		|| (rc=node(RXA_CAT,s3,n3,s3))!=RC_OK || (rc=node(RXA_CAT,s4,n4,s4))!=RC_OK) return rc;
+	if ((rc=node(RXA_ALT,s3,s3,s4))!=RC_OK || (rc=node(RXA_ALT,res,s2,s3))!=RC_OK) return rc;
+	anyMB=res; return RC_OK;
+}
+
+RC RxCompiler::negated(const RxBits& bs,uint32_t& res)
+{
+	RxBits nb; uint32_t n,mb; RC rc;
+	for (unsigned i=0; i<8; i++) nb.bits[i]=i<4?~bs.bits[i]:0;
+	nb.set(0x80,0xBF); nb.set(0xF8,0xFF);		// invalid UTF-8 bytes match as single characters
+	return (rc=cls(nb,n))!=RC_OK || (rc=multiByte(mb))!=RC_OK ? rc : node(RXA_ALT,res,n,mb);
+}
+
+RC RxCompiler::parseAlt(uint32_t& res)
+{
+	RC rc; uint32_t n;
+	if ((rc=parseCat(res))!=RC_OK) return rc;
+	while (pos<lpat && pat[pos]=='|') {
+		pos++; if ((rc=parseCat(n))!=RC_OK || (rc=node(RXA_ALT,res,res,n))!=RC_OK) return rc;
+	}
+	return RC_OK;
+}
+
+RC RxCompiler::parseCat(uint32_t& res)
+{
+	RC rc; uint32_t a; unsigned min,max; res=RX_NIL;
+	while (pos<lpat && pat[pos]!='|' && pat[pos]!=')') {
+		if ((rc=parseAtom(a))!=RC_OK) return rc;
+		while (pos<lpat) {
+			const size_t save=pos;
+			switch (pat[pos++]) {
+			case '*': min=0; max=RX_INF; break;
+			case '+': min=1; max=RX_INF; break;
+			case '?': min=0; max=1; break;
+			case '{':
+				if (!parseNum(min)) {pos=save; goto no_rep;}
+				max=min;
+				if (pos<lpat && pat[pos]==',') {
+					if (++pos<lpat && pat[pos]=='}') max=RX_INF; else if (!parseNum(max)) return RC_SYNTAX;
+				}
+				if (pos>=lpat || pat[pos]!='}' || max<min) return RC_SYNTAX;
+				if (min>RX_MAX_REP || max!=RX_INF && max>RX_MAX_REP) return RC_TOOBIG;
+				pos++; break;
+			default: pos=save; goto no_rep;
+			}
+			if (pos<lpat && pat[pos]=='?') pos++;			// lazy quantifiers don't change the result of the match
+			if ((rc=node(RXA_REP,a,a,RX_NIL,min,max))!=RC_OK) return rc;
+		}
+	no_rep:
+		if (res==RX_NIL) res=a; else if ((rc=node(RXA_CAT,res,res,a))!=RC_OK) return rc;
+	}
+	return res==RX_NIL?node(RXA_EMPTY,res):RC_OK;
+}
+
+RC RxCompiler::parseAtom(uint32_t& res)
+{
+	RxBits bs; byte c=pat[pos++]; RC rc; int k;
+	switch (c) {
+	case '(':
+		if (pos+1<lpat && pat[pos]=='?' && pat[pos+1]==':') pos+=2;
+		if ((rc=parseAlt(res))!=RC_OK) return rc;
+		if (pos>=lpat || pat[pos]!=')') return RC_SYNTAX;
+		pos++; return RC_OK;
+	case '[': return parseClass(res);
+	case '.': memset(&bs,0,sizeof(RxBits)); return negated(bs,res);
+	case '^': return node(RXA_BOL,res);
+	case '$': return node(RXA_EOL,res);
+	case '*': case '+': case '?': return RC_SYNTAX;
+	case '\\':
+		if ((k=parseEscape(bs,c))<0) return RC_SYNTAX;
+		return k==0?lit(c,res):k==1?cls(bs,res):negated(bs,res);
+	default:
+		if (c>=0xC0) {
+			const size_t l=c>=0xF0?4:c>=0xE0?3:2; if (pos-1+l>lpat) return RC_SYNTAX;
+			rc=seq(pat+pos-1,l,res); pos+=l-1; return rc;
+		}
+		return lit(c,res);
+	}
+}
+
+RC RxCompiler::parseClass(uint32_t& res)
+{
+	static const struct {const char *name; size_t l; const char *chars;} posixCls[] = {
+		{"alpha",5,"AZaz"}, {"digit",5,"09"}, {"alnum",5,"AZaz09"}, {"upper",5,"AZ"}, {"lower",5,"az"},
+		{"space",5,"\t\r  "}, {"blank",5,"\t\t  "}, {"xdigit",6,"09AFaf"}, {"punct",5,"!/:@[`{~"}, {"cntrl",5,"\x01\x1F\x7F\x7F"},
+	};
+	RxBits bs,eb; bool fNeg=false; uint32_t alt=RX_NIL,n; RC rc; int k;
+	memset(&bs,0,sizeof(RxBits));
+	if (pos<lpat && pat[pos]=='^') {fNeg=true; pos++;}
+	for (bool fFirst=true; ;fFirst=false) {
+		if (pos>=lpat) return RC_SYNTAX;
+		byte c=pat[pos++];
+		if (c==']' && !fFirst) break;
+		if (c=='[' && pos<lpat && pat[pos]==':') {
+			const byte *end=(const byte*)memchr(pat+pos+1,':',lpat-pos-1); if (end==NULL || end+1>=pat+lpat || end[1]!=']') return RC_SYNTAX;
+			const size_t l=end-pat-pos-1; unsigned i=0;
+			while (i<sizeof(posixCls)/sizeof(posixCls[0]) && (posixCls[i].l!=l || memcmp(posixCls[i].name,pat+pos+1,l)!=0)) i++;
+			if (i>=sizeof(posixCls)/sizeof(posixCls[0])) return RC_SYNTAX;
+			for (const char *p=posixCls[i].chars; *p!='\0'; p+=2) bs.set(byte(p[0]),byte(p[1]));
+			pos=end-pat+2; continue;
+		}
+		if (c=='\\') {
+			if ((k=parseEscape(eb,c))<0) return RC_SYNTAX;
+			if (k!=0) {for (unsigned i=0; i<8; i++) bs.bits[i]|=k==1?eb.bits[i]:i<4?~eb.bits[i]:0; continue;}
+		} else if (c>=0x80) {
+			const size_t l=c>=0xF0?4:c>=0xE0?3:c>=0xC0?2:1;
+			if (fNeg || pos-1+l>lpat) return RC_SYNTAX;
+			if ((rc=seq(pat+pos-1,l,n))!=RC_OK) return rc; pos+=l-1;
+			if (alt==RX_NIL) alt=n; else if ((rc=node(RXA_ALT,alt,alt,n))!=RC_OK) return rc;
+			if (pos+1<lpat && pat[pos]=='-' && pat[pos+1]!=']') return RC_SYNTAX;
+			continue;
+		}
+		if (pos+1<lpat && pat[pos]=='-' && pat[pos+1]!=']') {
+			byte c2=pat[++pos]; pos++;
+			if (c2=='\\' && parseEscape(eb,c2)!=0 || c2<c || c2>=0x80) return RC_SYNTAX;
+			bs.set(c,c2);
+		} else bs.set(c);
+	}
+	if (fNCase) bs.fold();
+	if (fNeg) return negated(bs,res);
+	if ((rc=cls(bs,n))!=RC_OK) return rc;
+	return alt==RX_NIL?(res=n,RC_OK):node(RXA_ALT,res,n,alt);
+}
+
+/**
+ * parses escape sequence after '\'
+ * returns 0 for a character in c, 1 for a class in bs, 2 for a negated class in bs, -1 for an invalid sequence
+ */
+int RxCompiler::parseEscape(RxBits& bs,byte& c)
+{
+	if (pos>=lpat) return -1;
+	memset(&bs,0,sizeof(RxBits));
+	switch (c=pat[pos++]) {
+	case 'd': case 'D': bs.set('0','9'); return c=='d'?1:2;
+	case 'w': case 'W': bs.set('0','9'); bs.set('A','Z'); bs.set('a','z'); bs.set('_'); return c=='w'?1:2;
+	case 's': case 'S': bs.set('\t','\r'); bs.set(' '); return c=='s'?1:2;
+	case 'n': c='\n'; return 0;
+	case 'r': c='\r'; return 0;
+	case 't': c='\t'; return 0;
+	case 'f': c='\f'; return 0;
+	case 'v': c='\v'; return 0;
+	case 'x':
+		if (pos+2>lpat || !isxdigit(pat[pos]) || !isxdigit(pat[pos+1])) return -1;
+		c=byte((isD(pat[pos])?pat[pos]-'0':(pat[pos]|0x20)-'a'+10)<<4|(isD(pat[pos+1])?pat[pos+1]-'0':(pat[pos+1]|0x20)-'a'+10));
+		pos+=2; return 0;
+	default: return isalnum(c)?-1:0;
+	}
+}
+
+bool RxCompiler::parseNum(unsigned& n)
+{
+	if (pos>=lpat || !isD(pat[pos])) return false;
+	for (n=0; pos<lpat && isD(pat[pos]); pos++) if ((n=n*10+pat[pos]-'0')>RX_INF) return false;
+	return true;
+}
+
+/**
+ * collects literal prefix of the pattern, returns true if the whole subtree is a literal string
+ */
+bool RxCompiler::prefix(uint32_t n,char *buf,size_t& l) const
+{
+	const RxAst& a=ast.v[n];
+	if (a.type==RXA_CAT) return prefix(a.left,buf,l) && prefix(a.right,buf,l);
+	if (a.type!=RXA_CLS || l>=RX_MAX_PREFIX) return false;
+	const RxBits& bs=bits.v[a.cls]; int c=-1;
+	for (unsigned i=0; i<256; i++) if (bs.test(byte(i))) {
+		if (c<0) c=i; else if (!fNCase || (i|0x20)!=unsigned(c|0x20) || unsigned((c|0x20)-'a')>=26u) return false;
+	}
+	if (c<0) return false; buf[l++]=char(fNCase&&unsigned((c|0x20)-'a')<26u?c|0x20:c);
+	return true;
+}
+
+RC RxCompiler::state(byte op,uint32_t& res,uint32_t out,uint32_t out1,uint16_t cls)
+{
+	if (states.n>=RX_MAX_NFA) return RC_TOOBIG;
+	RxState *ps=states.add(); if (ps==NULL) return RC_NORESOURCES;
+	ps->op=op; ps->cls=cls; ps->out=out; ps->out1=out1; res=states.n-1;
+	return RC_OK;
+}
+
+/**
+ * Thompson construction: st - start state of the fragment, pl - list of dangling outs of its states
+ */
+RC RxCompiler::emit(uint32_t n,uint32_t& st,uint32_t& pl)
+{
+	const RxAst a=ast.v[n]; uint32_t s,st2,pl2; RC rc;
+	switch (a.type) {
+	default: assert(0); return RC_INTERNAL;
+	case RXA_CLS:
+		if ((rc=state(RXS_CLASS,s,RX_NIL,RX_NIL,a.cls))!=RC_OK) return rc;
+		st=s; pl=s<<1; return RC_OK;
+	case RXA_BOL: case RXA_EOL: case RXA_EMPTY:
+		if ((rc=state(a.type==RXA_BOL?RXS_BOL:a.type==RXA_EOL?RXS_EOL:RXS_NOP,s))!=RC_OK) return rc;
+		st=s; pl=s<<1; return RC_OK;
+	case RXA_CAT:
+		if ((rc=emit(a.left,st,pl))!=RC_OK || (rc=emit(a.right,st2,pl2))!=RC_OK) return rc;
+		patch(pl,st2); pl=pl2; return RC_OK;
+	case RXA_ALT:
+		if ((rc=emit(a.left,st,pl))!=RC_OK || (rc=emit(a.right,st2,pl2))!=RC_OK || (rc=state(RXS_SPLIT,s,st,st2))!=RC_OK) return rc;
+		st=s; pl=append(pl,pl2); return RC_OK;
+	case RXA_REP:
+		st=pl=RX_NIL;
+		for (unsigned i=0; i<a.min; i++) {
+			if ((rc=emit(a.left,st2,pl2))!=RC_OK) return rc;
+			if (i+1==a.min && a.max==RX_INF) {
+				if ((rc=state(RXS_SPLIT,s,st2))!=RC_OK) return rc;
+				patch(pl2,s); pl2=s<<1|1;
+			}
+			link(st,pl,st2,pl2);
+		}
+		if (a.max==RX_INF) {
+			if (a.min==0) {
+				if ((rc=emit(a.left,st2,pl2))!=RC_OK || (rc=state(RXS_SPLIT,s,st2))!=RC_OK) return rc;
+				patch(pl2,s); link(st,pl,s,s<<1|1);
+			}
+		} else for (unsigned i=a.min; i<a.max; i++) {
+			if ((rc=emit(a.left,st2,pl2))!=RC_OK || (rc=state(RXS_SPLIT,s,st2))!=RC_OK) return rc;
+			link(st,pl,s,append(pl2,s<<1|1));
+		}
+		if (st==RX_NIL) {
+			if ((rc=state(RXS_NOP,s))!=RC_OK) return rc;
+			st=s; pl=s<<1;
+		}
+		return RC_OK;
+	}
+}
+
+/**
+ * finds or adds DFA state for the set of NFA states
+ */
+RC RxCompiler::addState(uint32_t *set,uint32_t n,bool fStart,uint32_t& idx)
+{
+	qsort(set,n,sizeof(uint32_t),cmpStates);
+	uint32_t h=n,*po; for (uint32_t i=0; i<n; i++) h=h*31+set[i];
+	for (h&=RX_HASH_SIZE-1; (idx=htab[h])!=0; h=h+1&RX_HASH_SIZE-1)
+		if (offs.v[idx]-offs.v[idx-1]==n && memcmp(&pool.v[offs.v[idx-1]],set,n*sizeof(uint32_t))==0) {idx--; return RC_OK;}
+	if (dflags.n>=RX_MAX_DFA || pool.n+n>RX_MAX_SET) return RC_TOOBIG;
+	for (uint32_t i=0; i<n; i++) {if ((po=pool.add())==NULL) return RC_NORESOURCES; *po=set[i];}
+	byte *pf=dflags.add(); if (pf==NULL || (po=offs.add())==NULL) return RC_NORESOURCES;
+	*po=pool.n; idx=dflags.n-1; htab[h]=dflags.n;
+	*pf=n==0?RXD_DEAD:0; for (uint32_t i=0; i<n; i++) if (states.v[set[i]].op==RXS_MATCH) {*pf=RXD_MATCH; break;}
+	if (*pf==0 && endMatch(states.v,set,n,tmp,mark,++gen,stk,fStart)) *pf=RXD_MATCHEND;
+	return RC_OK;
+}
+
+/**
+ * DFA construction by subset construction; abandoned if there are too many states
+ */
+RC RxCompiler::buildDFA(uint32_t st,const byte *rep,unsigned nb,uint32_t& dStart0,uint32_t& dStart1)
+{
+	const uint32_t ns=states.n; uint32_t n=0,idx,*po,*set; RC rc;
+	if ((mark=(uint32_t*)ma->malloc(ns*4*sizeof(uint32_t)))==NULL || (htab=(uint32_t*)ma->malloc(RX_HASH_SIZE*sizeof(uint32_t)))==NULL) return RC_NORESOURCES;
+	stk=mark+ns; set=stk+ns; tmp=set+ns; memset(mark,0,ns*sizeof(uint32_t)); memset(htab,0,RX_HASH_SIZE*sizeof(uint32_t));
+	if ((po=offs.add())==NULL) return RC_NORESOURCES; *po=0;
+	closure(states.v,st,set,n,mark,++gen,stk,true,false); if ((rc=addState(set,n,true,dStart0))!=RC_OK) return rc;
+	n=0; closure(states.v,st,set,n,mark,++gen,stk,false,false); if ((rc=addState(set,n,false,dStart1))!=RC_OK) return rc;
+	for (uint32_t d=0; d<dflags.n; d++) for (unsigned k=0; k<nb; k++) {
+		if ((dflags.v[d]&(RXD_MATCH|RXD_DEAD))!=0) idx=d;		// never left
+		else {
+			const uint32_t end=offs.v[d+1]; n=0; ++gen;
+			for (uint32_t i=offs.v[d]; i<end; i++) {
+				const RxState& q=states.v[pool.v[i]];
+				if (q.op==RXS_CLASS && bits.v[q.cls].test(rep[k])) closure(states.v,q.out,set,n,mark,gen,stk,false,false);
+			}
+			closure(states.v,st,set,n,mark,gen,stk,false,false);
+			if ((rc=addState(set,n,false,idx))!=RC_OK) return rc;
+		}
+		uint16_t *pt=trans.add(); if (pt==NULL) return RC_NORESOURCES; *pt=uint16_t(idx);
+	}
+	return RC_OK;
+}
+
+RC RxCompiler::compile(MemAlloc *sm,Regex *&rx)
+{
+	RC rc; uint32_t root,st=RX_NIL,pl,m,dStart0=0,dStart1=0; char pbuf[RX_MAX_PREFIX]; size_t lpref=0;
+	rx=NULL; if ((rc=parseAlt(root))!=RC_OK) return rc; if (pos<lpat) return RC_SYNTAX;
+	const bool fLiteral=prefix(root,pbuf,lpref);
+	byte bmap[256],rep[256]; unsigned nb=1; memset(bmap,0,sizeof(bmap)); rep[0]=0;
+	if (!fLiteral) {
+		if ((rc=emit(root,st,pl))!=RC_OK || (rc=state(RXS_MATCH,m))!=RC_OK) return rc;
+		patch(pl,m);
+		// byte equivalence classes: bytes which are not distinguished by any character class
+		for (uint32_t i=0; i<bits.n; i++) {
+			uint16_t remap[512]; memset(remap,0xFF,sizeof(remap)); nb=0;
+			for (unsigned c=0; c<256; c++) {
+				const unsigned k=bmap[c]<<1|(bits.v[i].test(byte(c))?1:0);
+				if (remap[k]==0xFFFF) {remap[k]=uint16_t(nb); rep[nb++]=byte(c);}
+				bmap[c]=byte(remap[k]);
+			}
+		}
+		if ((rc=buildDFA(st,rep,nb,dStart0,dStart1))==RC_TOOBIG) {dflags.n=trans.n=0; rc=RC_OK;}
+		if (rc!=RC_OK) return rc;
+	}
+	const uint32_t nDFA=dflags.n; const size_t lstates=fLiteral?0:states.n*sizeof(RxState),lbits=fLiteral?0:bits.n*sizeof(RxBits),ldfa=trans.n*sizeof(uint16_t);
+	if ((rx=new(lstates+lbits+ldfa+nDFA+lpat+lpref+1,sm) Regex(sm))==NULL) return RC_NORESOURCES;
+	byte *p=(byte*)(rx+1);
+	rx->states=(RxState*)p; if (lstates!=0) memcpy(p,states.v,lstates); p+=lstates;
+	rx->bits=(RxBits*)p; if (lbits!=0) memcpy(p,bits.v,lbits); p+=lbits;
+	rx->dfa=(uint16_t*)p; if (ldfa!=0) memcpy(p,trans.v,ldfa); p+=ldfa;
+	rx->dflags=p; if (nDFA!=0) memcpy(p,dflags.v,nDFA); p+=nDFA;
+	rx->pattern=(char*)p; memcpy(p,pat,lpat); p[lpat]=0; p+=lpat+1; rx->lPattern=lpat;
+	rx->prefix=(char*)p; memcpy(p,pbuf,lpref); rx->lPrefix=lpref;
+	rx->nStates=fLiteral?0:states.n; rx->start=st; rx->nDFA=nDFA; rx->nBCls=nb; rx->dStart0=uint16_t(dStart0); rx->dStart1=uint16_t(dStart1);
+	rx->fNCase=fNCase; rx->fLiteral=fLiteral; memcpy(rx->bmap,bmap,sizeof(bmap));
+	return RC_OK;
+}
+
+RC Regex::match(const char *s,size_t l,Session *ses) const
+{
+	if (fLiteral) return memFind(s,l,prefix,lPrefix,fNCase)!=NULL?RC_TRUE:RC_FALSE;
+	const byte *p=(const byte*)s,*const e=p+l;
+	if (lPrefix!=0 && (p=(const byte*)memFind(s,l,prefix,lPrefix,fNCase))==NULL) return RC_FALSE;
+	if (nDFA==0) return simulate(p,e,p==(const byte*)s,ses);
+	for (uint32_t d=p==(const byte*)s?dStart0:dStart1;;) {
+		const byte f=dflags[d];
+		if ((f&(RXD_MATCH|RXD_DEAD))!=0) return (f&RXD_MATCH)!=0?RC_TRUE:RC_FALSE;
+		if (p>=e) return (f&RXD_MATCHEND)!=0?RC_TRUE:RC_FALSE;
+		if (d==dStart1 && lPrefix!=0 && (p=(const byte*)memFind((const char*)p,e-p,prefix,lPrefix,fNCase))==NULL) return RC_FALSE;
+		d=dfa[d*nBCls+bmap[*p++]];
+	}
+}
+
+RC Regex::simulate(const byte *p,const byte *const e,bool fStart,Session *ses) const
+{
+	// compiled patterns are shared between sessions, so the state sets live in a per-session buffer reused across matches
+	const size_t lbuf=nStates*5;
+	if (ses->lRxBuf<lbuf) {
+		uint32_t *pb=(uint32_t*)ses->realloc(ses->rxBuf,lbuf*sizeof(uint32_t)); if (pb==NULL) return RC_NORESOURCES;
+		ses->rxBuf=pb; ses->lRxBuf=lbuf;
+	}
+	uint32_t *cur=ses->rxBuf,*nxt=cur+nStates,*const mark=nxt+nStates,*const stk=mark+nStates,*const tmp=stk+nStates;
+	uint32_t gen=1,nc=0,nn; bool fMatch=false; memset(mark,0,nStates*sizeof(uint32_t));
+	for (closure(states,start,cur,nc,mark,gen,stk,fStart,false); ;fStart=false) {
+		for (uint32_t i=0; i<nc; i++) if (states[cur[i]].op==RXS_MATCH) {fMatch=true; break;}
+		if (fMatch || nc==0) break;
+		if (p>=e) {fMatch=endMatch(states,cur,nc,tmp,mark,++gen,stk,fStart); break;}
+		const byte c=*p++; ++gen; nn=0;
+		for (uint32_t i=0; i<nc; i++) {
+			const RxState& q=states[cur[i]];
+			if (q.op==RXS_CLASS && bits[q.cls].test(c)) closure(states,q.out,nxt,nn,mark,gen,stk,false,false);
+		}
+		closure(states,start,nxt,nn,mark,gen,stk,false,false);
+		uint32_t *t=cur; cur=nxt; nxt=t; nc=nn;
+	}
+	return fMatch?RC_TRUE:RC_FALSE;
+}
+
+RC Regex::get(const char *pat,size_t lpat,bool fNCase,const Regex *&rx,bool fConst)
+{
+	Session *ses=Session::getSession(); if (ses==NULL) return RC_NOSESSION;
+	if (fConst) {
+		// constant patterns are compiled once, then found without locking; RC_NOTFOUND: the table is full, use the cache
+		RegexCache& cache=ses->getStore()->queryMgr->rxCache; if ((rx=cache.findConst(RxKey(pat,lpat,fNCase)))!=NULL) return RC_OK;
+		RC rc=cache.addConst(pat,lpat,fNCase,rx,ses); if (rc!=RC_NOTFOUND) return rc;
+	}
+	for (unsigned i=0; i<SES_RX_MEMO; i++) {
+		const Regex *r=ses->rxMemo[i];
+		if (r!=NULL && r->lPattern==lpat && r->fNCase==fNCase && memcmp(r->pattern,pat,lpat)==0) {rx=r; return RC_OK;}
+	}
+	Regex *r; RC rc=ses->getStore()->queryMgr->rxCache.get(pat,lpat,fNCase,r,ses); if (rc!=RC_OK) return rc;
+	Regex *&pr=ses->rxMemo[ses->iRxMemo++%SES_RX_MEMO]; if (pr!=NULL) pr->release(); pr=r; rx=r;
+	return RC_OK;
+}
+
+RegexCache::RegexCache(StoreCtx *ct) : ctx(ct),table(RX_CACHE_SIZE,ct,false),nRegex(0),nConsts(0)
+{
+	memset((void*)consts,0,sizeof(consts));
+}
+
+const Regex *RegexCache::findConst(const RxKey& key) const
+{
+	// open addressing in a table at most half full, entries are published after a barrier and never removed
+	for (unsigned h=uint32_t(key)%(RX_CONST_SIZE*2);;h=(h+1)%(RX_CONST_SIZE*2)) {
+		const Regex *rx=consts[h]; if (rx==NULL || rx->getKey()==key) return rx;
+	}
+}
+
+RC RegexCache::addConst(const char *pat,size_t lpat,bool fNCase,const Regex *&rx,MemAlloc *ma)
+{
+	if (nConsts>=RX_CONST_SIZE) return RC_NOTFOUND;
+	RxKey key(pat,lpat,fNCase); Regex *r; RC rc=get(pat,lpat,fNCase,r,ma); if (rc!=RC_OK) return rc;		// this reference is kept by the table
+	MutexP lck(&lock); unsigned h=uint32_t(key)%(RX_CONST_SIZE*2);
+	for (const Regex *p; (p=consts[h])!=NULL; h=(h+1)%(RX_CONST_SIZE*2))
+		if (p->getKey()==key) {lck.set(NULL); r->release(); rx=p; return RC_OK;}
+	if (nConsts>=RX_CONST_SIZE) {lck.set(NULL); r->release(); return RC_NOTFOUND;}
+	MemoryBarrier(); consts[h]=r; nConsts++; rx=r; return RC_OK;
+}
+
+RC RegexCache::get(const char *pat,size_t lpat,bool fNCase,Regex *&rx,MemAlloc *ma)
+{
+	RxKey key(pat,lpat,fNCase); Regex *old=NULL,*prx; RC rc;
+	{MutexP lck(&lock); if ((rx=table.find(key))!=NULL) {rx->lru.remove(); lruList.insertFirst(&rx->lru); InterlockedIncrement(&rx->refCnt); return RC_OK;}}
+	if ((rc=RxCompiler((const byte*)pat,lpat,fNCase,ma).compile(ctx,rx))!=RC_OK) return rc;
+	MutexP lck(&lock);
+	if ((prx=table.find(key))!=NULL) {old=rx; rx=prx; rx->lru.remove();}		// compiled concurrently
+	else {
+		table.insert(rx);
+		if (++nRegex>RX_CACHE_SIZE && (old=lruList.getLast())!=NULL) {table.remove(old); old->lru.remove(); nRegex--;}
+	}
+	lruList.insertFirst(&rx->lru); InterlockedIncrement(&rx->refCnt);
+	lck.set(NULL); if (old!=NULL) old->release();
+	return RC_OK;
+}
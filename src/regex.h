@@ -0,0 +1,136 @@
+/**************************************************************************************
+
+Copyright © 2004-2012 VMware, Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,  WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations
+under the License.
+
+**************************************************************************************/
+
+/**
+ * regular expressions for OP_REGEX
+ * patterns are compiled to Thompson NFA; DFA is built at compile time if the number of its states is small enough,
+ * otherwise NFA is simulated; both are linear in the length of the string
+ */
+#ifndef _REGEX_H_
+#define _REGEX_H_
+
+#include "utils.h"
+
+namespace AfyKernel
+{
+
+#define	RX_MAX_NFA		4096		/**< maximum number of NFA states in a pattern */
+#define	RX_MAX_DFA		1024		/**< maximum number of DFA states built at compile time */
+#define	RX_CACHE_SIZE	256			/**< maximum number of compiled patterns in the store-wide cache */
+#define	RX_CONST_SIZE	256			/**< maximum number of constant patterns of compiled expressions kept for the store lifetime */
+
+/**
+ * NFA state
+ */
+struct RxState
+{
+	byte		op;
+	uint16_t	cls;
+	uint32_t	out;
+	uint32_t	out1;
+};
+
+/**
+ * set of bytes
+ */
+struct RxBits
+{
+	uint32_t	bits[8];
+	bool	test(byte c) const {return (bits[c>>5]&1u<<(c&31))!=0;}
+	void	set(byte c) {bits[c>>5]|=1u<<(c&31);}
+	void	set(byte from,byte to) {for (unsigned c=from; c<=to; c++) set(byte(c));}
+	void	fold();
+};
+
+/**
+ * compiled pattern cache key
+ */
+struct RxKey
+{
+	const	char	*str;
+	size_t			len;
+	bool			fNCase;
+	RxKey(const char *s,size_t l,bool fNC) : str(s),len(l),fNCase(fNC) {}
+	operator uint32_t() const {uint32_t hash=uint32_t(len)^(fNCase?0x80000000:0); for (size_t i=0; i<len; i++) hash=hash<<1^str[i]; return hash;}
+	bool operator==(const RxKey& key) const {return len==key.len && fNCase==key.fNCase && memcmp(str,key.str,len)==0;}
+};
+
+/**
+ * compiled pattern
+ * shared between sessions, allocated in one block in store heap
+ */
+class Regex
+{
+	friend	class		RegexCache;
+	friend	class		RxCompiler;
+	HChain<Regex>		hash;
+	HChain<Regex>		lru;
+	long	volatile	refCnt;
+	MemAlloc			*const ma;
+	const	char		*pattern;
+	size_t				lPattern;
+	const	char		*prefix;
+	size_t				lPrefix;
+	const	RxState		*states;
+	const	RxBits		*bits;
+	const	uint16_t	*dfa;
+	const	byte		*dflags;
+	uint32_t			nStates;
+	uint32_t			start;
+	uint32_t			nDFA;
+	uint32_t			nBCls;
+	uint16_t			dStart0;
+	uint16_t			dStart1;
+	bool				fNCase;
+	bool				fLiteral;
+	byte				bmap[256];
+	Regex(MemAlloc *m) : hash(this),lru(this),refCnt(1),ma(m) {}
+	void				*operator new(size_t s,size_t lx,MemAlloc *ma) throw() {return ma->malloc(s+lx);}
+	RC					simulate(const byte *p,const byte *const e,bool fStart,class Session *ses) const;
+public:
+	RxKey				getKey() const {return RxKey(pattern,lPattern,fNCase);}
+	RC					match(const char *s,size_t l,class Session *ses) const;			/**< returns RC_TRUE, RC_FALSE or error code */
+	void				release() {if (InterlockedDecrement(&refCnt)==0) ma->free(this);}
+	static	RC			get(const char *pat,size_t lpat,bool fNCase,const Regex *&rx,bool fConst=false);
+};
+
+/**
+ * store-wide cache of compiled patterns with LRU replacement
+ * constant patterns of compiled expressions are kept in a separate table without replacement,
+ * entries are only added (under the lock) and looked up without locking
+ */
+class RegexCache
+{
+	typedef	HashTab<Regex,RxKey,&Regex::hash>	RxHash;
+	class	StoreCtx	*const ctx;
+	RxHash				table;
+	HChain<Regex>		lruList;
+	unsigned			nRegex;
+	Mutex				lock;
+	Regex* volatile		consts[RX_CONST_SIZE*2];
+	unsigned			nConsts;
+public:
+	RegexCache(StoreCtx *ct);
+	RC		get(const char *pat,size_t lpat,bool fNCase,Regex *&rx,MemAlloc *ma);
+	const	Regex	*findConst(const RxKey& key) const;
+	RC		addConst(const char *pat,size_t lpat,bool fNCase,const Regex *&rx,MemAlloc *ma);
+};
+
+};
+
+#endif
@@ -186,6 +186,12 @@ bool RequestQueue::postRequest(Request *req,StoreCtx *ctx,RQType rqt)
 	return true;
 }
 
+void RequestQueue::addThreads(long nThreads,RQType rqt)
+{
+	ThreadGroup& tg=rqt==RQ_IO?reqQ.io:rqt==RQ_HIGHPRTY?reqQ.higher:reqQ.normal; HTHREAD thread;
+	for (long nt=tg.nThreads; nt<nThreads && nt<MAX_THREADS; nt++) if (createThread(callProcessRequests,&tg,thread)!=RC_OK) break;
+}
+
 Request::~Request()
 {
 }
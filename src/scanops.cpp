@@ -86,8 +86,9 @@ PBlock *FullScan::init()
 	state|=QST_BOF|QST_EOF; return NULL;
 }
 
-RC FullScan::next(const PINEx *)
+RC FullScan::advance(const PINEx *)
 {
+	BufStrategyP bsp(qx->ses,&strategy);
 	PBlock *pb=NULL; if ((state&QST_EOF)!=0 || (state&QST_INIT)!=0 && (pb=init())==NULL) return RC_EOF;
 	if (res!=NULL) {
 		if (pb==NULL && !res->pb.isNull() && res->pb->getPageID()==heapPageID) {pb=res->pb; res->pb=NULL;}
@@ -141,6 +142,14 @@ RC FullScan::next(const PINEx *)
 	}
 }
 
+RC FullScan::batch(QBatch& qb)
+{
+	PINEx qr(qx->ses),*pqr=&qr,*const save=res; RC rc=RC_OK; res=pqr;
+	while (qb.nRows<QB_ROWS && (rc=advance())==RC_OK)
+		if ((qb.flt==NULL || qb.flt->check(&pqr,1,qx->ses)) && (rc=qb.add(qr))!=RC_OK) break;
+	res=save; return rc;
+}
+
 RC FullScan::rewind()
 {
 	if (it!=NULL) {if (&it->getPageSet()!=&stx->defHeap) ((PageSet*)&it->getPageSet())->destroy(); qx->ses->free(it);}
@@ -148,14 +157,20 @@ RC FullScan::rewind()
 	stx=&qx->ses->tx; state=state&~QST_EOF|QST_BOF; return RC_OK;
 }
 
+RC FullScan::reset()
+{
+	RC rc=rewind(); if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
 void FullScan::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("fullscan\n",9);
+	buf.fill('\t',level); buf.append("fullscan",8); printStats(buf); buf.append("\n",1);
 }
 
 //-----------------------------------------------------------------------------------------------
 
-ClassScan::ClassScan(QCtx *s,Class *cls,ulong qflags) : QueryOp(s,qflags|QO_UNIQUE|QO_STREAM|QO_IDSORT),scan(NULL)
+ClassScan::ClassScan(QCtx *s,Class *cls,ulong qflags) : QueryOp(s,qflags|QO_UNIQUE|QO_STREAM|QO_IDSORT|QO_SPLIT),scan(NULL)
 {
 	new(&key) SearchKey((uint64_t)(cls->getID()|((qflags&QO_DELETED)!=0?SDEL_FLAG:0)));
 	if (s->ses->getIdentity()!=STORE_OWNER && (cls->getFlags()&CLASS_ACL)!=0) {
@@ -168,7 +183,7 @@ ClassScan::~ClassScan()
 	if (scan!=NULL) scan->destroy();
 }
 
-RC ClassScan::next(const PINEx *skip)
+RC ClassScan::advance(const PINEx *skip)
 {
 	RC rc; if (res!=NULL) {res->cleanup(); *res=PIN::defPID;}
 	if ((state&QST_INIT)!=0) {
@@ -185,6 +200,19 @@ RC ClassScan::next(const PINEx *skip)
 	return RC_EOF;
 }
 
+RC ClassScan::batch(QBatch& qb)
+{
+	if ((state&QST_INIT)!=0 || qb.nProps!=0 || qb.flt!=NULL || scan==NULL) return QueryOp::batch(qb);
+	if ((state&QST_EOF)!=0) return RC_EOF;
+	size_t lData; const byte *er; RC rc; const uint16_t flags=(qflags&QO_CHECKED)!=0?PINEX_ACL_CHKED:0;
+	while (qb.nRows<QB_ROWS) {
+		if ((er=(const byte*)scan->nextValue(lData))==NULL) {state|=QST_EOF; return RC_EOF;}
+		if ((rc=qx->ses->testAbortQ())!=RC_OK) return rc;
+		EncPINRef& ep=qb.refs[qb.nRows]; memcpy(ep.buf,er,ep.lref=(byte)lData); ep.flags=flags; qb.nVals[qb.nRows++]=0;
+	}
+	return RC_OK;
+}
+
 RC ClassScan::rewind()
 {
 	RC rc=(state&QST_INIT)!=0?RC_OK:scan!=NULL?scan->rewind():
@@ -193,6 +221,12 @@ RC ClassScan::rewind()
 	return rc;
 }
 
+RC ClassScan::reset()
+{
+	if (scan!=NULL) {scan->destroy(); scan=NULL;}
+	state=QST_INIT; return RC_OK;
+}
+
 RC ClassScan::count(uint64_t& cnt,ulong nAbort)
 {
 #if 0
@@ -213,18 +247,20 @@ void ClassScan::print(SOutCtx& buf,int level) const
 	URI *uri=(URI*)qx->ses->getStore()->uriMgr->ObjMgr::find((uint32_t)key.v.u); char cbuf[20]; const char *s;
 	if (uri!=NULL&&(s=uri->getName())!=NULL) buf.append(s,strlen(s));
 	else {sprintf(cbuf,"%08X",(uint32_t)key.v.u); buf.append(cbuf,8);}
-	if (uri!=NULL) uri->release(); buf.append("\n",1);
+	if (uri!=NULL) uri->release(); printStats(buf); buf.append("\n",1);
 }
 
 //-----------------------------------------------------------------------------------------------
 
 IndexScan::IndexScan(QCtx *qc,ClassIndex& idx,ulong flg,ulong nr,ulong qf) 
-: QueryOp(qc,qf|QO_STREAM|QO_UNIQUE|QO_REVERSIBLE),index(idx),classID(((Class&)idx).getID()),flags(flg),
-	rangeIdx(0),scan(NULL),pids(NULL),nRanges(nr),vals(NULL)
+: QueryOp(qc,qf|QO_STREAM|QO_UNIQUE|QO_REVERSIBLE|QO_SPLIT),index(idx),classID(((Class&)idx).getID()),flags(flg),
+	rangeIdx(0),scan(NULL),pids(NULL),nRanges(nr),nScans(nr),vals(NULL),condIdx(NULL),cpars(NULL),nCPars(0)
 {
 	if (idx.getNSegs()==1) flags|=idx.getIndexSegs()->flags; if (nRanges==0) flags&=~SCAN_EXACT;
 	sort=(OrderSegQ*)((byte*)(this+1)+nRanges*2*sizeof(SearchKey)); nSegs=index.nSegs; 
-	props=&pl; nProps=1; pl.props=(PropertyID*)(sort+index.nSegs); pl.nProps=0; pl.fFree=false;
+	pl.props=(PropertyID*)(sort+index.nSegs); pl.nProps=0; pl.fFree=false;
+	// properties are published only if they can be served from index keys, QBuildCtx::load() doesn't add LoadOp then
+	if (idx.isCovering()) {props=&pl; nProps=1;}
 	for (unsigned i=0; i<index.nSegs; i++) {
 		const IndexSeg& is=index.indexSegs[i]; OrderSegQ& os=*(OrderSegQ*)&sort[i]; 
 		os.pid=is.propID; os.flags=uint8_t(is.flags)&~ORDER_EXPR; os.var=0; os.aggop=OP_SET; os.lPref=is.lPrefix;
@@ -244,10 +280,113 @@ IndexScan::~IndexScan()
 	index.release();
 }
 
+bool IndexScan::isPoint() const
+{
+	return (flags&SCAN_PREFIX)==0 && nRanges==1 && ((SearchKey*)(this+1))[0].isSet() && ((SearchKey*)(this+1))[1].isSet() 
+		&& ((SearchKey*)(this+1))[0].cmp(((SearchKey*)(this+1))[1])==0;
+}
+
 void IndexScan::initInfo()
 {
-	if ((flags&SCAN_PREFIX)==0 && nRanges==1 && ((SearchKey*)(this+1))[0].isSet() && ((SearchKey*)(this+1))[1].isSet() 
-		&& ((SearchKey*)(this+1))[0].cmp(((SearchKey*)(this+1))[1])==0) {qflags=qflags&~QO_REVERSIBLE|QO_IDSORT|QO_UNIQUE; sort=NULL; nSegs=0;}
+	if (isPoint()) {qflags=qflags&~QO_REVERSIBLE|QO_IDSORT|QO_UNIQUE; sort=NULL; nSegs=0;}
+}
+
+RC IndexScan::getParams(const CondIdx *ci,const Value *cpars,unsigned ncp,const ValueV& pars,IdxParam *iparams,ulong& flags,ulong& nRanges)
+{
+	const Value *param;
+	for (ulong i=0; ci!=NULL; ci=ci->next,++i) {
+		if (ci->param>=ncp || (param=&cpars[ci->param])->type==VT_RANGE && param->varray[0].type==VT_ANY && param->varray[1].type==VT_ANY) {
+			iparams[i].param=NULL; flags&=~SCAN_EXACT;
+		} else if (param->type==VT_ANY) {
+			if ((ci->ks.flags&(ORD_NULLS_BEFORE|ORD_NULLS_AFTER))!=0 && nRanges==0) nRanges=1;
+			iparams[i].param=NULL; flags&=~SCAN_EXACT;
+		} else {
+			if (param->type==VT_VARREF && (param->refV.flags&VAR_TYPE_MASK)==VAR_PARAM) {
+				if (param->length!=0 || param->refV.refN>=pars.nValues) return RC_INVPARAM;
+				param=&pars.vals[param->refV.refN];
+			}
+			iparams[i].param=param; iparams[i].idx=0; ulong nVals=1;
+			if (param->type==VT_ARRAY) nVals=param->length;
+			else if (param->type==VT_COLLECTION) nVals=param->nav->count();
+			if (nVals>1) {
+				if (ci->ks.op!=OP_EQ && ci->ks.op!=OP_IN && ci->ks.op!=OP_BEGINS) return RC_TYPE;
+				flags&=~SCAN_EXACT;
+			}
+			if (nVals>nRanges) nRanges=nVals;
+		}
+	}
+	return RC_OK;
+}
+
+RC IndexScan::setKeys(IdxParam *iparams)
+{
+	const unsigned nSegs=index.getNSegs(); const IndexSeg *const segs=index.getIndexSegs(); SearchKey *const keys=(SearchKey*)(this+1);
+	const Value **curValues=(const Value**)alloca(nSegs*sizeof(Value*)),*cv; RC rc; if (curValues==NULL) return RC_NORESOURCES;
+	for (ulong i=0; i<nRanges; i++) {
+		bool fRange=false; byte op;
+		for (ulong k=0; k<nSegs; k++) if ((cv=curValues[k]=iparams[k].param)!=NULL) {
+			if (cv->type==VT_ARRAY) {
+				if (iparams[k].idx<cv->length) cv=&cv->varray[iparams[k].idx++]; else cv=iparams[k].param=NULL;
+			} else if (cv->type==VT_COLLECTION) {
+				if ((cv=cv->nav->navigate(i==0?GO_FIRST:GO_NEXT))==NULL) iparams[k].param=NULL;
+			}
+			if ((curValues[k]=cv)==NULL) flags&=~SCAN_EXACT;
+			else switch (cv->type) {
+			case VT_RANGE:
+				if (segs[k].op!=OP_IN) return RC_TYPE;
+				fRange=true; flags&=~SCAN_EXACT; break;
+			case VT_EXPR: case VT_STMT: case VT_EXPRTREE: case VT_VARREF:
+				return RC_TYPE;
+			default:
+				op=segs[k].op;
+				if (op!=OP_EQ && op!=OP_IN) {flags&=~SCAN_EXACT; if (op!=OP_BEGINS) fRange=true;}
+				break;
+			}
+		}
+		if ((rc=keys[i*2].toKey(curValues,nSegs,segs,0,qx->ses))!=RC_OK) return rc;
+		if (!fRange) keys[i*2+1].copy(keys[i*2]);
+		else if ((rc=keys[i*2+1].toKey(curValues,nSegs,segs,1,qx->ses))!=RC_OK) return rc;
+	}
+	sortRanges(); return RC_OK;
+}
+
+static int __cdecl cmpRanges(const void *p1,const void *p2)
+{
+	const SearchKey *k1=(const SearchKey*)p1,*k2=(const SearchKey*)p2;
+	return !k1->isSet()?k2->isSet()?-1:0:!k2->isSet()?1:k1->cmp(*k2);
+}
+
+static bool overlap(const SearchKey *prev,const SearchKey *cur,const IndexSeg *segs,unsigned nSegs,ulong flags)
+{
+	int cmp;
+	if (prev[0].isSet() && cur[0].isSet() && prev[0].cmp(cur[0])==0 && (!prev[1].isSet()?!cur[1].isSet():cur[1].isSet() && prev[1].cmp(cur[1])==0)) return true;
+	if (nSegs==1) return (flags&SCAN_PREFIX)==0 && (!prev[1].isSet() || (cmp=prev[1].cmp(cur[0]))>0 || cmp==0 && (flags&(SCAN_EXCLUDE_START|SCAN_EXCLUDE_END))==0);
+	// multi-segment ranges are merged only if they differ in the leading segment
+	if (!prev[0].isSet() || !prev[1].isSet() || !cur[0].isSet() || !cur[1].isSet() || prev[0].type!=KT_VAR || (segs[0].flags&SCAN_PREFIX)!=0) return false;
+	const byte *ps=prev[0].getPtr2(),*pf=prev[1].getPtr2(),*cs=cur[0].getPtr2(),*cf=cur[1].getPtr2();
+	const ushort lps=firstSegLength(ps,prev[0].v.ptr.l),lpf=firstSegLength(pf,prev[1].v.ptr.l),lcs=firstSegLength(cs,cur[0].v.ptr.l),lcf=firstSegLength(cf,cur[1].v.ptr.l);
+	if (lps==0 || lpf==0 || lcs==0 || lcf==0 || prev[0].v.ptr.l-lps!=cur[0].v.ptr.l-lcs || prev[1].v.ptr.l-lpf!=cur[1].v.ptr.l-lcf
+		|| memcmp(ps+lps,cs+lcs,prev[0].v.ptr.l-lps)!=0 || memcmp(pf+lpf,cf+lcf,prev[1].v.ptr.l-lpf)!=0) return false;
+	unsigned nEq=0; cmp=cmpMSegPrefix(pf,prev[1].v.ptr.l,cs,cur[0].v.ptr.l,&nEq);
+	return nEq!=0?(segs[0].flags&(SCAN_EXCLUDE_START|SCAN_EXCLUDE_END))==0:cmp>0;
+}
+
+void IndexScan::sortRanges()
+{
+	// ranges are scanned in index order; duplicate and overlapping ranges are merged (ranges of a multi-segment index
+	// only if they differ in the leading segment), keys of merged ranges are kept at the end of the array and released with the rest
+	SearchKey *const keys=(SearchKey*)(this+1); nScans=nRanges; if (nRanges<2) return;
+	qsort(keys,nRanges,sizeof(SearchKey)*2,cmpRanges); SearchKey tmp[2]; ulong n=1;
+	for (ulong i=1; i<nRanges; i++) {
+		SearchKey *prev=&keys[(n-1)*2],*cur=&keys[i*2];
+		if (overlap(prev,cur,index.getIndexSegs(),index.getNSegs(),flags)) {
+			if (prev[1].isSet() && (!cur[1].isSet() || prev[1].cmp(cur[1])<0)) {memcpy((void*)tmp,&prev[1],sizeof(SearchKey)); memcpy((void*)&prev[1],&cur[1],sizeof(SearchKey)); memcpy((void*)&cur[1],tmp,sizeof(SearchKey));}
+			continue;
+		}
+		if (i!=n) {memcpy((void*)tmp,cur,sizeof(tmp)); memcpy((void*)cur,&keys[n*2],sizeof(tmp)); memcpy((void*)&keys[n*2],tmp,sizeof(tmp));}
+		n++;
+	}
+	nScans=n;
 }
 
 void IndexScan::reverse()
@@ -260,7 +399,7 @@ RC IndexScan::setScan(ulong idx)
 	if (index.fmt.keyType()==KT_ALL) return RC_EOF;
 	if (nRanges==0) scan=index.scan(qx->ses,NULL,NULL,flags);
 	else {
-		rangeIdx=idx; assert(idx<nRanges); const SearchKey *key=&((SearchKey*)(this+1))[idx*2];
+		rangeIdx=idx; assert(idx<nScans); const SearchKey *key=&((SearchKey*)(this+1))[((flags&SCAN_BACKWARDS)!=0?nScans-1-idx:idx)*2];
 		scan=index.scan(qx->ses,key[0].isSet()?key:(const SearchKey*)0,key[1].isSet()?key+1:(const SearchKey*)0,flags,index.getIndexSegs(),index.getNSegs());
 	}
 	return scan!=NULL?RC_OK:RC_NORESOURCES;
@@ -271,12 +410,12 @@ RC IndexScan::init()
 	RC rc=setScan(0);
 	if (rc==RC_OK) while (nSkip>0 && (rc=scan->skip(nSkip))!=RC_OK) {
 		scan->destroy(); scan=NULL;
-		if (rc!=RC_EOF || nRanges==0 || ++rangeIdx>=nRanges || (rc=setScan(rangeIdx))!=RC_OK) {state|=QST_EOF; return rc;}
+		if (rc!=RC_EOF || nScans==0 || ++rangeIdx>=nScans || (rc=setScan(rangeIdx))!=RC_OK) {state|=QST_EOF; return rc;}
 	}
 	return rc==RC_OK?qx->ses->testAbortQ():rc;
 }
 
-RC IndexScan::next(const PINEx *skip)
+RC IndexScan::advance(const PINEx *skip)
 {
 	RC rc; size_t l; const byte *er; if (res!=NULL) res->cleanup();
 	if ((state&QST_INIT)!=0) {
@@ -301,7 +440,29 @@ RC IndexScan::next(const PINEx *skip)
 			}
 			return RC_OK;
 		}
-		if (nRanges==0 || rangeIdx+1>=nRanges) break;
+		if (nScans==0 || rangeIdx+1>=nScans) break;
+		scan->destroy(); if ((rc=setScan(++rangeIdx))!=RC_OK) return rc;
+	}
+	return RC_EOF;
+}
+
+RC IndexScan::batch(QBatch& qb)
+{
+	if ((state&QST_INIT)!=0 || qb.nProps!=0 || qb.flt!=NULL) return QueryOp::batch(qb);
+	size_t l; const byte *er; RC rc; const uint16_t flags=(qflags&QO_CHECKED)!=0?PINEX_ACL_CHKED:0;
+	while (scan!=NULL) {
+		while ((er=(const byte*)scan->nextValue(l))!=NULL) {
+			if ((rc=qx->ses->testAbortQ())!=RC_OK) return rc;
+			if ((qflags&QO_UNIQUE)!=0 && PINRef::isColl(er,l)) {
+				PINEx pex(qx->ses); memcpy(pex.epr.buf,er,pex.epr.lref=(byte)l);
+				if (pids!=NULL) {if ((*pids)[pex]) continue;}
+				else if ((pids=new(qx->ses) PIDStore(qx->ses))==NULL) return RC_NORESOURCES;
+				(*pids)+=pex;
+			}
+			EncPINRef& ep=qb.refs[qb.nRows]; memcpy(ep.buf,er,ep.lref=(byte)l); ep.flags=flags; qb.nVals[qb.nRows]=0;
+			if (++qb.nRows>=QB_ROWS) return RC_OK;
+		}
+		if (nScans==0 || rangeIdx+1>=nScans) break;
 		scan->destroy(); if ((rc=setScan(++rangeIdx))!=RC_OK) return rc;
 	}
 	return RC_EOF;
@@ -316,6 +477,21 @@ RC IndexScan::rewind()
 	return rc;
 }
 
+RC IndexScan::reset()
+{
+	if (pids!=NULL) {delete pids; pids=NULL;} if (scan!=NULL) {scan->destroy(); scan=NULL;}
+	rangeIdx=0; state=QST_INIT; if (cpars==NULL || nRanges==0) return RC_OK;
+	// keys are rebuilt from the current parameter values, the number of ranges and a point lookup must stay the same
+	IdxParam *iparams=(IdxParam*)alloca(index.getNSegs()*sizeof(IdxParam)); if (iparams==NULL) return RC_NORESOURCES;
+	ulong fl=SCAN_EXACT,nr=0; const bool fPoint=isPoint(); RC rc;
+	if ((rc=getParams(condIdx,cpars,nCPars,qx->vals[QV_PARAMS],iparams,fl,nr))!=RC_OK) return rc;
+	if (nr!=nRanges) return RC_TYPE;
+	flags=fl|flags&SCAN_BACKWARDS; if (index.getNSegs()==1) flags|=index.getIndexSegs()->flags;
+	for (ulong i=0; i<nRanges*2; i++) ((SearchKey*)(this+1))[i].free(qx->ses);
+	if ((rc=setKeys(iparams))!=RC_OK) return rc;
+	return fPoint && !isPoint()?RC_TYPE:RC_OK;
+}
+
 RC IndexScan::count(uint64_t& cnt,ulong nAbort)
 {
 	uint64_t c=0; RC rc=RC_EOF; PINEx cb(qx->ses);
@@ -333,7 +509,7 @@ RC IndexScan::count(uint64_t& cnt,ulong nAbort)
 			}
 			if (++c>=nAbort) return RC_TIMEOUT;
 		}
-		scan->destroy(); scan=NULL; if (nRanges==0 || ++rangeIdx>=nRanges) break;
+		scan->destroy(); scan=NULL; if (nScans==0 || ++rangeIdx>=nScans) break;
 		if ((rc=setScan(rangeIdx))!=RC_OK || (rc=qx->ses->testAbortQ())!=RC_OK) break;
 	}
 	cnt=c; return rc;
@@ -342,13 +518,21 @@ RC IndexScan::count(uint64_t& cnt,ulong nAbort)
 RC IndexScan::loadData(PINEx& qr,Value *pv,unsigned nv,ElementID eid,bool fSort,MemAlloc *ma)
 {
 	if (scan==NULL) return RC_NOTFOUND;
+	if (!fSort && (props==NULL || qr.epr.lref!=0 && PINRef::isColl(qr.epr.buf,qr.epr.lref))) {
+		// the key contains a truncated value or one element of a collection, values are read from the PIN
+		RC rc=RC_OK;
+		if ((qr.getState()&(PEX_PAGE|PEX_PROPS))==0) {qr.epr.flags|=PINEX_RLOAD; if ((rc=getBody(qr))!=RC_OK) return rc;}
+		if (pv!=NULL) for (unsigned i=0; i<nv; i++)
+			if ((rc=qr.getValue(pv[i].property,pv[i],LOAD_SSV,ma,eid))==RC_NOTFOUND) rc=RC_OK; else if (rc!=RC_OK) break;
+		return rc;
+	}
 	if (pv==NULL || nv==0) {
 		const IndexSeg *is=index.getIndexSegs(); nv=index.getNSegs();
 		if ((pv=vals)==NULL) {
 			if ((pv=vals=new(qx->ses) Value[nv])==NULL) return RC_NORESOURCES;
 			for (unsigned i=0; i<nv; i++) vals[i].setError(is[i].propID);
 		} else for (unsigned i=0; i<nv; i++) {freeV(vals[i]); vals[i].setError(is[i].propID);}
-		res->setProps(pv,nv);
+		qr.setProps(pv,nv);
 	}
 	return scan->getKey().getValues(pv,nv,index.getIndexSegs(),index.getNSegs(),qx->ses,!fSort,ma);
 }
@@ -362,13 +546,14 @@ void IndexScan::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("index: ",7); buf.renderName(classID); 
 	if ((flags&SCAN_EXCLUDE_START)!=0) buf.append("[<",2); else buf.append("[",1);
-	for (ulong i=0; i<nRanges; i++) {
-		if (i!=0) buf.append("],[",2);
+	for (ulong i=0; i<nScans; i++) {
+		if (i!=0) buf.append("],[",3);
 		printKey(((SearchKey*)(this+1))[i*2],buf,"*",1);
 		buf.append(",",1);
 		printKey(((SearchKey*)(this+1))[i*2+1],buf,"*",1);
 	}
-	if ((flags&SCAN_EXCLUDE_END)!=0) buf.append(">]\n",3); else buf.append("]\n",2);
+	if ((flags&SCAN_EXCLUDE_END)!=0) buf.append(">]",2); else buf.append("]",1);
+	printStats(buf); buf.append("\n",1);
 }
 
 void IndexScan::printKey(const SearchKey& key,SOutCtx& buf,const char *def,size_t ldef) const
@@ -393,7 +578,7 @@ ArrayScan::~ArrayScan()
 {
 }
 
-RC ArrayScan::next(const PINEx *skip)
+RC ArrayScan::advance(const PINEx *skip)
 {
 	if (res!=NULL) {res->cleanup(); res->epr.flags=PINEX_EXTPID;} if (pids==NULL) return RC_EOF;
 	if ((state&QST_INIT)!=0) {
@@ -409,6 +594,11 @@ RC ArrayScan::rewind()
 	idx=0; state=state&~QST_EOF|QST_BOF; return RC_OK;
 }
 
+RC ArrayScan::reset()
+{
+	idx=0; state=QST_INIT; return RC_OK;
+}
+
 RC ArrayScan::count(uint64_t& cnt,ulong)
 {
 	cnt=nPids; return RC_OK;
@@ -416,7 +606,7 @@ RC ArrayScan::count(uint64_t& cnt,ulong)
 
 void ArrayScan::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("array\n",6);
+	buf.fill('\t',level); buf.append("array",5); printStats(buf); buf.append("\n",1);
 }
 
 //------------------------------------------------------------------------------------------------
@@ -434,7 +624,7 @@ FTScan::~FTScan()
 	for (ulong i=0; i<nScans; i++) if (scans[i].scan!=NULL) scans[i].scan->destroy();
 }
 
-RC FTScan::next(const PINEx *skip)
+RC FTScan::advance(const PINEx *skip)
 {
 	if ((state&QST_EOF)!=0) {res->cleanup(); return RC_EOF;}
 	RC rc=RC_OK; if (res!=NULL) {res->epr.lref=0; *res=PIN::defPID;}
@@ -507,9 +697,15 @@ RC FTScan::rewind()
 	return RC_OK;
 }
 
+RC FTScan::reset()
+{
+	for (ulong i=0; i<nScans; i++) if (scans[i].scan!=NULL) scans[i].scan->destroy();
+	nScans=0; freeV(current); current.setError(); state=QST_INIT; return RC_OK;
+}
+
 void FTScan::print(SOutCtx& buf,int level) const
 {
-	buf.fill('\t',level); buf.append("ft scan: ",9); buf.append((char*)word.v.ptr.p,word.v.ptr.l); buf.append("\n",1);
+	buf.fill('\t',level); buf.append("ft scan: ",9); buf.append((char*)word.v.ptr.p,word.v.ptr.l); printStats(buf); buf.append("\n",1);
 }
 
 PhraseFlt::PhraseFlt(QCtx *qc,FTScan *const *fts,ulong ns,ulong qf) : QueryOp(qc,qf|QO_JOIN|QO_IDSORT|QO_UNIQUE),nScans(ns)
@@ -522,7 +718,7 @@ PhraseFlt::~PhraseFlt()
 	for (ulong i=0; i<nScans; i++) delete scans[i].scan;
 }
 
-RC PhraseFlt::next(const PINEx *skip)
+RC PhraseFlt::advance(const PINEx *skip)
 {
 	if ((state&QST_EOF)!=0) {res->cleanup(); return RC_EOF;}
 	RC rc=RC_OK; if (res!=NULL) {res->cleanup(); *res=PIN::defPID;}
@@ -558,6 +754,13 @@ RC PhraseFlt::rewind()
 	return RC_OK;
 }
 
+RC PhraseFlt::reset()
+{
+	RC rc; freeV(current); current.setError();
+	for (ulong i=0; i<nScans; i++) {if ((rc=scans[i].scan->reset())!=RC_OK) return rc; scans[i].state=QOS_ADV;}
+	state=QST_INIT; return RC_OK;
+}
+
 void PhraseFlt::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("phrase: ",8); 
@@ -565,5 +768,267 @@ void PhraseFlt::print(SOutCtx& buf,int level) const
 		//const FTScan *ft=scans[i].scan;
 		//...
 	}
-	buf.append("\n",1);
+	printStats(buf); buf.append("\n",1);
+}
+
+//------------------------------------------------------------------------------------------------
+
+namespace AfyKernel
+{
+	/**
+	 * unit of work of the Exchange operator
+	 * input is an array of heap PageIDs or of encoded PIN references, output - encoded references of PINs passing the filter
+	 */
+	struct XUnit
+	{
+		XUnit		*next;
+		XUnit		*list;
+		RC			rc;
+		bool		fDone;
+		unsigned	nIn;
+		size_t		lIn;
+		byte		*out;
+		size_t		lOut;
+		size_t		xOut;
+		size_t		pos;
+		byte		*in() const {return (byte*)(this+1);}
+		RC			add(const EncPINRef& ep,StoreCtx *ctx) {
+			const size_t l=ep.trunc<8>();
+			if (lOut+l>xOut) {
+				size_t x=xOut==0?XCH_UNIT_REFS*16:xOut*2; byte *p=(byte*)ctx->realloc(out,x);
+				if (p==NULL) return RC_NORESOURCES; out=p; xOut=x;
+			}
+			memcpy(out+lOut,&ep,l); lOut+=l; return RC_OK;
+		}
+	};
+
+	/**
+	 * Exchange worker request
+	 * RequestQueue may skip or drop a request without running it, so a request is either run, cancelled when destroyed
+	 * or detached by Exchange::stop(), whichever happens first; it is referenced by the Exchange and by the queue
+	 */
+	enum XWState {XW_POSTED, XW_RUNNING, XW_DONE, XW_DETACHED};
+
+	class XWorker : public Request
+	{
+		Exchange	*const	xch;
+		StoreCtx	*const	ctx;
+		long	volatile	refCnt;
+	public:
+		long	volatile	wstate;
+		XWorker				*nextW;
+		XWorker(Exchange *x,StoreCtx *ct) : xch(x),ctx(ct),refCnt(2),wstate(XW_POSTED),nextW(NULL) {}
+		void	process() {Session *ses=Session::getSession(); if (ses!=NULL && cas(&wstate,(long)XW_POSTED,(long)XW_RUNNING)) xch->work(ses,this);}
+		void	destroy() {if (cas(&wstate,(long)XW_POSTED,(long)XW_DONE)) xch->finish(this); release();}
+		void	release() {if (InterlockedDecrement(&refCnt)==0) {StoreCtx *ct=ctx; this->~XWorker(); ct->free(this);}}
+	};
+};
+
+Exchange::Exchange(Filter *flt,QueryOp *sc,unsigned nw,ulong qf)
+	: QueryOp(flt,(flt->getQFlags()|qf|QO_ALLPROPS)&~QO_REVERSIBLE),filter(flt),src(sc),ctx(qx->ses->getStore()),nWorkers(nw),fPages((sc->getQFlags()&QO_ALLPROPS)!=0),
+	fOrdered((sc->getQFlags()&QO_IDSORT)!=0||sc->getSort(nSegs)!=NULL),sres(qx->ses),pending(NULL),lastPending(NULL),units(NULL),lastUnit(NULL),cur(NULL),
+	workers(NULL),nUnits(0),nPending(0),nReqs(0),fStop(false),fSrcEOF(false),fThreads(false),strategy(BAS_SCAN)
+{
+	if (fOrdered) sort=flt->getSort(nSegs); else {nSegs=0; qflags&=~QO_IDSORT;}
+	props=flt->getProps(nProps);
+	if (fPages) {FullScan *fs=(FullScan*)src; fs->dirPageID=ctx->theCB->getRoot(fs->fClasses?MA_CLASSDIRFIRST:MA_HEAPDIRFIRST); fs->idx=0;}
+}
+
+Exchange::~Exchange()
+{
+	stop();
+}
+
+void Exchange::connect(PINEx **results,unsigned nRes)
+{
+	if (results!=NULL && nRes==1) res=results[0];
+	if (!fPages) {PINEx *pex=&sres; src->connect(&pex);}
+}
+
+RC Exchange::advance(const PINEx *)
+{
+	BufStrategyP bsp(fPages?qx->ses:(Session*)0,&strategy); RC rc=RC_OK;
+	if ((state&QST_INIT)!=0) {state&=~QST_INIT; if (nSkip>0 && (rc=initSkip())!=RC_OK) return rc;}
+	if ((state&QST_EOF)!=0) return RC_EOF;
+	if (res!=NULL) res->cleanup();
+	for (;;) {
+		if (cur!=NULL) {
+			if ((rc=cur->rc)!=RC_OK) break;
+			if (cur->pos<cur->lOut) {
+				const EncPINRef *ep=(const EncPINRef*)(cur->out+cur->pos); cur->pos+=ep->trunc<8>();
+				if (res==NULL) return RC_OK;
+				*res=PIN::defPID; memcpy(&res->epr,ep,ep->trunc<8>());
+				// the PIN can be deleted after it was filtered by the worker
+				if ((rc=getBody(*res))!=RC_NOTFOUND && rc!=RC_DELETED) {if (rc==RC_OK) return rc; break;}
+				res->cleanup(); continue;
+			}
+			freeUnit(cur); cur=NULL;
+		}
+		if ((rc=qx->ses->testAbortQ())!=RC_OK || (rc=fill())!=RC_OK || (rc=wait())!=RC_OK) break;
+	}
+	state|=QST_EOF; return rc;
+}
+
+RC Exchange::fill()
+{
+	RC rc=RC_OK; bool fNew=false;
+	while (!fSrcEOF && nUnits<nWorkers*XCH_UNITS_PER_THREAD+1) {
+		XUnit *u=(XUnit*)ctx->malloc(sizeof(XUnit)+(fPages?XCH_UNIT_PAGES*sizeof(PageID):XCH_UNIT_REFS*sizeof(EncPINRef)));
+		if (u==NULL) {rc=RC_NORESOURCES; break;}
+		u->next=u->list=NULL; u->rc=RC_OK; u->fDone=false; u->nIn=0; u->lIn=0; u->out=NULL; u->lOut=u->xOut=u->pos=0;
+		if ((rc=fPages?getPages(u):getRefs(u))!=RC_OK || u->nIn==0) {ctx->free(u); break;}
+		MutexP lck(&lock); nUnits++; nPending++; fNew=true;
+		if (lastPending==NULL) pending=u; else lastPending->next=u; lastPending=u;
+		if (lastUnit==NULL) units=u; else lastUnit->list=u; lastUnit=u;
+	}
+	if (fNew) post();
+	return rc;
+}
+
+RC Exchange::getPages(XUnit *u)
+{
+	FullScan *fs=(FullScan*)src; PBlockP pDir; PageID *pages=(PageID*)u->in();
+	while (u->nIn<XCH_UNIT_PAGES) {
+		if (fs->dirPageID==INVALID_PAGEID) {fSrcEOF=true; break;}
+		if ((pDir.isNull()||pDir->getPageID()!=fs->dirPageID) && pDir.getPage(fs->dirPageID,ctx->hdirMgr,QMGR_SCAN,qx->ses)==NULL) {fs->dirPageID=INVALID_PAGEID; return RC_CORRUPTED;}
+		const HeapDirMgr::HeapDirPage *hd=(const HeapDirMgr::HeapDirPage*)pDir->getPageBuf();
+		if (fs->idx>=hd->nSlots) {fs->dirPageID=hd->next; fs->idx=0; continue;}
+		pages[u->nIn++]=((PageID*)(hd+1))[fs->idx++];
+	}
+	return RC_OK;
+}
+
+RC Exchange::getRefs(XUnit *u)
+{
+	RC rc=RC_OK;
+	while (u->nIn<XCH_UNIT_REFS) {
+		if ((rc=src->next())!=RC_OK) {if (rc==RC_EOF) {fSrcEOF=true; rc=RC_OK;} break;}
+		if (sres.epr.lref==0 && (rc=sres.pack())!=RC_OK) break;
+		const size_t l=sres.epr.trunc<8>(); memcpy(u->in()+u->lIn,&sres.epr,l); u->lIn+=l; u->nIn++;
+	}
+	return rc;
+}
+
+void Exchange::post()
+{
+	if (!fThreads) {RequestQueue::addThreads(nWorkers+1); fThreads=true;}
+	// the thread reading the scan processes units itself when it would otherwise wait
+	MutexP lck(&lock);
+	while (nReqs<nWorkers && nReqs+1<nPending) {
+		XWorker *w=new(ctx) XWorker(this,ctx); if (w==NULL) break;
+		if (!RequestQueue::postRequest(w,ctx)) {w->release(); w->release(); break;}
+		w->nextW=workers; workers=w; nReqs++;
+	}
+}
+
+RC Exchange::wait()
+{
+	MutexP lck(&lock);
+	for (XUnit *u,*prev;;) {
+		if ((u=units)==NULL) return RC_EOF;
+		if (!fOrdered) for (prev=NULL; u!=NULL && !u->fDone; u=u->list) prev=u; else prev=NULL;
+		if (u!=NULL && u->fDone) {
+			if (prev==NULL) units=u->list; else prev->list=u->list;
+			if (u==lastUnit) lastUnit=prev; nUnits--; cur=u; return RC_OK;
+		}
+		if ((u=pending)!=NULL) {
+			if ((pending=u->next)==NULL) lastPending=NULL; nPending--;
+			lck.set(NULL); process(u,qx->ses); lck.set(&lock); u->fDone=true;
+		} else
+			done.wait(lock,0);
+	}
+}
+
+void Exchange::work(Session *ses,XWorker *w)
+{
+	// PINs are read with the access rights of the query's session
+	const ulong iid=ses->getIdentity(); ses->setIdentity(qx->ses->getIdentity(),false);
+	BufStrategy bs(BAS_SCAN); BufStrategyP bsp(fPages?ses:(Session*)0,&bs); MutexP lck(&lock);
+	for (XUnit *u; !fStop && (u=pending)!=NULL; ) {
+		if ((pending=u->next)==NULL) lastPending=NULL; nPending--;
+		lck.set(NULL); process(u,ses); lck.set(&lock);
+		u->fDone=true; done.signalAll();
+	}
+	ses->setIdentity(iid,false); lck.set(NULL); finish(w);
+}
+
+void Exchange::finish(XWorker *w)
+{
+	// called once for each posted worker: after it ran or when it was destroyed without running
+	MutexP lck(&lock);
+	for (XWorker **pw=&workers; *pw!=NULL; pw=&(*pw)->nextW) if (*pw==w) {*pw=w->nextW; break;}
+	nReqs--; done.signalAll(); lck.set(NULL); w->release();
+}
+
+void Exchange::process(XUnit *u,Session *ses)
+{
+	PINEx pe(ses),*ppe=&pe; RC rc=RC_OK;
+	if (fPages) {
+		const uint32_t mask=((FullScan*)src)->mask; PBlockP pb; PID id; PageAddr addr;
+		for (unsigned i=0; i<u->nIn && rc==RC_OK; i++) {
+			if (pb.getPage(((PageID*)u->in())[i],ctx->heapMgr,QMGR_SCAN|PGCTL_RLATCH,ses)==NULL) continue;
+			const HeapPageMgr::HeapPage *hp=(const HeapPageMgr::HeapPage*)pb->getPageBuf(); addr.pageID=pb->getPageID();
+			for (unsigned slot=0; slot<hp->nSlots && rc==RC_OK; slot++) {
+				const HeapPageMgr::HeapPIN *hpin=(const HeapPageMgr::HeapPIN *)hp->getObject(hp->getOffset(PageIdx(slot)));
+				if (hpin==NULL || hpin->hdr.getType()!=HO_PIN || (hpin->hdr.descr&mask)!=mask>>16) continue;
+				addr.idx=(PageIdx)slot; if (!hpin->getAddr(id)) {id.pid=OID(addr); id.ident=STORE_OWNER;}
+				pe=id; pe=addr; pe.pb=(PBlock*)pb; pe.hpin=hpin; pe.epr.flags|=PINEX_ADDRSET;
+				if (filter->check(&ppe,1,ses) && (rc=pe.pack())==RC_OK) rc=u->add(pe.epr,ctx);
+				pe.pb=(PBlock*)0; pe.cleanup();
+			}
+		}
+	} else {
+		for (const byte *p=u->in(),*const end=p+u->lIn; p<end && rc==RC_OK; ) {
+			const EncPINRef *ep=(const EncPINRef*)p; p+=ep->trunc<8>();
+			pe.cleanup(); pe=PIN::defPID; memcpy(&pe.epr,ep,ep->trunc<8>());
+			if ((pe.epr.flags&PINEX_ADDRSET)==0) pe=PageAddr::invAddr;
+			if ((rc=ctx->queryMgr->getBody(pe,TVO_READ,0))!=RC_OK) {if (rc==RC_NOTFOUND || rc==RC_DELETED) rc=RC_OK; continue;}
+			if (filter->check(&ppe,1,ses)) rc=u->add(pe.epr,ctx);
+		}
+	}
+	u->rc=rc;
+}
+
+void Exchange::freeUnit(XUnit *u)
+{
+	if (u->out!=NULL) ctx->free(u->out); ctx->free(u);
+}
+
+void Exchange::stop()
+{
+	lock.lock(); fStop=true;
+	// workers which haven't started are detached and skipped, only running ones are waited for; they stop after the current unit
+	for (XWorker **pw=&workers,*w; (w=*pw)!=NULL; )
+		if (!cas(&w->wstate,(long)XW_POSTED,(long)XW_DETACHED)) pw=&w->nextW;
+		else {*pw=w->nextW; w->markSkip(); nReqs--; w->release();}
+	while (nReqs!=0) done.wait(lock,XCH_STOP_WAIT);
+	for (XUnit *u=units,*u2; u!=NULL; u=u2) {u2=u->list; freeUnit(u);}
+	units=lastUnit=pending=lastPending=NULL; nUnits=nPending=0; fStop=false;
+	lock.unlock();
+	if (cur!=NULL) {freeUnit(cur); cur=NULL;}
+}
+
+RC Exchange::rewind()
+{
+	RC rc=RC_OK; stop(); fSrcEOF=false;
+	if (fPages) {FullScan *fs=(FullScan*)src; fs->dirPageID=ctx->theCB->getRoot(fs->fClasses?MA_CLASSDIRFIRST:MA_HEAPDIRFIRST); fs->idx=0;}
+	else rc=src->rewind();
+	if (rc==RC_OK) state=state&~QST_EOF|QST_BOF;
+	return rc;
+}
+
+RC Exchange::reset()
+{
+	RC rc=RC_OK; stop(); fSrcEOF=false; sres.cleanup();
+	if (fPages) {FullScan *fs=(FullScan*)src; fs->dirPageID=ctx->theCB->getRoot(fs->fClasses?MA_CLASSDIRFIRST:MA_HEAPDIRFIRST); fs->idx=0;}
+	else rc=src->reset();
+	if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
+void Exchange::print(SOutCtx& buf,int level) const
+{
+	char cbuf[40]; buf.fill('\t',level); buf.append("exchange: ",10);
+	buf.append(cbuf,sprintf(cbuf,"%u thread(s)%s",nWorkers,fOrdered?", ordered":""));
+	printStats(buf); buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
@@ -78,13 +78,13 @@ void Session::terminateSession()
 
 Session::Session(StoreCtx *ct,MemAlloc *ma)
 	: ctx(ct),mem(ma),txid(INVALID_TXID),txcid(NO_TXCID),txState(TX_NOTRAN),sFlags(0),identity(STORE_INVALID_IDENTITY),
-	list(this),lockReq(this),heldLocks(NULL),latched(new(ma) LatchedPage[INITLATCHED]),nLatched(0),xLatched(INITLATCHED),
+	list(this),lockReq(this),heldLocks(NULL),latched(new(ma) LatchedPage[INITLATCHED]),nLatched(0),xLatched(INITLATCHED),bufStrategy(NULL),nPageGets(0),nPageReads(0),
 	firstLSN(0),undoNextLSN(0),flushLSN(0),sesLSN(0),nLogRecs(0),tx(this),subTxCnt(0),mini(NULL),
 	nTotalIns(0),xHeapPage(INVALID_PAGEID),forcedPage(INVALID_PAGEID),classLocked(RW_NO_LOCK),fAbort(false),
-	txil(0),repl(NULL),itf(0),URIBase(NULL),lURIBaseBuf(0),lURIBase(0),qNames(NULL),nQNames(0),fStdOvr(false),
+	txil(0),repl(NULL),itf(0),URIBase(NULL),lURIBaseBuf(0),lURIBase(0),qNames(NULL),nQNames(0),fStdOvr(false),iRxMemo(0),rxBuf(NULL),lRxBuf(0),
 	iTrace(NULL),traceMode(0),defExpiration(0),allocCtrl(NULL),tzShift(0)
 {
-	extAddr.pageID=INVALID_PAGEID; extAddr.idx=INVALID_INDEX;
+	extAddr.pageID=INVALID_PAGEID; extAddr.idx=INVALID_INDEX; memset(rxMemo,0,sizeof(rxMemo));
 #ifdef WIN32
 	TIME_ZONE_INFORMATION tzInfo; DWORD tzType=GetTimeZoneInformation(&tzInfo);
 	tzShift=int64_t(tzType==TIME_ZONE_ID_STANDARD?tzInfo.Bias+tzInfo.StandardBias:
@@ -115,6 +115,8 @@ void Session::cleanup()
 		if (reuse.ssvPages!=NULL) for (ulong i=0; i<reuse.nSSVPages; i++)
 			ctx->ssvMgr->HeapPageMgr::reuse(reuse.ssvPages[i].pid,reuse.ssvPages[i].space,ctx);
 		reuse.cleanup();
+		for (unsigned i=0; i<SES_RX_MEMO; i++) if (rxMemo[i]!=NULL) {rxMemo[i]->release(); rxMemo[i]=NULL;}
+		if (rxBuf!=NULL) {free(rxBuf); rxBuf=NULL; lRxBuf=0;}
 	}
 }
 
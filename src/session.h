@@ -39,6 +39,7 @@ namespace AfyKernel
 #define	SESSION_START_MEM	0x20000
 #define	STORE_START_MEM		0x4000
 #define	STORE_NEW_MEM		0x20000
+#define	SES_RX_MEMO			4			/**< number of compiled regular expressions held by a session */
 
 /**
  * StoreCtx - main store state descriptor
@@ -324,6 +325,9 @@ class Session : public MemAlloc
 	unsigned		nLatched;
 	unsigned		xLatched;
 	DLList			latchHolderList;
+	class	BufStrategy	*bufStrategy;
+	uint64_t		nPageGets;
+	uint64_t		nPageReads;
 
 	LSN				firstLSN;
 	LSN				undoNextLSN;
@@ -354,6 +358,11 @@ class Session : public MemAlloc
 	unsigned		nQNames;
 	bool			fStdOvr;
 
+	class	Regex	*rxMemo[SES_RX_MEMO];
+	unsigned		iRxMemo;
+	uint32_t		*rxBuf;
+	size_t			lRxBuf;
+
 	AfyDB::ITrace	*iTrace;
 	unsigned		traceMode;
 
@@ -423,6 +432,7 @@ public:
 	bool			hasLatched() const {return nLatched>0;}
 	void			releaseLatches(PageID,PageMgr*,bool fX);
 	RC				releaseAllLatches();
+	class	BufStrategy	*setBufStrategy(class BufStrategy *bs) {class BufStrategy *old=bufStrategy; bufStrategy=bs; return old;}
 
 	RC				pushTx();
 	RC				popTx(bool fCommit,bool fAll);
@@ -450,6 +460,8 @@ public:
 	friend	class	SessionX;
 	friend	class	ThreadGroup;
 	friend	class	BufMgr;
+	friend	class	PBlock;
+	friend	class	QueryOp;
 	friend	class	FSMgr;
 	friend	class	RWLock;
 	friend	class	HeapPageMgr;
@@ -462,6 +474,21 @@ public:
 	friend	class	FullScan;
 	friend	class	Cursor;
 	friend	class	Stmt;
+	friend	class	Regex;
+	friend	struct	PlanLift;
+};
+
+/**
+ * buffer access strategy holder
+ * installs a strategy for page accesses of the session while in scope
+ */
+class BufStrategyP
+{
+	Session				*const	ses;
+	class	BufStrategy	*const	old;
+public:
+	BufStrategyP(Session *s,class BufStrategy *bs) : ses(s),old(s!=NULL?s->setBufStrategy(bs):(class BufStrategy*)0) {}
+	~BufStrategyP() {if (ses!=NULL) ses->setBufStrategy(old);}
 };
 
 /**
@@ -24,12 +24,12 @@ Written by Mark Venguerov and Andrew Skowronski 2004-2012
 #include "parser.h"
 #include "expr.h"
 #include "blob.h"
-#include "fio.h"
+#include "extsort.h"
 
 using namespace AfyKernel;
 
-Sort::Sort(QueryOp *qop,const OrderSegQ *os,unsigned nsgs,ulong qf,unsigned nP,const PropList *pids,unsigned nPids)
-: QueryOp(qop,qf),nPreSorted(nP),fRepeat(false),pinMem(qx->ses),nAllPins(0),idx(0),pins(NULL),lPins(0),esFile(NULL),esRuns(NULL),esOutRun(NULL),nIns(0),curRun(~0u),
+Sort::Sort(QueryOp *qop,const OrderSegQ *os,unsigned nsgs,ulong qf,unsigned nP,const PropList *pids,unsigned nPids,ulong nT)
+: QueryOp(qop,qf),nPreSorted(nP),fRepeat(false),pinMem(qx->ses),nAllPins(0),idx(0),pins(NULL),lPins(0),esFile(NULL),esRuns(NULL),esOutRun(NULL),esTree(NULL),nIns(0),curRun(~0u),nTop(nT),
 	peakSortMem(DEFAULT_QUERY_MEM),maxSortMem(DEFAULT_QUERY_MEM),memUsed(0),nValues(0),index((unsigned*)((byte*)(this+1)+int(nsgs-1)*sizeof(OrderSegQ)+nPids*sizeof(PropList))),
 	nPls(nPids),pls((PropList*)((byte*)(this+1)+int(nsgs-1)*sizeof(OrderSegQ)))
 {
@@ -64,7 +64,19 @@ Sort::~Sort()
 	if (/*nValues>nPropIDs && */(qflags&QO_VCOPIED)!=0) for (unsigned i=0; i<nSegs; i++)
 		if ((sortSegs[i].flags&ORDER_EXPR)!=0) sortSegs[i].expr->destroy();
 	if (pls!=NULL) for (unsigned i=0; i<nPls; i++) if (pls[i].props!=NULL && pls[i].fFree) qx->ses->free(pls[i].props);
-	if (pins!=NULL) qx->ses->free(pins);
+	freePins();
+}
+
+void Sort::freePins()
+{
+	if (pins!=NULL) {
+		if (nTop!=0) for (ulong i=0; i<nAllPins; i++) {
+			Value *pv=(Value*)getValues(pins[i]); for (unsigned k=0; k<nValues; k++) freeV(pv[k]);
+			qx->ses->free(pins[i]);
+		}
+		qx->ses->free(pins); pins=NULL;
+	}
+	lPins=0;
 }
 
 void Sort::connect(PINEx **results,unsigned nRes)
@@ -80,11 +92,6 @@ __forceinline const byte *getSortID(const EncPINRef **ep,byte& lp)
 	lp=(*ep)->lref; return (*ep)->buf;
 }
 
-__forceinline const Value *getValues(const EncPINRef *ep)
-{
-	return (const Value*)((byte*)ep+ep->trunc<8>());		// 8???
-}
-
 __forceinline EncPINRef *Sort::storeSortData(const PINEx& qr,SubAlloc& pinMem)
 {
 	EncPINRef *ep=(EncPINRef*)pinMem.memalign(sizeof(EncPINRef*),qr.epr.trunc<8>()+nValues*sizeof(Value));
@@ -92,6 +99,14 @@ __forceinline EncPINRef *Sort::storeSortData(const PINEx& qr,SubAlloc& pinMem)
 	return ep;
 }
 
+__forceinline void Sort::getRef(const EncPINRef *ep,EncPINRef& er)
+{
+#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
+	if ((((ptrdiff_t)ep)&1)!=0) {er.flags=0; er.lref=byte((ptrdiff_t)ep)>>1; memcpy(er.buf,(byte*)&ep+1,er.lref);} else
+#endif
+	memcpy(&er,ep,ep->trunc<8>());
+}
+
 __forceinline int cmpSort(const EncPINRef *ep1,const EncPINRef *ep2)
 {
 	byte l1,l2; const byte *p1=getSortID(&ep1,l1),*p2=getSortID(&ep2,l2); return l1*l2!=0?PINRef::cmpPIDs(p1,l1,p2,l2):0;
@@ -140,11 +155,13 @@ int Sort::cmp(const EncPINRef *p1,const EncPINRef *p2) const
 
 #define QS_STKSIZ			(8*sizeof(void*)-2)
 #define QS_CUTOFF			8
+#define	SORT_MAX_PARTS		4			/**< maximum number of parts of a run sorted in parallel */
+#define	SORT_MIN_PART		0x1000		/**< minimum number of pins in a part of a run sorted by a worker thread */
 
-void Sort::quickSort(ulong nPins)
+void Sort::quickSort(ulong nPins,ulong first)
 {
 	struct {ulong lwr,upr;} bndstk[QS_STKSIZ]; int stkptr=0;
-	for (ulong lwr=0,upr=nPins-1;;) {
+	for (ulong lwr=first,upr=first+nPins-1;;) {
 		if (upr-lwr+1<=QS_CUTOFF) while (upr>lwr) {
 			ulong max=lwr;
 			for (ulong p=lwr+1; p<=upr; ++p) if (cmp(pins[p],pins[max])>0) max=p;
@@ -178,6 +195,80 @@ void Sort::quickSort(ulong nPins)
 	}
 }
 
+namespace AfyKernel
+{
+	/**
+	 * sources of LoserTree: runs of external sort and sorted parts of a run
+	 */
+	class MergeRuns
+	{
+		const	Sort&	srt;
+	public:
+		MergeRuns(const Sort& s) : srt(s) {}
+		const	EncPINRef	*top(unsigned i) const {return srt.esRuns[i].top();}
+		int		cmp(const EncPINRef *ep1,const EncPINRef *ep2) const {return srt.cmp(ep1,ep2);}
+	};
+	class MergeParts
+	{
+		const	Sort&	srt;
+		const	ulong	*const	cur;
+		const	ulong	*const	end;
+	public:
+		MergeParts(const Sort& s,const ulong *cr,const ulong *e) : srt(s),cur(cr),end(e) {}
+		const	EncPINRef	*top(unsigned i) const {return cur[i]<end[i]?srt.pins[cur[i]]:NULL;}
+		int		cmp(const EncPINRef *ep1,const EncPINRef *ep2) const {return srt.cmp(ep1,ep2);}
+	};
+
+	/**
+	 * sorting of a part of a run by a worker thread
+	 * if the request is not picked up by the time the run is written, the part is sorted by the session thread
+	 */
+	class SortPartReq : public Request
+	{
+		Sort&			srt;
+		const	ulong	first;
+		const	ulong	nPins;
+		long	volatile	refCnt;
+		bool	volatile	fDone;
+		Mutex			lock;
+		Event			done;
+	public:
+		SortPartReq(Sort& s,ulong f,ulong n) : srt(s),first(f),nPins(n),refCnt(2),fDone(false) {}
+		void	process() {srt.quickSort(nPins,first); MutexP lck(&lock); fDone=true; done.signalAll();}
+		void	destroy() {release();}
+		void	release() {if (InterlockedDecrement(&refCnt)==0) {this->~SortPartReq(); free(this,SERVER_HEAP);}}
+		void	wait() {
+			// a finished request has its queue state cleared too, markSkip() is only tried if process() hasn't completed
+			bool fLocal=false;
+			{MutexP lck(&lock); if (!fDone) {if (markSkip()) fLocal=true; else while (!fDone) done.wait(lock,0);}}
+			if (fLocal) srt.quickSort(nPins,first);
+			release();
+		}
+	};
+};
+
+RC Sort::pushTop(ulong& nPins)
+{
+	// pins[0..nPins-2] is a heap with the last kept result on top, the candidate pins[nPins-1] is allocated in pinMem
+	ulong i=nPins-1; const EncPINRef *ep=pins[i];
+	if (i>=nTop) {nPins=i; if (cmp(ep,pins[0])>=0) return RC_OK;}
+	const size_t l=ep->trunc<8>(); EncPINRef *cp=(EncPINRef*)qx->ses->malloc(l+nValues*sizeof(Value)); if (cp==NULL) return RC_NORESOURCES;
+	memcpy(cp,ep,l); const Value *pv=getValues(ep); Value *cv=(Value*)getValues(cp);
+	for (unsigned k=0; k<nValues; k++) if (copyV(pv[k],cv[k],qx->ses)!=RC_OK) {while (k!=0) freeV(cv[--k]); qx->ses->free(cp); return RC_NORESOURCES;}
+	if (i<nTop) {
+		for (ulong j; i!=0 && cmp(pins[j=(i-1)/2],cp)<0; i=j) pins[i]=pins[j];
+		nAllPins=nPins;
+	} else {
+		cv=(Value*)getValues(pins[0]); for (unsigned k=0; k<nValues; k++) freeV(cv[k]); qx->ses->free(pins[0]);
+		for (ulong j=i=0; (j=i*2+1)<nTop; i=j) {
+			if (j+1<nTop && cmp(pins[j+1],pins[j])>0) j++;
+			if (cmp(pins[j],cp)<=0) break;
+			pins[i]=pins[j];
+		}
+	}
+	pins[i]=cp; return RC_OK;
+}
+
 namespace AfyKernel
 {
 	struct ArrayVal {ArrayVal *prev; INav *nav; Value *vals; unsigned length,idx,vidx; ushort lPref;};
@@ -186,11 +277,15 @@ namespace AfyKernel
 RC Sort::sort(ulong nAbort)
 {
 	assert(queryOp!=NULL && pins==NULL && esRuns==NULL);
-	PINEx qr(qx->ses); RC rc=RC_OK,rc2; ulong nRunPins=0; nAllPins=0; ArrayVal *freeAV=NULL;
+	PINEx qr(qx->ses); RC rc=RC_OK,rc2; ulong nRunPins=0; nAllPins=0; ArrayVal *freeAV=NULL; SubAlloc::SubMark mrk0;
+	// top-N results are kept in a heap which must fit in memory; repeating results are not removed in this mode
+	if (nTop!=0 && ((qflags&QO_VUNIQUE)!=0 || (qflags&QO_UNIQUE)!=0 && (queryOp->getQFlags()&QO_UNIQUE)==0
+		|| nTop*(sizeof(EncPINRef*)+sizeof(EncPINRef)+nValues*sizeof(Value))>maxSortMem)) nTop=0;
+	if (nTop!=0) {if ((pins=(EncPINRef**)qx->ses->malloc((lPins=nTop+1)*sizeof(EncPINRef*)))==NULL) return RC_NORESOURCES; pinMem.mark(mrk0);}
 	unsigned nqr=queryOp->getNOuts(); PINEx **pqr=(PINEx**)alloca(nqr*sizeof(PINEx*)); if (pqr==NULL) return RC_NORESOURCES;
 	for (unsigned i=1; i<nqr; i++) if ((pqr[i]=new(qx->ses) PINEx(qx->ses))==NULL) return RC_NORESOURCES;
-	pqr[0]=&qr; queryOp->connect(pqr,nqr);
-	for (; ((rc=queryOp->next())==RC_OK || rc==RC_EOF); qr.cleanup()) {
+	pqr[0]=&qr; queryOp->connect(pqr,nqr); QBatch qb(qx->ses); const bool fBatch=nqr==1 && nValues==0;
+	for (; ((rc=fBatch?qb.next(queryOp,qr):queryOp->next())==RC_OK || rc==RC_EOF); qr.cleanup()) {
 		if ((rc2=qx->ses->testAbortQ())!=RC_OK) {rc=rc2; break;}
 		if (rc==RC_OK) {
 			if (qr.epr.lref==0 && qr.getPID().pid!=STORE_INVALID_PID && (rc2=qr.pack())!=RC_OK) {rc=rc2; break;}
@@ -199,8 +294,13 @@ RC Sort::sort(ulong nAbort)
 			}
 			if (nAllPins+nRunPins+1>nAbort) {rc=RC_TIMEOUT; break;}				// after repeating are deleted?
 		}
-		if (rc==RC_EOF || memUsed>peakSortMem || (nRunPins+1)*(sizeof(EncPINRef*)+sizeof(EncPINRef)+nValues*sizeof(Value))>maxSortMem) {	//?????
-			if (nRunPins>=2) {
+		if (nTop!=0) {
+			if (rc==RC_EOF) {if (nRunPins>=2) quickSort(nRunPins); pinMem.release(); break;}
+			if (pinMem.length(mrk0)>maxSortMem) {pinMem.release(); pinMem.mark(mrk0); freeAV=NULL;}	// candidates which didn't get into the heap
+		} else if (rc==RC_EOF || memUsed>peakSortMem || (nRunPins+1)*(sizeof(EncPINRef*)+sizeof(EncPINRef)+nValues*sizeof(Value))>maxSortMem) {	//?????
+			// spilled runs without removal of repeating results are sorted by parts in parallel in writeRun()
+			const bool fPar=(rc!=RC_EOF || nAllPins!=0) && (qflags&(QO_UNIQUE|QO_VUNIQUE))==0;
+			if (nRunPins>=2 && !fPar) {
 				fRepeat=false; quickSort(nRunPins);
 				if (fRepeat) {
 					for (ulong i=0,j=1,cnt=nRunPins; j<cnt; j++) {
@@ -212,10 +312,10 @@ RC Sort::sort(ulong nAbort)
 			}
 			nAllPins+=nRunPins;
 			if (rc==RC_EOF) {
-				if (nAllPins>nRunPins && (rc=writeRun(nRunPins,memUsed))==RC_OK) rc=RC_EOF;
+				if (nAllPins>nRunPins && (rc=writeRun(nRunPins,memUsed,fPar))==RC_OK) rc=RC_EOF;
 				break;
 			}
-			if ((rc=writeRun(nRunPins,memUsed))!=RC_OK) break;
+			if ((rc=writeRun(nRunPins,memUsed,fPar))!=RC_OK) break;
 			nRunPins=0; pinMem.release();		// better, reset() (without mem deallocation)
 		}
 		if (nRunPins>=lPins) {
@@ -223,13 +323,14 @@ RC Sort::sort(ulong nAbort)
 			if ((pins=(EncPINRef**)qx->ses->realloc(pins,lPins*sizeof(EncPINRef*)))!=NULL) memUsed+=(lPins-nRunPins)*sizeof(byte*); else {rc=RC_NORESOURCES; break;}
 		}
 #if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-		if (nValues==0 && qr.epr.lref<sizeof(EncPINRef*) && qr.epr.flags==0)
+		if (nTop==0 && nValues==0 && qr.epr.lref<sizeof(EncPINRef*) && qr.epr.flags==0)
 			{byte *p=(byte*)&pins[nRunPins++]; p[0]=qr.epr.lref<<1|1; memcpy(p+1,qr.epr.buf,qr.epr.lref); continue;}
 #endif
 
 		SubAlloc::SubMark mrk; pinMem.mark(mrk);
 		EncPINRef *ep=storeSortData(qr,pinMem); if (ep==NULL) {rc=RC_NORESOURCES; break;}
-		pins[nRunPins++]=ep; if (nValues==0) {memUsed+=pinMem.length(mrk); continue;}
+		pins[nRunPins++]=ep;
+		if (nValues==0) {if (nTop==0) memUsed+=pinMem.length(mrk); else if ((rc=pushTop(nRunPins))!=RC_OK) break; continue;}
 
 		Value *vals=(Value*)getValues(ep);
 		if (nPls!=0 && (rc=getData(pqr,nqr,pls,nPls,vals,&pinMem))!=RC_OK) break;
@@ -272,7 +373,8 @@ RC Sort::sort(ulong nAbort)
 		}
 		if (rc!=RC_OK) break;
 		if (fSkip) {pinMem.truncate(mrk); nRunPins--;}
-		else if (avs==NULL) memUsed+=pinMem.length(mrk);
+		else if (nTop!=0 && (rc=pushTop(nRunPins))!=RC_OK) break;
+		else if (avs==NULL) {if (nTop==0) memUsed+=pinMem.length(mrk);}
 		else {
 			// changeFColl();
 			for (;;) {
@@ -298,9 +400,11 @@ RC Sort::sort(ulong nAbort)
 					if ((pins=(EncPINRef**)qx->ses->realloc(pins,lPins*sizeof(EncPINRef*)))!=NULL) memUsed+=(lPins-nRunPins)*sizeof(byte*); else {rc=RC_NORESOURCES; break;}
 				}
 				pins[nRunPins++]=ep;
-				if (memUsed>peakSortMem || nRunPins*(sizeof(EncPINRef*)+sizeof(EncPINRef)+nValues*sizeof(Value))>maxSortMem) {
-					if (nRunPins>=2) quickSort(nRunPins); assert((qflags&QO_UNIQUE)==0);
-					nAllPins+=nRunPins; fRepeat=false; if ((rc=writeRun(nRunPins,memUsed))!=RC_OK) break;
+				if (nTop!=0) {if ((rc=pushTop(nRunPins))!=RC_OK) break;}
+				else if (memUsed>peakSortMem || nRunPins*(sizeof(EncPINRef*)+sizeof(EncPINRef)+nValues*sizeof(Value))>maxSortMem) {
+					const bool fPar=(qflags&QO_VUNIQUE)==0; assert((qflags&QO_UNIQUE)==0);
+					if (nRunPins>=2 && !fPar) quickSort(nRunPins);
+					nAllPins+=nRunPins; fRepeat=false; if ((rc=writeRun(nRunPins,memUsed,fPar))!=RC_OK) break;
 					nRunPins=0; pinMem.release();		// vals ???????????
 				}
 			}
@@ -310,357 +414,11 @@ RC Sort::sort(ulong nAbort)
 	}
 	//delete queryOp; const_cast<QueryOp*&>(this->queryOp)=NULL;
 	for (unsigned i=1; i<nqr; i++) {pqr[i]->~PINEx(); qx->ses->free((void*)pqr[i]);}
-	if (rc==RC_EOF && (nAllPins<=nRunPins||(rc=prepMerge())==RC_OK||rc==RC_EOF)) {rc=RC_OK; idx=0;} else {nAllPins=0; pinMem.release();}
+	if (rc==RC_EOF && (nAllPins<=nRunPins||(rc=prepMerge())==RC_OK||rc==RC_EOF)) {rc=RC_OK; idx=0;}
+	else {if (nTop!=0) freePins(); nAllPins=0; pinMem.release();}
 	return rc;
 }
 
-namespace AfyKernel
-{
-
-typedef	uint32_t		RunID;
-#define INVALID_RUN		RunID(~0u)
-#define EXTENT_ALLOC	0x40
-#define TESTES			0
-
-struct ExtSortPageHdr 
-{
-	uint32_t	nItems;		//Number of pins
-	uint32_t	bufEnd;		//End of buffer for backward scanning
-	RunID run;				//Sanity check
-};
-
-class ExtSortFile 
-{
-	friend class OutRun;
-	friend class InRun;
-	struct ExtSortPage {
-		PageID	next;	// next in run or empty list
-		PageID	prev;	// previous in run or empty
-	};
-	struct RunInfo {
-		PageID	head;
-		PageID	pos;	  // current
-		PageID	tail;  
-		RunInfo() : head(INVALID_PAGEID),pos(INVALID_PAGEID),tail(INVALID_PAGEID) {}
-	};
-	Session		*const	ses;
-	FileID		fid;
-	ExtSortPage	*pages;
-	ulong		nPages; // Currently allocated in file
-	RunInfo		*runs;
-	ulong		nRuns;
-	ulong		xRuns;
-	PageID		freeList;
-
-public:
-	ExtSortFile(Session *s) : ses(s),fid(INVALID_FILEID),pages(NULL),nPages(0),
-						runs(NULL),nRuns(0),xRuns(0),freeList(INVALID_PAGEID) {}
-	~ExtSortFile() {
-		if (pages!=NULL) ses->free(pages);
-		if (runs!=NULL) ses->free(runs);	
-		if (fid!=INVALID_FILEID) ses->getStore()->fileMgr->close(fid);
-	}
-
-	RunID beginRun() {
-		if (nRuns>=xRuns && (runs=(RunInfo*)ses->realloc(runs,sizeof(RunInfo)*(xRuns+=xRuns==0?16:xRuns/2)))==NULL) return INVALID_RUN;
-		runs[nRuns].head=runs[nRuns].tail=runs[nRuns].pos=INVALID_PAGEID; return nRuns++;
-	}
-
-	RC writePage(RunID runid,byte *pageBuf) {
-		if (runid>=nRuns) return RC_INVPARAM;
-		if (fid==INVALID_FILEID) {
-			RC rc=ses->getStore()->fileMgr->open(fid,NULL,FIO_TEMP);
-			if (rc!=RC_OK) {report(MSG_ERROR,"Failure to create external sort file (%d)\n",rc); return rc;}
-		}
-		PageID pos=getFreePage(); if (pos==INVALID_PAGEID) return RC_NORESOURCES;
-		assert(pages[pos].next==INVALID_PAGEID);
-
-		// encrypt page!!!
-		RC rc=ses->getStore()->fileMgr->io(FIO_WRITE,::PageIDFromPageNum(fid,pos),pageBuf,pageLen());  
-		if (rc!=RC_OK) {
-			report(MSG_ERROR,"Failure to write page %x to external sort file (%d)\n",pos,rc); releasePage(pos);
-		} else {
-			PageID oldTail=runs[runid].tail;
-			if(oldTail==INVALID_PAGEID) {
-				assert(runs[runid].head==INVALID_PAGEID);
-				runs[runid].head=runs[runid].pos=runs[runid].tail=pos;
-			} else {
-				assert(pages[oldTail].next==INVALID_PAGEID);
-				assert(runs[runid].head!=INVALID_PAGEID);
-				pages[oldTail].next=pos; runs[runid].tail=pos;
-			}
-		}
-		check();
-		return rc;
-	}
-	RC readPage(RunID runid, byte* buf, bool bRelease=false) {
-		if(buf==NULL) return RC_INVPARAM;
-		if(runid>=nRuns || runs[runid].pos==INVALID_PAGEID) return RC_NOTFOUND;
-		RC rc; PageID nextInRun=runs[runid].pos;
-		if ((rc=ses->getStore()->fileMgr->io(FIO_READ,::PageIDFromPageNum(fid,nextInRun),buf,pageLen()))==RC_OK) {
-			runs[runid].pos=pages[nextInRun].next;
-			if (bRelease) {runs[runid].head=runs[runid].pos; releasePage(nextInRun);} // when no rewind needed
-			// decrypt page!!!
-		}
-		check();
-		return rc;
-	}
-	// Return run pages to empty list
-	RC releaseRun(RunID runid) {	
-		for (PageID pos=runs[runid].head,next; pos!=INVALID_PAGEID; pos=next) {next=pages[pos].next; releasePage(pos);}
-		return RC_OK;
-	}
-	RC rewind(RunID runid) {
-		if(runid>=nRuns) return RC_INVPARAM;
-		runs[runid].pos=runs[runid].head;
-		return RC_OK;
-	}
-
-	size_t pageLen() const {return ses->getStore()->fileMgr->getPageSize();}
-	ulong runCount() const {return nRuns;}
-
-	void check(bool bPrintStats=false) {
-#ifdef _DEBUG
-		if (fid==INVALID_FILEID) {
-			assert(freeList==INVALID_PAGEID);
-		} else {
-			assert(nPages==(ulong)ses->getStore()->fileMgr->getFileSize(fid)/pageLen());
-			assert(pages!=NULL);
-			ulong cntFree=0; 
-			for (PageID iter=freeList; iter!=INVALID_PAGEID; iter=pages[iter].next) cntFree++;
-            assert(xRuns>=nRuns);
-			ulong cnt=cntFree; ulong cntEmpty=0;
-			for (ulong i=0; i<nRuns; i++) {
-				PageID iter=runs[i].head;
-				if (iter==INVALID_PAGEID) cntEmpty++;
-				else for (;iter!=INVALID_PAGEID; iter=pages[iter].next) cnt++;
-			}
-			if(bPrintStats) report(MSG_DEBUG,"External sort: Alloc Pages 0x%x, Free Pages 0x%x Runs 0x%x Empty Runs 0x%x\n",nPages,cntFree,nRuns,cntEmpty);
-			assert(nPages==cnt);
-		}
-#endif
-	}
-	void	operator	delete(void *p) {if (p!=NULL) ((ExtSortFile*)p)->ses->free(p);}
-
-private:
-	PageID getFreePage() {
-		if (freeList==INVALID_PAGEID) growFile();
-		if (freeList==INVALID_PAGEID) return INVALID_PAGEID;
-		PageID free=freeList;
-		freeList=pages[freeList].next;
-		pages[free].next=INVALID_PAGEID;
-		return free;
-	}
-
-	void releasePage(PageID c) {
-		assert(c<nPages); assert(c!=INVALID_PAGEID);
-		pages[c].next=freeList; freeList=c;
-	}
-
-	void growFile() {
-		assert(freeList==INVALID_PAGEID); // Only grow if all full
-		off64_t addr; RC rc;
-		if ((rc=ses->getStore()->fileMgr->allocateExtent(fid,EXTENT_ALLOC,addr))!=RC_OK)
-			{report(MSG_ERROR,"Cannot grow file for external sort (%d)\n",rc); return; }
-		ulong curPageCnt=nPages; nPages+=EXTENT_ALLOC;
-		pages=(ExtSortPage*)ses->realloc(pages,nPages*sizeof(ExtSortPage));
-		for (ulong i=curPageCnt; i<nPages-1; i++) pages[i].next=i+1;
-		pages[nPages-1].next=INVALID_PAGEID; freeList=curPageCnt;
-	}
-};
-
-class OutRun
-{
-	// Assist in writing a sorted series of pins into ExtSortFile
-	ExtSortFile		*esFile;
-	byte			*page;     
-	size_t			pagePos;
-	ExtSortPageHdr	*hdr;
-	unsigned		nValues;
-	ulong			nRunPins;
-public:
-	OutRun(ExtSortFile *es,unsigned nVals) : esFile(es),page(NULL),hdr(NULL),nValues(nVals),nRunPins(0) {
-		page=(byte*)es->ses->malloc(esFile->pageLen()); hdr=(ExtSortPageHdr*)page;
-	}
-	~OutRun() {
-		if (page!=NULL) esFile->ses->free(page);
-	}
-
-	RC beginRun() {
-		if (page==NULL) return RC_NORESOURCES;
-		hdr->run=esFile->beginRun(); hdr->nItems=0;
-		pagePos=sizeof(ExtSortPageHdr);
-		nRunPins=0;
-		return RC_OK;
-	}
-
-	RC add(const EncPINRef *ep) {
-		// Get buffer to fill in
-		const size_t lHdr=sizeof(uint16_t)+1+
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-			((((ptrdiff_t)ep)&1)!=0?byte((ptrdiff_t)ep)>>1:ep->lref);
-#else
-			ep->lref;
-#endif
-		size_t pinlen=lHdr,pageLen=esFile->pageLen();
-		if (nValues!=0) {
-			const Value *pv=getValues(ep);
-			for (ulong i=0; i<nValues; i++,pv++) pinlen+=AfyKernel::serSize(*pv);
-		}
-		size_t oldLen=afy_len32(pinlen); pinlen+=oldLen;
-		size_t newLen=afy_len32(pinlen); pinlen+=newLen-oldLen;
-
-		if (pinlen+pagePos>pageLen) {
-			if (hdr->nItems==0) {report(MSG_ERROR,"Single sort key too large (%u) for external sort\n",pinlen); return RC_NORESOURCES;}
-#if TESTES
-			report(MSG_DEBUG,"Write page, run %x, %x pins\n",hdr->run,hdr->nItems);
-#endif
-			RC rc = esFile->writePage(hdr->run,page); if (rc!=RC_OK) return rc;
-			// Start next page
-			pagePos = sizeof(ExtSortPageHdr); hdr->nItems=0;
-#ifdef _DEBUG
-			memset(page+pagePos,0xCD,pageLen-pagePos);
-#endif
-		}
-
-		// serialize pin
-		byte *ps=page+pagePos; afy_enc32(ps,pinlen);
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-		if ((((ptrdiff_t)ep)&1)!=0) {
-			*(uint16_t*)ps=0; ps[sizeof(uint16_t)]=byte((ptrdiff_t)ep)>>1; memcpy(ps+sizeof(uint16_t)+1,(byte*)&ep+1,ps[sizeof(uint16_t)]);
-		} else
-#endif
-		memcpy(ps,ep,lHdr); ps+=lHdr;
-
-		// Values 
-		if (nValues!=0) {
-			const Value *pv=getValues(ep);
-			for (ulong i=0; i<nValues; i++,pv++) ps=AfyKernel::serialize(*pv,ps);
-		}
-
-		hdr->nItems++; nRunPins++; pagePos=ulong(ps-page);
-		return RC_OK;
-	}
-
-	RC term()
-	{
-		if (hdr->nItems>0) { 
-			esFile->writePage(hdr->run,page); 
-#if TESTES
-			report(MSG_DEBUG,"Write last run page, run %x, %x pins, total %x\n",hdr->run,hdr->nItems,nRunPins);	
-#endif
-		}
-		return RC_OK;
-	}
-	void	operator	delete(void *p) {if (p!=NULL) ((OutRun*)p)->esFile->ses->free(p);}
-};
-
-class InRun
-{
-	// Assist in reading a run from disk
-	ExtSortFile			*esFile;
-	RunID				runid;
-	Sort				*sort;
-	ulong				remItems; 
-	const	byte		*page;     // Current page of run
-	const	byte		*pos;		
-	bool				bTemp;
-	EncPINRef			*ep;
-	byte				*buf;
-
-public:
-	// if new,delete created
-	InRun() : esFile(NULL),runid(INVALID_RUN),sort(NULL),remItems(0),page(NULL),pos(NULL),bTemp(false),ep(NULL),buf(NULL) {}
-
-	~InRun() {term(); if (buf!=NULL) sort->qx->ses->free(buf);}
-
-	RC init(ExtSortFile *es,Sort *s) {
-		esFile=es; sort=s;
-		buf=(byte*)s->qx->ses->memalign(sizeof(EncPINRef*),sizeof(EncPINRef)+s->nValues*sizeof(Value));
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-		assert((((ptrdiff_t)buf)&1)==0);
-#endif
-		return buf!=NULL&&(page=(byte*)s->qx->ses->malloc(esFile->pageLen()))!=NULL?RC_OK:RC_NORESOURCES;
-	}
-	void setRun(RunID r, bool bTempRun) {
-		// Can change run
-		runid=r; remItems=0; pos=NULL;
-		bTemp=bTempRun; 
-		ep=NULL;
-		next();
-	}
-	RC rewind() {
-		assert(!bTemp);
-		ep=NULL; remItems=0; pos=NULL;
-		esFile->rewind(runid);
-		return RC_OK;
-	}
-	void term() {
-		if (ep!=NULL) {
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-			if ((((ptrdiff_t)ep)&1)==0)
-#endif
-			{
-				Value *pv=(Value*)getValues(ep);
-				for (unsigned i=0; i<sort->nValues; i++) freeV(pv[i]);
-			}
-			ep=NULL;
-		}
-		if (page!=NULL) sort->qx->ses->free((byte*)page);
-	}
-
-	bool next() {
-		RC rc=RC_OK;
-		if (remItems==0) {
-			if (esFile->readPage(runid,(byte*)page,bTemp)==RC_OK) {
-				pos=page;
-				ExtSortPageHdr *pageHdr=(ExtSortPageHdr*)page;
-				assert(pageHdr->run==runid);
-				remItems=pageHdr->nItems;
-				pos+=sizeof(ExtSortPageHdr);
-#if TESTES
-				report(MSG_DEBUG,"Read page, run %x, %x pins\n",runid,pageHdr->nItems);
-#endif
-			} else {
-				if (ep!=NULL) {
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-					if ((((ptrdiff_t)ep)&1)==0)
-#endif
-					{
-						Value *pv=(Value*)getValues(ep);
-						for (unsigned i=0; i<sort->nValues; i++) freeV(pv[i]);
-					}
-					ep=NULL;
-				}
-				pos=NULL; return false;
-			}
-		}
-		assert(page!=NULL);
-		assert((ulong)(pos-page)<esFile->pageLen());
-
-		const byte *end=pos; size_t len; afy_dec32(pos,len); end+=len; assert((ulong)(end-page)<=esFile->pageLen());
-		const EncPINRef *hdr=(const EncPINRef *)pos; pos+=sizeof(uint16_t)+1+hdr->lref; assert((ulong)(pos-page)<=esFile->pageLen());
-
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-		if (sort->nValues==0 && hdr->lref<sizeof(EncPINRef*) && hdr->flags==0)		// flags alignment???
-			{byte *p=(byte*)&ep; p[0]=hdr->lref<<1|1; memcpy(p+1,hdr->buf,hdr->lref);} else
-#endif
-		{
-			ep=(EncPINRef*)buf; memcpy(ep,hdr,sizeof(uint16_t)+1+hdr->lref);
-			Value *pv=(Value*)getValues(ep);
-			for (unsigned i=0; i<sort->nValues; i++,pv++)
-				if ((rc=AfyKernel::deserialize(*pv,pos,end,sort->qx->ses,false))!=RC_OK) break;
-		}
-		pos=end; remItems--;
-		return rc==RC_OK;
-	}
-	const EncPINRef *top() {return ep;} // current item in run
-	void *operator new[](size_t s,Session *ses) throw() {return ses->malloc(s);}
-	void operator delete[](void *p) {free(p,SES_HEAP);}
-};
-
-}
-
 RC Sort::prepMerge() {
 	RC rc; ulong r; ulong nTtlRuns=esFile->runCount(); assert(nTtlRuns>0);
 	assert(esFile!=NULL && esRuns==NULL && esOutRun!=NULL);
@@ -669,61 +427,44 @@ RC Sort::prepMerge() {
 	qx->ses->free(pins); pins=NULL; pinMem.release(); //Not needed for ext sort
 	assert(maxSortMem%esFile->pageLen()==0);
 
-	ulong maxMerge = (ulong)(maxSortMem/esFile->pageLen())-1;  assert(maxMerge>1);
+	// a page per input run plus output page; if all runs fit twice, next page of each run is read ahead
+	const ulong nPages=(ulong)(maxSortMem/esFile->pageLen()),maxMerge=nPages-1; assert(maxMerge>1);
+	const bool fAhead=nTtlRuns*2<nPages;
 
 	nIns=nTtlRuns>maxMerge?maxMerge:nTtlRuns;	
-	if ((esRuns=new(qx->ses) InRun[nIns])==NULL) return RC_NORESOURCES;
-	for (r=0;r<nIns;r++) {rc=esRuns[r].init(esFile,this); if (rc!=RC_OK) return rc;}
+	if ((esRuns=new(qx->ses) InRun[nIns])==NULL || (esTree=(unsigned*)qx->ses->malloc(nIns*sizeof(unsigned)))==NULL) return RC_NORESOURCES;
+	for (r=0;r<nIns;r++) {rc=esRuns[r].init(esFile,nValues,fAhead); if (rc!=RC_OK) return rc;}
 
+	// intermediate merges combine only as many runs as necessary for the final merge to take all the rest
 	ulong firstLiveRun=0; ulong nActiveRuns=nTtlRuns;
-	for (;;) {
-		if (nActiveRuns>maxMerge) {
-			//intermediate merges to reduce number of runs
-			ulong npass = nActiveRuns/maxMerge; ulong extra = nActiveRuns%maxMerge;
-			for (ulong p=0; p<npass; p++) {
+	while (nActiveRuns>maxMerge) {
+		const unsigned nMerge=unsigned(min(maxMerge,nActiveRuns-maxMerge+1));
 #if TESTES
-				report(MSG_DEBUG,"Pass %x merges to target %x\n",p,firstLiveRun+nActiveRuns+p+1);
+		report(MSG_DEBUG,"Merge %x runs from %x to target %x\n",nMerge,firstLiveRun,esFile->runCount());
 #endif
-				for (r=0;r<maxMerge;r++){
-					ulong runid=firstLiveRun+p*maxMerge+r;
-					esRuns[r].setRun(runid,true);
-				}
-				rc=esOutRun->beginRun(); if(rc!=RC_OK) return rc;
-				for (;;) {
-					const EncPINRef *minep=NULL; ulong champ=nIns;
-					for (r=0; r<nIns; r++){
-						const EncPINRef *cand=esRuns[r].top();
-						if (minep==NULL || cand!=NULL && cmp(minep,cand)>0) {minep=cand; champ=r;}
-					}
-					if (minep==NULL) break; assert(champ<nIns);
-					esOutRun->add(minep); esRuns[champ].next();
-				}
-				esOutRun->term();
-			}					
-			firstLiveRun+=npass*maxMerge;//prep next iter
-			nActiveRuns=npass+extra;
-		}
-		else {
-			if (nIns>nActiveRuns) nIns=nActiveRuns;
-			for (r=0;r<nIns;r++) esRuns[r].setRun(firstLiveRun+r,false/*final*/);
-			//final merge will be "on demand"
-			break;
+		for (r=0; r<nMerge; r++) esRuns[r].setRun(RunID(firstLiveRun+r),true);
+		if ((rc=esOutRun->beginRun())!=RC_OK) return rc;
+		LoserTree<MergeRuns> lt(MergeRuns(*this),esTree,nMerge); const EncPINRef *ep; unsigned w;
+		for (lt.build(); (ep=esRuns[w=lt.winner()].top())!=NULL; lt.adjust(w)) {
+			if ((rc=esOutRun->add(ep))!=RC_OK) return rc;
+			esRuns[w].next();
 		}
+		esOutRun->term(); firstLiveRun+=nMerge; nActiveRuns-=nMerge-1;
 		esFile->check(true);
 	}
+	//final merge will be "on demand"
+	if (nIns>nActiveRuns) nIns=nActiveRuns;
+	for (r=0;r<nIns;r++) esRuns[r].setRun(RunID(firstLiveRun+r),false/*final*/);
 	delete esOutRun; esOutRun=NULL;
 	return RC_OK;
 }
 
 RC Sort::esnext(PINEx& qr)
 {
-	const EncPINRef *ep=NULL; ulong r;
-	if (curRun!=~0u) esRuns[curRun].next();
-	for (r=0,curRun=~0u; r<nIns; r++) {
-		const EncPINRef *cand=esRuns[r].top();
-		if (cand!=NULL && (ep==NULL || cmp(ep,cand)>0)) {ep=cand; curRun=r;}
-	}
-	if (ep==NULL) return RC_EOF;					//All runs exhausted
+	LoserTree<MergeRuns> lt(MergeRuns(*this),esTree,unsigned(nIns));
+	if (curRun==~0u) lt.build(); else {esRuns[curRun].next(); lt.adjust(unsigned(curRun));}
+	const EncPINRef *ep=esRuns[curRun=lt.winner()].top();
+	if (ep==NULL) {curRun=~0u; return RC_EOF;}					//All runs exhausted
 #if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
 	if ((((ptrdiff_t)ep)&1)!=0) {
 		qr.epr.flags=0; qr.epr.lref=byte((ptrdiff_t)ep)>>1; memcpy(qr.epr.buf,(byte*)&ep+1,qr.epr.lref);
@@ -733,14 +474,34 @@ RC Sort::esnext(PINEx& qr)
 	return RC_OK;
 }
 
-RC Sort::writeRun(ulong nRunPins,size_t& mUsed)
+RC Sort::writeRun(ulong nRunPins,size_t& mUsed,bool fSort)
 {
-	if (esFile==NULL) esFile=new(qx->ses) ExtSortFile(qx->ses);
+	if (esFile==NULL) esFile=new(qx->ses) ExtSortFile(qx->ses,stats.lSpill);
 	if (esOutRun==NULL) esOutRun=new(qx->ses) OutRun(esFile,nValues);
 
+	// parts of the run are sorted by worker threads and merged while being written
+	unsigned nParts=1; ulong cur[SORT_MAX_PARTS],end[SORT_MAX_PARTS]; RC rc;
+	if (fSort && nRunPins>=2) {
+		const int nProc=getNProcessors(); if (nProc>1) nParts=nProc<SORT_MAX_PARTS?unsigned(nProc):SORT_MAX_PARTS;
+		if (nParts>nRunPins/SORT_MIN_PART) nParts=nRunPins<SORT_MIN_PART*2?1:unsigned(nRunPins/SORT_MIN_PART);
+		if (nParts==1) quickSort(nRunPins);
+		else {
+			SortPartReq *reqs[SORT_MAX_PARTS]; unsigned i;
+			for (i=0; i<nParts; i++) {cur[i]=nRunPins*i/nParts; end[i]=nRunPins*(i+1)/nParts;}
+			for (i=1; i<nParts; i++)
+				if ((reqs[i]=new(SERVER_HEAP) SortPartReq(*this,cur[i],end[i]-cur[i]))!=NULL && !RequestQueue::postRequest(reqs[i],NULL)) reqs[i]->release();
+			quickSort(end[0]);
+			for (i=nParts; --i!=0; ) if (reqs[i]!=NULL) reqs[i]->wait(); else quickSort(end[i]-cur[i],cur[i]);
+		}
+	}
+
 	// dump sorted pins into run
-	esOutRun->beginRun(); RC rc;
-	for (ulong k=0; k<nRunPins; k++) if ((rc=esOutRun->add(pins[k]))!=RC_OK) return rc;
+	esOutRun->beginRun();
+	if (nParts==1) {for (ulong k=0; k<nRunPins; k++) if ((rc=esOutRun->add(pins[k]))!=RC_OK) return rc;}
+	else {
+		unsigned tree[SORT_MAX_PARTS],w; LoserTree<MergeParts> lt(MergeParts(*this,cur,end),tree,nParts);
+		for (lt.build(); w=lt.winner(),cur[w]<end[w]; cur[w]++,lt.adjust(w)) if ((rc=esOutRun->add(pins[cur[w]]))!=RC_OK) return rc;
+	}
 	esOutRun->term(); mUsed=esFile->pageLen();
 	return RC_OK;
 }
@@ -749,10 +510,11 @@ void Sort::esCleanup()
 {
 	if (esOutRun!=NULL) {delete esOutRun; esOutRun=NULL;}
 	if (esRuns!=NULL) {delete[] esRuns; esRuns=NULL;}
+	if (esTree!=NULL) {qx->ses->free(esTree); esTree=NULL;}
 	if (esFile!=NULL) {delete esFile; esFile=NULL;}
 }
 
-RC Sort::next(const PINEx *skip)
+RC Sort::advance(const PINEx *skip)
 {
 	if (res!=NULL) {res->cleanup(); *res=PIN::defPID;} if ((state&QST_EOF)!=0) return RC_EOF;
 	RC rc=RC_OK;
@@ -790,27 +552,40 @@ RC Sort::next(const PINEx *skip)
 			}
 		}
 	}
-	if (pins!=NULL) {
-		const EncPINRef *ep=pins[idx];
-#if defined(__x86_64__) || defined(IA64) || defined(_M_X64) || defined(_M_IA64)
-		if ((((ptrdiff_t)ep)&1)!=0) {
-			res->epr.flags=0; res->epr.lref=byte((ptrdiff_t)ep)>>1; memcpy(res->epr.buf,(byte*)&ep+1,res->epr.lref);
-		} else
-#endif
-		 memcpy(&res->epr,ep,ep->trunc<8>());
-	} else if (esRuns!=NULL) {
+	if (pins!=NULL) getRef(pins[idx],res->epr);
+	else if (esRuns!=NULL) {
 		if ((rc=esnext(*res))!=RC_OK) return rc;
 	} else return RC_EOF;
 	return qx->ses->testAbortQ();
 }
 
+RC Sort::batch(QBatch& qb)
+{
+	if ((state&QST_INIT)!=0 || pins==NULL || qb.nProps!=0 || qb.flt!=NULL) return QueryOp::batch(qb);
+	if ((state&QST_EOF)!=0) return RC_EOF;
+	while (qb.nRows<QB_ROWS && idx+1<nAllPins) {getRef(pins[++idx],qb.refs[qb.nRows]); qb.nVals[qb.nRows++]=0;}
+	if (idx+1>=nAllPins) {state|=QST_EOF; return RC_EOF;}
+	return qx->ses->testAbortQ();
+}
+
 RC Sort::rewind()
 {
 	RC rc; idx=0;
-	if (esRuns!=NULL) for (ulong i=0; i<nIns; i++) if ((rc=esRuns[i].rewind())!=RC_OK) return rc;
+	if (esRuns!=NULL) {
+		for (ulong i=0; i<nIns; i++) if ((rc=esRuns[i].rewind())!=RC_OK) return rc; else esRuns[i].next();
+		curRun=~0u;
+	}
 	state|=QST_BOF; if (nAllPins>1) state&=~QST_EOF; return RC_OK;
 }
 
+RC Sort::reset()
+{
+	esCleanup(); freePins();
+	pinMem.release(); memUsed=0; nAllPins=idx=0; nIns=0; curRun=~0u; fRepeat=false;
+	RC rc=queryOp!=NULL?queryOp->reset():RC_OK; if (rc==RC_OK) state=QST_INIT;
+	return rc;
+}
+
 RC Sort::count(uint64_t& cnt,ulong nAbort)
 {
 	if (queryOp!=NULL) {
@@ -889,5 +664,6 @@ void Sort::print(SOutCtx& buf,int level) const
 		// flags!!!
 		// var
 	}
-	buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
+	if (nTop!=0) {char cbuf[40]; buf.append(cbuf,sprintf(cbuf," (top %lu)",nTop));}
+	printStats(buf); buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
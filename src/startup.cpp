@@ -180,14 +180,14 @@ RC openStore(const StartupParameters& params,AfyDBCtx &cctx)
 
 		ctx->fileMgr->setPageSize(ctx->theCB->lPage);
 
-		ctx->bufMgr=new(ctx) BufMgr(ctx,calcBuffers(params.nBuffers,ctx->theCB->lPage),ctx->theCB->lPage);
+		ctx->bufMgr=new(ctx) BufMgr(ctx,calcBuffers(params.nBuffers,ctx->theCB->lPage),ctx->theCB->lPage,params.nBufPartitions);
 		if ((rc=ctx->bufMgr->init())!=RC_OK) {report(MSG_CRIT,"Cannot initialize buffer manager (%d)\n",rc); throw rc;}
 
 		assert(ctx->theCB->lPage!=0);
 
 		ctx->txMgr=new(ctx) TxMgr(ctx,ctx->theCB->lastTXID,params.notification);
 	
-		ctx->logMgr=new(ctx) LogMgr(ctx,params.logBufSize,(params.mode&STARTUP_ARCHIVE_LOGS)!=0,params.logDirectory);
+		ctx->logMgr=new(ctx) LogMgr(ctx,params.logBufSize,(params.mode&STARTUP_ARCHIVE_LOGS)!=0,params.logDirectory,params.commitDelay,params.commitBatch);
 
 		for (ulong i=dataFileN; i<ctx->theCB->nDataFiles; i++) {
 			lastFile=FileID(RESERVEDFILEIDS + i - dataFileN); char buf[100];
@@ -200,7 +200,7 @@ RC openStore(const StartupParameters& params,AfyDBCtx &cctx)
 		ctx->fsMgr=new(ctx) FSMgr(ctx); rc=ctx->fsMgr->init(lastFile);
 		if (rc!=RC_OK) {report(MSG_CRIT,"Cannot initialize free space manager (%d)\n",rc); if (!fForce) throw rc;}
 
-		ctx->treeMgr=new(ctx) TreeMgr(ctx,params.shutdownAsyncTimeout);
+		ctx->treeMgr=new(ctx) TreeMgr(ctx,params.shutdownAsyncTimeout,params.indexFill);
 		ctx->heapMgr=new(ctx) PINPageMgr(ctx);
 		ctx->hdirMgr=new(ctx) HeapDirMgr(ctx);
 		ctx->ssvMgr=new(ctx) SSVPageMgr(ctx);
@@ -261,7 +261,7 @@ RC createStore(const StoreCreationParameters& create,const StartupParameters& pa
 
 		if ((ctx=StoreCtx::createCtx(params.mode,true))==NULL) return RC_NORESOURCES;
 
-		ctx->bufMgr=new(ctx) BufMgr(ctx,calcBuffers(params.nBuffers,create.pageSize),create.pageSize);
+		ctx->bufMgr=new(ctx) BufMgr(ctx,calcBuffers(params.nBuffers,create.pageSize),create.pageSize,params.nBufPartitions);
 
 		FileMgr *fio=ctx->fileMgr=new(ctx) FileMgr(ctx,params.maxFiles,params.io);
 		setDirectory(fio,params.directory,ctx); fio->setPageSize(create.pageSize);
@@ -306,7 +306,7 @@ RC createStore(const StoreCreationParameters& create,const StartupParameters& pa
 
 		ctx->txMgr=new(ctx) TxMgr(ctx,0,params.notification);
 
-		ctx->logMgr=new(ctx) LogMgr(ctx,params.logBufSize,(params.mode&STARTUP_ARCHIVE_LOGS)!=0,params.logDirectory);
+		ctx->logMgr=new(ctx) LogMgr(ctx,params.logBufSize,(params.mode&STARTUP_ARCHIVE_LOGS)!=0,params.logDirectory,params.commitDelay,params.commitBatch);
 		if ((rc=ctx->logMgr->init())!=RC_OK) {report(MSG_CRIT,"Cannot allocate log file(s) (%d)\n",rc); throw rc;}
 
 		assert(ctx->theCB->state==SST_INIT);
@@ -314,7 +314,7 @@ RC createStore(const StoreCreationParameters& create,const StartupParameters& pa
 		ctx->fsMgr=new(ctx) FSMgr(ctx); rc=ctx->fsMgr->create(fid);
 		if (rc!=RC_OK) {report(MSG_CRIT,"Cannot create free space manager (%d)\n",rc); throw rc;}
 
-		ctx->treeMgr=new(ctx) TreeMgr(ctx,params.shutdownAsyncTimeout);
+		ctx->treeMgr=new(ctx) TreeMgr(ctx,params.shutdownAsyncTimeout,params.indexFill);
 		ctx->heapMgr=new(ctx) PINPageMgr(ctx);
 		ctx->hdirMgr=new(ctx) HeapDirMgr(ctx);
 		ctx->ssvMgr=new(ctx) SSVPageMgr(ctx);
@@ -468,6 +468,7 @@ RC shutdownStore(AfyDBCtx ctx)
 		}
 
 		if ((ctx->mode&STARTUP_PRINT_STATS)!=0) {
+			ctx->queryMgr->getPlanCache().printStats();
 			Session *ses=Session::createSession(ctx); if (ses!=NULL) ses->setIdentity(STORE_OWNER,true);
 			reportTree(ctx->theCB->mapRoots[MA_FTINDEX],"FT",ctx);
 			reportTree(ctx->theCB->mapRoots[MA_CLASSINDEX],"Class",ctx);
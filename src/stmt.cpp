@@ -34,6 +34,7 @@ void SessionX::abortQuery()
 
 Stmt::~Stmt()
 {
+	if (prep!=NULL) {if (prep->fIdle) delete prep; else prep->stmt=NULL;}
 	for (QVar *var=vars,*vnxt; var!=NULL; var=vnxt) {vnxt=var->next; delete var;}
 	if (orderBy!=NULL) {
 		for (unsigned i=0; i<nOrderBy; i++) if ((orderBy[i].flags&ORDER_EXPR)!=0) ma->free(orderBy[i].expr);
@@ -284,8 +284,9 @@ class Stmt : public IStmt
 	Value			*values;
 	unsigned		nValues;
 	unsigned		nNested;
+	mutable	class	Cursor	*prep;		/**< query plan kept for the next execution with new parameters */
 public:
-	Stmt(ulong md,MemAlloc *m,STMT_OP sop=STMT_QUERY) : op(sop),mode(md),ma(m),top(NULL),nTop(0),vars(NULL),nVars(0),orderBy(NULL),nOrderBy(0),values(NULL),nValues(0),nNested(0) {}
+	Stmt(ulong md,MemAlloc *m,STMT_OP sop=STMT_QUERY) : op(sop),mode(md),ma(m),top(NULL),nTop(0),vars(NULL),nVars(0),orderBy(NULL),nOrderBy(0),values(NULL),nValues(0),nNested(0),prep(NULL) {}
 	virtual	~Stmt();
 	QVarID	addVariable(const ClassSpec *classes=NULL,unsigned nClasses=0,IExprTree *cond=NULL);
 	QVarID	addVariable(const PID& pid,PropertyID propID,IExprTree *cond=NULL);
@@ -379,7 +380,11 @@ class Cursor : public ICursor
 	bool				fSnapshot;
 	bool				fProc;
 	bool				fAdvance;
+	bool				fIdle;
+	const	Stmt		*stmt;		/**< statement keeping this cursor for re-execution */
+	uint32_t			gen;
 	void	operator	delete(void *p) {if (p!=NULL) ((Cursor*)p)->ses->free(p);}
+	RC					rebind(const Value *pars,unsigned nPars,bool fSS);
 	RC					skip();
 	RC					advance(bool fRet=true);
 	void				getPID(PID &id) {qr.getID(id);}
@@ -387,7 +392,7 @@ class Cursor : public ICursor
 public:
 	Cursor(QueryOp *qop,uint64_t nRet,ulong md,const Value *vals,unsigned nV,Session *s,STMT_OP sop=STMT_QUERY,SelectType ste=SEL_PINSET,bool fSS=false)
 		: queryOp(qop),ses(s),nReturn(nRet),values(vals),nValues(nV),mode(md),stype(ste),op(sop),results(NULL),nResults(0),qr(s),pqr(&qr),
-		txid(INVALID_TXID),txcid(NO_TXCID),cnt(0),tx(s),fSnapshot(fSS),fProc(false),fAdvance(true) {}
+		txid(INVALID_TXID),txcid(NO_TXCID),cnt(0),tx(s),fSnapshot(fSS),fProc(false),fAdvance(true),fIdle(false),stmt(NULL),gen(0) {}
 	virtual				~Cursor();
 	RC					next(Value&);
 	RC					next(PID&);
@@ -128,7 +128,7 @@ void StoreCB::preload(StoreCtx *ctx) const
 	static const PGID mapRootsPGIDs[MA_ALL] = {
 		PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,PGID_INDEX,
 		PGID_INDEX,PGID_INDEX,PGID_HEAPDIR,PGID_HEAPDIR,PGID_HEAPDIR,PGID_HEAPDIR,
-		PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL};
+		PGID_INDEX,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL,PGID_ALL};
 	PageID pages[MA_ALL]; PageMgr *pmgrs[MA_ALL]; ulong cnt=0;
 	for (ulong i=0; i<MA_ALL; i++) if (mapRoots[i]!=INVALID_PAGEID)
 		{pages[cnt]=mapRoots[i]; pmgrs[cnt]=ctx->getPageMgr(mapRootsPGIDs[i]); cnt++;}
@@ -71,7 +71,8 @@ enum MapAnchor
 	MA_PINEXTURI,						/**< PIN external URI map root page (not implemented yet) */
 	MA_HEAPDIRFIRST, MA_HEAPDIRLAST,	/**< first and last pages in the directory of heap pages */
 	MA_CLASSDIRFIRST, MA_CLASSDIRLAST,	/**< first and last pages in the directory of class PIN pages */
-	MA_RESERVED1, MA_RESERVED2, MA_RESERVED3, MA_RESERVED4, MA_RESERVED5, MA_RESERVED6, MA_RESERVED7, MA_RESERVED8,		/**< reserved for future use */
+	MA_CLASSSTATS,						/**< family index statistics map root page */
+	MA_RESERVED2, MA_RESERVED3, MA_RESERVED4, MA_RESERVED5, MA_RESERVED6, MA_RESERVED7, MA_RESERVED8,		/**< reserved for future use */
 	MA_ALL
 };
 
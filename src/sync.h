@@ -87,6 +87,7 @@ template<typename T> __forceinline T casV(volatile T *ptr,T oldV,T newV) {return
 #define	casV(a,b,c)									__sync_val_compare_and_swap(a,b,c)
 #define	InterlockedIncrement(a)						__sync_add_and_fetch(a,1)
 #define	InterlockedDecrement(a)						__sync_sub_and_fetch(a,1)
+#define	MemoryBarrier()								__sync_synchronize()
 /**
  * non-blocking list implementation using cas() functions for Linux and OSX
  * names are preserved from WIN32 API
@@ -139,6 +140,7 @@ inline SLIST_ENTRY *InterlockedPopEntrySList(SLIST_HEADER *pHeader)
 #define	casV(a,b,c)									__sync_val_compare_and_swap(a,b,c)
 #define	InterlockedIncrement(a)						__sync_add_and_fetch(a,1)
 #define	InterlockedDecrement(a)						__sync_sub_and_fetch(a,1)
+#define	MemoryBarrier()								__sync_synchronize()
 /**
  * non-blocking list implementation using cas() functions for ARM
  */
@@ -462,12 +464,13 @@ class RWLock
 
 	volatile	long	count;
 	SemData* volatile	queue;
+	volatile	long	version;	// incremented on every exclusive acquisition, validates unlatched reads
 	void				wait(SemData*);
 public:
 #ifdef _DEBUG
 	THREADID			threadID;
 #endif
-	RWLock() : count(0),queue(NULL) {}
+	RWLock() : count(0),queue(NULL),version(0) {}
 	void lock(RW_LockType lock) {
 		// For U/X locks, first set the RU_BIT/RX_BIT (don't wait for open lock),
 		// to reserve the lock asap, then wait.
@@ -487,7 +490,7 @@ public:
 		case RW_X_LOCK:
 			RW_LOCK((c&RX_BIT)!=0,c|RX_BIT);
 			spinCount=SpinC::SC.spinCount; waitSpinCount=WAIT_SPIN_COUNT;
-			RW_LOCK(c!=RX_BIT&&c!=(RU_BIT|RX_BIT),((c|X_BIT)&~RX_BIT)+1);
+			RW_LOCK(c!=RX_BIT&&c!=(RU_BIT|RX_BIT),((c|X_BIT)&~RX_BIT)+1); ++version;
 #ifdef _DEBUG
 			threadID=getThreadId();
 #endif
@@ -505,7 +508,7 @@ public:
 #endif
 			break;
 		case RW_X_LOCK:
-			RW_TRYLOCK(c!=0,long(X_BIT|1));
+			RW_TRYLOCK(c!=0,long(X_BIT|1)); ++version;
 #ifdef _DEBUG
 			threadID=getThreadId();
 #endif
@@ -525,7 +528,7 @@ public:
 			for (long c=count; ;c=count)
 				if ((c&(RX_BIT|X_BIT))!=0 || (unset=cas(&count,c,c|RX_BIT))) break; else {RW_WAIT}
 			mask=unset?(U_BIT|RX_BIT):U_BIT; spinCount=SpinC::SC.spinCount; waitSpinCount=WAIT_SPIN_COUNT;
-			RW_LOCK((c&~(RU_BIT|U_BIT|RX_BIT|X_BIT))!=1,(c&~mask)|X_BIT);
+			RW_LOCK((c&~(RU_BIT|U_BIT|RX_BIT|X_BIT))!=1,(c&~mask)|X_BIT); ++version;
 #ifdef _DEBUG
 			threadID=getThreadId();
 #endif
@@ -534,7 +537,7 @@ public:
 		return true;
 	}
 	bool tryupgrade() {
-		assert((count&U_BIT)!=0); RW_TRYLOCK(c!=(U_BIT|1),long(X_BIT|1)); return true;
+		assert((count&U_BIT)!=0); RW_TRYLOCK(c!=(U_BIT|1),long(X_BIT|1)); ++version; return true;
 	}
 	bool downgradelock(RW_LockType lock) {
 		SemData *volatile q;
@@ -585,6 +588,7 @@ public:
 	bool	isXLocked() const {return (count&X_BIT)!=0;}
 	bool	isULocked() const {return (count&U_BIT)!=0;}
 	bool	isLocked() const {return count!=0;}
+	long	getVersion() const {return version;}
 };
 
 #undef	RW_WAIT
@@ -901,6 +905,7 @@ public:
 	static	RC		addStore(class StoreCtx& ctx);
 	static	void	removeStore(class StoreCtx& ctx,ulong timeout);
 	static	bool	postRequest(Request *req,class StoreCtx *ctx,RQType=RQ_NORMAL);
+	static	void	addThreads(long nThreads,RQType=RQ_NORMAL);
 	static	void	startThreads();
 	static	void	stopThreads();
 };
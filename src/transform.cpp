@@ -27,7 +27,7 @@ Written by Mark Venguerov 2010 - 2012
 using namespace AfyKernel;
 
 TransOp::TransOp(QueryOp *q,const ValueV *d,unsigned nD,const ValueV& ag,const OrderSegQ *gs,unsigned nG,const Expr *hv,ulong qf) 
-	: QueryOp(q,qf|(q->getQFlags()&(QO_UNIQUE|QO_IDSORT|QO_REVERSIBLE))),dscr(d),ins(NULL),nIns(0),qr(qx->ses),pqr(&qr),res(NULL),nRes(0),aggs(ag),groupSeg(gs),nGroup(nG),having(hv),ac(NULL)
+	: QueryOp(q,qf|(q->getQFlags()&(QO_UNIQUE|QO_IDSORT|QO_REVERSIBLE))),dscr(d),ins(NULL),nIns(0),qr(qx->ses),pqr(&qr),res(NULL),nRes(0),aggs(ag),groupSeg(gs),nGroup(nG),having(hv),ac(NULL),inb(NULL)
 {
 	nOuts=nD!=0?nD:1; sort=q->getSort(nSegs);
 	if ((qf&QO_VCOPIED)!=0) {
@@ -43,13 +43,14 @@ TransOp::TransOp(QueryOp *q,const ValueV *d,unsigned nD,const ValueV& ag,const O
 }
 
 TransOp::TransOp(QCtx *qc,const ValueV *d,unsigned nD,ulong qf) 
-	: QueryOp(qc,qf|QO_UNIQUE),dscr(d),ins(NULL),nIns(0),qr(qc->ses),pqr(&qr),res(NULL),nRes(0),groupSeg(NULL),nGroup(0),having(NULL),ac(NULL)
+	: QueryOp(qc,qf|QO_UNIQUE),dscr(d),ins(NULL),nIns(0),qr(qc->ses),pqr(&qr),res(NULL),nRes(0),groupSeg(NULL),nGroup(0),having(NULL),ac(NULL),inb(NULL)
 {
 	nOuts=nD!=0?nD:1;
 }
 
 TransOp::~TransOp()
 {
+	freeBatch();
 	if (ac!=NULL) for (unsigned j=0; j<aggs.nValues; j++) if (ac[j].hist!=NULL) {ac[j].hist->~Histogram(); qx->ses->free(ac[j].hist);}
 	if ((qflags&QO_VCOPIED)!=0) {
 		if (dscr!=NULL) {
@@ -70,7 +71,7 @@ TransOp::~TransOp()
 
 void TransOp::connect(PINEx **results,unsigned nr)
 {
-	res=results; nRes=nr;
+	res=results; nRes=nr; if (results!=NULL && nr!=0) QueryOp::res=results[0];
 	if (queryOp!=NULL && (nIns=queryOp->getNOuts())!=0) {
 		if (nIns==1) queryOp->connect(ins=&pqr);
 		else if ((ins=new(qx->ses) PINEx*[nIns])==NULL) return;	//???
@@ -82,7 +83,61 @@ void TransOp::connect(PINEx **results,unsigned nr)
 	}
 }
 
-RC TransOp::next(const PINEx *)
+RC TransOp::initBatch()
+{
+	// without grouping the input is read in batches projecting the properties used by the transformation,
+	// group values are read through queryOp->loadData() which needs the current result of queryOp
+	if (queryOp==NULL || nIns!=1 || nGroup!=0) return RC_OK;
+	PropListP plp(qx->ses); RC rc;
+	for (unsigned i=0; i<=nOuts; i++) {
+		const ValueV *vv=i<nOuts?(dscr!=NULL?&dscr[i]:(ValueV*)0):&aggs; if (vv==NULL) continue;
+		for (unsigned j=0; j<vv->nValues; j++) {
+			const Value& v=vv->vals[j];
+			if (v.type==VT_VARREF) {
+				if ((v.refV.flags&VAR_TYPE_MASK)!=0 || v.refV.refN!=0) continue; if (v.length==0) return RC_OK;
+				const PropertyID pid=v.refV.id; if ((rc=plp.merge(0,&pid,1,true))!=RC_OK) return rc;
+			} else if (v.type==VT_EXPR && (v.meta&META_PROP_EVAL)!=0) {
+				const Expr *exp=(const Expr*)v.expr; if (!exp->isBatch()) return RC_OK;
+				if ((rc=exp->mergeProps(plp,true))!=RC_OK) return rc;
+			}
+		}
+	}
+	if (plp.nPls==0 || plp.pls[0].nProps==0) return RC_OK;
+	// special properties (PIN id, stamp, etc.) are not stored values and are read from the PIN itself
+	for (unsigned i=0; i<plp.pls[0].nProps; i++) if ((plp.pls[0].props[i]&STORE_MAX_URIID)<=PROP_SPEC_MAX) return RC_OK;
+	const unsigned nP=plp.pls[0].nProps; PropertyID *props=(PropertyID*)qx->ses->malloc(nP*sizeof(PropertyID));
+	Value *vals=(Value*)qx->ses->malloc(QB_ROWS*nP*sizeof(Value));
+	if (props==NULL || vals==NULL || (inb=new(qx->ses) QBatch(qx->ses,props,nP,vals))==NULL)
+		{if (props!=NULL) qx->ses->free(props); if (vals!=NULL) qx->ses->free(vals); return RC_NORESOURCES;}
+	for (unsigned i=0; i<nP; i++) {
+		PropertyID pid=plp.pls[0].props[i]&STORE_MAX_URIID; unsigned k=i;
+		for (; k>0 && props[k-1]>pid; k--) props[k]=props[k-1];
+		props[k]=pid;
+	}
+	return RC_OK;
+}
+
+void TransOp::freeBatch()
+{
+	if (inb!=NULL) {
+		PropertyID *props=(PropertyID*)inb->props; Value *vals=inb->vals;
+		inb->~QBatch(); qx->ses->free(inb); qx->ses->free(props); qx->ses->free(vals); inb=NULL;
+	}
+}
+
+RC TransOp::batch(QBatch& qb)
+{
+	// results are derived PINs with their values already set, so they are added without loading PIN bodies
+	if (res==NULL || nRes!=1 || res[0]==NULL) return QueryOp::batch(qb);
+	PINEx *re=res[0]; RC rc=RC_OK;
+	while (qb.nRows<QB_ROWS && (rc=advance())==RC_OK) {
+		if (qb.flt!=NULL && !qb.flt->check(&re,1,qx->ses)) continue;
+		if ((rc=qb.add(*re))!=RC_OK) break;
+	}
+	return rc;
+}
+
+RC TransOp::advance(const PINEx *)
 {
 	if ((state&QST_EOF)!=0) return RC_EOF;
 	if ((state&QST_INIT)!=0) {
@@ -100,12 +155,13 @@ RC TransOp::next(const PINEx *)
 			if ((qx->vals[QV_GROUP].vals=new(qx->ses) Value[qx->vals[QV_GROUP].nValues=nGroup])==NULL) {state|=QST_EOF; return RC_NORESOURCES;}
 			qx->vals[QV_GROUP].fFree=true; memset((Value*)qx->vals[QV_GROUP].vals,0,nGroup*sizeof(Value));
 		}
+		if (inb==NULL) {RC rc=initBatch(); if (rc!=RC_OK) {state|=QST_EOF; return rc;}}
 		state|=QST_BOF;
 	}
 	RC rc=RC_OK; Value *newV=NULL;
 	if (queryOp==NULL) state|=QST_EOF;
 	else for (;;) {
-		if ((rc=queryOp->next())!=RC_OK) {
+		if ((rc=nextIn())!=RC_OK) {
 			state|=QST_EOF; if (rc!=RC_EOF || nGroup+aggs.nValues==0 || (state&QST_BOF)!=0) return rc;
 			for (unsigned i=0; i<aggs.nValues; i++) {
 				if (nGroup!=0) freeV(*(Value*)&qx->vals[QV_AGGS].vals[i]);
@@ -247,6 +303,7 @@ RC TransOp::next(const PINEx *)
 RC TransOp::rewind()
 {
 	RC rc=queryOp!=NULL?queryOp->rewind():RC_OK;
+	if (inb!=NULL) {inb->cleanup(); inb->fEOF=false;}
 	if (rc==RC_OK) {
 		state=state&~QST_EOF|QST_BOF;
 		for (unsigned i=0; i<aggs.nValues; i++) ac[i].reset();
@@ -255,11 +312,24 @@ RC TransOp::rewind()
 	return rc;
 }
 
+RC TransOp::reset()
+{
+	// accumulators and group values allocated on the first call of advance() are reused
+	RC rc=queryOp!=NULL?queryOp->reset():RC_OK;
+	if (inb!=NULL) {inb->cleanup(); inb->fEOF=false;}
+	if (rc==RC_OK && (state&QST_INIT)==0) {
+		state=state&~QST_EOF|QST_BOF;
+		for (unsigned i=0; i<aggs.nValues; i++) {ac[i].reset(); freeV(*(Value*)&qx->vals[QV_AGGS].vals[i]); ((Value*)&qx->vals[QV_AGGS].vals[i])->setError();}
+		for (unsigned j=0; j<nGroup; j++) {freeV(*(Value*)&qx->vals[QV_GROUP].vals[j]); ((Value*)&qx->vals[QV_GROUP].vals[j])->setError();}
+	}
+	return rc;
+}
+
 void TransOp::print(SOutCtx& buf,int level) const
 {
 	buf.fill('\t',level); buf.append("transform: ",11);
 	for (unsigned i=0; i<nOuts; i++) {
 		//?????
 	}
-	buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
+	printStats(buf); buf.append("\n",1); if (queryOp!=NULL) queryOp->print(buf,level+1);
 }
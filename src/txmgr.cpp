@@ -196,7 +196,7 @@ RC TxMgr::commit(Session *ses,bool fAll,bool fFlush)
 		cleanup(ses);
 	}
 	if (fNotify) notification->txNotify(type,txid);
-	if (fFlush && !commitLSN.isNull() && (ctx->mode&STARTUP_REDUCED_DURABILITY)==0) ctx->logMgr->flushTo(commitLSN);	// check rc?
+	if (fFlush && !commitLSN.isNull() && (ctx->mode&STARTUP_REDUCED_DURABILITY)==0) ctx->logMgr->commitFlush(commitLSN);	// check rc?
 	return RC_OK;
 }
 
@@ -222,7 +222,7 @@ RC TxMgr::abort(Session *ses,bool fAll)
 		ses->txState=ses->txState&~0xFFFFul|TX_ABORTED; cleanup(ses,true);
 	}
 	if (fNotify) notification->txNotify(type,txid);
-	if (!abortLSN.isNull() && (ctx->mode&STARTUP_REDUCED_DURABILITY)==0) ctx->logMgr->flushTo(abortLSN); //check rc?
+	if (!abortLSN.isNull() && (ctx->mode&STARTUP_REDUCED_DURABILITY)==0) ctx->logMgr->commitFlush(abortLSN); //check rc?
 	return RC_OK;
 }
 
@@ -26,6 +26,17 @@ Written by Mark Venguerov 2004-2012
 #include "session.h"
 #include "affinityimpl.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define	SIMD_STR
+#ifdef WIN32
+#include <intrin.h>
+#define	SIMD_AVX2
+#else
+#include <immintrin.h>
+#define	SIMD_AVX2	__attribute__((target("avx2")))
+#endif
+#endif
+
 using namespace	AfyDB;
 using namespace AfyKernel;
 
@@ -1610,3 +1621,136 @@ void PageSet::test() const
 	}
 	assert(cnt==nPages);
 }
+
+static __forceinline byte lcase(char c)
+{
+	return unsigned(byte(c)-'A')<26u?byte(c)|0x20:byte(c);
+}
+
+static int memNCaseCmp_s(const char *p1,const char *p2,size_t l)
+{
+	for (size_t i=0; i<l; i++) {byte c1=lcase(p1[i]),c2=lcase(p2[i]); if (c1!=c2) return int(c1)-int(c2);}
+	return 0;
+}
+
+static const char *memFind_s(const char *s,size_t ls,const char *p,size_t lp,bool fNCase)
+{
+	if (lp==0) return s; if (lp>ls) return NULL;
+	const char *const e=s+ls-lp;
+	if (!fNCase) {
+		for (const char *q; (q=(const char*)memchr(s,*p,e-s+1))!=NULL; s=q+1) if (memcmp(q+1,p+1,lp-1)==0) return q;
+	} else {
+		for (const byte ch=lcase(*p); s<=e; s++) if (lcase(*s)==ch && memNCaseCmp_s(s+1,p+1,lp-1)==0) return s;
+	}
+	return NULL;
+}
+
+#ifdef SIMD_STR
+
+/**
+ * candidate positions are found by matching the first and the last character of the pattern
+ * in 16 (32) consecutive positions at once (W.Mula, SIMD-friendly algorithms for substring searching)
+ */
+
+static __forceinline __m128i fold16(__m128i v)
+{
+	const __m128i m=_mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8('A'-1)),_mm_cmpgt_epi8(_mm_set1_epi8('Z'+1),v));
+	return _mm_or_si128(v,_mm_and_si128(m,_mm_set1_epi8(0x20)));
+}
+
+static int memNCaseCmp_sse2(const char *p1,const char *p2,size_t l)
+{
+	size_t i=0;
+	for (; i+16<=l; i+=16) {
+		const __m128i v1=fold16(_mm_loadu_si128((const __m128i*)(p1+i))),v2=fold16(_mm_loadu_si128((const __m128i*)(p2+i)));
+		const unsigned m=unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v1,v2)))^0xFFFF;
+		if (m!=0) {i+=ntz(m); return int(lcase(p1[i]))-int(lcase(p2[i]));}
+	}
+	return memNCaseCmp_s(p1+i,p2+i,l-i);
+}
+
+static const char *memFind_sse2(const char *s,size_t ls,const char *p,size_t lp,bool fNCase)
+{
+	if (lp<2 || lp>ls) return memFind_s(s,ls,p,lp,fNCase);
+	const size_t last=lp-1; size_t i=0;
+	const __m128i vf=_mm_set1_epi8(fNCase?lcase(p[0]):p[0]),vl=_mm_set1_epi8(fNCase?lcase(p[last]):p[last]);
+	for (; i+last+16<=ls; i+=16) {
+		__m128i v0=_mm_loadu_si128((const __m128i*)(s+i)),v1=_mm_loadu_si128((const __m128i*)(s+i+last));
+		if (fNCase) {v0=fold16(v0); v1=fold16(v1);}
+		for (unsigned m=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0,vf),_mm_cmpeq_epi8(v1,vl))); m!=0; m&=m-1) {
+			const char *q=s+i+ntz(m);
+			if ((fNCase?memNCaseCmp_sse2(q+1,p+1,last-1):memcmp(q+1,p+1,last-1))==0) return q;
+		}
+	}
+	return memFind_s(s+i,ls-i,p,lp,fNCase);
+}
+
+static __forceinline SIMD_AVX2 __m256i fold32(__m256i v)
+{
+	const __m256i m=_mm256_and_si256(_mm256_cmpgt_epi8(v,_mm256_set1_epi8('A'-1)),_mm256_cmpgt_epi8(_mm256_set1_epi8('Z'+1),v));
+	return _mm256_or_si256(v,_mm256_and_si256(m,_mm256_set1_epi8(0x20)));
+}
+
+static SIMD_AVX2 int memNCaseCmp_avx2(const char *p1,const char *p2,size_t l)
+{
+	size_t i=0;
+	for (; i+32<=l; i+=32) {
+		const __m256i v1=fold32(_mm256_loadu_si256((const __m256i*)(p1+i))),v2=fold32(_mm256_loadu_si256((const __m256i*)(p2+i)));
+		const unsigned m=~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1,v2)));
+		if (m!=0) {i+=ntz(m); return int(lcase(p1[i]))-int(lcase(p2[i]));}
+	}
+	return memNCaseCmp_sse2(p1+i,p2+i,l-i);
+}
+
+static SIMD_AVX2 const char *memFind_avx2(const char *s,size_t ls,const char *p,size_t lp,bool fNCase)
+{
+	if (lp<2 || lp>ls) return memFind_s(s,ls,p,lp,fNCase);
+	const size_t last=lp-1; size_t i=0;
+	const __m256i vf=_mm256_set1_epi8(fNCase?lcase(p[0]):p[0]),vl=_mm256_set1_epi8(fNCase?lcase(p[last]):p[last]);
+	for (; i+last+32<=ls; i+=32) {
+		__m256i v0=_mm256_loadu_si256((const __m256i*)(s+i)),v1=_mm256_loadu_si256((const __m256i*)(s+i+last));
+		if (fNCase) {v0=fold32(v0); v1=fold32(v1);}
+		for (unsigned m=_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v0,vf),_mm256_cmpeq_epi8(v1,vl))); m!=0; m&=m-1) {
+			const char *q=s+i+ntz(m);
+			if ((fNCase?memNCaseCmp_avx2(q+1,p+1,last-1):memcmp(q+1,p+1,last-1))==0) return q;
+		}
+	}
+	return memFind_sse2(s+i,ls-i,p,lp,fNCase);
+}
+
+static bool hasAVX2()
+{
+#ifdef WIN32
+	int CPUInfo[4]; __cpuid(CPUInfo,0); if (CPUInfo[0]<7) return false;
+	__cpuid(CPUInfo,1); if ((CPUInfo[2]&0x18000000)!=0x18000000 || (_xgetbv(0)&6)!=6) return false;
+	__cpuidex(CPUInfo,7,0); return (CPUInfo[1]&0x20)!=0;
+#else
+	__builtin_cpu_init(); return __builtin_cpu_supports("avx2")!=0;
+#endif
+}
+
+static void initStrKernels()
+{
+	if (hasAVX2()) {memNCaseCmp=memNCaseCmp_avx2; memFind=memFind_avx2;}
+	else {memNCaseCmp=memNCaseCmp_sse2; memFind=memFind_sse2;}
+}
+
+static const char *memFind_init(const char *s,size_t ls,const char *p,size_t lp,bool fNCase)
+{
+	initStrKernels(); return memFind(s,ls,p,lp,fNCase);
+}
+
+static int memNCaseCmp_init(const char *p1,const char *p2,size_t l)
+{
+	initStrKernels(); return memNCaseCmp(p1,p2,l);
+}
+
+const char *(*AfyKernel::memFind)(const char*,size_t,const char*,size_t,bool)=memFind_init;
+int (*AfyKernel::memNCaseCmp)(const char*,const char*,size_t)=memNCaseCmp_init;
+
+#else
+
+const char *(*AfyKernel::memFind)(const char*,size_t,const char*,size_t,bool)=memFind_s;
+int (*AfyKernel::memNCaseCmp)(const char*,const char*,size_t)=memNCaseCmp_s;
+
+#endif
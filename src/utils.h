@@ -144,6 +144,15 @@ __forceinline bool cmpncase(const char *p1,const char *p2,size_t l)
 	return true;
 }
 
+/**
+ * string search and ASCII case-insensitive comparison kernels
+ * SSE2/AVX2 versions are selected on first call according to CPU features
+ * memFind returns pointer to the first occurence of p in s or NULL
+ * memNCaseCmp compares folding ASCII letters to lower case, returns <0, 0, >0
+ */
+extern	const	char	*(*memFind)(const char *s,size_t ls,const char *p,size_t lp,bool fNCase);
+extern	int				(*memNCaseCmp)(const char *p1,const char *p2,size_t l);
+
 /**
  * various conversion helper functions
  */
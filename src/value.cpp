@@ -433,7 +433,7 @@ int AfyKernel::cmpNoConv(const Value& arg,const Value& arg2,ulong u)
 		if (arg2.str==NULL||arg2.length==0) return 1;
 		len=arg.length<=arg2.length?arg.length:arg2.length;
 		c=sign(arg.type==VT_BSTR||(u&(CND_EQ|CND_NE))!=0&&(u&CND_NCASE)==0?memcmp(arg.bstr,arg2.bstr,len):
-					(u&CND_NCASE)!=0?strncasecmp(arg.str,arg2.str,len):strncmp(arg.str,arg2.str,len));
+					(u&CND_NCASE)!=0?memNCaseCmp(arg.str,arg2.str,len):strncmp(arg.str,arg2.str,len));
 		return c!=0?c:cmp3(arg.length,arg2.length);
 	case VT_REF: return (u&CND_SORT)!=0?cmpPIDs(arg.pin->getPID(),arg2.pin->getPID()):arg.pin->getPID()==arg2.pin->getPID()?0:(u&CND_NE)!=0?-1:-2;
 	case VT_REFPROP: return arg.ref.pin->getPID()==arg2.ref.pin->getPID()&&arg.ref.pid==arg.ref.pid?0:(u&CND_NE)!=0?-1:-2;								// CND_SORT